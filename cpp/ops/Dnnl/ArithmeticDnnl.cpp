@@ -13,6 +13,7 @@
 
 #include "dnnl.hpp"
 
+#include "PrimitiveCache.h"
 #include "Utils.h"
 
 namespace ops {
@@ -35,11 +36,14 @@ void binary_op(algorithm alg, std::vector<int32_t> shape, std::vector<int32_t> l
   src0 = reorder_if_needed(src0, dst_md);
   src1 = reorder_if_needed(src1, dst_md);
 
-  auto desc = binary::desc(alg, src0.get_desc(), src1.get_desc(), dst.get_desc());
-  auto pd = binary::primitive_desc(desc, ENG);
+  // After the reorders, the primitive only depends on the shape
+  auto cached = cached_primitive<binary>(
+      PrimitiveKey("binary").add((int64_t)alg).add(shape), [&] {
+        auto desc = binary::desc(alg, src0.get_desc(), src1.get_desc(), dst.get_desc());
+        return binary::primitive_desc(desc, ENG);
+      });
 
-  auto op = binary(pd);
-  op.execute(
+  cached->prim.execute(
       S, {{DNNL_ARG_SRC_0, src0}, {DNNL_ARG_SRC_1, src1}, {DNNL_ARG_DST, dst}});
   S.wait();
 }
@@ -105,12 +109,17 @@ void mmul(std::vector<int32_t> lhs_dims, std::vector<int32_t> lhs_strides, int32
   auto user_src1 = memory(rhs_md, ENG, src1_buffer);
   auto user_dst = memory(dst_md, ENG, dst_buffer);
 
-  auto matmul_d = matmul::desc(lhs_md, rhs_md, dst_md);
-
-  // Create primitive descriptor.
-  auto matmul_pd = matmul::primitive_desc(matmul_d, ENG);
-  // Create the primitive.
-  auto matmul_prim = matmul(matmul_pd);
+  // Get the primitive, creating its primitive descriptor if it isn't cached.
+  auto cached = cached_primitive<matmul>(
+      PrimitiveKey("matmul")
+          .add(lhs_dims)
+          .add(lhs_strides)
+          .add(rhs_dims)
+          .add(rhs_strides),
+      [&] {
+        auto matmul_d = matmul::desc(lhs_md, rhs_md, dst_md);
+        return matmul::primitive_desc(matmul_d, ENG);
+      });
 
   // Primitive arguments.
   std::unordered_map<int, memory> matmul_args;
@@ -118,7 +127,7 @@ void mmul(std::vector<int32_t> lhs_dims, std::vector<int32_t> lhs_strides, int32
   matmul_args.insert({DNNL_ARG_WEIGHTS, user_src1});
   matmul_args.insert({DNNL_ARG_DST, user_dst});
 
-  matmul_prim.execute(S, matmul_args);
+  cached->prim.execute(S, matmul_args);
 
   // Wait for all primitives in the stream to finish.
   S.wait();
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "Async.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "Threading/Threading.h"
+
+namespace ops {
+
+namespace {
+
+// The queue of ops and the thread running them. The thread is started by
+// the first queued op.
+class OpQueue {
+  // An op, and the partition of the cores of the thread that queued it
+  struct QueuedOp {
+    std::function<void()> run;
+    int partition;
+  };
+
+public:
+  ~OpQueue() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    queued_cv_.notify_all();
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  uint64_t push(std::function<void()> op, int partition) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!thread_.joinable())
+      thread_ = std::thread([this] { loop(); });
+    ops_.push_back(QueuedOp{std::move(op), partition});
+    uint64_t ticket = ++submitted_;
+    queued_cv_.notify_one();
+    return ticket;
+  }
+
+  bool is_done(uint64_t ticket) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return completed_ >= ticket;
+  }
+
+  void wait(uint64_t ticket) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    completed_cv_.wait(lock, [&] { return completed_ >= ticket; });
+    if (!error_.empty()) {
+      std::string error;
+      error.swap(error_);
+      throw std::runtime_error(error);
+    }
+  }
+
+  void sync() {
+    uint64_t ticket;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ticket = submitted_;
+    }
+    wait(ticket);
+  }
+
+private:
+  void loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // The partition routed to, which the thread keeps until an op of another
+    // one
+    int partition = -1;
+    while (true) {
+      queued_cv_.wait(lock, [&] { return stop_ || !ops_.empty(); });
+      if (ops_.empty())
+        return;
+      auto op = std::move(ops_.front());
+      ops_.pop_front();
+      lock.unlock();
+      std::string error;
+      try {
+        // The op thread runs the ops on behalf of the JNI threads, so it
+        // follows their thread configuration, in their partition rather than
+        // one of its own
+        if (op.partition != partition) {
+          set_thread_partition(op.partition);
+          partition = op.partition;
+        }
+        use_thread_config();
+        op.run();
+      } catch (const std::exception &e) {
+        error = e.what();
+      }
+      lock.lock();
+      // Keep the first error until it is reported
+      if (!error.empty() && error_.empty())
+        error_ = error;
+      completed_++;
+      completed_cv_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable queued_cv_;
+  std::condition_variable completed_cv_;
+  std::deque<QueuedOp> ops_;
+  uint64_t submitted_ = 0;
+  uint64_t completed_ = 0;
+  std::string error_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+OpQueue queue;
+std::atomic<bool> async_mode(false);
+
+} // namespace
+
+void set_async(bool async) {
+  bool was_async = async_mode.exchange(async);
+  if (was_async && !async)
+    queue.sync();
+}
+
+bool is_async() { return async_mode; }
+
+uint64_t run_op(std::function<void()> op) {
+  if (!async_mode) {
+    op();
+    return 0;
+  }
+  // The caller applied its configuration before queuing the op
+  return queue.push(std::move(op), thread_partition());
+}
+
+bool is_done(uint64_t ticket) { return ticket == 0 || queue.is_done(ticket); }
+
+void wait(uint64_t ticket) {
+  if (ticket != 0)
+    queue.wait(ticket);
+}
+
+void sync() { queue.sync(); }
+
+} // namespace ops
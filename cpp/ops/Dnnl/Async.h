@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef OPS_ASYNC_H_
+#define OPS_ASYNC_H_
+
+#include <functional>
+#include <stdint.h>
+
+namespace ops {
+
+// Asynchronous execution of the ops on native tensors.
+//
+// By default, ops run when they are called, and return once their result is
+// computed. In async mode, the ops on native tensors compute the shape and
+// layout of their result, allocate it, and queue their computation on a
+// single op thread, which runs them in order, each in the partition of the
+// cores of the thread that queued it. The caller can then prepare the next op
+// while the previous ones run, and only waits when it reads a result, or
+// calls sync().
+//
+// Each queued op gets a ticket, increasing in queue order, which tells
+// whether it is done. Ops on Java arrays always run synchronously, as the
+// arrays are only pinned for the duration of the call.
+
+// Enables or disables async mode. Disabling it waits for the queued ops.
+void set_async(bool async);
+bool is_async();
+
+// Runs op now, or queues it in async mode, and returns its ticket.
+uint64_t run_op(std::function<void()> op);
+
+// Whether the op of the ticket has completed. Ticket 0 is always done.
+bool is_done(uint64_t ticket);
+
+// Waits until the op of the ticket has completed. Throws a runtime_error if
+// a queued op failed since the last wait.
+void wait(uint64_t ticket);
+
+// Waits until all the queued ops have completed, with the errors of wait().
+void sync();
+
+} // namespace ops
+
+#endif // OPS_ASYNC_H_
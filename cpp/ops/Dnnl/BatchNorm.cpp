@@ -13,6 +13,8 @@
 
 #include "dnnl.hpp"
 
+#include "Async.h"
+#include "PrimitiveCache.h"
 #include "Utils.h"
 
 namespace ops {
@@ -32,6 +34,15 @@ batch_normalization_forward::primitive_desc make_bnorm_pd(memory::desc src_md) {
   return batch_normalization_forward::primitive_desc(bnorm_d, ENG);
 }
 
+// Get the forward primitive for src_md, which is shared by the batch norm of
+// arrays and of native tensors with the same layout
+std::shared_ptr<CachedPrimitive<batch_normalization_forward>>
+cached_bnorm(memory::desc src_md) {
+  return cached_primitive<batch_normalization_forward>(
+      PrimitiveKey("batch_norm").add(src_md),
+      [&] { return make_bnorm_pd(src_md); });
+}
+
 memory::desc get_nhwc_md(std::vector<int32_t> input_shape) {
   memory::dim N = input_shape[0], H = input_shape[1], W = input_shape[2],
               C = input_shape[3];
@@ -68,20 +79,46 @@ void batch_norm(std::vector<int32_t> input_shape, float *res_buffer,
   auto user_mean = memory(get_c_md(input_shape), ENG, mean_buffer);
   auto user_variance = memory(get_c_md(input_shape), ENG, variance_buffer);
 
-  auto bnorm_pd = make_bnorm_pd(nhwc_md);
-
-  // Create and execute the primitive
-  auto bnorm_prim = batch_normalization_forward(bnorm_pd);
-  bnorm_prim.execute(S, {{DNNL_ARG_SRC, user_src},
-                         {DNNL_ARG_MEAN, user_mean},
-                         {DNNL_ARG_VARIANCE, user_variance},
-                         {DNNL_ARG_SCALE_SHIFT, user_scale_shift},
-                         {DNNL_ARG_DST, user_dst}});
+  // Get and execute the primitive
+  auto cached = cached_bnorm(nhwc_md);
+  cached->prim.execute(S, {{DNNL_ARG_SRC, user_src},
+                           {DNNL_ARG_MEAN, user_mean},
+                           {DNNL_ARG_VARIANCE, user_variance},
+                           {DNNL_ARG_SCALE_SHIFT, user_scale_shift},
+                           {DNNL_ARG_DST, user_dst}});
 
   // Wait for all primitives in the stream to finish.
   S.wait();
 }
 
+DenseTensor batch_norm(const DenseTensor &input, float *mean_buffer,
+                       float *variance_buffer, float *scale_shift_buffer) {
+  auto &input_shape = input.shape();
+  assert(input_shape.size() == 4);
+
+  auto user_scale_shift =
+      memory(get_nc_md(input_shape), ENG, scale_shift_buffer);
+  auto user_mean = memory(get_c_md(input_shape), ENG, mean_buffer);
+  auto user_variance = memory(get_c_md(input_shape), ENG, variance_buffer);
+
+  // Normalize in the input layout, as a previous conv may have left it
+  // blocked.
+  auto cached = cached_bnorm(input.desc());
+  auto dst = memory(cached->pd.dst_desc(), ENG);
+
+  // The mean and variance are written to the caller's buffers, so the op is
+  // waited for even in async mode.
+  wait(run_op([&] {
+    cached->prim.execute(S, {{DNNL_ARG_SRC, input.mem()},
+                             {DNNL_ARG_MEAN, user_mean},
+                             {DNNL_ARG_VARIANCE, user_variance},
+                             {DNNL_ARG_SCALE_SHIFT, user_scale_shift},
+                             {DNNL_ARG_DST, dst}});
+    S.wait();
+  }));
+  return DenseTensor(input_shape, dst);
+}
+
 void batch_norm_grad(std::vector<int32_t> input_shape, float *input_grad_buffer,
                      float *scale_shift_grad_buffer, float *seed_buffer,
                      float *input_buffer, float *scale_shift_buffer,
@@ -102,22 +139,24 @@ void batch_norm_grad(std::vector<int32_t> input_shape, float *input_grad_buffer,
   auto user_mean = memory(c_md, ENG, mean_buffer);
   auto user_variance = memory(c_md, ENG, variance_buffer);
 
-  auto bnorm_bwd_d = batch_normalization_backward::desc(
-      prop_kind::backward, nhwc_md, nhwc_md, EPSILON,
-      normalization_flags::use_scale_shift);
-  auto bnorm_pd = make_bnorm_pd(nhwc_md);
-  auto bnorm_bwd_pd =
-      batch_normalization_backward::primitive_desc(bnorm_bwd_d, ENG, bnorm_pd);
-
-  // Create and execute the primitive
-  auto bnorm_bwd_prim = batch_normalization_backward(bnorm_bwd_pd);
-  bnorm_bwd_prim.execute(S, {{DNNL_ARG_DIFF_SRC, user_diff_src},
-                             {DNNL_ARG_DIFF_SCALE_SHIFT, user_diff_scale_shift},
-                             {DNNL_ARG_DIFF_DST, user_diff_dst},
-                             {DNNL_ARG_SRC, user_src},
-                             {DNNL_ARG_SCALE_SHIFT, user_scale_shift},
-                             {DNNL_ARG_MEAN, user_mean},
-                             {DNNL_ARG_VARIANCE, user_variance}});
+  auto cached = cached_primitive<batch_normalization_backward>(
+      PrimitiveKey("batch_norm_grad").add(nhwc_md), [&] {
+        auto bnorm_bwd_d = batch_normalization_backward::desc(
+            prop_kind::backward, nhwc_md, nhwc_md, EPSILON,
+            normalization_flags::use_scale_shift);
+        auto bnorm_pd = make_bnorm_pd(nhwc_md);
+        return batch_normalization_backward::primitive_desc(bnorm_bwd_d, ENG,
+                                                            bnorm_pd);
+      });
+
+  // Get and execute the primitive
+  cached->prim.execute(S, {{DNNL_ARG_DIFF_SRC, user_diff_src},
+                           {DNNL_ARG_DIFF_SCALE_SHIFT, user_diff_scale_shift},
+                           {DNNL_ARG_DIFF_DST, user_diff_dst},
+                           {DNNL_ARG_SRC, user_src},
+                           {DNNL_ARG_SCALE_SHIFT, user_scale_shift},
+                           {DNNL_ARG_MEAN, user_mean},
+                           {DNNL_ARG_VARIANCE, user_variance}});
 
   // Wait for all primitives in the stream to finish.
   S.wait();
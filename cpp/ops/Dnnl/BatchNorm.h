@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include <vector>
 
+#include "DenseTensor.h"
+
 namespace ops {
 
 // Batch Normalization (forward)
@@ -21,6 +23,14 @@ void batch_norm(std::vector<int32_t> input_shape, float *res_buffer,
                 float *mean_buffer, float *variance_buffer, float *input_buffer,
                 float *scale_shift_buffer);
 
+// Batch Normalization (forward) on a native tensor
+//
+// Inputs: input (NHWC), scale and shift (2C)
+// Outputs: result, with the layout of the input, mean (C), variance (C)
+// This waits for the result even in async mode, as it writes to the buffers.
+DenseTensor batch_norm(const DenseTensor &input, float *mean_buffer,
+                       float *variance_buffer, float *scale_shift_buffer);
+
 // Batch Normalization gradient
 //
 // Inputs: seed (NHWC), input (NHWC), mean (C), variance (C), scale and shift
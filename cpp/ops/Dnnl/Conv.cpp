@@ -12,7 +12,10 @@
 
 #include "dnnl.hpp"
 
+#include "Async.h"
+#include "PrimitiveCache.h"
 #include "Utils.h"
+#include "WeightsCache.h"
 
 namespace ops {
 
@@ -20,6 +23,24 @@ using namespace dnnl;
 
 const algorithm CONV_ALGORITHM = algorithm::convolution_direct;
 
+// Key of a conv primitive, from the shapes of its three tensors, its strides
+// and its padding
+PrimitiveKey conv_key(const char *op, const std::vector<int32_t> &shape0,
+                      const std::vector<int32_t> &shape1,
+                      const std::vector<int32_t> &shape2, int32_t hstride,
+                      int32_t wstride, Padding padding) {
+  return PrimitiveKey(op)
+      .add(shape0)
+      .add(shape1)
+      .add(shape2)
+      .add(hstride)
+      .add(wstride)
+      .add(padding.left)
+      .add(padding.right)
+      .add(padding.top)
+      .add(padding.bottom);
+}
+
 // DNNL Conv2D (forward)
 void conv(std::vector<int32_t> res_shape, std::vector<int32_t> img_shape,
           std::vector<int32_t> fil_shape, float *res, float *img, float *fil,
@@ -56,11 +77,18 @@ void conv(std::vector<int32_t> res_shape, std::vector<int32_t> img_shape,
   const memory::dims padding_low = {padding.top, padding.left};
   const memory::dims padding_high = {padding.bottom, padding.right};
 
-  // Create the convolution descriptor and primitive descriptor.
-  auto conv_d = convolution_forward::desc(
-      prop_kind::forward_training, CONV_ALGORITHM, conv_src_md, conv_wei_md,
-      conv_dst_md, strides, padding_low, padding_high);
-  auto conv_pd = convolution_forward::primitive_desc(conv_d, ENG);
+  // Get the convolution primitive, creating its descriptor and primitive
+  // descriptor if it isn't cached.
+  auto cached = cached_primitive<convolution_forward>(
+      conv_key("conv", res_shape, img_shape, fil_shape, hstride, wstride,
+               padding),
+      [&] {
+        auto conv_d = convolution_forward::desc(
+            prop_kind::forward_training, CONV_ALGORITHM, conv_src_md,
+            conv_wei_md, conv_dst_md, strides, padding_low, padding_high);
+        return convolution_forward::primitive_desc(conv_d, ENG);
+      });
+  auto &conv_pd = cached->pd;
 
   // Conditinally reorder src and weights in case the user format does
   // not match the one convolution picked. This probably always happens.
@@ -78,10 +106,9 @@ void conv(std::vector<int32_t> res_shape, std::vector<int32_t> img_shape,
   }
 
   // Do convolution
-  auto conv = convolution_forward(conv_pd);
-  conv.execute(S, {{DNNL_ARG_SRC, conv_src},
-                   {DNNL_ARG_WEIGHTS, conv_wei},
-                   {DNNL_ARG_DST, conv_dst}});
+  cached->prim.execute(S, {{DNNL_ARG_SRC, conv_src},
+                           {DNNL_ARG_WEIGHTS, conv_wei},
+                           {DNNL_ARG_DST, conv_dst}});
 
   // Conditionally reorder result
   if (reorder_dst)
@@ -91,6 +118,61 @@ void conv(std::vector<int32_t> res_shape, std::vector<int32_t> img_shape,
   S.wait();
 }
 
+DenseTensor conv(const DenseTensor &img, const DenseTensor &fil,
+                 int32_t hstride, int32_t wstride, Padding padding) {
+  auto &img_shape = img.shape();
+  auto &fil_shape = fil.shape();
+  const memory::dim BATCH = img_shape[0];
+  const memory::dim IC = img_shape[3], OC = fil_shape[0];
+  const memory::dim IH = img_shape[1], FH = fil_shape[1];
+  const memory::dim IW = img_shape[2], FW = fil_shape[2];
+  const memory::dim OH = (IH + padding.top + padding.bottom - FH) / hstride + 1;
+  const memory::dim OW = (IW + padding.left + padding.right - FW) / wstride + 1;
+
+  // Let conv pick the format of all its memories
+  auto conv_src_md = memory::desc({BATCH, IC, IH, IW}, memory::data_type::f32,
+                                  memory::format_tag::any);
+  auto conv_wei_md = memory::desc({OC, IC, FH, FW}, memory::data_type::f32,
+                                  memory::format_tag::any);
+  auto conv_dst_md = memory::desc({BATCH, OC, OH, OW}, memory::data_type::f32,
+                                  memory::format_tag::any);
+
+  const memory::dims strides = {hstride, wstride};
+  const memory::dims padding_low = {padding.top, padding.left};
+  const memory::dims padding_high = {padding.bottom, padding.right};
+
+  // The shapes determine the primitive, whatever the layout of the inputs,
+  // so it is shared with the conv of arrays of the same shapes
+  std::vector<int32_t> res_shape = {img_shape[0], (int32_t)OH, (int32_t)OW,
+                                    fil_shape[0]};
+  auto cached = cached_primitive<convolution_forward>(
+      conv_key("conv", res_shape, img_shape, fil_shape, hstride, wstride,
+               padding),
+      [&] {
+        auto conv_d = convolution_forward::desc(
+            prop_kind::forward_training, CONV_ALGORITHM, conv_src_md,
+            conv_wei_md, conv_dst_md, strides, padding_low, padding_high);
+        return convolution_forward::primitive_desc(conv_d, ENG);
+      });
+  auto &conv_pd = cached->pd;
+
+  memory conv_dst = memory(conv_pd.dst_desc(), ENG);
+
+  auto ticket = run_op([=] {
+    // Inputs produced by a previous conv are usually in the right format
+    // already, and are not reordered. Filters are reordered once per version.
+    memory conv_src = img.as(cached->pd.src_desc());
+    memory conv_wei =
+        WeightsCache::instance().get(fil, cached->pd.weights_desc());
+
+    cached->prim.execute(S, {{DNNL_ARG_SRC, conv_src},
+                             {DNNL_ARG_WEIGHTS, conv_wei},
+                             {DNNL_ARG_DST, conv_dst}});
+    S.wait();
+  });
+  return DenseTensor(res_shape, conv_dst, ticket);
+}
+
 // Make convolution primitive_descriptor for convolution_backward
 convolution_forward::primitive_desc
 make_conv_pd_for_bwd(std::vector<int32_t> src_shape,
@@ -172,17 +254,25 @@ void conv_grad_image(std::vector<int32_t> res_shape,
   const memory::dims padding_low = {padding.top, padding.left};
   const memory::dims padding_high = {padding.bottom, padding.right};
 
-  // Make the conv forward primitive descriptor for the conv_backward_data
-  // primitive descriptor
-  auto conv_pd = make_conv_pd_for_bwd(diff_src_shape, diff_dst_shape, wei_shape,
-                                      strides, padding_low, padding_high);
-
-  // Finally make the conv_backward_data descriptor and primitive descriptor
-  auto conv_bwd_data_d = convolution_backward_data::desc(
-      CONV_ALGORITHM, diff_src_md, wei_md, diff_dst_md, strides, padding_low,
-      padding_high);
-  auto conv_bwd_data_pd =
-      convolution_backward_data::primitive_desc(conv_bwd_data_d, ENG, conv_pd);
+  auto cached = cached_primitive<convolution_backward_data>(
+      conv_key("conv_grad_image", res_shape, seed_shape, fil_shape, hstride,
+               wstride, padding),
+      [&] {
+        // Make the conv forward primitive descriptor for the
+        // conv_backward_data primitive descriptor
+        auto conv_pd =
+            make_conv_pd_for_bwd(diff_src_shape, diff_dst_shape, wei_shape,
+                                 strides, padding_low, padding_high);
+
+        // Finally make the conv_backward_data descriptor and primitive
+        // descriptor
+        auto conv_bwd_data_d = convolution_backward_data::desc(
+            CONV_ALGORITHM, diff_src_md, wei_md, diff_dst_md, strides,
+            padding_low, padding_high);
+        return convolution_backward_data::primitive_desc(conv_bwd_data_d, ENG,
+                                                         conv_pd);
+      });
+  auto &conv_bwd_data_pd = cached->pd;
 
   // Conditinally reorder seed and weights in case the user format does
   // not match the one the op picked.
@@ -201,10 +291,9 @@ void conv_grad_image(std::vector<int32_t> res_shape,
   }
 
   // Finally run the op
-  auto conv_bwd_data = convolution_backward_data(conv_bwd_data_pd);
-  conv_bwd_data.execute(S, {{DNNL_ARG_DIFF_DST, diff_dst_m},
-                            {DNNL_ARG_DIFF_SRC, diff_src_m},
-                            {DNNL_ARG_WEIGHTS, wei_m}});
+  cached->prim.execute(S, {{DNNL_ARG_DIFF_DST, diff_dst_m},
+                           {DNNL_ARG_DIFF_SRC, diff_src_m},
+                           {DNNL_ARG_WEIGHTS, wei_m}});
 
   // Conditionally reorder result
   if (reorder_dst)
@@ -214,6 +303,59 @@ void conv_grad_image(std::vector<int32_t> res_shape,
   S.wait();
 }
 
+DenseTensor conv_grad_image(const DenseTensor &seed, const DenseTensor &fil,
+                            std::vector<int32_t> img_shape, int32_t hstride,
+                            int32_t wstride, Padding padding) {
+  auto &seed_shape = seed.shape();
+  auto &fil_shape = fil.shape();
+  const memory::dim BATCH = img_shape[0];
+  const memory::dim IC = img_shape[3], OC = fil_shape[0];
+  const memory::dim IH = img_shape[1], KH = fil_shape[1], OH = seed_shape[1];
+  const memory::dim IW = img_shape[2], KW = fil_shape[2], OW = seed_shape[2];
+
+  auto diff_src_md = memory::desc({BATCH, IC, IH, IW}, memory::data_type::f32,
+                                  memory::format_tag::any);
+  auto wei_md = memory::desc({OC, IC, KH, KW}, memory::data_type::f32,
+                             memory::format_tag::any);
+  auto diff_dst_md = memory::desc({BATCH, OC, OH, OW}, memory::data_type::f32,
+                                  memory::format_tag::any);
+
+  const memory::dims strides = {hstride, wstride};
+  const memory::dims padding_low = {padding.top, padding.left};
+  const memory::dims padding_high = {padding.bottom, padding.right};
+
+  // Shared with the conv_grad_image of arrays of the same shapes
+  auto cached = cached_primitive<convolution_backward_data>(
+      conv_key("conv_grad_image", img_shape, seed_shape, fil_shape, hstride,
+               wstride, padding),
+      [&] {
+        auto conv_pd = make_conv_pd_for_bwd(img_shape, seed_shape, fil_shape,
+                                            strides, padding_low, padding_high);
+        auto conv_bwd_data_d = convolution_backward_data::desc(
+            CONV_ALGORITHM, diff_src_md, wei_md, diff_dst_md, strides,
+            padding_low, padding_high);
+        return convolution_backward_data::primitive_desc(conv_bwd_data_d, ENG,
+                                                         conv_pd);
+      });
+  auto &conv_bwd_data_pd = cached->pd;
+
+  memory diff_src_m = memory(conv_bwd_data_pd.diff_src_desc(), ENG);
+
+  auto ticket = run_op([=] {
+    // The filters reordered for the forward conv are usually in the layout
+    // wanted here too.
+    memory diff_dst_m = seed.as(cached->pd.diff_dst_desc());
+    memory wei_m =
+        WeightsCache::instance().get(fil, cached->pd.weights_desc());
+
+    cached->prim.execute(S, {{DNNL_ARG_DIFF_DST, diff_dst_m},
+                             {DNNL_ARG_DIFF_SRC, diff_src_m},
+                             {DNNL_ARG_WEIGHTS, wei_m}});
+    S.wait();
+  });
+  return DenseTensor(img_shape, diff_src_m, ticket);
+}
+
 // Conv grad w.r.t. filter
 void conv_grad_filter(std::vector<int32_t> res_shape,
                       std::vector<int32_t> seed_shape,
@@ -264,18 +406,25 @@ void conv_grad_filter(std::vector<int32_t> res_shape,
   const memory::dims padding_low = {padding.top, padding.left};
   const memory::dims padding_high = {padding.bottom, padding.right};
 
-  // Make the conv forward primitive descriptor for the conv_backward_weights
-  // primitive descriptor
-  auto conv_pd =
-      make_conv_pd_for_bwd(src_shape, diff_dst_shape, diff_weights_shape,
-                           strides, padding_low, padding_high);
-
-  // Finally make the conv_backward_weights descriptor and primitive descriptor
-  auto conv_bwd_weights_d = convolution_backward_weights::desc(
-      CONV_ALGORITHM, src_md, diff_weights_md, diff_dst_md, strides,
-      padding_low, padding_high);
-  auto conv_bwd_weights_pd = convolution_backward_weights::primitive_desc(
-      conv_bwd_weights_d, ENG, conv_pd);
+  auto cached = cached_primitive<convolution_backward_weights>(
+      conv_key("conv_grad_filter", res_shape, seed_shape, img_shape, hstride,
+               wstride, padding),
+      [&] {
+        // Make the conv forward primitive descriptor for the
+        // conv_backward_weights primitive descriptor
+        auto conv_pd =
+            make_conv_pd_for_bwd(src_shape, diff_dst_shape, diff_weights_shape,
+                                 strides, padding_low, padding_high);
+
+        // Finally make the conv_backward_weights descriptor and primitive
+        // descriptor
+        auto conv_bwd_weights_d = convolution_backward_weights::desc(
+            CONV_ALGORITHM, src_md, diff_weights_md, diff_dst_md, strides,
+            padding_low, padding_high);
+        return convolution_backward_weights::primitive_desc(
+            conv_bwd_weights_d, ENG, conv_pd);
+      });
+  auto &conv_bwd_weights_pd = cached->pd;
 
   // Conditinally reorder seed and weights in case the user format does
   // not match the one the op picked.
@@ -295,10 +444,9 @@ void conv_grad_filter(std::vector<int32_t> res_shape,
   }
 
   // Finally run the op
-  auto conv_bwd_weights = convolution_backward_weights(conv_bwd_weights_pd);
-  conv_bwd_weights.execute(S, {{DNNL_ARG_DIFF_DST, diff_dst_m},
-                               {DNNL_ARG_SRC, src_m},
-                               {DNNL_ARG_DIFF_WEIGHTS, diff_weights_m}});
+  cached->prim.execute(S, {{DNNL_ARG_DIFF_DST, diff_dst_m},
+                           {DNNL_ARG_SRC, src_m},
+                           {DNNL_ARG_DIFF_WEIGHTS, diff_weights_m}});
 
   // Conditionally reorder result
   if (reorder_dst)
@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include <vector>
 
+#include "DenseTensor.h"
+
 namespace ops {
 
 struct Padding {
@@ -24,12 +26,24 @@ void conv(std::vector<int32_t> res_shape, std::vector<int32_t> img_shape,
           std::vector<int32_t> fil_shape, float *res, float *img, float *fil,
           int32_t hstride, int32_t wstride, Padding padding);
 
+// Conv2D on native tensors. The result keeps the layout picked by the
+// convolution, which is usually blocked, so that the next op can use it
+// without a reorder.
+DenseTensor conv(const DenseTensor &img, const DenseTensor &fil,
+                 int32_t hstride, int32_t wstride, Padding padding);
+
 void conv_grad_image(std::vector<int32_t> res_shape,
                      std::vector<int32_t> seed_shape,
                      std::vector<int32_t> fil_shape, float *res, float *seed,
                      float *fil, int32_t hstride, int32_t wstride,
                      Padding padding);
 
+// Conv gradient w.r.t. image on native tensors, for images of img_shape. The
+// result keeps the layout picked by the op.
+DenseTensor conv_grad_image(const DenseTensor &seed, const DenseTensor &fil,
+                            std::vector<int32_t> img_shape, int32_t hstride,
+                            int32_t wstride, Padding padding);
+
 void conv_grad_filter(std::vector<int32_t> res_shape,
                       std::vector<int32_t> seed_shape,
                       std::vector<int32_t> img_shape, float *res, float *seed,
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "DenseTensor.h"
+
+#include <atomic>
+#include <cstring>
+#include <stdint.h>
+
+#include "dnnl.hpp"
+
+#include "Async.h"
+#include "Utils.h"
+
+namespace ops {
+
+using namespace dnnl;
+
+memory::desc user_desc(const std::vector<int32_t> &shape) {
+  if (shape.size() == 4)
+    return memory::desc({shape[0], shape[3], shape[1], shape[2]},
+                        memory::data_type::f32, memory::format_tag::nhwc);
+  // A scalar is held as a single element
+  if (shape.empty())
+    return memory::desc({1}, memory::data_type::f32, memory::format_tag::a);
+  return memory::desc(to_dims(shape), memory::data_type::f32,
+                      get_plain_tag(shape.size()));
+}
+
+DenseTensor::DenseTensor(std::vector<int32_t> shape, memory mem,
+                         uint64_t ticket)
+    : shape_(std::move(shape)), mem_(std::move(mem)), ticket_(ticket),
+      version_(std::make_shared<std::atomic<uint64_t>>(0)) {
+  static std::atomic<uint64_t> next_id(1);
+  id_ = next_id++;
+}
+
+DenseTensor DenseTensor::from_user(std::vector<int32_t> shape,
+                                   const float *data) {
+  auto mem = memory(user_desc(shape), ENG);
+  std::memcpy(mem.get_data_handle(), data, product(shape) * sizeof(float));
+  return DenseTensor(std::move(shape), mem);
+}
+
+memory DenseTensor::as(memory::desc md) const {
+  return reorder_if_needed(mem_, md);
+}
+
+bool DenseTensor::ready() const { return is_done(ticket_); }
+
+void DenseTensor::wait() const { ops::wait(ticket_); }
+
+void DenseTensor::read(float *data) const {
+  wait();
+  read_ready(data);
+}
+
+void DenseTensor::read_ready(float *data) const {
+  auto md = user_desc(shape_);
+  if (desc() == md) {
+    std::memcpy(data, mem_.get_data_handle(), product(shape_) * sizeof(float));
+    return;
+  }
+  reorder(mem_, memory(md, ENG, data));
+  S.wait();
+}
+
+void DenseTensor::write(const float *data) {
+  // Wait for any op still reading the tensor before overwriting it
+  sync();
+  write_synced(data);
+}
+
+void DenseTensor::write_synced(const float *data) {
+  auto md = user_desc(shape_);
+  if (desc() == md) {
+    std::memcpy(mem_.get_data_handle(), data, product(shape_) * sizeof(float));
+  } else {
+    reorder(memory(md, ENG, const_cast<float *>(data)), mem_);
+    S.wait();
+  }
+  (*version_)++;
+}
+
+} // namespace ops
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef OPS_DENSETENSOR_H_
+#define OPS_DENSETENSOR_H_
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "dnnl.hpp"
+
+namespace ops {
+
+// A float tensor owned by native code, held as a DNNL memory.
+//
+// The shape is the user shape (NHWC for images, OHWI for filters), but the
+// memory may have any layout, including the blocked layouts picked by DNNL
+// primitives. This lets a chain of ops pass their results to each other
+// without reordering them back to the user layout and copying them to Java
+// after each op. The data is only reordered to the user layout by read().
+class DenseTensor {
+public:
+  // ticket is the ticket of the op computing mem, see Async.h
+  DenseTensor(std::vector<int32_t> shape, dnnl::memory mem,
+              uint64_t ticket = 0);
+
+  // Copies data, in the user layout, into a new tensor of the given shape.
+  static DenseTensor from_user(std::vector<int32_t> shape, const float *data);
+
+  const std::vector<int32_t> &shape() const { return shape_; }
+  const dnnl::memory &mem() const { return mem_; }
+  dnnl::memory::desc desc() const { return mem_.get_desc(); }
+
+  // The identity of the tensor memory, unique in the process, and shared by
+  // copies of the tensor
+  uint64_t id() const { return id_; }
+  // The number of times the tensor has been overwritten by write()
+  uint64_t version() const { return version_->load(); }
+  // Whether the op computing the tensor has completed
+  bool ready() const;
+
+  // Returns the tensor memory in the layout of md, reordering it if needed.
+  // In async mode, this is only called from queued ops, which run after the
+  // op computing the tensor.
+  //
+  // Non-blocking; caller is responsible for calling S.wait() before accessing
+  // result data.
+  dnnl::memory as(dnnl::memory::desc md) const;
+
+  // Waits until the op computing the tensor has completed, with the errors
+  // of ops::wait().
+  void wait() const;
+
+  // Copies the tensor into data, in the user layout, once it is computed.
+  void read(float *data) const;
+  // Like read(), once wait() returned, without blocking. For copies into
+  // pinned Java arrays, which must not block.
+  void read_ready(float *data) const;
+
+  // Overwrites the tensor with data, in the user layout, keeping its layout,
+  // and increments its version. This waits for all the queued ops, as they
+  // may read the tensor.
+  void write(const float *data);
+  // Like write(), once ops::sync() returned, without blocking.
+  void write_synced(const float *data);
+
+private:
+  std::vector<int32_t> shape_;
+  dnnl::memory mem_;
+  uint64_t id_;
+  uint64_t ticket_;
+  // Shared by copies, as they share the memory. Atomic, as the ops of other
+  // threads read it while write() increments it.
+  std::shared_ptr<std::atomic<uint64_t>> version_;
+};
+
+// Returns the memory descriptor of the user layout for a shape.
+//
+// Rank 4 shapes are NHWC (or OHWI, which has the same strides), and are
+// described with DNNL's NCHW dims. Other shapes are plain.
+dnnl::memory::desc user_desc(const std::vector<int32_t> &shape);
+
+} // namespace ops
+
+#endif // OPS_DENSETENSOR_H_
@@ -13,6 +13,7 @@
 
 #include "dnnl.hpp"
 
+#include "PrimitiveCache.h"
 #include "Utils.h"
 
 namespace ops {
@@ -34,13 +35,14 @@ void log_softmax(std::vector<int32_t> shape, float *src_buffer,
   auto user_src = memory(md, ENG, src_buffer);
   auto user_dst = memory(md, ENG, dst_buffer);
 
-  auto log_softmax_pd = make_log_softmax_pd(md, axis);
+  auto cached = cached_primitive<logsoftmax_forward>(
+      PrimitiveKey("log_softmax").add(shape).add(axis),
+      [&] { return make_log_softmax_pd(md, axis); });
 
   // Check assumption that our dst is what log_softmax_pd expects
-  assert(log_softmax_pd.dst_desc() == md);
+  assert(cached->pd.dst_desc() == md);
 
-  auto log_softmax = logsoftmax_forward(log_softmax_pd);
-  log_softmax.execute(S, {{DNNL_ARG_SRC, user_src}, {DNNL_ARG_DST, user_dst}});
+  cached->prim.execute(S, {{DNNL_ARG_SRC, user_src}, {DNNL_ARG_DST, user_dst}});
   S.wait();
 }
 
@@ -54,15 +56,17 @@ void log_softmax_grad(std::vector<int32_t> shape, float *grad, float *seed,
   auto user_diff_src = memory(md, ENG, grad);
   auto user_diff_dst = memory(md, ENG, seed);
 
-  auto log_softmax_pd = make_log_softmax_pd(md, axis);
-  auto log_softmax_bwd_desc = logsoftmax_backward::desc(md, md, axis);
-  auto log_softmax_bwd_pd = logsoftmax_backward::primitive_desc(
-      log_softmax_bwd_desc, ENG, log_softmax_pd);
+  auto cached = cached_primitive<logsoftmax_backward>(
+      PrimitiveKey("log_softmax_grad").add(shape).add(axis), [&] {
+        auto log_softmax_pd = make_log_softmax_pd(md, axis);
+        auto log_softmax_bwd_desc = logsoftmax_backward::desc(md, md, axis);
+        return logsoftmax_backward::primitive_desc(log_softmax_bwd_desc, ENG,
+                                                   log_softmax_pd);
+      });
 
-  auto log_softmax_bwd = logsoftmax_backward(log_softmax_bwd_pd);
-  log_softmax_bwd.execute(S, {{DNNL_ARG_DST, user_dst},
-                              {DNNL_ARG_DIFF_SRC, user_diff_src},
-                              {DNNL_ARG_DIFF_DST, user_diff_dst}});
+  cached->prim.execute(S, {{DNNL_ARG_DST, user_dst},
+                           {DNNL_ARG_DIFF_SRC, user_diff_src},
+                           {DNNL_ARG_DIFF_DST, user_diff_dst}});
   S.wait();
 }
 
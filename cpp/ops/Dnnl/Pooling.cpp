@@ -12,6 +12,8 @@
 
 #include "dnnl.hpp"
 
+#include "Async.h"
+#include "PrimitiveCache.h"
 #include "Utils.h"
 
 namespace ops {
@@ -52,11 +54,21 @@ void pooling_helper(algorithm alg, std::vector<int32_t> res_shape,
   auto dst_md = memory::desc(user_dst.get_desc());
   dst_md.data.format_kind = dnnl_format_kind_any;
 
-  // Make the primitive descriptor
-  auto pool_d = pooling_forward::desc(prop_kind::forward_training, alg,
-                                      user_src.get_desc(), dst_md, strides,
-                                      kernel, padding, padding);
-  auto pool_pd = pooling_forward::primitive_desc(pool_d, ENG);
+  // Get the primitive, making its primitive descriptor if it isn't cached
+  auto cached = cached_primitive<pooling_forward>(
+      PrimitiveKey("pool")
+          .add((int64_t)alg)
+          .add(res_shape)
+          .add(img_shape)
+          .add(pool_height)
+          .add(pool_width),
+      [&] {
+        auto pool_d = pooling_forward::desc(prop_kind::forward_training, alg,
+                                            user_src.get_desc(), dst_md,
+                                            strides, kernel, padding, padding);
+        return pooling_forward::primitive_desc(pool_d, ENG);
+      });
+  auto &pool_pd = cached->pd;
 
   memory dst = user_dst;
   bool reorder_dst = false;
@@ -93,8 +105,7 @@ void pooling_helper(algorithm alg, std::vector<int32_t> res_shape,
   }
 
   // Do pool
-  auto pool = pooling_forward(pool_pd);
-  pool.execute(S, pooling_args);
+  cached->prim.execute(S, pooling_args);
 
   // Conditionally reorder dst and workspace
   if (reorder_dst)
@@ -140,16 +151,26 @@ void pooling_grad_helper(algorithm alg, std::vector<int32_t> res_shape,
   auto diff_dst_md = memory::desc(user_diff_dst.get_desc());
   diff_dst_md.data.format_kind = dnnl_format_kind_any;
 
-  // Make the forward primitive descriptor
-  auto pool_d = pooling_forward::desc(prop_kind::forward_training, alg,
-                                      user_diff_src.get_desc(), diff_dst_md,
-                                      strides, kernel, padding, padding);
-  auto pool_pd = pooling_forward::primitive_desc(pool_d, ENG);
-  // Make the backward primitive descriptor
-  auto pool_bwd_d =
-      pooling_backward::desc(alg, user_diff_src.get_desc(), diff_dst_md,
-                             strides, kernel, padding, padding);
-  auto pool_bwd_pd = pooling_backward::primitive_desc(pool_bwd_d, ENG, pool_pd);
+  auto cached = cached_primitive<pooling_backward>(
+      PrimitiveKey("pool_grad")
+          .add((int64_t)alg)
+          .add(res_shape)
+          .add(seed_shape)
+          .add(pool_height)
+          .add(pool_width),
+      [&] {
+        // Make the forward primitive descriptor
+        auto pool_d = pooling_forward::desc(
+            prop_kind::forward_training, alg, user_diff_src.get_desc(),
+            diff_dst_md, strides, kernel, padding, padding);
+        auto pool_pd = pooling_forward::primitive_desc(pool_d, ENG);
+        // Make the backward primitive descriptor
+        auto pool_bwd_d =
+            pooling_backward::desc(alg, user_diff_src.get_desc(), diff_dst_md,
+                                   strides, kernel, padding, padding);
+        return pooling_backward::primitive_desc(pool_bwd_d, ENG, pool_pd);
+      });
+  auto &pool_bwd_pd = cached->pd;
 
   // Initialize pooling argumentsls
   std::unordered_map<int, memory> pooling_args;
@@ -174,13 +195,51 @@ void pooling_grad_helper(algorithm alg, std::vector<int32_t> res_shape,
       reorder_if_needed(user_diff_dst, pool_bwd_pd.diff_dst_desc());
 
   // Do pool backward
-  auto pool_bwd = pooling_backward(pool_bwd_pd);
-  pool_bwd.execute(S, pooling_args);
+  cached->prim.execute(S, pooling_args);
 
   // Wait for all primitives in the stream to finish.
   S.wait();
 }
 
+DenseTensor pooling_tensor_helper(algorithm alg, const DenseTensor &img,
+                                  int32_t pool_height, int32_t pool_width) {
+  auto &img_shape = img.shape();
+  const memory::dim N = img_shape[0], C = img_shape[3];
+  const memory::dim IH = img_shape[1], IW = img_shape[2];
+  const memory::dim OH = (IH - pool_height) / pool_height + 1;
+  const memory::dim OW = (IW - pool_width) / pool_width + 1;
+  memory::dims kernel = {pool_height, pool_width};
+  memory::dims strides = {pool_height, pool_width};
+  memory::dims padding = {0, 0};
+
+  // Pool in the image layout, and let the pooling pick the dst format
+  auto dst_md = memory::desc({N, C, OH, OW}, memory::data_type::f32,
+                             memory::format_tag::any);
+
+  // Inference, so that max pool has no workspace to keep
+  auto cached = cached_primitive<pooling_forward>(
+      PrimitiveKey("pool_inference")
+          .add((int64_t)alg)
+          .add(img.desc())
+          .add(pool_height)
+          .add(pool_width),
+      [&] {
+        auto pool_d = pooling_forward::desc(prop_kind::forward_inference, alg,
+                                            img.desc(), dst_md, strides,
+                                            kernel, padding, padding);
+        return pooling_forward::primitive_desc(pool_d, ENG);
+      });
+  auto dst = memory(cached->pd.dst_desc(), ENG);
+  auto src = img.mem();
+
+  auto ticket = run_op([=] {
+    cached->prim.execute(S, {{DNNL_ARG_SRC, src}, {DNNL_ARG_DST, dst}});
+    S.wait();
+  });
+  return DenseTensor({img_shape[0], (int32_t)OH, (int32_t)OW, img_shape[3]},
+                     dst, ticket);
+}
+
 void avg_pool(std::vector<int32_t> res_shape, std::vector<int32_t> img_shape,
               float *res, float *img, int32_t pool_height, int32_t pool_width) {
   pooling_helper(algorithm::pooling_avg, res_shape, img_shape, res, img,
@@ -201,6 +260,18 @@ void max_pool(std::vector<int32_t> res_shape, std::vector<int32_t> img_shape,
                  pool_height, pool_width, workspace);
 }
 
+DenseTensor avg_pool(const DenseTensor &img, int32_t pool_height,
+                     int32_t pool_width) {
+  return pooling_tensor_helper(algorithm::pooling_avg, img, pool_height,
+                               pool_width);
+}
+
+DenseTensor max_pool(const DenseTensor &img, int32_t pool_height,
+                     int32_t pool_width) {
+  return pooling_tensor_helper(algorithm::pooling_max, img, pool_height,
+                               pool_width);
+}
+
 void max_pool_grad(std::vector<int32_t> res_shape,
                    std::vector<int32_t> seed_shape, float *res,
                    uint8_t *workspace, float *seed, int32_t pool_height,
@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include <vector>
 
+#include "DenseTensor.h"
+
 namespace ops {
 
 // AvgPool (forward)
@@ -20,6 +22,11 @@ namespace ops {
 void avg_pool(std::vector<int32_t> res_shape, std::vector<int32_t> img_shape,
               float *res, float *img, int32_t pool_height, int32_t pool_width);
 
+// AvgPool (forward) on a native tensor. The result keeps the layout picked by
+// the pooling.
+DenseTensor avg_pool(const DenseTensor &img, int32_t pool_height,
+                     int32_t pool_width);
+
 // AvgPool gradient
 // Requires workspace in the format that AvgPool forward returns. Workspace has
 // the same shape as seed.
@@ -35,6 +42,11 @@ void max_pool(std::vector<int32_t> res_shape, std::vector<int32_t> img_shape,
               float *res, uint8_t *workspace, float *img, int32_t pool_height,
               int32_t pool_width);
 
+// MaxPool (forward) on a native tensor, for inference: no workspace is
+// computed, so the gradient has to be computed from the array version.
+DenseTensor max_pool(const DenseTensor &img, int32_t pool_height,
+                     int32_t pool_width);
+
 // MaxPool gradient
 // Requires workspace in the format that MaxPool forward returns. Workspace has
 // the same shape as seed.
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "PrimitiveCache.h"
+
+#include <omp.h>
+
+namespace ops {
+
+PrimitiveKey::PrimitiveKey(const char *op) : key_(op) {
+  add((int64_t)omp_get_max_threads());
+}
+
+PrimitiveKey &PrimitiveKey::add(int64_t n) {
+  key_.append((const char *)&n, sizeof(n));
+  return *this;
+}
+
+PrimitiveKey &PrimitiveKey::add(const std::vector<int32_t> &ns) {
+  // The size separates the vectors, so that shapes of different ranks can't
+  // produce the same key
+  add((int64_t)ns.size());
+  key_.append((const char *)ns.data(), ns.size() * sizeof(int32_t));
+  return *this;
+}
+
+PrimitiveKey &PrimitiveKey::add(const dnnl::memory::desc &md) {
+  key_.append((const char *)&md.data, sizeof(md.data));
+  return *this;
+}
+
+PrimitiveCache &PrimitiveCache::instance() {
+  static PrimitiveCache cache;
+  return cache;
+}
+
+std::shared_ptr<void> PrimitiveCache::get(const std::string &key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    misses_++;
+    return nullptr;
+  }
+  hits_++;
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->second;
+}
+
+void PrimitiveCache::put(const std::string &key, std::shared_ptr<void> value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (capacity_ == 0)
+    return;
+  auto it = index_.find(key);
+  if (it != index_.end()) {
+    it->second->second = std::move(value);
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return;
+  }
+  entries_.emplace_front(key, std::move(value));
+  index_[key] = entries_.begin();
+  evict();
+}
+
+void PrimitiveCache::erase_prefix(const std::string &prefix) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->first.compare(0, prefix.size(), prefix) == 0) {
+      index_.erase(it->first);
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void PrimitiveCache::evict() {
+  while (entries_.size() > capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+void PrimitiveCache::set_capacity(size_t capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity_ = capacity;
+  evict();
+}
+
+size_t PrimitiveCache::capacity() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return capacity_;
+}
+
+size_t PrimitiveCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+uint64_t PrimitiveCache::hits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+uint64_t PrimitiveCache::misses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+void PrimitiveCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  index_.clear();
+  hits_ = 0;
+  misses_ = 0;
+}
+
+} // namespace ops
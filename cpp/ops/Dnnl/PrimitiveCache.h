@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef OPS_PRIMITIVECACHE_H_
+#define OPS_PRIMITIVECACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dnnl.hpp"
+
+namespace ops {
+
+// The key of a cached primitive: the op kind, followed by everything its
+// primitive descriptor is built from, such as shapes, strides, padding and
+// algorithm.
+//
+// DNNL splits the work of a primitive between the OpenMP threads available
+// when it is built, so the key also holds their number, which differs
+// between partitions (see Threading/Threading.h).
+class PrimitiveKey {
+public:
+  explicit PrimitiveKey(const char *op);
+
+  PrimitiveKey &add(int64_t n);
+  PrimitiveKey &add(const std::vector<int32_t> &ns);
+  // Adds a memory descriptor, for ops whose inputs may have any layout
+  PrimitiveKey &add(const dnnl::memory::desc &md);
+
+  const std::string &str() const { return key_; }
+
+private:
+  std::string key_;
+};
+
+// A process-wide LRU cache of the primitives built by the ops.
+//
+// The ops build the same primitives with the same shapes at each step of a
+// training loop, and building them is often more expensive than running them
+// on small tensors. The cache is thread-safe, and holds its values as
+// shared_ptrs so that an entry evicted by another thread stays valid while it
+// is used.
+class PrimitiveCache {
+public:
+  static const size_t DEFAULT_CAPACITY = 1024;
+
+  static PrimitiveCache &instance();
+
+  // Returns the value for key and marks it as most recently used, or null.
+  std::shared_ptr<void> get(const std::string &key);
+  // Adds or replaces the value for key, evicting the least recently used
+  // entries beyond the capacity.
+  void put(const std::string &key, std::shared_ptr<void> value);
+  // Removes the entries whose keys start with prefix
+  void erase_prefix(const std::string &prefix);
+
+  // A capacity of 0 disables caching.
+  void set_capacity(size_t capacity);
+  size_t capacity() const;
+  size_t size() const;
+  uint64_t hits() const;
+  uint64_t misses() const;
+  // Removes all the entries and resets the counters
+  void clear();
+
+private:
+  typedef std::pair<std::string, std::shared_ptr<void>> Entry;
+
+  void evict();
+
+  mutable std::mutex mutex_;
+  size_t capacity_ = DEFAULT_CAPACITY;
+  // Most recently used first
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+// A primitive with the primitive descriptor it was made from
+template <typename Prim> struct CachedPrimitive {
+  typename Prim::primitive_desc pd;
+  Prim prim;
+
+  explicit CachedPrimitive(typename Prim::primitive_desc pd)
+      : pd(pd), prim(pd) {}
+};
+
+// Returns the cached primitive for key, building it from the primitive
+// descriptor returned by make_pd if it isn't cached. Keys of different
+// primitive types must differ by their op kind.
+template <typename Prim, typename MakePd>
+std::shared_ptr<CachedPrimitive<Prim>>
+cached_primitive(const PrimitiveKey &key, MakePd make_pd) {
+  auto &cache = PrimitiveCache::instance();
+  auto value = cache.get(key.str());
+  if (value)
+    return std::static_pointer_cast<CachedPrimitive<Prim>>(value);
+  auto res = std::make_shared<CachedPrimitive<Prim>>(make_pd());
+  cache.put(key.str(), res);
+  return res;
+}
+
+} // namespace ops
+
+#endif // OPS_PRIMITIVECACHE_H_
@@ -13,6 +13,7 @@
 
 #include "dnnl.hpp"
 
+#include "PrimitiveCache.h"
 #include "Utils.h"
 
 namespace ops {
@@ -31,11 +32,13 @@ void reduce_sum(std::vector<int32_t> res_shape, float *res, std::vector<int32_t>
   auto user_src = memory(src_md, ENG, src_buffer);
   auto user_dst = memory(dst_md, ENG, dst_buffer);
 
-  auto reduction_d = reduction::desc(algorithm::reduction_sum, src_md, dst_md, 0.f, 0.f);
-  auto reduction_pd = reduction::primitive_desc(reduction_d, ENG);
-  auto reduction_p = reduction(reduction_pd);
+  auto cached = cached_primitive<reduction>(
+      PrimitiveKey("reduce_sum").add(res_shape).add(input_shape), [&] {
+        auto reduction_d = reduction::desc(algorithm::reduction_sum, src_md, dst_md, 0.f, 0.f);
+        return reduction::primitive_desc(reduction_d, ENG);
+      });
 
-  reduction_p.execute(S, {{DNNL_ARG_SRC, user_src}, {DNNL_ARG_DST, user_dst}});
+  cached->prim.execute(S, {{DNNL_ARG_SRC, user_src}, {DNNL_ARG_DST, user_dst}});
   S.wait();
 }
 
@@ -13,6 +13,7 @@
 
 #include "dnnl.hpp"
 
+#include "Async.h"
 #include "Utils.h"
 
 namespace ops {
@@ -56,6 +57,21 @@ void relu(std::vector<int32_t> shape, float *res, float *data) {
   S.wait();
 }
 
+DenseTensor relu(const DenseTensor &data) {
+  // Relu is elementwise, so it runs on the input layout, whatever it is.
+  auto md = data.desc();
+  auto relu_pd = make_relu_pd(md);
+  auto dst = memory(relu_pd.dst_desc(), ENG);
+  auto src = data.mem();
+
+  auto ticket = run_op([=] {
+    auto relu = eltwise_forward(relu_pd);
+    relu.execute(S, {{DNNL_ARG_SRC, src}, {DNNL_ARG_DST, dst}});
+    S.wait();
+  });
+  return DenseTensor(data.shape(), dst, ticket);
+}
+
 void relu_grad(std::vector<int32_t> shape, float *res, float *seed,
                float *data) {
   auto *src_buffer = data;
@@ -11,11 +11,16 @@
 #include <stdint.h>
 #include <vector>
 
+#include "DenseTensor.h"
+
 namespace ops {
 
 // Relu (forward)
 void relu(std::vector<int32_t> shape, float *res, float *data);
 
+// Relu (forward) on a native tensor. The result has the layout of the input.
+DenseTensor relu(const DenseTensor &data);
+
 // Relu grad
 // data, res, and seed should all be the same memory format.
 void relu_grad(std::vector<int32_t> shape, float *res, float *seed,
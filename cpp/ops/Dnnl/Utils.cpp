@@ -6,68 +6,17 @@
  */
 
 #include "Utils.h"
-#include <array>
 #include <iostream>
 #include <stdint.h>
 #include <vector>
 
 #include "dnnl.hpp"
-#include <omp.h>
 
 namespace ops {
 using dnnl::memory;
 
 dnnl::engine ENG(dnnl::engine::kind::cpu, 0);
-dnnl::stream S(ENG);
-
-namespace thread_detail {
-
-int get_value_for(std::string body, std::string value_desc) {
-  size_t line_start = body.find("\n" + value_desc) + 1;
-  size_t line_end = body.find("\n", line_start);
-  size_t value_start =
-      body.find_last_of(" ", line_end - 1, line_end - line_start + 1) + 1;
-  auto value = body.substr(value_start, line_end - value_start);
-  return std::stoi(value);
-}
-
-// https://stackoverflow.com/a/478960
-std::string exec(std::string cmd) {
-  std::array<char, 128> buffer;
-  std::string result;
-  std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd.c_str(), "r"),
-                                                pclose);
-  if (!pipe) {
-    throw std::runtime_error("popen() failed!");
-  }
-  while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-    result += buffer.data();
-  }
-  return result;
-}
-
-// Set the maximum OMP threads to the number of physical CPUs by default.
-int dummy_for_setting_num_threads = [] {
-  // Setting via `omp_set_num_threads` overrides the environment variable;
-  // if the environment variable is set, don't set via the function.
-  // Note that we must set via the function because setting the env var
-  // within the program appears to have no effect.
-  if (std::getenv("OMP_NUM_THREADS") != NULL)
-    return 0;
-
-  try {
-    auto output = exec("lscpu");
-    int num_cpus = get_value_for(output, "CPU(s):");
-    int threads_per_cpu = get_value_for(output, "Thread(s) per core:");
-    int num_physical_cpus = num_cpus / threads_per_cpu;
-    omp_set_num_threads(num_physical_cpus);
-  } catch (...) {
-  }
-
-  return 0;
-}();
-
-} // namespace thread_detail
+thread_local dnnl::stream S(ENG);
 
 void reorder(memory src, memory dst) {
   auto r_pd = dnnl::reorder::primitive_desc(src, dst);
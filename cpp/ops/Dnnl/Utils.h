@@ -14,8 +14,18 @@ namespace ops {
 // DNNL engine and stream
 // Extern because their value is set in the .cpp
 // https://stackoverflow.com/a/18113888
+//
+// The engine is shared, but each thread has its own stream, created the first
+// time the thread uses it, so that ops called from several JNI threads at once
+// don't share a stream. Primitives, which are shared through the primitive
+// cache, are safe to execute concurrently on different streams.
+//
+// A CPU stream runs primitives on the OpenMP team of the calling thread, so
+// with partitions (see Threading/Threading.h), the stream of a thread runs
+// its ops on the cores of the thread's partition. The CPU engine holds no
+// per-core state, so partitions share it.
 extern dnnl::engine ENG;
-extern dnnl::stream S;
+extern thread_local dnnl::stream S;
 
 // Returns the product of a numerical vector, or 1 if the vector is empty.
 template <typename T> T product(std::vector<T> ns) {
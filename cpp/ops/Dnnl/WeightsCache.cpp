@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "WeightsCache.h"
+
+#include <stdint.h>
+#include <string>
+
+#include "Utils.h"
+
+namespace ops {
+
+using namespace dnnl;
+
+// Weights reordered from a version of a tensor
+struct ReorderedWeights {
+  uint64_t version;
+  memory mem;
+};
+
+namespace {
+
+// The keys of the weights of a tensor start with its id, to erase them
+// together. Unlike the keys of primitives, they don't hold the number of
+// threads, as the reordered weights don't depend on it.
+std::string key_prefix(uint64_t id) {
+  return std::string("weights").append((const char *)&id, sizeof(id));
+}
+
+} // namespace
+
+WeightsCache &WeightsCache::instance() {
+  static WeightsCache cache;
+  return cache;
+}
+
+memory WeightsCache::get(const DenseTensor &weights, memory::desc md) {
+  if (weights.desc() == md)
+    return weights.mem();
+
+  auto key = key_prefix(weights.id()).append((const char *)&md.data,
+                                             sizeof(md.data));
+  auto value = entries_.get(key);
+  if (value) {
+    auto reordered = std::static_pointer_cast<ReorderedWeights>(value);
+    if (reordered->version == weights.version())
+      return reordered->mem;
+  }
+
+  auto mem = memory(md, ENG);
+  reorder(weights.mem(), mem);
+  entries_.put(key, std::make_shared<ReorderedWeights>(
+                        ReorderedWeights{weights.version(), mem}));
+  return mem;
+}
+
+void WeightsCache::erase(uint64_t id) { entries_.erase_prefix(key_prefix(id)); }
+
+} // namespace ops
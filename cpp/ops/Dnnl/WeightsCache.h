@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef OPS_WEIGHTSCACHE_H_
+#define OPS_WEIGHTSCACHE_H_
+
+#include "dnnl.hpp"
+
+#include "DenseTensor.h"
+#include "PrimitiveCache.h"
+
+namespace ops {
+
+// A process-wide cache of native weights reordered to the layouts the ops
+// want.
+//
+// A conv reorders its OHWI filters to the blocked layout it picks on every
+// call, although filters rarely change between calls, and never change for
+// inference. The cache keeps the reordered weights keyed by the identity of
+// the weights tensor and the target descriptor, and only reorders them again
+// when the version of the tensor changes. Entries are evicted in LRU order,
+// an entry for an old version is replaced by the new one, and the entries of
+// a tensor are erased when it is deleted.
+class WeightsCache {
+public:
+  static const size_t DEFAULT_CAPACITY = 256;
+
+  static WeightsCache &instance();
+
+  // Returns weights in the layout of md, reordering them if they aren't in
+  // that layout and aren't cached for their current version.
+  //
+  // Non-blocking; caller is responsible for calling S.wait() before accessing
+  // result data.
+  dnnl::memory get(const DenseTensor &weights, dnnl::memory::desc md);
+
+  // Removes the weights reordered from the tensor of id, so that a deleted
+  // tensor doesn't hold its reordered copies until they are evicted.
+  void erase(uint64_t id);
+
+  // The entries and counters are those of an LRU PrimitiveCache
+  PrimitiveCache &entries() { return entries_; }
+
+private:
+  WeightsCache() { entries_.set_capacity(DEFAULT_CAPACITY); }
+
+  PrimitiveCache entries_;
+};
+
+} // namespace ops
+
+#endif // OPS_WEIGHTSCACHE_H_
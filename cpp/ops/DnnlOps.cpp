@@ -6,21 +6,44 @@
  */
 
 #include "DnnlOps.h"
+#include "JniRegistry.h"
+#include "Threading/ThreadingJni.h"
 
 #include <assert.h>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "dnnl.hpp"
 
 #include "Dnnl/ArithmeticDnnl.h"
+#include "Dnnl/Async.h"
 #include "Dnnl/BatchNorm.h"
 #include "Dnnl/Conv.h"
+#include "Dnnl/DenseTensor.h"
 #include "Dnnl/LogSoftmax.h"
 #include "Dnnl/Pooling.h"
+#include "Dnnl/PrimitiveCache.h"
 #include "Dnnl/Reduce.h"
 #include "Dnnl/Relu.h"
+#include "Dnnl/WeightsCache.h"
 
-static const std::string OOM_ERROR_FQ_NAME = "java/lang/OutOfMemoryError";
+// The error classes, resolved once when the library is loaded
+static jni::ErrorClasses errors;
+
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
+  JNIEnv *env = jni::getEnv(vm);
+  if (env == NULL || !errors.load(env))
+    return JNI_ERR;
+  return jni::VERSION;
+}
+
+JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *vm, void *reserved) {
+  JNIEnv *env = jni::getEnv(vm);
+  if (env != NULL)
+    errors.unload(env);
+}
 
 // Check assumption that jint == int32_t and jfloat == float.
 static_assert(sizeof(jint) == sizeof(int32_t),
@@ -30,12 +53,12 @@ static_assert(sizeof(jfloat) == sizeof(float),
 
 // Throw a Java OutOfMemoryError
 void out_of_memory(JNIEnv *env) {
-  jclass oomErrorClass = env->FindClass(OOM_ERROR_FQ_NAME.c_str());
-  // We should not fail to find the OOM Error class, but if by chance we do,
-  // raise the error raised from that.
-  if (oomErrorClass == NULL)
-    return;
-  env->ThrowNew(oomErrorClass, "");
+  env->ThrowNew(errors.outOfMemoryError, "");
+}
+
+// Throw a Java Error with a message
+void java_error(JNIEnv *env, const char *msg) {
+  env->ThrowNew(errors.error, msg);
 }
 
 // Given an array of ints, return a vector of a copy of the ints.
@@ -72,6 +95,14 @@ std::vector<int32_t> get_shape(JNIEnv *env, jintArray dims_data) {
   return vdims;
 }
 
+// Given an array of floats, return a vector of a copy of the floats, for
+// the ops which may block and so can't run on pinned arrays.
+std::vector<float> get_floats(JNIEnv *env, jfloatArray floats_data) {
+  std::vector<float> vfloats(env->GetArrayLength(floats_data));
+  env->GetFloatArrayRegion(floats_data, 0, vfloats.size(), vfloats.data());
+  return vfloats;
+}
+
 // Releases C++ float arrays via ReleasePrimitiveArrayCritical.
 void release_arrays(JNIEnv *env, std::vector<float *> arrs,
                     std::vector<jfloatArray> jarrs) {
@@ -145,6 +176,7 @@ JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_add(
     JNIEnv *env, jobject obj, jintArray shape_data, jintArray lhs_strides,
     jintArray rhs_strides, jint lhs_offset, jint rhs_offset, jfloatArray res_buffer,
     jfloatArray lhs_buffer, jfloatArray rhs_buffer) {
+  ops::use_thread_config();
   binary_arithmetic_helper(env, shape_data, lhs_strides, rhs_strides, lhs_offset, rhs_offset, res_buffer,
                            lhs_buffer, rhs_buffer, ops::add);
 }
@@ -153,6 +185,7 @@ JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_sub(
     JNIEnv *env, jobject obj, jintArray shape_data, jintArray lhs_strides,
     jintArray rhs_strides, jint lhs_offset, jint rhs_offset, jfloatArray res_buffer,
     jfloatArray lhs_buffer, jfloatArray rhs_buffer) {
+  ops::use_thread_config();
   binary_arithmetic_helper(env, shape_data, lhs_strides, rhs_strides, lhs_offset, rhs_offset, res_buffer,
                            lhs_buffer, rhs_buffer, ops::sub);
 }
@@ -165,6 +198,7 @@ JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_avgPool(
     jintArray img_shape_data, jfloatArray img_data,
     /* pool dims */
     jint pool_height, jint pool_width) {
+  ops::use_thread_config();
   // Get shapes
   auto img_shape = get_ints(env, img_shape_data);
   auto res_shape = get_ints(env, res_shape_data);
@@ -195,6 +229,7 @@ Java_org_diffkt_external_Dnnl_avgPoolGrad(
     jintArray seed_shape_data, jfloatArray seed_data,
     /* pool dims */
     jint pool_height, jint pool_width) {
+  ops::use_thread_config();
   // Get shapes
   auto seed_shape = get_ints(env, seed_shape_data);
   auto res_shape = get_ints(env, res_shape_data);
@@ -221,6 +256,7 @@ Java_org_diffkt_external_Dnnl_batchNorm(
     JNIEnv *env, jobject obj, jintArray shape_data, jfloatArray result_data,
     jfloatArray mean_data, jfloatArray variance_data, jfloatArray input_data,
     jfloatArray scale_shift_data) {
+  ops::use_thread_config();
   auto input_shape = get_ints(env, shape_data);
   if (env->ExceptionOccurred())
     return;
@@ -244,6 +280,7 @@ Java_org_diffkt_external_Dnnl_batchNormGrad(
     jfloatArray scale_shift_grad_data, jfloatArray seed_data,
     jfloatArray input_data, jfloatArray scale_shift_data, jfloatArray mean_data,
     jfloatArray variance_data) {
+  ops::use_thread_config();
   auto input_shape = get_ints(env, shape_data);
   if (env->ExceptionOccurred())
     return;
@@ -276,6 +313,7 @@ JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_conv2d(
     /* padding */
     jint padding_left, jint padding_right, jint padding_top,
     jint padding_bottom) {
+  ops::use_thread_config();
 
   auto img_shape = get_shape(env, img_shape_data);
   auto fil_shape = get_shape(env, fil_shape_data);
@@ -310,6 +348,7 @@ Java_org_diffkt_external_Dnnl_conv2dGradImage(
     /* padding */
     jint padding_left, jint padding_right, jint padding_top,
     jint padding_bottom) {
+  ops::use_thread_config();
 
   auto seed_shape = get_shape(env, seed_shape_data);
   auto fil_shape = get_shape(env, fil_shape_data);
@@ -345,6 +384,7 @@ Java_org_diffkt_external_Dnnl_conv2dGradFilter(
     /* padding */
     jint padding_left, jint padding_right, jint padding_top,
     jint padding_bottom) {
+  ops::use_thread_config();
 
   // Get shapes
   auto seed_shape = get_shape(env, seed_shape_data);
@@ -373,6 +413,7 @@ JNIEXPORT void JNICALL
 Java_org_diffkt_external_Dnnl_linear(
     JNIEnv *env, jobject obj, jintArray shape_data, jintArray stride_data, jint offset,
     jfloatArray result, jfloatArray input, jfloat scale, jfloat shift) {
+  ops::use_thread_config();
   auto shape = get_ints(env, shape_data);
   auto strides = get_ints(env, stride_data);
   if (env->ExceptionOccurred())
@@ -392,6 +433,7 @@ JNIEXPORT void JNICALL
 Java_org_diffkt_external_Dnnl_logSoftmax(
     JNIEnv *env, jobject obj, jintArray shape_data, jfloatArray input,
     jfloatArray result, jint axis) {
+  ops::use_thread_config();
   auto shape = get_ints(env, shape_data);
   std::vector<jfloatArray> jarrays = {input, result};
   auto arrays = get_arrays(env, jarrays);
@@ -405,6 +447,7 @@ JNIEXPORT void JNICALL
 Java_org_diffkt_external_Dnnl_logSoftmaxGrad(
     JNIEnv *env, jobject obj, jintArray shape_data, jfloatArray grad,
     jfloatArray seed, jfloatArray fwd_result, jint axis) {
+  ops::use_thread_config();
   auto shape = get_ints(env, shape_data);
   std::vector<jfloatArray> jarrays = {grad, seed, fwd_result};
   auto arrays = get_arrays(env, jarrays);
@@ -425,6 +468,7 @@ JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_maxPool(
     jintArray img_shape_data, jfloatArray img_data,
     /* pool dims */
     jint pool_height, jint pool_width) {
+  ops::use_thread_config();
   // Get shapes
   auto img_shape = get_ints(env, img_shape_data);
   auto res_shape = get_ints(env, res_shape_data);
@@ -463,6 +507,7 @@ Java_org_diffkt_external_Dnnl_maxPoolGrad(
     jintArray seed_shape_data, jfloatArray seed_data,
     /* pool dims */
     jint pool_height, jint pool_width) {
+  ops::use_thread_config();
   // Get shapes
   auto seed_shape = get_ints(env, seed_shape_data);
   auto res_shape = get_ints(env, res_shape_data);
@@ -494,6 +539,7 @@ JNIEXPORT void JNICALL
 Java_org_diffkt_external_Dnnl_mulScalar(
     JNIEnv *env, jobject obj, jintArray shape_data, jfloatArray res_buffer,
     jfloatArray lhs_buffer, jfloat rhs) {
+  ops::use_thread_config();
   auto shape = get_ints(env, shape_data);
   if (env->ExceptionOccurred())
     return;
@@ -516,6 +562,7 @@ Java_org_diffkt_external_Dnnl_reduceSum(
     jfloatArray res_buffer,
     jintArray input_shape_data,
     jfloatArray input_buffer) {
+  ops::use_thread_config();
   auto res_shape = get_ints(env, res_shape_data);
   auto input_shape = get_ints(env, input_shape_data);
   if (env->ExceptionOccurred())
@@ -535,6 +582,7 @@ Java_org_diffkt_external_Dnnl_reduceSum(
 JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_relu(
     JNIEnv *env, jobject obj, jintArray shape_data, jfloatArray res,
     jfloatArray input) {
+  ops::use_thread_config();
   auto shape = get_ints(env, shape_data);
   if (env->ExceptionOccurred())
     return;
@@ -553,6 +601,7 @@ JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_relu(
 JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_reluGrad(
     JNIEnv *env, jobject obj, jintArray shape_data, jfloatArray res,
     jfloatArray seed, jfloatArray input) {
+  ops::use_thread_config();
   auto shape = get_ints(env, shape_data);
   if (env->ExceptionOccurred())
     return;
@@ -573,6 +622,7 @@ Java_org_diffkt_external_Dnnl_matmul(JNIEnv *env, jobject obj,
     jintArray lhs_shape_data, jintArray lhs_stride_data, jint lhs_offset,
     jintArray rhs_shape_data, jintArray rhs_stride_data, jint rhs_offset,
     jfloatArray res_buffer, jfloatArray lhs_buffer, jfloatArray rhs_buffer) {
+  ops::use_thread_config();
   auto lhs_shape = get_ints(env, lhs_shape_data);
   auto rhs_shape = get_ints(env, rhs_shape_data);
   auto lhs_strides = get_ints(env, lhs_stride_data);
@@ -589,3 +639,301 @@ Java_org_diffkt_external_Dnnl_matmul(JNIEnv *env, jobject obj,
 
   release_arrays(env, arrays, jarrays);
 }
+
+// Runs op, which computes a native tensor, and returns a new handle to the
+// result, or 0 with the error message in error if the op failed.
+//
+// This does not call JNI, so it can run while Java arrays are held.
+template <typename Op> jlong new_tensor(Op op, std::string &error) {
+  try {
+    return (jlong) new ops::DenseTensor(op());
+  } catch (const std::exception &e) {
+    error = e.what();
+  }
+  return 0;
+}
+
+// Same as new_tensor, but throws a Java Error if the op failed.
+template <typename Op> jlong tensor_call(JNIEnv *env, Op op) {
+  std::string error;
+  jlong res = new_tensor(op, error);
+  if (res == 0)
+    java_error(env, error.c_str());
+  return res;
+}
+
+// Returns the tensor held by a handle
+ops::DenseTensor &get_tensor(jlong handle) {
+  if (handle == 0)
+    throw std::runtime_error("The dense tensor handle is not valid");
+  return *(ops::DenseTensor *)handle;
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_Dnnl_putTensor(
+    JNIEnv *env, jobject obj, jintArray shape_data, jfloatArray data) {
+  ops::use_thread_config();
+  auto shape = get_ints(env, shape_data);
+  if (env->ExceptionOccurred())
+    return 0;
+
+  float *arr = (float *)env->GetPrimitiveArrayCritical(data, 0);
+  if (arr == nullptr) {
+    out_of_memory(env);
+    return 0;
+  }
+  std::string error;
+  jlong res = new_tensor(
+      [&] { return ops::DenseTensor::from_user(shape, arr); }, error);
+  env->ReleasePrimitiveArrayCritical(data, arr, JNI_ABORT);
+  if (res == 0)
+    java_error(env, error.c_str());
+  return res;
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_getTensor(
+    JNIEnv *env, jobject obj, jlong handle, jfloatArray res) {
+  ops::use_thread_config();
+  // Wait for the tensor before pinning the array, which must not block
+  try {
+    get_tensor(handle).wait();
+  } catch (const std::exception &e) {
+    return java_error(env, e.what());
+  }
+  float *arr = (float *)env->GetPrimitiveArrayCritical(res, 0);
+  if (arr == nullptr)
+    return out_of_memory(env);
+  std::string error;
+  try {
+    get_tensor(handle).read_ready(arr);
+  } catch (const std::exception &e) {
+    error = e.what();
+  }
+  env->ReleasePrimitiveArrayCritical(res, arr, 0);
+  if (!error.empty())
+    java_error(env, error.c_str());
+}
+
+JNIEXPORT jintArray JNICALL Java_org_diffkt_external_Dnnl_getTensorShape(
+    JNIEnv *env, jobject obj, jlong handle) {
+  if (handle == 0) {
+    java_error(env, "The dense tensor handle is not valid");
+    return NULL;
+  }
+  auto &shape = get_tensor(handle).shape();
+  jintArray res = env->NewIntArray(shape.size());
+  if (res == NULL)
+    return NULL;
+  env->SetIntArrayRegion(res, 0, shape.size(), shape.data());
+  return res;
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_deleteTensor(
+    JNIEnv *env, jobject obj, jlong handle) {
+  auto tensor = (ops::DenseTensor *)handle;
+  // Copies of the tensor share its id, they only reorder their weights again.
+  // The erase is queued after the ops already queued on the tensor, which
+  // would otherwise cache its weights again once it's erased.
+  if (tensor != nullptr) {
+    uint64_t id = tensor->id();
+    ops::run_op([id] { ops::WeightsCache::instance().erase(id); });
+  }
+  delete tensor;
+}
+
+JNIEXPORT jboolean JNICALL Java_org_diffkt_external_Dnnl_isTensorReady(
+    JNIEnv *env, jobject obj, jlong handle) {
+  try {
+    return get_tensor(handle).ready();
+  } catch (const std::exception &e) {
+    java_error(env, e.what());
+  }
+  return false;
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_setAsync(JNIEnv *env,
+                                                              jobject obj,
+                                                              jboolean async) {
+  try {
+    ops::set_async(async);
+  } catch (const std::exception &e) {
+    java_error(env, e.what());
+  }
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_sync(JNIEnv *env,
+                                                          jobject obj) {
+  try {
+    ops::sync();
+  } catch (const std::exception &e) {
+    java_error(env, e.what());
+  }
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_updateTensor(
+    JNIEnv *env, jobject obj, jlong handle, jfloatArray data) {
+  ops::use_thread_config();
+  // Wait for the queued ops, which may read the tensor, before pinning the
+  // array, which must not block
+  try {
+    ops::sync();
+  } catch (const std::exception &e) {
+    return java_error(env, e.what());
+  }
+  float *arr = (float *)env->GetPrimitiveArrayCritical(data, 0);
+  if (arr == nullptr)
+    return out_of_memory(env);
+  std::string error;
+  try {
+    get_tensor(handle).write_synced(arr);
+  } catch (const std::exception &e) {
+    error = e.what();
+  }
+  env->ReleasePrimitiveArrayCritical(data, arr, JNI_ABORT);
+  if (!error.empty())
+    java_error(env, error.c_str());
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_Dnnl_conv2dTensor(
+    JNIEnv *env, jobject obj, jlong img, jlong fil, jint hstride, jint wstride,
+    jint padding_left, jint padding_right, jint padding_top,
+    jint padding_bottom) {
+  ops::use_thread_config();
+  return tensor_call(env, [&] {
+    return ops::conv(get_tensor(img), get_tensor(fil), hstride, wstride,
+                     {padding_left, padding_right, padding_top,
+                      padding_bottom});
+  });
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_Dnnl_conv2dGradImageTensor(
+    JNIEnv *env, jobject obj, jlong seed, jlong fil, jintArray img_shape_data,
+    jint hstride, jint wstride, jint padding_left, jint padding_right,
+    jint padding_top, jint padding_bottom) {
+  ops::use_thread_config();
+  auto img_shape = get_shape(env, img_shape_data);
+  if (env->ExceptionOccurred())
+    return 0;
+
+  return tensor_call(env, [&] {
+    return ops::conv_grad_image(get_tensor(seed), get_tensor(fil), img_shape,
+                                hstride, wstride,
+                                {padding_left, padding_right, padding_top,
+                                 padding_bottom});
+  });
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_Dnnl_batchNormTensor(
+    JNIEnv *env, jobject obj, jlong input, jfloatArray mean_data,
+    jfloatArray variance_data, jfloatArray scale_shift_data) {
+  ops::use_thread_config();
+  // The op waits for the queued ops, so it runs on native copies of the
+  // arrays rather than pinning them, and the mean and variance are copied
+  // back once it completed.
+  auto mean = get_floats(env, mean_data);
+  auto variance = get_floats(env, variance_data);
+  auto scale_shift = get_floats(env, scale_shift_data);
+  if (env->ExceptionOccurred())
+    return 0;
+
+  std::string error;
+  jlong res = new_tensor(
+      [&] {
+        auto &tensor = get_tensor(input);
+        if (tensor.shape().size() != 4)
+          throw std::runtime_error("batch norm requires a rank 4 input");
+        size_t channels = tensor.shape()[3];
+        if (mean.size() != channels || variance.size() != channels ||
+            scale_shift.size() != 2 * channels)
+          throw std::runtime_error(
+              "The sizes of the mean, variance, scale and shift arrays "
+              "don't match the channels of the input");
+        return ops::batch_norm(tensor, mean.data(), variance.data(),
+                               scale_shift.data());
+      },
+      error);
+
+  if (res == 0) {
+    java_error(env, error.c_str());
+    return 0;
+  }
+  env->SetFloatArrayRegion(mean_data, 0, mean.size(), mean.data());
+  env->SetFloatArrayRegion(variance_data, 0, variance.size(), variance.data());
+  return res;
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_Dnnl_reluTensor(
+    JNIEnv *env, jobject obj, jlong input) {
+  ops::use_thread_config();
+  return tensor_call(env, [&] { return ops::relu(get_tensor(input)); });
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_Dnnl_avgPoolTensor(
+    JNIEnv *env, jobject obj, jlong img, jint pool_height, jint pool_width) {
+  ops::use_thread_config();
+  return tensor_call(env, [&] {
+    return ops::avg_pool(get_tensor(img), pool_height, pool_width);
+  });
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_Dnnl_maxPoolTensor(
+    JNIEnv *env, jobject obj, jlong img, jint pool_height, jint pool_width) {
+  ops::use_thread_config();
+  return tensor_call(env, [&] {
+    return ops::max_pool(get_tensor(img), pool_height, pool_width);
+  });
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_Dnnl_setPrimitiveCacheCapacity(
+    JNIEnv *env, jobject obj, jint capacity) {
+  ops::PrimitiveCache::instance().set_capacity(capacity);
+}
+
+// Returns the hits, misses, size and capacity of a cache
+jlongArray cache_stats(JNIEnv *env, const ops::PrimitiveCache &cache) {
+  jlong stats[] = {(jlong)cache.hits(), (jlong)cache.misses(),
+                   (jlong)cache.size(), (jlong)cache.capacity()};
+  jlongArray res = env->NewLongArray(4);
+  if (res == NULL)
+    return NULL;
+  env->SetLongArrayRegion(res, 0, 4, stats);
+  return res;
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_org_diffkt_external_Dnnl_getPrimitiveCacheStats(JNIEnv *env,
+                                                     jobject obj) {
+  return cache_stats(env, ops::PrimitiveCache::instance());
+}
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_clearPrimitiveCache(JNIEnv *env, jobject obj) {
+  ops::PrimitiveCache::instance().clear();
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_org_diffkt_external_Dnnl_getWeightsCacheStats(JNIEnv *env, jobject obj) {
+  return cache_stats(env, ops::WeightsCache::instance().entries());
+}
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_setThreadConfig(JNIEnv *env, jobject obj,
+    jint num_threads, jint pinning) {
+  ops::set_thread_config(num_threads, (ops::Pinning)pinning);
+}
+
+JNIEXPORT jintArray JNICALL
+Java_org_diffkt_external_Dnnl_getThreadInfo(JNIEnv *env, jobject obj) {
+  return ops::thread_info(env);
+}
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_setPartitions(JNIEnv *env, jobject obj,
+    jint num_partitions) {
+  ops::set_partitions(num_partitions);
+}
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_setThreadPartition(JNIEnv *env, jobject obj,
+    jint partition) {
+  ops::set_thread_partition(partition);
+}
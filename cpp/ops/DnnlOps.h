@@ -263,6 +263,155 @@ Java_org_diffkt_external_Dnnl_sub(JNIEnv *, jobject,
     /* right-hand side */
     jfloatArray);
 
+// Native tensors
+//
+// A native tensor is held by a handle to a tensor in native memory, in the
+// layout picked by the op that computed it. The ops taking native tensors
+// return new handles, and every handle must be deleted via deleteTensor.
+
+JNIEXPORT jlong JNICALL
+Java_org_diffkt_external_Dnnl_putTensor(JNIEnv *, jobject,
+    /* shape */
+    jintArray,
+    /* data */
+    jfloatArray);
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_getTensor(JNIEnv *, jobject,
+    /* tensor */
+    jlong,
+    /* result */
+    jfloatArray);
+
+JNIEXPORT jintArray JNICALL
+Java_org_diffkt_external_Dnnl_getTensorShape(JNIEnv *, jobject,
+    /* tensor */
+    jlong);
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_deleteTensor(JNIEnv *, jobject,
+    /* tensor */
+    jlong);
+
+// Whether the op computing a tensor has completed, see Dnnl/Async.h
+JNIEXPORT jboolean JNICALL
+Java_org_diffkt_external_Dnnl_isTensorReady(JNIEnv *, jobject,
+    /* tensor */
+    jlong);
+
+// Enables or disables async mode for the ops on native tensors
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_setAsync(JNIEnv *, jobject,
+    /* async */
+    jboolean);
+
+// Waits for all the queued ops on native tensors
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_sync(JNIEnv *, jobject);
+
+// Overwrites a tensor, such as weights updated by training, in place
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_updateTensor(JNIEnv *, jobject,
+    /* tensor */
+    jlong,
+    /* data */
+    jfloatArray);
+
+JNIEXPORT jlong JNICALL
+Java_org_diffkt_external_Dnnl_conv2dTensor(JNIEnv *, jobject,
+    /* image */
+    jlong,
+    /* filter */
+    jlong,
+    /* strides */
+    jint, jint,
+    /* padding */
+    jint, jint, jint, jint);
+
+JNIEXPORT jlong JNICALL
+Java_org_diffkt_external_Dnnl_conv2dGradImageTensor(JNIEnv *, jobject,
+    /* seed */
+    jlong,
+    /* filter */
+    jlong,
+    /* image shape */
+    jintArray,
+    /* strides */
+    jint, jint,
+    /* padding */
+    jint, jint, jint, jint);
+
+JNIEXPORT jlong JNICALL
+Java_org_diffkt_external_Dnnl_batchNormTensor(JNIEnv *, jobject,
+    /* input */
+    jlong,
+    /* mean result */
+    jfloatArray,
+    /* variance result */
+    jfloatArray,
+    /* scale and shift */
+    jfloatArray);
+
+JNIEXPORT jlong JNICALL
+Java_org_diffkt_external_Dnnl_reluTensor(JNIEnv *, jobject,
+    /* input */
+    jlong);
+
+JNIEXPORT jlong JNICALL
+Java_org_diffkt_external_Dnnl_avgPoolTensor(JNIEnv *, jobject,
+    /* image */
+    jlong,
+    /* pool dims */
+    jint, jint);
+
+JNIEXPORT jlong JNICALL
+Java_org_diffkt_external_Dnnl_maxPoolTensor(JNIEnv *, jobject,
+    /* image */
+    jlong,
+    /* pool dims */
+    jint, jint);
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_setPrimitiveCacheCapacity(JNIEnv *, jobject,
+    /* capacity */
+    jint);
+
+// Returns the hits, misses, size and capacity of the primitive cache
+JNIEXPORT jlongArray JNICALL
+Java_org_diffkt_external_Dnnl_getPrimitiveCacheStats(JNIEnv *, jobject);
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_clearPrimitiveCache(JNIEnv *, jobject);
+
+// Returns the hits, misses, size and capacity of the reordered weights cache
+JNIEXPORT jlongArray JNICALL
+Java_org_diffkt_external_Dnnl_getWeightsCacheStats(JNIEnv *, jobject);
+
+// Sets the number of threads, or the default when <= 0, and the pinning
+// policy of the library's ops, see Threading/Threading.h
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_setThreadConfig(JNIEnv *, jobject,
+    /* num_threads, pinning */
+    jint, jint);
+
+// Returns the logical CPUs, physical cores, sockets and quota CPUs, followed
+// by the number of threads, the pinning, the number of partitions and the
+// partition of the calling thread
+JNIEXPORT jintArray JNICALL
+Java_org_diffkt_external_Dnnl_getThreadInfo(JNIEnv *, jobject);
+
+// Splits the cores into partitions, see Threading/Threading.h
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_setPartitions(JNIEnv *, jobject,
+    /* num_partitions */
+    jint);
+
+// Routes the calling thread to a partition, or by its thread id when < 0
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_Dnnl_setThreadPartition(JNIEnv *, jobject,
+    /* partition */
+    jint);
+
 } // extern "C"
 
 #endif // DNNLOPS_H_
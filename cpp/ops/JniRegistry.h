@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef JNIREGISTRY_H_
+#define JNIREGISTRY_H_
+
+#include <jni.h>
+
+/**
+ * Helpers to resolve the Java classes, methods and fields used by a JNI
+ * library once, in its JNI_OnLoad, instead of on every call.
+ *
+ * Classes are held as global references, so they and their method and
+ * field IDs stay valid until the library is unloaded. Each JNI library
+ * keeps its own registry, as they are loaded independently. */
+namespace jni {
+
+  /** The JNI version required by the libraries */
+  const jint VERSION = JNI_VERSION_1_6;
+
+  /** Get the JNIEnv of the current thread from the VM, or NULL */
+  inline JNIEnv * getEnv(JavaVM * vm) {
+    void * env = NULL;
+    if (vm->GetEnv(&env, VERSION) != JNI_OK) return NULL;
+    return (JNIEnv *)env;
+  }
+
+  /** Find a class and return it as a global reference, or NULL with a
+   * pending Java exception if it is not found */
+  inline jclass globalClass(JNIEnv * env, const char * name) {
+    jclass local = env->FindClass(name);
+    if (local == NULL) return NULL;
+    jclass global = (jclass)env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return global;
+  }
+
+  /** Delete a global reference to a class and reset it */
+  inline void deleteGlobalClass(JNIEnv * env, jclass & clazz) {
+    if (clazz != NULL) env->DeleteGlobalRef(clazz);
+    clazz = NULL;
+  }
+
+  /** The error classes thrown by all the JNI libraries */
+  struct ErrorClasses {
+    jclass error = NULL;
+    jclass outOfMemoryError = NULL;
+
+    /** Resolve the classes, returning false if one is not found */
+    bool load(JNIEnv * env) {
+      error = globalClass(env, "java/lang/Error");
+      outOfMemoryError = globalClass(env, "java/lang/OutOfMemoryError");
+      return error != NULL && outOfMemoryError != NULL;
+    }
+
+    /** Release the classes */
+    void unload(JNIEnv * env) {
+      deleteGlobalClass(env, error);
+      deleteGlobalClass(env, outOfMemoryError);
+    }
+  };
+
+} // namespace jni
+
+#endif // JNIREGISTRY_H_
@@ -6,6 +6,7 @@
  */
 
 #include "math.h"
+#include "simd.h"
 #include "util.h"
 #include <iostream>
 #include <cmath>
@@ -35,23 +36,19 @@ void times(float *a, float *b, float *res, int size) {
 }
 
 void exp(float *a, float *res, int size) {
-  for (size_t i = 0; i < size; i++)
-    res[i] = std::exp(a[i]);
+  simd::kernels().exp(a, res, size);
 }
 
 void log(float *a, float *res, int size) {
-  for (size_t i = 0; i < size; i++)
-    res[i] = std::log(a[i]);
+  simd::kernels().log(a, res, size);
 }
 
 void lgamma(float *a, float *res, int size) {
-  for (size_t i = 0; i < size; i++)
-    res[i] = std::lgamma(a[i]);
+  simd::kernels().lgamma(a, res, size);
 }
 
 void digamma(float *a, float *res, int size) {
-  for (size_t i = 0; i < size; i++)
-    res[i] = util::digamma(a[i]);
+  simd::kernels().digamma(a, res, size);
 }
 
 void trigamma(float *a, float *res, int size) {
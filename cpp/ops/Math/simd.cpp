@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "simd.h"
+#include "simd_kernels.h"
+#include "util.h"
+#include <cmath>
+
+namespace math { namespace simd {
+
+namespace {
+
+void exp_scalar(const float *a, float *res, int size) {
+  for (int i = 0; i < size; i++)
+    res[i] = std::exp(a[i]);
+}
+
+void log_scalar(const float *a, float *res, int size) {
+  for (int i = 0; i < size; i++)
+    res[i] = std::log(a[i]);
+}
+
+void lgamma_scalar(const float *a, float *res, int size) {
+  for (int i = 0; i < size; i++)
+    res[i] = std::lgamma(a[i]);
+}
+
+void digamma_scalar(const float *a, float *res, int size) {
+  for (int i = 0; i < size; i++)
+    res[i] = util::digamma(a[i]);
+}
+
+const Kernels scalar_set = {"scalar", exp_scalar, log_scalar, lgamma_scalar,
+                            digamma_scalar};
+
+bool cpu_supports_avx2() {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+  return false;
+#endif
+}
+
+bool cpu_supports_avx512() {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f");
+#else
+  return false;
+#endif
+}
+
+} // namespace
+
+const Kernels *scalar_kernels() { return &scalar_set; }
+
+const Kernels *avx2_kernels() {
+  return cpu_supports_avx2() ? impl::avx2() : nullptr;
+}
+
+const Kernels *avx512_kernels() {
+  return cpu_supports_avx512() ? impl::avx512() : nullptr;
+}
+
+const Kernels &kernels() {
+  static const Kernels *picked = [] {
+    const Kernels *k = avx512_kernels();
+    if (k == nullptr) k = avx2_kernels();
+    return k != nullptr ? k : scalar_kernels();
+  }();
+  return *picked;
+}
+
+}} // namespace math::simd
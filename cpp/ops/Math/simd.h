@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef MATH_SIMD_H_
+#define MATH_SIMD_H_
+
+namespace math { namespace simd {
+
+// Vectorized float32 kernels of the elementwise math ops.
+//
+// The kernels are compiled for AVX2 (with FMA) and AVX-512F on x86-64, and
+// the best set supported by the CPU is picked at runtime. The scalar set,
+// the plain loops over the standard library, is used on other CPUs.
+//
+// Error bounds, in units in the last place of the float result, against the
+// exact result:
+//  - exp, log: 2 ULP (1.0 and 0.8 measured)
+//  - lgamma, digamma: 1 ULP (0.5 measured). They are computed in double
+//    precision, so this also holds close to their zeros, where the result is
+//    tiny.
+// Special values (infinities, NaNs, zeros, and negative inputs for lgamma
+// and digamma) give the same results as the scalar code.
+struct Kernels {
+  const char *name;
+  void (*exp)(const float *a, float *res, int size);
+  void (*log)(const float *a, float *res, int size);
+  void (*lgamma)(const float *a, float *res, int size);
+  void (*digamma)(const float *a, float *res, int size);
+};
+
+// The kernels picked for this CPU
+const Kernels &kernels();
+
+// The kernel sets, or null if the CPU or the compiler doesn't support them
+const Kernels *scalar_kernels();
+const Kernels *avx2_kernels();
+const Kernels *avx512_kernels();
+
+}} // namespace math::simd
+
+#endif // MATH_SIMD_H_
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Compiled with -mavx2 -mfma, only called on CPUs that support them
+
+#include "simd_kernels.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+
+namespace math { namespace simd { namespace impl {
+
+namespace {
+
+struct Avx2 {
+  typedef __m256 F;
+  typedef __m256 MF;
+  typedef __m256d D;
+  typedef __m256d MD;
+  static const int NF = 8;
+  static const int ND = 4;
+
+  static F load(const float *p) { return _mm256_loadu_ps(p); }
+  static void store(float *p, F a) { _mm256_storeu_ps(p, a); }
+  static F set1(float c) { return _mm256_set1_ps(c); }
+  static F add(F a, F b) { return _mm256_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+  static F div(F a, F b) { return _mm256_div_ps(a, b); }
+  static F fmadd(F a, F b, F c) { return _mm256_fmadd_ps(a, b, c); }
+  static MF lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static MF gt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+  static MF eq(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+  static MF unord(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_UNORD_Q); }
+  static F select(MF m, F a, F b) { return _mm256_blendv_ps(b, a, m); }
+  static MF mor(MF a, MF b) { return _mm256_or_ps(a, b); }
+  static bool any(MF m) { return _mm256_movemask_ps(m) != 0; }
+  static F round(F a) {
+    return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  }
+  static F getexp(F a) {
+    __m256i e = _mm256_srli_epi32(_mm256_castps_si256(a), 23);
+    return _mm256_cvtepi32_ps(_mm256_sub_epi32(e, _mm256_set1_epi32(127)));
+  }
+  static F getmant(F a) {
+    __m256i m = _mm256_and_si256(_mm256_castps_si256(a), _mm256_set1_epi32(0x007fffff));
+    return _mm256_castsi256_ps(_mm256_or_si256(m, _mm256_set1_epi32(0x3f800000)));
+  }
+  static F pow2(F n) {
+    __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+  }
+
+  static D set1(double c) { return _mm256_set1_pd(c); }
+  static D add(D a, D b) { return _mm256_add_pd(a, b); }
+  static D sub(D a, D b) { return _mm256_sub_pd(a, b); }
+  static D mul(D a, D b) { return _mm256_mul_pd(a, b); }
+  static D div(D a, D b) { return _mm256_div_pd(a, b); }
+  static D fmadd(D a, D b, D c) { return _mm256_fmadd_pd(a, b, c); }
+  static MD lt(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+  static MD gt(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+  static MD eq(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+  static MD unord(D a, D b) { return _mm256_cmp_pd(a, b, _CMP_UNORD_Q); }
+  static D select(MD m, D a, D b) { return _mm256_blendv_pd(b, a, m); }
+  static MD mor(MD a, MD b) { return _mm256_or_pd(a, b); }
+  static bool any(MD m) { return _mm256_movemask_pd(m) != 0; }
+  static int mask_bits(MD m) { return _mm256_movemask_pd(m); }
+  static D getexp(D a) {
+    // The biased exponent, converted exactly through the mantissa of 2^52
+    __m256i e = _mm256_srli_epi64(_mm256_castpd_si256(a), 52);
+    D big = _mm256_castsi256_pd(_mm256_or_si256(e, _mm256_set1_epi64x(0x4330000000000000)));
+    return _mm256_sub_pd(big, _mm256_set1_pd(4503599627370496. + 1023.));
+  }
+  static D getmant(D a) {
+    __m256i m = _mm256_and_si256(_mm256_castpd_si256(a),
+                                 _mm256_set1_epi64x(0x000fffffffffffff));
+    return _mm256_castsi256_pd(_mm256_or_si256(m, _mm256_set1_epi64x(0x3ff0000000000000)));
+  }
+  static D load_float(const float *p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+  static void store_float(float *p, D a) { _mm_storeu_ps(p, _mm256_cvtpd_ps(a)); }
+};
+
+constexpr Kernels avx2_set = kernel_set<Avx2>("avx2");
+
+} // namespace
+
+const Kernels *avx2() { return &avx2_set; }
+
+}}} // namespace math::simd::impl
+
+#else
+
+namespace math { namespace simd { namespace impl {
+
+const Kernels *avx2() { return nullptr; }
+
+}}} // namespace math::simd::impl
+
+#endif
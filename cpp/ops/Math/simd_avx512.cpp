@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Compiled with -mavx512f, only called on CPUs that support it
+
+#include "simd_kernels.h"
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+
+namespace math { namespace simd { namespace impl {
+
+namespace {
+
+struct Avx512 {
+  typedef __m512 F;
+  typedef __mmask16 MF;
+  typedef __m512d D;
+  typedef __mmask8 MD;
+  static const int NF = 16;
+  static const int ND = 8;
+
+  static F load(const float *p) { return _mm512_loadu_ps(p); }
+  static void store(float *p, F a) { _mm512_storeu_ps(p, a); }
+  static F set1(float c) { return _mm512_set1_ps(c); }
+  static F add(F a, F b) { return _mm512_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+  static F div(F a, F b) { return _mm512_div_ps(a, b); }
+  static F fmadd(F a, F b, F c) { return _mm512_fmadd_ps(a, b, c); }
+  static MF lt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+  static MF gt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+  static MF eq(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+  static MF unord(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_UNORD_Q); }
+  static F select(MF m, F a, F b) { return _mm512_mask_blend_ps(m, b, a); }
+  static MF mor(MF a, MF b) { return a | b; }
+  static bool any(MF m) { return m != 0; }
+  static F round(F a) {
+    return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  }
+  static F getexp(F a) { return _mm512_getexp_ps(a); }
+  static F getmant(F a) {
+    return _mm512_getmant_ps(a, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero);
+  }
+  static F pow2(F n) {
+    __m512i e = _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(e, 23));
+  }
+
+  static D set1(double c) { return _mm512_set1_pd(c); }
+  static D add(D a, D b) { return _mm512_add_pd(a, b); }
+  static D sub(D a, D b) { return _mm512_sub_pd(a, b); }
+  static D mul(D a, D b) { return _mm512_mul_pd(a, b); }
+  static D div(D a, D b) { return _mm512_div_pd(a, b); }
+  static D fmadd(D a, D b, D c) { return _mm512_fmadd_pd(a, b, c); }
+  static MD lt(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+  static MD gt(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+  static MD eq(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+  static MD unord(D a, D b) { return _mm512_cmp_pd_mask(a, b, _CMP_UNORD_Q); }
+  static D select(MD m, D a, D b) { return _mm512_mask_blend_pd(m, b, a); }
+  static MD mor(MD a, MD b) { return a | b; }
+  static bool any(MD m) { return m != 0; }
+  static int mask_bits(MD m) { return m; }
+  static D getexp(D a) { return _mm512_getexp_pd(a); }
+  static D getmant(D a) {
+    return _mm512_getmant_pd(a, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_zero);
+  }
+  static D load_float(const float *p) { return _mm512_cvtps_pd(_mm256_loadu_ps(p)); }
+  static void store_float(float *p, D a) { _mm256_storeu_ps(p, _mm512_cvtpd_ps(a)); }
+};
+
+constexpr Kernels avx512_set = kernel_set<Avx512>("avx512");
+
+} // namespace
+
+const Kernels *avx512() { return &avx512_set; }
+
+}}} // namespace math::simd::impl
+
+#else
+
+namespace math { namespace simd { namespace impl {
+
+const Kernels *avx512() { return nullptr; }
+
+}}} // namespace math::simd::impl
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef MATH_SIMD_KERNELS_H_
+#define MATH_SIMD_KERNELS_H_
+
+#include "simd.h"
+#include "util.h"
+#include <cmath>
+
+// The kernels of simd.h, written once over the vector operations of an
+// instruction set, V, and instantiated by the translation unit compiled for
+// it. V provides:
+//  - the float vectors F of NF lanes and their masks MF, and the double
+//    vectors D of ND lanes and their masks MD
+//  - load, store, set1, add, sub, mul, div, fmadd (a * b + c), lt, gt, eq,
+//    unord (true for NaNs), select (a where the mask is set, else b), mor,
+//    any, and round (to nearest), on both
+//  - getexp and getmant, the exponent and the mantissa in [1, 2) of a
+//    positive normal number, on both
+//  - pow2, 2^n for integral n in the normal range, on F
+//  - load_float and store_float, which convert ND floats to and from D, and
+//    mask_bits, the lanes set in an MD as bits
+
+namespace math { namespace simd { namespace impl {
+
+/** Cephes expf: exp(x) = 2^n exp(r), with n = round(x / log(2)) and r reduced
+ * with fmas against log(2) split in two. */
+template <class V>
+typename V::F exp(typename V::F x) {
+  typedef typename V::F F;
+  F n = V::round(V::mul(x, V::set1(1.44269504088896341f)));
+  F r = V::fmadd(n, V::set1(-0.693145751953125f), x);
+  r = V::fmadd(n, V::set1(-1.428606765330187045e-06f), r);
+  F y = V::set1(1.9875691500E-4f);
+  y = V::fmadd(y, r, V::set1(1.3981999507E-3f));
+  y = V::fmadd(y, r, V::set1(8.3334519073E-3f));
+  y = V::fmadd(y, r, V::set1(4.1665795894E-2f));
+  y = V::fmadd(y, r, V::set1(1.6666665459E-1f));
+  y = V::fmadd(y, r, V::set1(5.0000001201E-1f));
+  // 1 added last, to round the small terms once
+  y = V::add(V::fmadd(y, V::mul(r, r), r), V::set1(1.f));
+  // n is in [-150, 128] here, scale in two steps to stay in the normal range
+  // of 2^n and to round subnormal results once
+  F n1 = V::round(V::mul(n, V::set1(0.5f)));
+  y = V::mul(V::mul(y, V::pow2(n1)), V::pow2(V::sub(n, n1)));
+  y = V::select(V::gt(x, V::set1(88.7228394f)), V::set1(INFINITY), y);
+  y = V::select(V::lt(x, V::set1(-103.972084f)), V::set1(0.f), y);
+  return V::select(V::unord(x, x), x, y);
+}
+
+/** Cephes logf: log(x) = e log(2) + log(1 + f), with 1 + f in
+ * [sqrt(1/2), sqrt(2)) */
+template <class V>
+typename V::F log(typename V::F x) {
+  typedef typename V::F F;
+  typedef typename V::MF MF;
+  // Scale the subnormals into the normal range
+  MF subnormal = V::lt(x, V::set1(1.17549435e-38f));
+  F s = V::select(subnormal, V::mul(x, V::set1(8388608.f)), x);
+  F e = V::sub(V::getexp(s), V::select(subnormal, V::set1(23.f), V::set1(0.f)));
+  F m = V::getmant(s);
+  MF large = V::gt(m, V::set1(1.41421356f));
+  e = V::select(large, V::add(e, V::set1(1.f)), e);
+  F f = V::sub(V::select(large, V::mul(m, V::set1(0.5f)), m), V::set1(1.f));
+  F z = V::mul(f, f);
+  F y = V::set1(7.0376836292E-2f);
+  y = V::fmadd(y, f, V::set1(-1.1514610310E-1f));
+  y = V::fmadd(y, f, V::set1(1.1676998740E-1f));
+  y = V::fmadd(y, f, V::set1(-1.2420140846E-1f));
+  y = V::fmadd(y, f, V::set1(1.4249322787E-1f));
+  y = V::fmadd(y, f, V::set1(-1.6668057665E-1f));
+  y = V::fmadd(y, f, V::set1(2.0000714765E-1f));
+  y = V::fmadd(y, f, V::set1(-2.4999993993E-1f));
+  y = V::fmadd(y, f, V::set1(3.3333331174E-1f));
+  y = V::mul(V::mul(y, f), z);
+  y = V::fmadd(e, V::set1(-2.12194440e-4f), y);
+  y = V::fmadd(z, V::set1(-0.5f), y);
+  F r = V::fmadd(e, V::set1(0.693359375f), V::add(f, y));
+  r = V::select(V::lt(x, V::set1(0.f)), V::set1(NAN), r);
+  r = V::select(V::eq(x, V::set1(0.f)), V::set1(-INFINITY), r);
+  r = V::select(V::eq(x, V::set1(INFINITY)), x, r);
+  return V::select(V::unord(x, x), x, r);
+}
+
+/** fdlibm log, for positive normal x */
+template <class V>
+typename V::D log(typename V::D x) {
+  typedef typename V::D D;
+  D k = V::getexp(x);
+  D m = V::getmant(x);
+  auto large = V::gt(m, V::set1(1.4142135623730951));
+  k = V::select(large, V::add(k, V::set1(1.)), k);
+  D f = V::sub(V::select(large, V::mul(m, V::set1(0.5)), m), V::set1(1.));
+  D s = V::div(f, V::add(f, V::set1(2.)));
+  D z = V::mul(s, s);
+  D w = V::mul(z, z);
+  D t1 = V::fmadd(w, V::set1(1.531383769920937332e-01), V::set1(2.222219843214978396e-01));
+  t1 = V::mul(w, V::fmadd(w, t1, V::set1(3.999999999940941908e-01)));
+  D t2 = V::fmadd(w, V::set1(1.479819860511658591e-01), V::set1(1.818357216161805012e-01));
+  t2 = V::fmadd(w, t2, V::set1(2.857142874366239149e-01));
+  t2 = V::mul(z, V::fmadd(w, t2, V::set1(6.666666666666735130e-01)));
+  D R = V::add(t2, t1);
+  D hfsq = V::mul(V::set1(0.5), V::mul(f, f));
+  D lo = V::fmadd(s, V::add(hfsq, R), V::mul(k, V::set1(1.90821492927058770002e-10)));
+  return V::add(V::mul(k, V::set1(6.93147180369123816490e-01)),
+                V::sub(f, V::sub(hfsq, lo)));
+}
+
+/** lgamma(x) = lgamma(x + n) - log(x (x + 1) ... (x + n - 1)), with x + n >= 16
+ * for the Stirling series, for positive finite x */
+template <class V>
+typename V::D lgamma(typename V::D x) {
+  typedef typename V::D D;
+  typedef typename V::MD MD;
+  D z = x, p = V::set1(1.);
+  for (MD m = V::lt(z, V::set1(16.)); V::any(m); m = V::lt(z, V::set1(16.))) {
+    p = V::select(m, V::mul(p, z), p);
+    z = V::select(m, V::add(z, V::set1(1.)), z);
+  }
+  // The terms up to 1/z^11, the next is below 1e-16 for z >= 16
+  D w = V::div(V::set1(1.), z);
+  D w2 = V::mul(w, w);
+  D s = V::fmadd(w2, V::set1(-691. / 360360.), V::set1(1. / 1188.));
+  s = V::fmadd(w2, s, V::set1(-1. / 1680.));
+  s = V::fmadd(w2, s, V::set1(1. / 1260.));
+  s = V::fmadd(w2, s, V::set1(-1. / 360.));
+  s = V::fmadd(w2, s, V::set1(1. / 12.));
+  D r = V::fmadd(V::sub(z, V::set1(0.5)), log<V>(z), V::sub(V::mul(w, s), z));
+  r = V::add(r, V::set1(0.91893853320467274178)); // log(2 pi) / 2
+  return V::sub(r, log<V>(p));
+}
+
+/** digamma(x) = digamma(x + n) - 1/x - ... - 1/(x + n - 1), with x + n >= 10
+ * for the asymptotic series of util::digamma, for positive finite x */
+template <class V>
+typename V::D digamma(typename V::D x) {
+  typedef typename V::D D;
+  typedef typename V::MD MD;
+  // The sum of 1/x + ... as num / den, to divide once
+  D z = x, num = V::set1(0.), den = V::set1(1.);
+  for (MD m = V::lt(z, V::set1(10.)); V::any(m); m = V::lt(z, V::set1(10.))) {
+    num = V::select(m, V::fmadd(num, z, den), num);
+    den = V::select(m, V::mul(den, z), den);
+    z = V::select(m, V::add(z, V::set1(1.)), z);
+  }
+  D w = V::div(V::set1(1.), z);
+  D w2 = V::mul(w, w);
+  D y = V::fmadd(w2, V::set1(8.33333333333333333333E-2), V::set1(-2.10927960927960927961E-2));
+  y = V::fmadd(w2, y, V::set1(7.57575757575757575758E-3));
+  y = V::fmadd(w2, y, V::set1(-4.16666666666666666667E-3));
+  y = V::fmadd(w2, y, V::set1(3.96825396825396825397E-3));
+  y = V::fmadd(w2, y, V::set1(-8.33333333333333333333E-3));
+  y = V::fmadd(w2, y, V::set1(8.33333333333333333333E-2));
+  y = V::mul(w2, y);
+  D r = V::sub(log<V>(z), V::fmadd(V::set1(0.5), w, y));
+  return V::sub(r, V::div(num, den));
+}
+
+/** Apply a float kernel, with the tail padded to a full vector */
+template <class V, typename V::F (*f)(typename V::F)>
+void map(const float *a, float *res, int size) {
+  int i = 0;
+  for (; i + V::NF <= size; i += V::NF)
+    V::store(res + i, f(V::load(a + i)));
+  if (i < size) {
+    float buf[V::NF] = {0};
+    for (int j = i; j < size; j++) buf[j - i] = a[j];
+    V::store(buf, f(V::load(buf)));
+    for (int j = i; j < size; j++) res[j] = buf[j - i];
+  }
+}
+
+/** Apply a double kernel defined for positive finite inputs, leaving the
+ * others to the scalar fallback */
+template <class V, typename V::D (*f)(typename V::D), float (*fallback)(float)>
+void map_positive(const float *a, float *res, int size) {
+  typedef typename V::D D;
+  typedef typename V::MD MD;
+  float buf[V::ND];
+  for (int i = 0; i < size; i += V::ND) {
+    int n = size - i < V::ND ? size - i : V::ND;
+    const float *in = a + i;
+    if (n < V::ND) {
+      for (int j = 0; j < V::ND; j++) buf[j] = j < n ? a[i + j] : 1.f;
+      in = buf;
+    }
+    D x = V::load_float(in);
+    MD other = V::mor(V::unord(x, x), V::mor(V::lt(x, V::set1(0.)), V::eq(x, V::set1(0.))));
+    other = V::mor(other, V::eq(x, V::set1(HUGE_VAL)));
+    int bits = V::mask_bits(other);
+    if (!bits && n == V::ND) {
+      V::store_float(res + i, f(x));
+      continue;
+    }
+    // Keep the loops of the kernel finite
+    x = V::select(other, V::set1(1.), x);
+    V::store_float(buf, f(x));
+    for (int j = 0; j < n; j++)
+      res[i + j] = bits & (1 << j) ? fallback(a[i + j]) : buf[j];
+  }
+}
+
+inline float lgamma_scalar(float x) { return std::lgamma(x); }
+
+inline float digamma_scalar(float x) { return util::digamma(x); }
+
+/** Constant so that it is initialized without running code compiled for V */
+template <class V>
+constexpr Kernels kernel_set(const char *name) {
+  return Kernels{name,
+                 map<V, exp<V> >,
+                 map<V, log<V> >,
+                 map_positive<V, lgamma<V>, lgamma_scalar>,
+                 map_positive<V, digamma<V>, digamma_scalar>};
+}
+
+// The kernel sets of the instruction sets, or null if they are not compiled
+const Kernels *avx2();
+const Kernels *avx512();
+
+}}} // namespace math::simd::impl
+
+#endif // MATH_SIMD_KERNELS_H_
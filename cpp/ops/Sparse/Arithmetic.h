@@ -25,6 +25,40 @@ namespace ops {
   SpMat times(SpMatMap & left, SpMatMap & right);
   SpMat sub(SpMatMap & left, SpMatMap & right);
   SpMat matmul(SpMatMap & left, SpMatMap & right);
+  /**
+   * Sparse matrix multiplication with a dense result: res = left * right.
+   *
+   * res is a dense row-major matrix with left.rows() rows and right.cols()
+   * columns; it is fully overwritten. The products are accumulated into
+   * res directly, so there is no symbolic phase. */
+  void matmulToDense(SpMatMap & left, SpMatMap & right, DataType * res);
+  /** Whether the result of left * right is estimated to be dense enough,
+   * that matmulToDense is preferred over matmul.
+   *
+   * When it's not and fallback is given, the product is computed into
+   * fallback by matmul, which reuses the analysis of the operands done for
+   * the estimate where the backend allows it. */
+  bool denseMatmulPreferred(SpMatMap & left, SpMatMap & right, SpMat * fallback = NULL);
+  /**
+   * Sparse-times-dense matrix multiplication (SpMM): res = left * right.
+   *
+   * right is a dense row-major matrix with left.cols() rows and rightCols
+   * columns. res is a dense row-major matrix with left.rows() rows and
+   * rightCols columns; it is fully overwritten. */
+  void spmm(SpMatMap & left, const DataType * right, DimensionType rightCols, DataType * res);
+  /**
+   * Sampled dense-dense matrix multiplication (SDDMM): the product of left
+   * and the transpose of right, computed only at the non-zeros of pattern.
+   *
+   * left is a dense row-major matrix with pattern.rows() rows and inner
+   * columns, right is a dense row-major matrix with pattern.cols() rows
+   * and inner columns. The result has the same structure as pattern, and
+   * its value at (i, j) is the dot product of row i of left and row j of
+   * right. The values of pattern are not used.
+   *
+   * It is used for the gradient of a sparse matmul w.r.t. its sparse
+   * operand, which is only needed at the operand's non-zeros. */
+  SpMat sddmm(SpMatMap & pattern, const DataType * left, const DataType * right, DimensionType inner);
   SpMat cooTocsr(COO & coo);
   SpMat transpose(SpMatMap & tensor);
 } // namespace ops
@@ -28,6 +28,13 @@ namespace ops {
     return left * right;
   }
 
+  void spmm(SpMatMap & left, const DataType * right, DimensionType rightCols, DataType * res) {
+    typedef Eigen::Matrix<DataType, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> DenseMat;
+    Eigen::Map<const DenseMat> r(right, left.cols(), rightCols);
+    Eigen::Map<DenseMat> out(res, left.rows(), rightCols);
+    out.noalias() = left * r;
+  }
+
   /** Inverse is achieved by solving: A*A_inv = I, where A is the input matrix,
    * I is an identity matrix.
    *
@@ -31,7 +31,7 @@ namespace ops {
   /** NOTE: MKL doesn't support sparse times operation, thus we use our own parallel
    * version */
   SpMat times(SpMatMap & left, SpMatMap & right) {
-    return rowIntersection(left, right, times);
+    return rowIntersection<times>(left, right);
   }
 
   SpMat sub(SpMatMap & left, SpMatMap & right) {
@@ -57,6 +57,48 @@ namespace ops {
     return SpMat(res);
   }
 
+  void matmulToDense(SpMatMap & left, SpMatMap & right, DataType * res) {
+    // NOTE: MKL fails when the sparse matrix is empty
+    if (left.nonZeros() == 0 || right.nonZeros() == 0) {
+      #pragma omp parallel for
+      for (size_t i=0; i<(size_t)left.rows() * right.cols(); ++i) res[i] = 0;
+      return;
+    }
+    sparse_status_t status;
+    if (std::is_same<DataType, float>::value)
+      status = mkl_sparse_s_spmmd(SPARSE_OPERATION_NON_TRANSPOSE, left.get(), right.get(),
+          SPARSE_LAYOUT_ROW_MAJOR, (float *)res, right.cols());
+    else {
+      Require((std::is_same<DataType, double>::value), "matmulToDense operation only supports the data type to be float or double");
+      status = mkl_sparse_d_spmmd(SPARSE_OPERATION_NON_TRANSPOSE, left.get(), right.get(),
+          SPARSE_LAYOUT_ROW_MAJOR, (double *)res, right.cols());
+    }
+    Require(status == SPARSE_STATUS_SUCCESS, "Failed to compute sparse matmul with a dense result");
+  }
+
+  void spmm(SpMatMap & left, const DataType * right, DimensionType rightCols, DataType * res) {
+    // NOTE: MKL fails when the sparse matrix is empty
+    if (left.nonZeros() == 0 || rightCols == 0) {
+      #pragma omp parallel for
+      for (size_t i=0; i<(size_t)left.rows() * rightCols; ++i) res[i] = 0;
+      return;
+    }
+    struct matrix_descr descr;
+    descr.type = SPARSE_MATRIX_TYPE_GENERAL;
+    sparse_status_t status;
+    // _s_ and _d_ in the function name means the values type are
+    // single and double precision float respectively
+    if (std::is_same<DataType, float>::value)
+      status = mkl_sparse_s_mm(SPARSE_OPERATION_NON_TRANSPOSE, 1, left.get(), descr,
+          SPARSE_LAYOUT_ROW_MAJOR, (const float *)right, rightCols, rightCols, 0, (float *)res, rightCols);
+    else {
+      Require((std::is_same<DataType, double>::value), "spmm operation only supports the data type to be float or double");
+      status = mkl_sparse_d_mm(SPARSE_OPERATION_NON_TRANSPOSE, 1, left.get(), descr,
+          SPARSE_LAYOUT_ROW_MAJOR, (const double *)right, rightCols, rightCols, 0, (double *)res, rightCols);
+    }
+    Require(status == SPARSE_STATUS_SUCCESS, "Failed to compute sparse-dense matmul");
+  }
+
   SpMat cooTocsr(COO & coo) {
     if (coo.nonZeros() == 0) {
       return SpMat(coo.rows(), coo.cols());
@@ -10,22 +10,28 @@
 #include "Arithmetic.h"
 #include "ArithmeticUtils.h"
 #include "DebugUtils.h"
+#include "MatmulPlan.h"
 
 #include <omp.h>
+#include <algorithm>
 #include <limits>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
 
 namespace ops {
 
   SpMat add(SpMatMap & left, SpMatMap & right) {
-    return rowUnion(left, right, add);
+    return rowUnion<add>(left, right);
   }
 
   SpMat times(SpMatMap & left, SpMatMap & right) {
-    return rowIntersection(left, right, times);
+    return rowIntersection<times>(left, right);
   }
 
   SpMat sub(SpMatMap & left, SpMatMap & right) {
-    return rowUnion(left, right, sub);
+    return rowUnion<sub>(left, right);
   }
 
   template<typename T>
@@ -144,6 +150,9 @@ namespace ops {
    *   value is maxIns.
    *   totalIns: similar with maxIns. Instead of finding the maximum, the
    *   sum is computed.
+   *   rowIns: similar with maxIns, but it keeps the number of
+   *   multiplications for each row, which is used to balance the rows
+   *   among threads.
    *   maxInsCompressed: similar with maxIns, but it's on the compressed
    *   right matrix.
    *   totalInsCompressed: similar with totalIns, but it's on the
@@ -152,6 +161,7 @@ namespace ops {
       bool & sortedRight, Array<OrdinalType> & compressedOuter,
       Array<DimensionType> & vMin, Array<DimensionType> & vRange,
       OrdinalType & maxInsRange, OrdinalType & maxIns, OrdinalType & totalIns,
+      Array<OrdinalType> & rowIns,
       OrdinalType & maxInsCompressed, OrdinalType & totalInsCompressed) {
     // Compute sortedRight
     // Compute the min and max column indices for each row on the right
@@ -184,10 +194,11 @@ namespace ops {
     if (sortedRight)
       compute_compressed(right, compressedOuter);
 
-    // compute vMin, vRange, maxInsRange, maxIns, totalIns,
+    // compute vMin, vRange, maxInsRange, maxIns, totalIns, rowIns,
     // maxInsCompressed, totalInsCompressed
     vMin.resize(left.rows());
     vRange.resize(left.rows());
+    rowIns.resize(left.rows());
     maxInsRange = 0;
     maxIns = 0;
     totalIns = 0;
@@ -209,6 +220,7 @@ namespace ops {
       }
       vMin[i] = (max >= min) ? min : 0;
       vRange[i] = (max >= min) ? max - min + 1 : 0;
+      rowIns[i] = ins;
       maxInsRange = (vRange[i] > maxInsRange) ? vRange[i] : maxInsRange;
       maxIns = (ins > maxIns) ? ins: maxIns;
       totalIns += ins;
@@ -219,6 +231,22 @@ namespace ops {
     }
   }
 
+  /** The results of matmul_analysis on left and right, so that the analysis
+   * done to estimate the result, see denseMatmulPreferred, is reused by the
+   * multiplication */
+  struct MatmulStats {
+    bool sortedRight;
+    Array<DimensionType> compressedOuter;
+    Array<DimensionType> vMin, vRange;
+    Array<OrdinalType> rowIns;
+    OrdinalType maxInsRange, maxIns, totalIns, maxInsCompressed, totalInsCompressed;
+
+    MatmulStats(const SpMatMap & left, const SpMatMap & right) {
+      matmul_analysis(left, right, sortedRight, compressedOuter,
+          vMin, vRange, maxInsRange, maxIns, totalIns, rowIns, maxInsCompressed, totalInsCompressed);
+    }
+  };
+
   /** This function generates the chunk size for a task to be dynamically scheduled among threads */
   OrdinalType get_chunk_size(OrdinalType numOfTasks, OrdinalType tasksPerThread) {
     OrdinalType chunk_size;
@@ -229,6 +257,37 @@ namespace ops {
     return (chunk_size == 0) ? 1 : chunk_size;
   }
 
+  /**
+   * The accumulators pruning out zero values directly may find less
+   * non-zeros in the numeric phase than the symbolic phase has reserved,
+   * in which case the size information from symbolic and numeric are
+   * inconsistent. This function compresses inner and values afterwards,
+   * keeping rowSizes[i+1] non-zeros for row i, and updates outer. */
+  void compact_rows(Array<OrdinalType> & outer, Array<DimensionType> & inner, Array<DataType> & values,
+      Array<DimensionType> & rowSizes, const OrdinalType nonzeros, const Array<DimensionType> & blocks) {
+    Require(nonzeros <= outer.back(), "nonzeros computed from numeric phase should be smaller or equal to the one computed from symbolic.");
+    if (nonzeros == outer.back()) return;
+    // compress the data if the total number of nonzero is inconsistent
+    // between symbolic and numeric.
+    rowSizes[0] = 0;
+    prefixsum(rowSizes.data(), rowSizes.size());
+    Require(rowSizes.back() == nonzeros, "The last element in rowSizes should be the same as the number of non-zeros");
+    Array<DimensionType> innerPruned(nonzeros);
+    Array<DataType> valuesPruned(nonzeros);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t b=1; b<blocks.size(); ++b)
+    for (DimensionType i=blocks[b-1]; i<blocks[b]; ++i) {
+      OrdinalType k = outer[i];
+      for (OrdinalType j=rowSizes[i]; j<rowSizes[i+1]; ++j, ++k) {
+        innerPruned[j] = inner[k];
+        valuesPruned[j] = values[k];
+      }
+    }
+    outer = std::move(rowSizes);
+    inner = std::move(innerPruned);
+    values = std::move(valuesPruned);
+  }
+
   /**
    * The accumulation implementation optimized for dense insertions.
    * That is, a large number of insertions happen in a small range of
@@ -241,7 +300,7 @@ namespace ops {
   void accumulate_denseInsertion(const SpMatMap & left, const SpMatMap & right,
       Array<OrdinalType> & outer, Array<DimensionType> & inner, Array<DataType> & values,
       const Array<DimensionType> & vMin, const Array<DimensionType> & vRange, const OrdinalType maxInsRange,
-      const OrdinalType chunk_size, const bool symbolic) {
+      const Array<DimensionType> & blocks, const bool symbolic) {
     Array<DimensionType> rowSizes;
     if (symbolic) {
       outer.resize(left.rows() + 1);
@@ -261,8 +320,9 @@ namespace ops {
       // use vector instead of Array for table to avoid adding parallelism
       // inside of parallel region. Array also doesn't support `bool`
       std::vector<T> table(maxInsRange, initialvalue);
-      #pragma omp for schedule(dynamic, chunk_size) reduction(+:nonzeros)
-      for (DimensionType i=0; i<left.rows(); ++i) {
+      #pragma omp for schedule(dynamic, 1) reduction(+:nonzeros)
+      for (size_t b=1; b<blocks.size(); ++b)
+      for (DimensionType i=blocks[b-1]; i<blocks[b]; ++i) {
         DimensionType rowMin = vMin[i];
         for (OrdinalType j=left.rowStartPtr()[i]; j<left.rowEndPtr()[i]; ++j) {
           DimensionType rowRight = left.innerIndexPtr()[j];
@@ -292,32 +352,190 @@ namespace ops {
     }
     if (symbolic)
       prefixsum(outer.data(), outer.size());
-    else {
-      Require(nonzeros <= outer.back(), "nonzeros computed from numeric phase should be smaller or equal to the one computed from symbolic.");
-      // Since this approach prunes out zero values directly, then it is
-      // possible that the size information from symbolic and numeric are
-      // inconsistent. Therefore, in that case, we need to further
-      // compress the memory afterwards.
-      if (nonzeros < outer.back()) {
-        // compress the data if the total number of nonzero is inconsistent
-        // between symbolic and numeric.
-        prefixsum(rowSizes.data(), rowSizes.size());
-        Require(rowSizes.back() == nonzeros, "The last element in rowSizes should be the same as the number of non-zeros");
-        Array<DimensionType> innerPruned(nonzeros);
-        Array<DataType> valuesPruned(nonzeros);
-        #pragma omp parallel for schedule(dynamic, chunk_size)
-        for (DimensionType i=0; i<left.rows(); ++i) {
-          OrdinalType k = outer[i];
-          for (OrdinalType j=rowSizes[i]; j<rowSizes[i+1]; ++j, ++k) {
-            innerPruned[j] = inner[k];
-            valuesPruned[j] = values[k];
+    else
+      compact_rows(outer, inner, values, rowSizes, nonzeros, blocks);
+  }
+
+  /** The L2 cache size in bytes used when it can't be detected */
+  static const size_t DEFAULT_L2_CACHE_SIZE = 1 << 20;
+
+  /** This function returns the size in bytes of the L2 cache, which is
+   * detected once */
+  size_t l2_cache_size() {
+    static const size_t size = []() {
+      long s = -1;
+      #if defined(_SC_LEVEL2_CACHE_SIZE)
+      s = sysconf(_SC_LEVEL2_CACHE_SIZE);
+      #elif defined(__APPLE__)
+      size_t v = 0, len = sizeof(v);
+      if (sysctlbyname("hw.l2cachesize", &v, &len, NULL, 0) == 0) s = v;
+      #endif
+      return (s > 0) ? (size_t)s : DEFAULT_L2_CACHE_SIZE;
+    }();
+    return size;
+  }
+
+  /**
+   * The right matrix with the non-zeros of each row grouped by the column
+   * panels of `width` columns, in the order of the panels. The non-zeros of
+   * row r are in [outer[r], outer[r+1]) of inner and values. */
+  struct ColumnPanels {
+    DimensionType panels, width;
+    Array<OrdinalType> outer;
+    Array<DimensionType> inner;
+    Array<DataType> values;
+  };
+
+  /** This function groups the non-zeros of each row of m by the panels of
+   * width columns. Rows already grouped, such as sorted ones, are copied. */
+  void partition_columns(const SpMatMap & m, const DimensionType width, ColumnPanels & res) {
+    typedef std::pair<DimensionType, DataType> Entry;
+    res.width = width;
+    res.panels = (m.cols() + width - 1) / width;
+    res.outer.resize(m.rows() + 1);
+    res.outer[0] = 0;
+    #pragma omp parallel for
+    for (DimensionType r=0; r<m.rows(); ++r)
+      res.outer[r+1] = m.rowEndPtr()[r] - m.rowStartPtr()[r];
+    prefixsum(res.outer.data(), res.outer.size());
+    res.inner.resize(res.outer.back());
+    res.values.resize(res.outer.back());
+    #pragma omp parallel
+    {
+      std::vector<Entry> entries;
+      #pragma omp for schedule(dynamic, 64)
+      for (DimensionType r=0; r<m.rows(); ++r) {
+        const DimensionType * cols = m.innerIndexPtr() + m.rowStartPtr()[r];
+        const DataType * vals = m.valuePtr() + m.rowStartPtr()[r];
+        const OrdinalType size = res.outer[r+1] - res.outer[r];
+        DimensionType * inner = res.inner.data() + res.outer[r];
+        DataType * values = res.values.data() + res.outer[r];
+        OrdinalType k = 1;
+        while (k < size && cols[k-1] / width <= cols[k] / width) ++k;
+        if (k >= size) {
+          std::copy(cols, cols + size, inner);
+          std::copy(vals, vals + size, values);
+          continue;
+        }
+        entries.clear();
+        for (k=0; k<size; ++k) entries.emplace_back(cols[k], vals[k]);
+        std::stable_sort(entries.begin(), entries.end(),
+            [width](const Entry & x, const Entry & y) { return x.first / width < y.first / width; });
+        for (k=0; k<size; ++k) {
+          inner[k] = entries[k].first;
+          values[k] = entries[k].second;
+        }
+      }
+    }
+  }
+
+  /**
+   * The accumulation implementation for dense insertions, with the columns
+   * tiled into panels.
+   * When the range of a row is wider than the cache, every insertion into
+   * the table of accumulate_denseInsertion misses the cache. Here a row is
+   * accumulated panel by panel instead, with a table of the panel width
+   * which stays in the cache.
+   * Each non-zero of the left row keeps a cursor into its right row, and is
+   * queued on the panel of the next column of the cursor. A panel then only
+   * visits the non-zeros queued on it, so the left row isn't rescanned for
+   * each panel.
+   * Similar with accumulate_denseInsertion, the rows are sorted, and zero
+   * results are pruned out. */
+  template<typename T>
+  void accumulate_tiled(const SpMatMap & left, const ColumnPanels & right,
+      Array<OrdinalType> & outer, Array<DimensionType> & inner, Array<DataType> & values,
+      const Array<DimensionType> & vMin, const Array<DimensionType> & vRange,
+      const Array<DimensionType> & blocks, const bool symbolic) {
+    Array<DimensionType> rowSizes;
+    if (symbolic) {
+      outer.resize(left.rows() + 1);
+      outer[0] = 0;
+    } else {
+      inner.resize(outer.back());
+      values.resize(outer.back());
+      rowSizes.resize(left.rows()+1);
+    }
+    const DimensionType width = right.width;
+    const OrdinalType * rightOuter = right.outer.data();
+    const DimensionType * rightInner = right.inner.data();
+    const DataType * rightValues = right.values.data();
+    OrdinalType nonzeros = 0;
+    T initialvalue = 0;
+    #pragma omp parallel
+    {
+      std::vector<T> table(width, initialvalue);
+      // the first non-zero queued on each panel, and for the non-zeros of
+      // the left row, the next one queued on the same panel and the cursor
+      std::vector<OrdinalType> head(right.panels, -1);
+      std::vector<OrdinalType> next, cursor;
+      #pragma omp for schedule(dynamic, 1) reduction(+:nonzeros)
+      for (size_t b=1; b<blocks.size(); ++b)
+      for (DimensionType i=blocks[b-1]; i<blocks[b]; ++i) {
+        DimensionType count = 0;
+        DimensionType rowMin = vMin[i];
+        DimensionType rowMax = vMin[i] + vRange[i];
+        const OrdinalType leftStart = left.rowStartPtr()[i];
+        const OrdinalType leftSize = left.rowEndPtr()[i] - leftStart;
+        next.resize(leftSize);
+        cursor.resize(leftSize);
+        for (OrdinalType j=0; j<leftSize; ++j) {
+          DimensionType rowRight = left.innerIndexPtr()[leftStart + j];
+          cursor[j] = rightOuter[rowRight];
+          if (cursor[j] < rightOuter[rowRight+1]) {
+            DimensionType p = rightInner[cursor[j]] / width;
+            next[j] = head[p];
+            head[p] = j;
+          }
+        }
+        for (DimensionType p=rowMin/width; vRange[i]>0 && p<=(rowMax-1)/width; ++p) {
+          DimensionType panelMin = p * width;
+          OrdinalType j = head[p];
+          head[p] = -1;
+          while (j >= 0) {
+            OrdinalType queued = next[j];
+            DimensionType rowRight = left.innerIndexPtr()[leftStart + j];
+            DataType v = left.valuePtr()[leftStart + j];
+            OrdinalType k = cursor[j];
+            const OrdinalType end = rightOuter[rowRight+1];
+            for (; k<end && rightInner[k] < panelMin + width; ++k) {
+              DimensionType c = rightInner[k] - panelMin;
+              table[c] = symbolic ? 1 : (T)((DataType)table[c] + v * rightValues[k]);
+            }
+            // queue it on a later panel, as the right row is grouped by panels
+            if (k < end) {
+              cursor[j] = k;
+              DimensionType q = rightInner[k] / width;
+              next[j] = head[q];
+              head[q] = j;
+            }
+            j = queued;
+          }
+          DimensionType s = std::max(rowMin, panelMin) - panelMin;
+          DimensionType e = std::min(rowMax, panelMin + width) - panelMin;
+          for (DimensionType c=s; c<e; ++c) {
+            if (table[c] != initialvalue) {
+              if (!symbolic) {
+                inner[count+outer[i]] = c + panelMin;
+                values[count+outer[i]] = table[c];
+              }
+              ++count;
+              table[c] = initialvalue;
+            }
           }
         }
-        outer = std::move(rowSizes);
-        inner = std::move(innerPruned);
-        values = std::move(valuesPruned);
+        if (symbolic)
+          outer[i+1] = count;
+        else {
+          rowSizes[i+1] = count;
+          nonzeros += count;
+        }
       }
     }
+    if (symbolic)
+      prefixsum(outer.data(), outer.size());
+    else
+      compact_rows(outer, inner, values, rowSizes, nonzeros, blocks);
   }
 
   /** This function counts the number of 1s in the binary form of x */
@@ -340,7 +558,7 @@ namespace ops {
       Array<OrdinalType> & compressedOuter,
       Array<OrdinalType> & outer,
       const Array<DimensionType> & vMin, const Array<DimensionType> & vRange, const OrdinalType maxInsRange,
-      const OrdinalType maxInsCompressed, const OrdinalType chunk_size,
+      const OrdinalType maxInsCompressed, const Array<DimensionType> & blocks,
       bool denseInsertion) {
     outer.resize(left.rows() + 1);
     outer[0] = 0;
@@ -357,8 +575,9 @@ namespace ops {
       Array<DimensionType> colIndices;
       if (!denseInsertion)
         colIndices.resize(std::min(maxInsCompressed, tableSize));
-      #pragma omp for schedule(dynamic, chunk_size)
-      for (DimensionType i=0; i<left.rows(); ++i) {
+      #pragma omp for schedule(dynamic, 1)
+      for (size_t b=1; b<blocks.size(); ++b)
+      for (DimensionType i=blocks[b-1]; i<blocks[b]; ++i) {
         DimensionType rowMin = vMin[i] >> 5;
         DimensionType countIns = 0;
         for (OrdinalType j=left.rowStartPtr()[i]; j<left.rowEndPtr()[i]; ++j) {
@@ -395,20 +614,18 @@ namespace ops {
   /**
    * The accumulator for matrix multiplication for general matrix cases.
    * If symbolic is true, this computes outer;
-   * Otherwise, it assumes outer is computed and computes inner and
-   * values.
+   * Otherwise, it assumes outer is computed and fills inner and values,
+   * which hold outer.back() elements. inner may be null when the column
+   * indices are known already, such as for a MatmulPlan.
    * Note that this approach will not prune out zero results directly. */
   template<typename T>
   void accumulate(const SpMatMap & left, const SpMatMap & right,
-      Array<OrdinalType> & outer, Array<DimensionType> & inner, Array<DataType> & values,
+      Array<OrdinalType> & outer, DimensionType * inner, DataType * values,
       const Array<DimensionType> & vMin, const OrdinalType maxInsRange, const OrdinalType maxIns,
-      const OrdinalType chunk_size, const bool symbolic) {
+      const Array<DimensionType> & blocks, const bool symbolic) {
     if (symbolic) {
       outer.resize(left.rows() + 1);
       outer[0] = 0;
-    } else {
-      inner.resize(outer.back());
-      values.resize(outer.back());
     }
     T initial_value = symbolic ? 0 : std::numeric_limits<T>::max();
     #pragma omp parallel
@@ -419,8 +636,9 @@ namespace ops {
       // appeared.
       std::vector<T> table(maxInsRange, initial_value);
       Array<DimensionType> colIndices(std::min(maxIns, maxInsRange));
-      #pragma omp for schedule(dynamic, chunk_size)
-      for (DimensionType i=0; i<left.rows(); ++i) {
+      #pragma omp for schedule(dynamic, 1)
+      for (size_t b=1; b<blocks.size(); ++b)
+      for (DimensionType i=blocks[b-1]; i<blocks[b]; ++i) {
         DimensionType count = 0;
         DimensionType rowMin = vMin[i];
         for (OrdinalType j=left.rowStartPtr()[i]; j<left.rowEndPtr()[i]; ++j) {
@@ -437,7 +655,8 @@ namespace ops {
         }
         for (OrdinalType j=0; j<count; ++j) {
           if (!symbolic) {
-            inner[j+outer[i]] = colIndices[j];
+            if (inner)
+              inner[j+outer[i]] = colIndices[j];
             values[j+outer[i]] = table[colIndices[j]-rowMin];
           }
           table[colIndices[j]-rowMin] = initial_value;
@@ -450,6 +669,113 @@ namespace ops {
       prefixsum(outer.data(), outer.size());
   }
 
+  /** The multiplier of the Fibonacci hash of the column indices in
+   * accumulate_hash, 2^32 divided by the golden ratio. The hash keeps the
+   * high bits of the 32-bit product, into which all the bits of the index
+   * are mixed, so that columns strided by a power of two are spread over the
+   * table too, rather than landing in the same slot. */
+  static const uint32_t HASH_SCALE = 2654435761u;
+
+  /** This function returns the smallest power of two that is not less than x */
+  inline size_t next_pow2(size_t x) {
+    size_t p = 1;
+    while (p < x) p <<= 1;
+    return p;
+  }
+
+  /** This function returns log2(x) for a power of two x */
+  inline int log2_pow2(size_t x) {
+    int n = 0;
+    while (x > 1) { x >>= 1; ++n; }
+    return n;
+  }
+
+  /**
+   * The accumulator for matrix multiplication implemented with hash tables.
+   * It's used when the column range of the result rows is much wider than
+   * the number of insertions in a row, in which case the tables sized to the
+   * column range used by the other accumulators are mostly empty and don't
+   * fit in the cache.
+   *
+   * Each thread owns a table with open addressing and linear probing. Its
+   * capacity is a power of two, at least twice min(maxIns, maxInsRange), so
+   * that it is never more than half full. For each row, only the leading
+   * part of the table, sized by the number of insertions of the row, is
+   * used.
+   *
+   * If symbolic is true, this computes outer;
+   * Otherwise, it assumes outer is computed and fills inner, which may be
+   * null, and values, as the general accumulator.
+   * Similar with the general accumulator, the column indices in a result row
+   * are in the order of their first insertion, and zero results are not
+   * pruned out. */
+  void accumulate_hash(const SpMatMap & left, const SpMatMap & right,
+      Array<OrdinalType> & outer, DimensionType * inner, DataType * values,
+      const OrdinalType maxInsRange, const OrdinalType maxIns,
+      const Array<DimensionType> & blocks, const bool symbolic) {
+    if (symbolic) {
+      outer.resize(left.rows() + 1);
+      outer[0] = 0;
+    }
+    const DimensionType emptyKey = -1;
+    const OrdinalType maxCount = std::min(maxIns, maxInsRange);
+    const size_t capacity = next_pow2(2 * (size_t)maxCount);
+    #pragma omp parallel
+    {
+      // Similar to the other accumulators, we use vectors here instead of
+      // Array. `keys` stores the column indices, `table` stores the
+      // accumulated values, and `slots` stores the positions used in the
+      // table, in the order of insertion.
+      std::vector<DimensionType> keys(capacity, emptyKey);
+      std::vector<DataType> table(symbolic ? 0 : capacity);
+      std::vector<size_t> slots(maxCount);
+      #pragma omp for schedule(dynamic, 1)
+      for (size_t b=1; b<blocks.size(); ++b)
+      for (DimensionType i=blocks[b-1]; i<blocks[b]; ++i) {
+        OrdinalType ins = 0;
+        for (OrdinalType j=left.rowStartPtr()[i]; j<left.rowEndPtr()[i]; ++j) {
+          DimensionType rowRight = left.innerIndexPtr()[j];
+          ins += right.rowEndPtr()[rowRight] - right.rowStartPtr()[rowRight];
+        }
+        const size_t size = std::min(capacity, next_pow2(2 * (size_t)ins));
+        const size_t mask = size - 1;
+        // The hash is the log2(size) high bits of the product
+        const int shift = 32 - log2_pow2(size);
+
+        DimensionType count = 0;
+        for (OrdinalType j=left.rowStartPtr()[i]; j<left.rowEndPtr()[i]; ++j) {
+          DimensionType rowRight = left.innerIndexPtr()[j];
+          for (OrdinalType k=right.rowStartPtr()[rowRight]; k<right.rowEndPtr()[rowRight]; ++k) {
+            DimensionType colRight = right.innerIndexPtr()[k];
+            size_t h = (size_t)((uint32_t)colRight * HASH_SCALE) >> shift;
+            while (keys[h] != colRight && keys[h] != emptyKey) h = (h + 1) & mask;
+            if (keys[h] == emptyKey) {
+              keys[h] = colRight;
+              slots[count++] = h;
+              if (!symbolic)
+                table[h] = left.valuePtr()[j] * right.valuePtr()[k];
+            } else if (!symbolic) {
+              table[h] += left.valuePtr()[j] * right.valuePtr()[k];
+            }
+          }
+        }
+        for (DimensionType j=0; j<count; ++j) {
+          size_t h = slots[j];
+          if (!symbolic) {
+            if (inner)
+              inner[j+outer[i]] = keys[h];
+            values[j+outer[i]] = table[h];
+          }
+          keys[h] = emptyKey;
+        }
+        if (symbolic)
+          outer[i+1] = count;
+      }
+    }
+    if (symbolic)
+      prefixsum(outer.data(), outer.size());
+  }
+
   /** This function selects between dense insertion case and the general
    * case */
   template<typename T>
@@ -457,77 +783,554 @@ namespace ops {
       Array<OrdinalType> & outer, Array<DimensionType> & inner, Array<DataType> & values,
       const Array<DimensionType> & vMin, const Array<DimensionType> & vRange,
       const OrdinalType maxInsRange, const OrdinalType maxIns,
-      const OrdinalType chunk_size, const bool symbolic, const bool denseInsertion) {
+      const Array<DimensionType> & blocks, const bool symbolic, const bool denseInsertion) {
     if (denseInsertion) // bandwidth-like computation
-        accumulate_denseInsertion<T>(left, right, outer, inner, values, vMin, vRange, maxInsRange, chunk_size, symbolic);
-    else // general case
-        accumulate<T>(left, right, outer, inner, values, vMin, maxInsRange, maxIns, chunk_size, symbolic);
+        accumulate_denseInsertion<T>(left, right, outer, inner, values, vMin, vRange, maxInsRange, blocks, symbolic);
+    else { // general case
+      if (!symbolic) {
+        inner.resize(outer.back());
+        values.resize(outer.back());
+      }
+      accumulate<T>(left, right, outer, inner.data(), values.data(), vMin, maxInsRange, maxIns, blocks, symbolic);
+    }
   }
 
-  SpMat matmul(SpMatMap & left, SpMatMap & right) {
-    Require(left.cols() == right.rows(), "In matmul operation, the number of columns on the left\
-        should be equal to the number of rows on the right.");
+  /** The hash accumulator is only considered when maxInsRange is at least
+   * HASH_MIN_RANGE, below which a dense table of floats still fits in L2 */
+  static const OrdinalType HASH_MIN_RANGE = 1 << 15;
+  /** and when maxInsRange is more than HASH_RANGE_RATIO times of maxIns */
+  static const OrdinalType HASH_RANGE_RATIO = 8;
 
-    // analysis: generate size information during insertion
-    // information about the right input matrix
-    bool sortedRight;
-    Array<DimensionType> compressedOuter;
-    // information about the result matrix
-    Array<DimensionType> vMin, vRange;
-    OrdinalType maxInsRange, maxIns, totalIns, maxInsCompressed, totalInsCompressed;
-    matmul_analysis(left, right, sortedRight, compressedOuter,
-        vMin, vRange, maxInsRange, maxIns, totalIns, maxInsCompressed, totalInsCompressed);
+  /** The number of row blocks per thread to schedule dynamically in matmul */
+  static const OrdinalType MATMUL_BLOCKS_PER_THREAD = 30;
+  /** A row is only split across threads when it has at least
+   * SPLIT_MIN_INS multiplications, below which splitting doesn't pay off */
+  static const OrdinalType SPLIT_MIN_INS = 1 << 16;
+
+  /**
+   * This function partitions the rows into numBlocks blocks of continuous
+   * rows, so that each block has about the same number of multiplications,
+   * based on the prefix sum of rowIns.
+   * Block b covers the rows in [blocks[b], blocks[b+1]).
+   *
+   * Compared to blocks with the same number of rows, this keeps threads
+   * balanced when the multiplications are skewed among rows, such as for
+   * matrices of power-law graphs. */
+  void flop_partition(const Array<OrdinalType> & rowIns, const OrdinalType totalIns,
+      const OrdinalType numBlocks, Array<DimensionType> & blocks) {
+    const DimensionType rows = rowIns.size();
+    Array<OrdinalType> insPrefix(rows + 1);
+    insPrefix[0] = 0;
+    std::copy(rowIns.data(), rowIns.data() + rows, insPrefix.data() + 1);
+    prefixsum(insPrefix.data(), insPrefix.size());
 
-    if (maxInsRange == 0 || maxIns == 0 || totalIns == 0) return SpMat(left.rows(), right.cols());
+    blocks.resize(numBlocks + 1);
+    for (OrdinalType b=0; b<numBlocks; ++b) {
+      OrdinalType target = (OrdinalType)((int64_t)totalIns * b / numBlocks);
+      blocks[b] = std::lower_bound(insPrefix.data(), insPrefix.data() + rows + 1, target) - insPrefix.data();
+    }
+    blocks[numBlocks] = rows;
+  }
 
-    Array<OrdinalType> outer;
-    Array<DimensionType> inner;
-    Array<DataType> values;
-    // the number of continues rows as a task to schedule dynamically
-    OrdinalType chunk_size  = get_chunk_size(left.rows(), 30);
+  bool matmul_compute(const SpMatMap & left, const SpMatMap & right,
+      Array<OrdinalType> & outer, Array<DimensionType> & inner, Array<DataType> & values,
+      const bool splitHeavyRows);
+
+  /**
+   * This function multiplies left and right, with the rows of left split
+   * into pieces[i] pieces each.
+   *
+   * A row is split at its non-zeros, so that the pieces have about the
+   * same number of multiplications. The pieces are the rows of an expanded
+   * left matrix which shares the data with left, so multiplying the
+   * expanded matrix is balanced among threads as usual. Then a split row
+   * has a partial result for each of its pieces, and the partial results
+   * are sorted, and merged in parallel by column slices. */
+  void matmul_split(const SpMatMap & left, const SpMatMap & right,
+      const Array<OrdinalType> & rowIns, const Array<DimensionType> & pieces,
+      Array<OrdinalType> & outer, Array<DimensionType> & inner, Array<DataType> & values) {
+    typedef std::pair<DimensionType, DataType> Entry;
+    const DimensionType rows = left.rows();
+
+    // generate the expanded left matrix, where first[i] is the first row
+    // for the pieces of row i
+    Array<DimensionType> first(rows + 1);
+    first[0] = 0;
+    std::copy(pieces.data(), pieces.data() + rows, first.data() + 1);
+    prefixsum(first.data(), first.size());
+    const DimensionType rowsExpanded = first[rows];
+    Array<OrdinalType> startExpanded(rowsExpanded);
+    Array<OrdinalType> endExpanded(rowsExpanded);
+    #pragma omp parallel for
+    for (DimensionType i=0; i<rows; ++i) {
+      DimensionType r = first[i];
+      DimensionType p = 1;
+      startExpanded[r] = left.rowStartPtr()[i];
+      OrdinalType ins = 0;
+      for (OrdinalType j=left.rowStartPtr()[i]; j<left.rowEndPtr()[i] && p<pieces[i]; ++j) {
+        DimensionType rowRight = left.innerIndexPtr()[j];
+        ins += right.rowEndPtr()[rowRight] - right.rowStartPtr()[rowRight];
+        // cut after j once the pieces so far have their shares
+        for (; p<pieces[i] && (int64_t)ins * pieces[i] >= (int64_t)rowIns[i] * p; ++p) {
+          endExpanded[r] = j + 1;
+          startExpanded[++r] = j + 1;
+        }
+      }
+      for (; p<pieces[i]; ++p) {
+        endExpanded[r] = left.rowEndPtr()[i];
+        startExpanded[++r] = left.rowEndPtr()[i];
+      }
+      endExpanded[r] = left.rowEndPtr()[i];
+    }
+    SpMatMap expanded(rowsExpanded, left.cols(), left.nonZeros(),
+        startExpanded.data(), endExpanded.data(),
+        const_cast<DimensionType *>(left.innerIndexPtr()), const_cast<DataType *>(left.valuePtr()));
+
+    Array<OrdinalType> outerExpanded;
+    Array<DimensionType> innerExpanded;
+    Array<DataType> valuesExpanded;
+    matmul_compute(expanded, right, outerExpanded, innerExpanded, valuesExpanded, false);
+
+    // the split rows, and their partial results as rows of the expanded result
+    std::vector<DimensionType> splitRows, partials;
+    std::vector<DimensionType> splitIndex(rows, -1);
+    for (DimensionType i=0; i<rows; ++i) {
+      if (pieces[i] == 1) continue;
+      splitIndex[i] = splitRows.size();
+      splitRows.push_back(i);
+      for (DimensionType r=first[i]; r<first[i+1]; ++r) partials.push_back(r);
+    }
+
+    // sort the partial results by column indices, the dense insertion
+    // accumulator generates sorted rows already
+    #pragma omp parallel
+    {
+      std::vector<Entry> entries;
+      #pragma omp for schedule(dynamic, 1)
+      for (size_t p=0; p<partials.size(); ++p) {
+        OrdinalType s = outerExpanded[partials[p]];
+        OrdinalType e = outerExpanded[partials[p]+1];
+        DimensionType * cols = innerExpanded.data();
+        DataType * vals = valuesExpanded.data();
+        if (std::is_sorted(cols + s, cols + e)) continue;
+        entries.clear();
+        for (OrdinalType k=s; k<e; ++k) entries.emplace_back(cols[k], vals[k]);
+        std::sort(entries.begin(), entries.end(),
+            [](const Entry & x, const Entry & y) { return x.first < y.first; });
+        for (OrdinalType k=s; k<e; ++k) {
+          cols[k] = entries[k-s].first;
+          vals[k] = entries[k-s].second;
+        }
+      }
+    }
+
+    // merge the partial results, each split row is merged by numSlices
+    // tasks on column slices. The slices are taken from the largest
+    // partial result, so that they have similar sizes.
+    const DimensionType numSlices = omp_get_max_threads();
+    std::vector<DimensionType> splitters(splitRows.size() * (numSlices + 1));
+    for (size_t h=0; h<splitRows.size(); ++h) {
+      DimensionType i = splitRows[h];
+      DimensionType largest = first[i];
+      for (DimensionType r=first[i]; r<first[i+1]; ++r)
+        if (outerExpanded[r+1] - outerExpanded[r] > outerExpanded[largest+1] - outerExpanded[largest])
+          largest = r;
+      OrdinalType size = outerExpanded[largest+1] - outerExpanded[largest];
+      DimensionType * splitter = splitters.data() + h * (numSlices + 1);
+      splitter[0] = 0;
+      for (DimensionType t=1; t<numSlices; ++t)
+        splitter[t] = innerExpanded[outerExpanded[largest] + size * t / numSlices];
+      splitter[numSlices] = right.cols();
+    }
+    std::vector<std::vector<Entry>> merged(splitRows.size() * numSlices);
+    #pragma omp parallel
+    {
+      std::vector<Entry> entries;
+      #pragma omp for schedule(dynamic, 1)
+      for (size_t task=0; task<merged.size(); ++task) {
+        size_t h = task / numSlices;
+        DimensionType t = task % numSlices;
+        DimensionType i = splitRows[h];
+        const DimensionType * splitter = splitters.data() + h * (numSlices + 1);
+        entries.clear();
+        for (DimensionType r=first[i]; r<first[i+1]; ++r) {
+          const DimensionType * cols = innerExpanded.data();
+          const DimensionType * s = std::lower_bound(cols + outerExpanded[r], cols + outerExpanded[r+1], splitter[t]);
+          const DimensionType * e = std::lower_bound(s, cols + outerExpanded[r+1], splitter[t+1]);
+          for (; s<e; ++s) entries.emplace_back(*s, valuesExpanded[s - cols]);
+        }
+        std::sort(entries.begin(), entries.end(),
+            [](const Entry & x, const Entry & y) { return x.first < y.first; });
+        std::vector<Entry> & res = merged[task];
+        for (const Entry & x : entries) {
+          if (!res.empty() && res.back().first == x.first)
+            res.back().second += x.second;
+          else
+            res.push_back(x);
+        }
+      }
+    }
+
+    // generate the result, the rows not split are copied from the expanded
+    // result
+    outer.resize(rows + 1);
+    outer[0] = 0;
+    #pragma omp parallel for
+    for (DimensionType i=0; i<rows; ++i) {
+      if (splitIndex[i] < 0) {
+        outer[i+1] = outerExpanded[first[i]+1] - outerExpanded[first[i]];
+      } else {
+        OrdinalType size = 0;
+        for (DimensionType t=0; t<numSlices; ++t) size += merged[splitIndex[i] * numSlices + t].size();
+        outer[i+1] = size;
+      }
+    }
+    prefixsum(outer.data(), outer.size());
+    inner.resize(outer.back());
+    values.resize(outer.back());
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (DimensionType i=0; i<rows; ++i) {
+      OrdinalType k = outer[i];
+      if (splitIndex[i] < 0) {
+        for (OrdinalType j=outerExpanded[first[i]]; j<outerExpanded[first[i]+1]; ++j, ++k) {
+          inner[k] = innerExpanded[j];
+          values[k] = valuesExpanded[j];
+        }
+      } else {
+        for (DimensionType t=0; t<numSlices; ++t) {
+          for (const Entry & x : merged[splitIndex[i] * numSlices + t]) {
+            inner[k] = x.first;
+            values[k++] = x.second;
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * This function multiplies left and right into outer, inner and values,
+   * with the rows balanced among threads by their multiplications.
+   * If splitHeavyRows is true, the rows with too many multiplications to be
+   * balanced by rows are split across threads, see matmul_split.
+   * It returns false when the result is empty, in which case outer, inner
+   * and values are not generated.
+   * stats is the analysis of left and right, see MatmulStats. */
+  bool matmul_compute(const SpMatMap & left, const SpMatMap & right, MatmulStats & stats,
+      Array<OrdinalType> & outer, Array<DimensionType> & inner, Array<DataType> & values,
+      const bool splitHeavyRows) {
+    if (stats.maxInsRange == 0 || stats.maxIns == 0 || stats.totalIns == 0) return false;
+
+    const OrdinalType numThreads = omp_get_max_threads();
+    if (splitHeavyRows && numThreads > 1) {
+      // A row with more than half of the multiplications a thread has on
+      // average leaves the other threads waiting at the end. Such a row is
+      // split into pieces with about a quarter of that each.
+      OrdinalType heavyIns = std::max(stats.totalIns / numThreads / 2, SPLIT_MIN_INS);
+      OrdinalType pieceIns = std::max(stats.totalIns / numThreads / 4, (OrdinalType)1);
+      if (stats.maxIns > heavyIns) {
+        Array<DimensionType> pieces(left.rows());
+        DimensionType numSplit = 0;
+        #pragma omp parallel for reduction(+:numSplit)
+        for (DimensionType i=0; i<left.rows(); ++i) {
+          OrdinalType nonzeros = left.rowEndPtr()[i] - left.rowStartPtr()[i];
+          pieces[i] = 1;
+          if (stats.rowIns[i] > heavyIns)
+            pieces[i] = std::min(std::min(numThreads, (stats.rowIns[i] + pieceIns - 1) / pieceIns), nonzeros);
+          if (pieces[i] > 1) ++numSplit;
+        }
+        if (numSplit > 0) {
+          matmul_split(left, right, stats.rowIns, pieces, outer, inner, values);
+          return true;
+        }
+      }
+    }
+
+    // the blocks of continuous rows to schedule dynamically
+    Array<DimensionType> blocks;
+    flop_partition(stats.rowIns, stats.totalIns, numThreads * MATMUL_BLOCKS_PER_THREAD, blocks);
 
     // When the number of insertion can be largely reduced with
     // compression, then use compression for the symbolic phase
-    bool usecompression = sortedRight && totalInsCompressed < (totalIns >> 1);
+    bool usecompression = stats.sortedRight && stats.totalInsCompressed < (stats.totalIns >> 1);
     // Within maxInsRange, each value in average is inserted enough times,
     // then we call this dense insertion, and according optimizations can
     // be applied
-    bool denseInsertion = maxInsRange*left.rows()*4 < totalIns;
+    bool denseInsertion = (int64_t)stats.maxInsRange*left.rows()*4 < stats.totalIns;
+    // When the column range of the result rows is wide and much larger than
+    // the number of insertions in a row, the per-thread tables sized to the
+    // range would be large and mostly empty, then hash tables sized to
+    // the insertions are used instead
+    bool hashInsertion = !denseInsertion && stats.maxInsRange >= HASH_MIN_RANGE &&
+      stats.maxInsRange / HASH_RANGE_RATIO > stats.maxIns;
+
+    if (hashInsertion) {
+      accumulate_hash(left, right, outer, NULL, NULL, stats.maxInsRange, stats.maxIns, blocks, true);
+      inner.resize(outer.back());
+      values.resize(outer.back());
+      accumulate_hash(left, right, outer, inner.data(), values.data(), stats.maxInsRange, stats.maxIns, blocks, false);
+      return true;
+    }
+
+    // When the dense table of a row doesn't fit in half of the L2 cache,
+    // the insertions keep missing the cache, then the columns are tiled into
+    // panels whose tables fit
+    const DimensionType panelWidth = l2_cache_size() / 2 / sizeof(DataType);
+    bool tiledInsertion = denseInsertion && stats.maxInsRange > panelWidth;
+
+    if (tiledInsertion) {
+      ColumnPanels panels;
+      partition_columns(right, panelWidth, panels);
+      // symbolic: generate outer, the compressed table is 32 times smaller
+      if (usecompression)
+        accumulate_compress(left, right, stats.compressedOuter, outer, stats.vMin, stats.vRange, stats.maxInsRange, stats.maxInsCompressed, blocks, denseInsertion);
+      else
+        accumulate_tiled<bool>(left, panels, outer, inner, values, stats.vMin, stats.vRange, blocks, true);
+      // numeric: generate inner, values
+      accumulate_tiled<DataType>(left, panels, outer, inner, values, stats.vMin, stats.vRange, blocks, false);
+      return true;
+    }
 
     // symbolic: generate outer
     if (usecompression) {
-      accumulate_compress(left, right, compressedOuter, outer, vMin, vRange, maxInsRange, maxInsCompressed, chunk_size, denseInsertion);
+      accumulate_compress(left, right, stats.compressedOuter, outer, stats.vMin, stats.vRange, stats.maxInsRange, stats.maxInsCompressed, blocks, denseInsertion);
     } else {
-      accumulate<bool>(left, right, outer, inner, values, vMin, vRange, maxInsRange, maxIns, chunk_size, true, denseInsertion);
+      accumulate<bool>(left, right, outer, inner, values, stats.vMin, stats.vRange, stats.maxInsRange, stats.maxIns, blocks, true, denseInsertion);
     }
     // numeric: generate inner, values
-    accumulate<DataType>(left, right, outer, inner, values, vMin, vRange, maxInsRange, maxIns, chunk_size, false, denseInsertion);
+    accumulate<DataType>(left, right, outer, inner, values, stats.vMin, stats.vRange, stats.maxInsRange, stats.maxIns, blocks, false, denseInsertion);
+    return true;
+  }
+
+  bool matmul_compute(const SpMatMap & left, const SpMatMap & right,
+      Array<OrdinalType> & outer, Array<DimensionType> & inner, Array<DataType> & values,
+      const bool splitHeavyRows) {
+    MatmulStats stats(left, right);
+    return matmul_compute(left, right, stats, outer, inner, values, splitHeavyRows);
+  }
+
+  SpMat matmul(SpMatMap & left, SpMatMap & right) {
+    Require(left.cols() == right.rows(), "In matmul operation, the number of columns on the left\
+        should be equal to the number of rows on the right.");
+
+    Array<OrdinalType> outer;
+    Array<DimensionType> inner;
+    Array<DataType> values;
+    if (!matmul_compute(left, right, outer, inner, values, true))
+      return SpMat(left.rows(), right.cols());
     return SpMat(left.rows(), right.cols(), outer, inner, values);
   }
 
+  bool denseMatmulPreferred(SpMatMap & left, SpMatMap & right, SpMat * fallback) {
+    Require(left.cols() == right.rows(), "In matmul operation, the number of columns on the left\
+        should be equal to the number of rows on the right.");
+    if (left.rows() == 0 || right.cols() == 0) {
+      if (fallback) *fallback = SpMat(left.rows(), right.cols());
+      return false;
+    }
+
+    // the number of non-zeros in a result row is bounded by both the
+    // number of insertions and the range of the inserted column indices
+    MatmulStats stats(left, right);
+    int64_t estimated = 0;
+    #pragma omp parallel for reduction(+:estimated)
+    for (DimensionType i=0; i<left.rows(); ++i)
+      estimated += std::min(stats.rowIns[i], stats.vRange[i]);
+    if (dense_output(estimated, left.rows(), right.cols())) return true;
+
+    if (fallback) {
+      Array<OrdinalType> outer;
+      Array<DimensionType> inner;
+      Array<DataType> values;
+      if (!matmul_compute(left, right, stats, outer, inner, values, true))
+        *fallback = SpMat(left.rows(), right.cols());
+      else
+        *fallback = SpMat(left.rows(), right.cols(), outer, inner, values);
+    }
+    return false;
+  }
+
+  /** This function runs the numeric phase of a matmul plan with the
+   * accumulator picked by its symbolic phase. inner may be null, see
+   * accumulate. */
+  void plan_accumulate(const SpMatMap & left, const SpMatMap & right,
+      Array<OrdinalType> & outer, DimensionType * inner, DataType * values,
+      const Array<DimensionType> & vMin, const OrdinalType maxInsRange, const OrdinalType maxIns,
+      const Array<DimensionType> & blocks, const bool hash) {
+    if (hash)
+      accumulate_hash(left, right, outer, inner, values, maxInsRange, maxIns, blocks, false);
+    else
+      accumulate<DataType>(left, right, outer, inner, values, vMin, maxInsRange, maxIns, blocks, false);
+  }
+
+  /**
+   * The symbolic phase of a matmul plan is the one of matmul, with the
+   * blocks of rows balanced by flop_partition, except that the accumulators
+   * pruning out zeros and splitting rows aren't used, as the structure must
+   * not depend on the values. The column indices are then collected by a
+   * numeric pass of the accumulator. */
+  void MatmulPlan::symbolic(const SpMatMap & left, const SpMatMap & right) {
+    bool sortedRight;
+    Array<DimensionType> compressedOuter;
+    Array<DimensionType> vRange;
+    Array<OrdinalType> rowIns;
+    OrdinalType totalIns, maxInsCompressed, totalInsCompressed;
+    matmul_analysis(left, right, sortedRight, compressedOuter,
+        vMin_, vRange, maxInsRange_, maxIns_, totalIns, rowIns, maxInsCompressed, totalInsCompressed);
+
+    if (maxInsRange_ == 0 || maxIns_ == 0 || totalIns == 0) {
+      outer_.resize(rows_ + 1);
+      std::fill(outer_.data(), outer_.data() + outer_.size(), 0);
+      return;
+    }
+
+    flop_partition(rowIns, totalIns, omp_get_max_threads() * MATMUL_BLOCKS_PER_THREAD, blocks_);
+    bool denseInsertion = (int64_t)maxInsRange_*left.rows()*4 < totalIns;
+    hash_ = !denseInsertion && maxInsRange_ >= HASH_MIN_RANGE &&
+      maxInsRange_ / HASH_RANGE_RATIO > maxIns_;
+    if (hash_)
+      accumulate_hash(left, right, outer_, NULL, NULL, maxInsRange_, maxIns_, blocks_, true);
+    else if (sortedRight && totalInsCompressed < (totalIns >> 1))
+      accumulate_compress(left, right, compressedOuter, outer_, vMin_, vRange, maxInsRange_, maxInsCompressed, blocks_, denseInsertion);
+    else
+      accumulate<bool>(left, right, outer_, NULL, NULL, vMin_, maxInsRange_, maxIns_, blocks_, true);
+
+    inner_.resize(outer_.back());
+    Array<DataType> values(outer_.back());
+    plan_accumulate(left, right, outer_, inner_.data(), values.data(), vMin_, maxInsRange_, maxIns_, blocks_, hash_);
+  }
+
+  void MatmulPlan::numeric(const SpMatMap & left, const SpMatMap & right, DataType * values) const {
+    // the numeric phase only reads outer
+    plan_accumulate(left, right, const_cast<Array<OrdinalType> &>(outer_), NULL, values,
+        vMin_, maxInsRange_, maxIns_, blocks_, hash_);
+  }
+
+  /** The number of dense columns updated together in spmm. A panel of the
+   * result row (SPMM_COL_PANEL floats) stays in L1 while all the non-zeros
+   * of the left row are accumulated into it. */
+  static const DimensionType SPMM_COL_PANEL = 512;
+
+  void spmm(SpMatMap & left, const DataType * right, DimensionType rightCols, DataType * res) {
+    Require(rightCols >= 0, "In spmm operation, the number of columns on the right should not be negative.");
+    if (left.rows() == 0 || rightCols == 0) return;
 
-  OrdinalType * genOuter(const DimensionType * row_indices, OrdinalType nonzeros, DimensionType num_row) {
-    OrdinalType * outerptr;
-    size_t num_threads;
+    // rows are cheap or expensive depending on their number of non-zeros,
+    // so schedule them dynamically
+    OrdinalType chunk_size = get_chunk_size(left.rows(), 30);
+    #pragma omp parallel for schedule(dynamic, chunk_size)
+    for (DimensionType i=0; i<left.rows(); ++i) {
+      DataType * resRow = res + (size_t)i * rightCols;
+      for (DimensionType c0=0; c0<rightCols; c0+=SPMM_COL_PANEL) {
+        DimensionType width = std::min(SPMM_COL_PANEL, rightCols - c0);
+        DataType * resPanel = resRow + c0;
+        #pragma omp simd
+        for (DimensionType c=0; c<width; ++c) resPanel[c] = 0;
+        for (OrdinalType j=left.rowStartPtr()[i]; j<left.rowEndPtr()[i]; ++j) {
+          const DataType v = left.valuePtr()[j];
+          const DataType * rightPanel = right + (size_t)left.innerIndexPtr()[j] * rightCols + c0;
+          #pragma omp simd
+          for (DimensionType c=0; c<width; ++c) resPanel[c] += v * rightPanel[c];
+        }
+      }
+    }
+  }
+
+
+  /**
+   * A deterministic parallel counting sort by keys, without atomics, used
+   * to place the non-zeros by row for transpose and coo to csr conversion.
+   *
+   * Each thread owns a range of the input, count(t, numThreads, hist) counts
+   * the keys in the range of thread t into hist, its own histogram. The
+   * histograms are then combined into outer, the starting position of each
+   * key with numKeys + 1 elements, and into the starting position of each
+   * thread within each key. place(t, numThreads, hist) places the elements in
+   * the range of thread t in order, with the position of an element with key
+   * k being hist[k]++.
+   * So the elements with the same key keep their order in the input, and the
+   * result doesn't depend on the scheduling of threads. */
+  template<typename Count, typename Place>
+  void counting_sort(const DimensionType numKeys, Array<OrdinalType> & outer, Count count, Place place) {
+    outer.resize(numKeys + 1);
+    Array<OrdinalType> hists;
     #pragma omp parallel
     {
-      num_threads = omp_get_num_threads();
+      const int numThreads = omp_get_num_threads();
+      const int t = omp_get_thread_num();
+      #pragma omp single
+      hists.resize((size_t)numKeys * numThreads);
+
+      OrdinalType * hist = hists.data() + (size_t)numKeys * t;
+      std::fill(hist, hist + numKeys, 0);
+      count(t, numThreads, hist);
+      #pragma omp barrier
+
+      // for each key, the threads start after the elements with the same
+      // key of the previous threads
+      #pragma omp for
+      for (DimensionType k=0; k<numKeys; ++k) {
+        OrdinalType sum = 0;
+        for (int p=0; p<numThreads; ++p) {
+          OrdinalType c = hists[(size_t)numKeys * p + k];
+          hists[(size_t)numKeys * p + k] = sum;
+          sum += c;
+        }
+        outer[k+1] = sum;
+      }
+      #pragma omp single
+      {
+        outer[0] = 0;
+        prefixsum(outer.data(), outer.size());
+      }
+      #pragma omp for
+      for (DimensionType k=0; k<numKeys; ++k)
+        for (int p=0; p<numThreads; ++p)
+          hists[(size_t)numKeys * p + k] += outer[k];
+
+      place(t, numThreads, hist);
     }
+  }
 
-    Calloc(outerptr, (num_row+1)*num_threads, sizeof(OrdinalType));
-    // generate the outer array
-    #pragma omp parallel for
-    for (OrdinalType i=0; i<nonzeros; ++i) {
-      outerptr[omp_get_thread_num()*(num_row+1) + row_indices[i]+1]++;
+  /** This function sums up the non-zeros with the same column index in
+   * each row, where the column indices are sorted, and compresses outer,
+   * inner and values if there are any */
+  void sum_duplicates(const DimensionType rows, Array<OrdinalType> & outer,
+      Array<DimensionType> & inner, Array<DataType> & values) {
+    // merge the duplicates to the front of each row
+    Array<OrdinalType> rowSizes(rows + 1);
+    rowSizes[0] = 0;
+    OrdinalType nonzeros = 0;
+    #pragma omp parallel for schedule(dynamic, 256) reduction(+:nonzeros)
+    for (DimensionType i=0; i<rows; ++i) {
+      OrdinalType w = outer[i];
+      for (OrdinalType j=outer[i]; j<outer[i+1]; ++j) {
+        if (w > outer[i] && inner[w-1] == inner[j]) {
+          values[w-1] += values[j];
+        } else {
+          inner[w] = inner[j];
+          values[w] = values[j];
+          ++w;
+        }
+      }
+      rowSizes[i+1] = w - outer[i];
+      nonzeros += rowSizes[i+1];
     }
-    #pragma omp parallel for
-    for (OrdinalType i=1; i<num_row+1; ++i) {
-      size_t offset = i+num_row+1;
-      for (OrdinalType j=1; j<omp_get_num_threads(); ++j, offset+=num_row+1)
-        outerptr[i] += outerptr[offset];
+    if (nonzeros == outer.back()) return;
+
+    prefixsum(rowSizes.data(), rowSizes.size());
+    Array<DimensionType> innerMerged(nonzeros);
+    Array<DataType> valuesMerged(nonzeros);
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (DimensionType i=0; i<rows; ++i) {
+      OrdinalType k = outer[i];
+      for (OrdinalType j=rowSizes[i]; j<rowSizes[i+1]; ++j, ++k) {
+        innerMerged[j] = inner[k];
+        valuesMerged[j] = values[k];
+      }
     }
-    prefixsum(outerptr, num_row + 1);
-    return outerptr;
+    outer = std::move(rowSizes);
+    inner = std::move(innerMerged);
+    values = std::move(valuesMerged);
   }
 
   SpMat cooTocsr(COO & coo) {
@@ -549,50 +1352,92 @@ namespace ops {
           for (OrdinalType j=coo.row_index()[i-1]+1; j<=coo.row_index()[i]; ++j) outer[j] = i;
       }
     } else {
-      // generate outer
-      OrdinalType * outerptr = genOuter(coo.row_index().data(), coo.nonZeros(), coo.rows());
-      outer.assign(outerptr, coo.rows() + 1);
-
-      // generate the value and inner index
-      #pragma omp parallel for
-      for (OrdinalType i=0; i<coo.nonZeros(); ++i) {
-        DimensionType r = coo.row_index()[i];
-        OrdinalType pos;
-        #pragma omp atomic capture
-        pos = outerptr[r]++;
-
-        inner[pos] = coo.col_index()[i];
-        values[pos] = coo.values()[i];
-      }
-      FREE(outerptr);
+      // LSD radix sort on (row, col) with a digit for each: place the
+      // non-zeros by columns first, then stably by rows, so the columns in
+      // each row are sorted. Each thread takes a continuous range of the
+      // non-zeros in both passes.
+      const OrdinalType nnz = coo.nonZeros();
+      const DimensionType * rowIndex = coo.row_index().data();
+      const DimensionType * colIndex = coo.col_index().data();
+      const DataType * cooValues = coo.values().data();
+      Array<OrdinalType> colOuter;
+      Array<DimensionType> rowsByCol(nnz), colsByCol(nnz);
+      Array<DataType> valuesByCol(nnz);
+      counting_sort(coo.cols(), colOuter,
+        [&](int t, int numThreads, OrdinalType * hist) {
+          OrdinalType begin = (int64_t)nnz * t / numThreads, end = (int64_t)nnz * (t + 1) / numThreads;
+          for (OrdinalType i=begin; i<end; ++i) ++hist[colIndex[i]];
+        },
+        [&](int t, int numThreads, OrdinalType * hist) {
+          OrdinalType begin = (int64_t)nnz * t / numThreads, end = (int64_t)nnz * (t + 1) / numThreads;
+          for (OrdinalType i=begin; i<end; ++i) {
+            OrdinalType pos = hist[colIndex[i]]++;
+            rowsByCol[pos] = rowIndex[i];
+            colsByCol[pos] = colIndex[i];
+            valuesByCol[pos] = cooValues[i];
+          }
+        });
+      counting_sort(coo.rows(), outer,
+        [&](int t, int numThreads, OrdinalType * hist) {
+          OrdinalType begin = (int64_t)nnz * t / numThreads, end = (int64_t)nnz * (t + 1) / numThreads;
+          for (OrdinalType i=begin; i<end; ++i) ++hist[rowsByCol[i]];
+        },
+        [&](int t, int numThreads, OrdinalType * hist) {
+          OrdinalType begin = (int64_t)nnz * t / numThreads, end = (int64_t)nnz * (t + 1) / numThreads;
+          for (OrdinalType i=begin; i<end; ++i) {
+            OrdinalType pos = hist[rowsByCol[i]]++;
+            inner[pos] = colsByCol[i];
+            values[pos] = valuesByCol[i];
+          }
+        });
+      sum_duplicates(coo.rows(), outer, inner, values);
     }
     return SpMat(coo.rows(), coo.cols(), outer, inner, values);
   }
 
   SpMat transpose(SpMatMap & tensor) {
-    Array<OrdinalType> outer(tensor.cols()+1);
+    Array<OrdinalType> outer;
     Array<DimensionType> inner(tensor.nonZeros());
     Array<DataType> values(tensor.nonZeros());
 
-    // generate outer
-    OrdinalType * outerptr = genOuter(tensor.innerIndexPtr(), tensor.nonZeros(), tensor.cols());
-    outer.assign(outerptr, tensor.cols() + 1);
-
-    // generate the value and inner index
-    #pragma omp parallel for
-    for (OrdinalType i=0; i<tensor.rows(); ++i) {
-      for (OrdinalType j=tensor.rowStartPtr()[i]; j<tensor.rowEndPtr()[i]; ++j) {
-        DimensionType r = tensor.innerIndexPtr()[j];
-        OrdinalType pos;
-        #pragma omp atomic capture
-        pos = outerptr[r]++;
-
-        inner[pos] = i;
-        values[pos] = tensor.valuePtr()[j];
+    // each thread takes a continuous range of rows, balanced by the number
+    // of non-zeros when the rows are stored continuously. The rows are
+    // visited in order, so the column indices in the result are sorted.
+    const DimensionType rows = tensor.rows();
+    const OrdinalType nnz = tensor.nonZeros();
+    const OrdinalType * rowsStart = tensor.rowStartPtr();
+    const OrdinalType * rowsEnd = tensor.rowEndPtr();
+    const DimensionType * tensorInner = tensor.innerIndexPtr();
+    const DataType * tensorValues = tensor.valuePtr();
+    const bool continuous = rowsEnd == rowsStart + 1;
+    auto rowRange = [&](int t, int numThreads, DimensionType & begin, DimensionType & end) {
+      if (continuous) {
+        begin = std::lower_bound(rowsStart, rowsStart + rows, rowsStart[0] + (int64_t)nnz * t / numThreads) - rowsStart;
+        end = std::lower_bound(rowsStart, rowsStart + rows, rowsStart[0] + (int64_t)nnz * (t + 1) / numThreads) - rowsStart;
+        if (t == numThreads - 1) end = rows;
+      } else {
+        begin = (int64_t)rows * t / numThreads;
+        end = (int64_t)rows * (t + 1) / numThreads;
       }
-    }
+    };
+    counting_sort(tensor.cols(), outer,
+      [&](int t, int numThreads, OrdinalType * hist) {
+        DimensionType begin, end;
+        rowRange(t, numThreads, begin, end);
+        for (DimensionType i=begin; i<end; ++i)
+          for (OrdinalType j=rowsStart[i]; j<rowsEnd[i]; ++j) ++hist[tensorInner[j]];
+      },
+      [&](int t, int numThreads, OrdinalType * hist) {
+        DimensionType begin, end;
+        rowRange(t, numThreads, begin, end);
+        for (DimensionType i=begin; i<end; ++i)
+          for (OrdinalType j=rowsStart[i]; j<rowsEnd[i]; ++j) {
+            OrdinalType pos = hist[tensorInner[j]]++;
+            inner[pos] = i;
+            values[pos] = tensorValues[j];
+          }
+      });
 
-    FREE(outerptr);
     return SpMat(tensor.cols(), tensor.rows(), outer, inner, values);
   }
 
@@ -9,9 +9,11 @@
 
 #include "ArithmeticUtils.h"
 #include "DebugUtils.h"
+#include "SortedIntersection.h"
 
 #include <unordered_map>
 #include <set>
+#include <vector>
 
 namespace ops {
 
@@ -71,15 +73,18 @@ namespace ops {
     size_t unsorted = 0;
     #pragma omp parallel for reduction(+:unsorted)
     for (OrdinalType i=1; i<coo.nonZeros(); ++i) {
-      if (unsorted == 0)
-        if (coo.row_index()[i-1] > coo.row_index()[i]) unsorted++;
+      if (unsorted == 0) {
+        DimensionType r0 = coo.row_index()[i-1], r1 = coo.row_index()[i];
+        if (r0 > r1 || (r0 == r1 && coo.col_index()[i-1] >= coo.col_index()[i])) unsorted++;
+      }
     }
     return unsorted == 0;
   }
 
   // rowIntersection when either of the side is empty or both sides have same
   // non-zeros, in these cases, computations can be simplified.
-  SpMat rowIntersectionTrival(SpMatMap & left, SpMatMap & right, OP * op) {
+  template <OP op>
+  SpMat rowIntersectionTrival(SpMatMap & left, SpMatMap & right) {
     // If one of the matrices is empty, then directly return an empty
     // matrix
     if (left.nonZeros() == 0 || right.nonZeros() == 0)
@@ -121,13 +126,14 @@ namespace ops {
   }
 
   // TODO: add prune option
-  SpMat rowIntersection(SpMatMap & left, SpMatMap & right, OP * op) {
+  template <OP op>
+  SpMat rowIntersection(SpMatMap & left, SpMatMap & right) {
     Require(left.valid() && right.valid(), "matrices in both side should be valid.");
     Require(left.rows() == right.rows(), "the number of rows on both side should be the same.");
     Require(left.cols() == right.cols(), "the number of cols on both side should be the same.");
 
     if (left.nonZeros() == 0 || right.nonZeros() == 0 || orderedTheSame(left, right))
-      rowIntersectionTrival(left, right, op);
+      return rowIntersectionTrival<op>(left, right);
 
     // compute the number of non-zeros for each row in the resulting
     // matrix
@@ -149,18 +155,9 @@ namespace ops {
       sortedrow[i] = sorted(left.innerIndexPtr(), left.rowStartPtr()[i], left.rowEndPtr()[i]) &&
         sorted(right.innerIndexPtr(), right.rowStartPtr()[i], right.rowEndPtr()[i]);
       if (sortedrow[i]) {
-        // find the size by merging two sorted rows
-        OrdinalType j=left.rowStartPtr()[i];
-        OrdinalType k=right.rowStartPtr()[i];
-        while(j < left.rowEndPtr()[i] && k < right.rowEndPtr()[i]) {
-          if (left.innerIndexPtr()[j] < right.innerIndexPtr()[k]) {
-            ++j;
-          } else if (left.innerIndexPtr()[j] > right.innerIndexPtr()[k]) {
-            ++k;
-          } else {
-            ++j, ++k, ++count;
-          }
-        }
+        // find the size by intersecting two sorted rows
+        count = sortedIntersection(left.innerIndexPtr() + left.rowStartPtr()[i], left_row_size,
+            right.innerIndexPtr() + right.rowStartPtr()[i], right_row_size, NULL, NULL);
       } else {
         // use set to store the existing column indices
         std::set<DimensionType> s;
@@ -178,43 +175,47 @@ namespace ops {
     // compute the inner and values
     Array<DimensionType> inner(outer[left.rows()]);
     Array<DataType> values(outer[left.rows()]);
-    #pragma omp parallel for schedule(dynamic)
-    for (OrdinalType i=0; i<left.rows(); ++i) {
-      OrdinalType left_row_size = left.rowEndPtr()[i] - left.rowStartPtr()[i];
-      OrdinalType right_row_size = right.rowEndPtr()[i] - right.rowStartPtr()[i];
-      if (left_row_size == 0 || right_row_size == 0) {
-        continue;
-      }
-      if (outer[i] == outer[i+1]) continue;
+    #pragma omp parallel
+    {
+      // positions of the common indices in the left and right rows
+      std::vector<OrdinalType> posLeft, posRight;
+      #pragma omp for schedule(dynamic)
+      for (OrdinalType i=0; i<left.rows(); ++i) {
+        OrdinalType left_row_size = left.rowEndPtr()[i] - left.rowStartPtr()[i];
+        OrdinalType right_row_size = right.rowEndPtr()[i] - right.rowStartPtr()[i];
+        if (left_row_size == 0 || right_row_size == 0) {
+          continue;
+        }
+        if (outer[i] == outer[i+1]) continue;
 
-      OrdinalType count = outer[i];
-      if (sortedrow[i]) {
-        // find the size by merging two sorted rows
-        OrdinalType j=left.rowStartPtr()[i];
-        OrdinalType k=right.rowStartPtr()[i];
-        while(j < left.rowEndPtr()[i] && k < right.rowEndPtr()[i]) {
-          if (left.innerIndexPtr()[j] < right.innerIndexPtr()[k]) {
-            ++j;
-          } else if (left.innerIndexPtr()[j] > right.innerIndexPtr()[k]) {
-            ++k;
-          } else {
-            inner[count] = left.innerIndexPtr()[j];
-            values[count] = op(left.valuePtr()[j], right.valuePtr()[k]);
-            ++j, ++k, ++count;
+        OrdinalType count = outer[i];
+        if (sortedrow[i]) {
+          // find the positions by intersecting two sorted rows, then compute
+          // the values from the positions
+          const DimensionType * leftInner = left.innerIndexPtr() + left.rowStartPtr()[i];
+          const DataType * leftValues = left.valuePtr() + left.rowStartPtr()[i];
+          const DataType * rightValues = right.valuePtr() + right.rowStartPtr()[i];
+          posLeft.resize(outer[i+1] - outer[i]);
+          posRight.resize(outer[i+1] - outer[i]);
+          OrdinalType n = sortedIntersection(leftInner, left_row_size,
+              right.innerIndexPtr() + right.rowStartPtr()[i], right_row_size, posLeft.data(), posRight.data());
+          for (OrdinalType t=0; t<n; ++t) {
+            inner[count + t] = leftInner[posLeft[t]];
+            values[count + t] = op(leftValues[posLeft[t]], rightValues[posRight[t]]);
           }
-        }
-      } else {
-        // find the intersection of the two rows
-        // use map to store the existing column indices and their values
-        std::unordered_map<DimensionType, DataType> m;
-        for (OrdinalType j=left.rowStartPtr()[i]; j<left.rowEndPtr()[i]; ++j)
-          m.insert({left.innerIndexPtr()[j], left.valuePtr()[j]});
-        for (OrdinalType j=right.rowStartPtr()[i]; j<right.rowEndPtr()[i]; ++j) {
-          auto it = m.find(right.innerIndexPtr()[j]);
-          if (it != m.end()) {
-            inner[count] = it -> first;
-            values[count] = op(it -> second, right.valuePtr()[j]);
-            count++;
+        } else {
+          // find the intersection of the two rows
+          // use map to store the existing column indices and their values
+          std::unordered_map<DimensionType, DataType> m;
+          for (OrdinalType j=left.rowStartPtr()[i]; j<left.rowEndPtr()[i]; ++j)
+            m.insert({left.innerIndexPtr()[j], left.valuePtr()[j]});
+          for (OrdinalType j=right.rowStartPtr()[i]; j<right.rowEndPtr()[i]; ++j) {
+            auto it = m.find(right.innerIndexPtr()[j]);
+            if (it != m.end()) {
+              inner[count] = it -> first;
+              values[count] = op(it -> second, right.valuePtr()[j]);
+              count++;
+            }
           }
         }
       }
@@ -230,7 +231,8 @@ namespace ops {
   // matrix
   // - If the non-zeros in both side are ordered the same, computations
   // can be simplified.
-  SpMat rowUnionTrival(SpMatMap & left, SpMatMap & right, OP * op) {
+  template <OP op>
+  SpMat rowUnionTrival(SpMatMap & left, SpMatMap & right) {
       SpMatMap & nonempty = (left.nonZeros() == 0) ? right : left;
       Array<OrdinalType> outer(nonempty.rows()+1);
       Array<DimensionType> inner(nonempty.nonZeros());
@@ -277,13 +279,14 @@ namespace ops {
   }
 
   // TODO: add prune option
-  SpMat rowUnion(SpMatMap & left, SpMatMap & right, OP * op) {
+  template <OP op>
+  SpMat rowUnion(SpMatMap & left, SpMatMap & right) {
     Require(left.valid() && right.valid(), "matrices in both side should be valid.");
     Require(left.rows() == right.rows(), "the number of rows on both side should be the same.");
     Require(left.cols() == right.cols(), "the number of cols on both side should be the same.");
 
     if (left.nonZeros() == 0 || right.nonZeros() == 0 || orderedTheSame(left, right)) {
-      return rowUnionTrival(left, right, op);
+      return rowUnionTrival<op>(left, right);
     }
 
     // compute the number of non-zeros for each row in the resulting
@@ -306,18 +309,9 @@ namespace ops {
       sortedrow[i] = sorted(left.innerIndexPtr(), left.rowStartPtr()[i], left.rowEndPtr()[i]) &&
         sorted(right.innerIndexPtr(), right.rowStartPtr()[i], right.rowEndPtr()[i]);
       if (sortedrow[i]) {
-        // find the size by merging two sorted rows
-        OrdinalType j=left.rowStartPtr()[i];
-        OrdinalType k=right.rowStartPtr()[i];
-        while(j < left.rowEndPtr()[i] && k < right.rowEndPtr()[i]) {
-          if (left.innerIndexPtr()[j] < right.innerIndexPtr()[k]) {
-            ++j;
-          } else if (left.innerIndexPtr()[j] > right.innerIndexPtr()[k]) {
-            ++k;
-          } else {
-            ++j, ++k, --count;
-          }
-        }
+        // find the size by intersecting two sorted rows
+        count -= sortedIntersection(left.innerIndexPtr() + left.rowStartPtr()[i], left_row_size,
+            right.innerIndexPtr() + right.rowStartPtr()[i], right_row_size, NULL, NULL);
       } else {
         // use set to store the existing column indices
         std::set<DimensionType> s;
@@ -416,5 +410,12 @@ namespace ops {
 
     return SpMat(left.rows(), left.cols(), outer, inner, values);
   }
+
+  template SpMat rowIntersection<times>(SpMatMap & left, SpMatMap & right);
+  template SpMat rowIntersection<add>(SpMatMap & left, SpMatMap & right);
+  template SpMat rowIntersection<sub>(SpMatMap & left, SpMatMap & right);
+  template SpMat rowUnion<times>(SpMatMap & left, SpMatMap & right);
+  template SpMat rowUnion<add>(SpMatMap & left, SpMatMap & right);
+  template SpMat rowUnion<sub>(SpMatMap & left, SpMatMap & right);
 }
 #endif // not defined EIGEN
@@ -25,20 +25,31 @@ namespace ops {
    * left and the right.
    *
    * It's currently used to implement `times` operation between sparse
-   * matrices. */
-  SpMat rowIntersection(SpMatMap & left, SpMatMap & right, OP * op);
+   * matrices.
+   *
+   * The element-wise operator is a template parameter so that it's inlined
+   * into the loops, it's instantiated for times, add and sub. */
+  template <OP op>
+  SpMat rowIntersection(SpMatMap & left, SpMatMap & right);
   /**
    * In parallel, for each row, do a set union on the non-zeros, for the row on the
    * left and the right.
    *
    * It's currently used to implement `sub` and `add` operations between sparse
-   * matrices. */
-  SpMat rowUnion(SpMatMap & left, SpMatMap & right, OP * op);
+   * matrices.
+   *
+   * The element-wise operator is a template parameter as in rowIntersection. */
+  template <OP op>
+  SpMat rowUnion(SpMatMap & left, SpMatMap & right);
 
   /** This function is used to check whether the non-zeros in a COO are
-   * sorted, and it's used for optimizing the performance for coo to csr
-   * conversion */
+   * sorted by rows and then columns without duplicates, and it's used for
+   * optimizing the performance for coo to csr conversion */
   bool sorted(COO & coo);
+
+  /** Whether a matmul result of rows by cols with an estimated number of
+   * non-zeros is dense enough to be computed by matmulToDense */
+  bool dense_output(int64_t estimated, DimensionType rows, DimensionType cols);
 }
 
 #endif // not defined EIGEN
@@ -22,6 +22,17 @@ namespace ops {
     }
   }
 
+  CSRMap::CSRMap(DimensionType r, DimensionType c, OrdinalType nnz,
+      OrdinalType * rows_start, OrdinalType * rows_end, DimensionType * inner, DataType * values) {
+    if (r <= 0 || c <= 0 || rows_start == NULL || rows_end == NULL) {
+      valid_ = false;
+    } else if (nnz == 0) {
+      assign(r, c, nnz, rows_start, rows_end);
+    } else {
+      assign(r, c, nnz, rows_start, rows_end, inner, values);
+    }
+  }
+
   void CSRMap::assign(DimensionType r, DimensionType c, OrdinalType nnz, OrdinalType * rows_start, OrdinalType * rows_end,
       DimensionType * col_index, DataType * values) {
     rows_ = r;
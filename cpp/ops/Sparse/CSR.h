@@ -27,6 +27,9 @@ namespace ops {
       /** 3-array CSR variant pointers for constructor */
       CSRMap(DimensionType r, DimensionType c, OrdinalType nnz,
         OrdinalType * outer, DimensionType * inner, DataType * values);
+      /** 4-array CSR variant pointers for constructor */
+      CSRMap(DimensionType r, DimensionType c, OrdinalType nnz,
+        OrdinalType * rows_start, OrdinalType * rows_end, DimensionType * inner, DataType * values);
 
       /** De-constructor: destroy the sparse matrix created */
       ~CSRMap() {}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "Arithmetic.h"
+#include "ArithmeticUtils.h"
+#include "DebugUtils.h"
+
+#include <omp.h>
+#include <algorithm>
+
+namespace ops {
+
+  /** The result of matmul is considered dense when its estimated number of
+   * non-zeros is at least DENSE_OUTPUT_RATIO of all its elements. In CSR,
+   * a non-zero takes both an index and a value, so above 1/2 the CSR
+   * result is larger than the dense one. */
+  static const double DENSE_OUTPUT_RATIO = 0.5;
+
+  bool dense_output(int64_t estimated, DimensionType rows, DimensionType cols) {
+    return estimated >= DENSE_OUTPUT_RATIO * rows * cols;
+  }
+
+  #if defined(EIGEN) || defined(MKL)
+  // The OpenMP implementation in ArithmeticOMP.cpp estimates with the
+  // analysis of its matmul, which then reuses it for the fallback. Eigen and
+  // MKL don't expose theirs, so the estimate takes its own pass.
+
+  /** The estimated number of non-zeros of left * right */
+  static int64_t estimate_nonzeros(SpMatMap & left, SpMatMap & right) {
+    const OrdinalType * leftStart, * leftEnd, * rightStart, * rightEnd;
+    rowPointers(left, leftStart, leftEnd);
+    rowPointers(right, rightStart, rightEnd);
+
+    // the min and max column indices for each row on the right
+    Array<DimensionType> rightMin(right.rows());
+    Array<DimensionType> rightMax(right.rows());
+    #pragma omp parallel for
+    for (DimensionType i=0; i<right.rows(); ++i) {
+      DimensionType min = right.cols();
+      DimensionType max = -1;
+      for (OrdinalType j=rightStart[i]; j<rightEnd[i]; ++j) {
+        DimensionType v = right.innerIndexPtr()[j];
+        min = std::min(min, v);
+        max = std::max(max, v);
+      }
+      rightMin[i] = min;
+      rightMax[i] = max;
+    }
+
+    // the number of non-zeros in a result row is bounded by both the
+    // number of insertions and the range of the inserted column indices
+    int64_t estimated = 0;
+    #pragma omp parallel for reduction(+:estimated)
+    for (DimensionType i=0; i<left.rows(); ++i) {
+      DimensionType min = right.cols();
+      DimensionType max = -1;
+      int64_t ins = 0;
+      for (OrdinalType j=leftStart[i]; j<leftEnd[i]; ++j) {
+        DimensionType v = left.innerIndexPtr()[j];
+        min = std::min(min, rightMin[v]);
+        max = std::max(max, rightMax[v]);
+        ins += rightEnd[v] - rightStart[v];
+      }
+      if (max >= min)
+        estimated += std::min(ins, (int64_t)(max - min + 1));
+    }
+    return estimated;
+  }
+
+  bool denseMatmulPreferred(SpMatMap & left, SpMatMap & right, SpMat * fallback) {
+    Require(left.cols() == right.rows(), "In matmul operation, the number of columns on the left\
+        should be equal to the number of rows on the right.");
+    if (left.rows() > 0 && right.cols() > 0 &&
+        dense_output(estimate_nonzeros(left, right), left.rows(), right.cols()))
+      return true;
+    if (fallback) *fallback = matmul(left, right);
+    return false;
+  }
+  #endif // EIGEN || MKL
+
+  #ifndef MKL // MKL has its own implementation in ArithmeticMKL.cpp
+  void matmulToDense(SpMatMap & left, SpMatMap & right, DataType * res) {
+    Require(left.cols() == right.rows(), "In matmul operation, the number of columns on the left\
+        should be equal to the number of rows on the right.");
+    const OrdinalType * leftStart, * leftEnd, * rightStart, * rightEnd;
+    rowPointers(left, leftStart, leftEnd);
+    rowPointers(right, rightStart, rightEnd);
+    const size_t cols = right.cols();
+
+    // the result row is the accumulator, so there is no symbolic phase
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (DimensionType i=0; i<left.rows(); ++i) {
+      DataType * row = res + i * cols;
+      std::fill(row, row + cols, 0);
+      for (OrdinalType j=leftStart[i]; j<leftEnd[i]; ++j) {
+        DataType v = left.valuePtr()[j];
+        DimensionType rowRight = left.innerIndexPtr()[j];
+        for (OrdinalType k=rightStart[rowRight]; k<rightEnd[rowRight]; ++k)
+          row[right.innerIndexPtr()[k]] += v * right.valuePtr()[k];
+      }
+    }
+  }
+  #endif // MKL
+} // namespace ops
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "MatmulPlan.h"
+#include "Arithmetic.h"
+#include "DebugUtils.h"
+
+#include <omp.h>
+#include <algorithm>
+
+namespace ops {
+
+  /** Copy the structure of m, compressed, into outer and inner */
+  static void copy_structure(const SpMatMap & m, Array<OrdinalType> & outer,
+      Array<DimensionType> & inner) {
+    const OrdinalType * start, * end;
+    rowPointers(m, start, end);
+    outer.resize(m.rows() + 1);
+    outer[0] = 0;
+    for (DimensionType i=0; i<m.rows(); ++i)
+      outer[i+1] = outer[i] + (end[i] - start[i]);
+    inner.resize(outer.back());
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (DimensionType i=0; i<m.rows(); ++i)
+      std::copy(m.innerIndexPtr() + start[i], m.innerIndexPtr() + end[i], inner.data() + outer[i]);
+  }
+
+  /** Whether m has the structure copied by copy_structure */
+  static bool same_structure(const SpMatMap & m, const Array<OrdinalType> & outer,
+      const Array<DimensionType> & inner) {
+    const OrdinalType * start, * end;
+    rowPointers(m, start, end);
+    DimensionType mismatches = 0;
+    #pragma omp parallel for schedule(dynamic, 64) reduction(+:mismatches)
+    for (DimensionType i=0; i<m.rows(); ++i) {
+      if (end[i] - start[i] != outer[i+1] - outer[i] ||
+          !std::equal(m.innerIndexPtr() + start[i], m.innerIndexPtr() + end[i], inner.data() + outer[i]))
+        mismatches++;
+    }
+    return mismatches == 0;
+  }
+
+  MatmulPlan::MatmulPlan(const SpMatMap & left, const SpMatMap & right) :
+      rows_(left.rows()), mid_(left.cols()), cols_(right.cols()) {
+    Require(left.cols() == right.rows(), "In matmul operation, the number of columns on the left\
+        should be equal to the number of rows on the right.");
+    copy_structure(left, leftOuter_, leftInner_);
+    copy_structure(right, rightOuter_, rightInner_);
+    symbolic(left, right);
+  }
+
+  void MatmulPlan::execute(const SpMatMap & left, const SpMatMap & right, DataType * values) const {
+    Require(left.rows() == rows_ && left.cols() == mid_ && right.cols() == cols_,
+        "The shapes of the inputs are different from the ones the matmul plan is created for");
+    // the accumulators index their tables and the result by the structure,
+    // so check it before writing anything
+    Require(same_structure(left, leftOuter_, leftInner_) && same_structure(right, rightOuter_, rightInner_),
+        "The structures of the inputs are different from the ones the matmul plan is created for");
+    if (nonZeros() == 0) return;
+    numeric(left, right, values);
+  }
+
+  SpMat MatmulPlan::execute(const SpMatMap & left, const SpMatMap & right) const {
+    if (nonZeros() == 0) {
+      execute(left, right, NULL);
+      return SpMat(rows_, cols_);
+    }
+    Array<OrdinalType> outer(outer_.size());
+    Array<DimensionType> inner(inner_.size());
+    Array<DataType> values(inner_.size());
+    std::copy(outer_.data(), outer_.data() + outer_.size(), outer.data());
+    std::copy(inner_.data(), inner_.data() + inner_.size(), inner.data());
+    execute(left, right, values.data());
+    #ifdef EIGEN
+    return SpMat(SpMatMap(rows_, cols_, values.size(), outer.data(), inner.data(), values.data()));
+    #else
+    return SpMat(rows_, cols_, outer, inner, values);
+    #endif
+  }
+
+  #if defined(EIGEN) || defined(MKL)
+  // The OpenMP implementation runs the phases with its accumulators in
+  // ArithmeticOMP.cpp. Eigen and MKL don't expose theirs, so the phases run
+  // their matmul.
+
+  void MatmulPlan::symbolic(const SpMatMap & left, const SpMatMap & right) {
+    // the structure is the one of the product of the inputs with all their
+    // values set to 1, which can't cancel out
+    Array<DataType> leftOnes(leftInner_.size()), rightOnes(rightInner_.size());
+    std::fill(leftOnes.data(), leftOnes.data() + leftOnes.size(), 1);
+    std::fill(rightOnes.data(), rightOnes.data() + rightOnes.size(), 1);
+    SpMatMap leftPattern(rows_, mid_, leftInner_.size(), leftOuter_.data(), leftInner_.data(), leftOnes.data());
+    SpMatMap rightPattern(mid_, cols_, rightInner_.size(), rightOuter_.data(), rightInner_.data(), rightOnes.data());
+    SpMat product = matmul(leftPattern, rightPattern);
+
+    const OrdinalType * start, * end;
+    rowPointers(product, start, end);
+    outer_.resize(rows_ + 1);
+    outer_[0] = 0;
+    for (DimensionType i=0; i<rows_; ++i)
+      outer_[i+1] = outer_[i] + (end[i] - start[i]);
+    inner_.resize(outer_.back());
+    // sorted, for numeric() to find the columns of the products
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (DimensionType i=0; i<rows_; ++i) {
+      DimensionType * row = inner_.data() + outer_[i];
+      std::copy(product.innerIndexPtr() + start[i], product.innerIndexPtr() + end[i], row);
+      std::sort(row, inner_.data() + outer_[i+1]);
+    }
+  }
+
+  void MatmulPlan::numeric(const SpMatMap & left, const SpMatMap & right, DataType * values) const {
+    SpMat product = matmul(const_cast<SpMatMap &>(left), const_cast<SpMatMap &>(right));
+    const OrdinalType * start, * end;
+    rowPointers(product, start, end);
+    // the product may have pruned out zeros, which stay in the structure
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (DimensionType i=0; i<rows_; ++i) {
+      const DimensionType * row = inner_.data() + outer_[i];
+      const DimensionType * rowEnd = inner_.data() + outer_[i+1];
+      std::fill(values + outer_[i], values + outer_[i+1], 0);
+      for (OrdinalType k=start[i]; k<end[i]; ++k)
+        values[outer_[i] + (std::lower_bound(row, rowEnd, product.innerIndexPtr()[k]) - row)] =
+          product.valuePtr()[k];
+    }
+  }
+  #endif // EIGEN || MKL
+} // namespace ops
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef OPS_SPARSEMATMULPLAN_H_
+#define OPS_SPARSEMATMULPLAN_H_
+
+#include "SpMat.h"
+#include "MemUtils.h"
+
+namespace ops {
+  /**
+   * A reusable plan for sparse matrix multiplication: left * right.
+   *
+   * Constructing a plan runs the analysis and the symbolic phase of matmul
+   * once, with the same accumulators, to compute the sparsity structure of
+   * the result (outer and inner). execute() then only runs the numeric
+   * phase, so the plan can be reused as long as the sparsity structures of
+   * left and right stay the same and only their values change.
+   *
+   * Note that:
+   * the result structure is the structural one: products cancelling each
+   * other out are kept as explicit zeros instead of being pruned out, so
+   * that the structure doesn't depend on the values. After pruning the
+   * zeros, the result is the one of matmul.
+   * execute() checks that the inputs have the structures the plan is
+   * created for, which the accumulators rely on to stay within their
+   * tables and the result.
+   * With Eigen and MKL, which have no separate numeric phase, execute()
+   * runs their matmul and scatters its result into the structure. */
+  class MatmulPlan {
+    public:
+      /** Run the symbolic phase for left * right */
+      MatmulPlan(const SpMatMap & left, const SpMatMap & right);
+      /** Copy is not supported */
+      MatmulPlan(const MatmulPlan& other) = delete;
+      /** Copy assignment is not supported */
+      MatmulPlan& operator=(const MatmulPlan& other) = delete;
+      /** Move constructor */
+      MatmulPlan(MatmulPlan&& other) noexcept = default;
+      /** Move assignment */
+      MatmulPlan& operator=(MatmulPlan&& other) noexcept = default;
+
+      /** Run the numeric phase into values, which is preallocated with
+       * nonZeros() elements, in the order of outer() and inner() */
+      void execute(const SpMatMap & left, const SpMatMap & right, DataType * values) const;
+      /** Run the numeric phase and return the result as a new matrix */
+      SpMat execute(const SpMatMap & left, const SpMatMap & right) const;
+
+      DimensionType rows() const { return rows_; }
+      DimensionType cols() const { return cols_; }
+      OrdinalType nonZeros() const { return outer_.data()[outer_.size() - 1]; }
+      /** get the row pointers of the result, with rows() + 1 elements */
+      const Array<OrdinalType> & outer() const { return outer_; }
+      /** get the column indices of the result, with nonZeros() elements */
+      const Array<DimensionType> & inner() const { return inner_; }
+
+    private:
+      /** compute outer_ and inner_, and what numeric() needs, implemented
+       * by the sparse library */
+      void symbolic(const SpMatMap & left, const SpMatMap & right);
+      /** compute the values of the result into values */
+      void numeric(const SpMatMap & left, const SpMatMap & right, DataType * values) const;
+
+      /** shapes of the inputs, to check the inputs on execute() */
+      DimensionType rows_, mid_, cols_;
+      /** the structures of the inputs, compressed, to check the inputs on
+       * execute() */
+      Array<OrdinalType> leftOuter_, rightOuter_;
+      Array<DimensionType> leftInner_, rightInner_;
+      /** the structure of the result matrix in the 3-array CSR format */
+      Array<OrdinalType> outer_;
+      Array<DimensionType> inner_;
+      /** the blocks of rows balanced by their multiplications, the minimum
+       * column index of each result row, the sizes of the accumulators and
+       * whether they are hash tables, see matmul in ArithmeticOMP.cpp */
+      Array<DimensionType> blocks_;
+      Array<DimensionType> vMin_;
+      OrdinalType maxInsRange_ = 0, maxIns_ = 0;
+      bool hash_ = false;
+  };
+} // namespace ops
+
+#endif // OPS_SPARSEMATMULPLAN_H_
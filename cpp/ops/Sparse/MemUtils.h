@@ -14,29 +14,18 @@
 #include <utility> // swap
 #include <string> // to_string
 #include <type_traits> //std::is_same
-#include "Sparse/DebugUtils.h" // Require
-
-#ifdef MKL
-#include <mkl.h> // mkl_calloc, mkl_malloc, mkl_free
-#else
-#include <stdlib.h> // malloc, calloc, free
 #include <stdint.h> // int32_t
-#endif
+#include "Sparse/DebugUtils.h" // Require
+#include "Sparse/Pool.h" // pool_calloc, pool_malloc, pool_free
 
 namespace ops {
 
-#ifdef MKL
   /** Memory allocation interfaces
-   * 128 is the alignment size */
-  #define CALLOC(n, e) mkl_calloc(n, e, 128)
-  #define MALLOC(s) mkl_malloc(s, 128)
-  #define FREE(ptr) mkl_free(ptr)
-#else
-  /** Memory allocation interfaces */
-  #define CALLOC(n, e) calloc(n, e)
-  #define MALLOC(s) malloc(s)
-  #define FREE(ptr) free(ptr)
-#endif
+   * The memory comes from the pool of Pool.h, which gets it from mkl_malloc
+   * with MKL, and malloc otherwise. */
+  #define CALLOC(n, e) ops::pool_calloc(n, e)
+  #define MALLOC(s) ops::pool_malloc(s)
+  #define FREE(ptr) ops::pool_free(ptr)
 
   /** Basic types used */
   typedef int32_t INT;
@@ -70,7 +59,10 @@ namespace ops {
    * Note : this class is similar with C++ vector but not the same.
    * This class only supports functions needed for sparse computation. Others,
    * such as copy constructor, copy assignment, appending, and automatic
-   * resizing, are not supported. */
+   * resizing, are not supported.
+   *
+   * An Array can also be a non-owning view on memory owned by others, see
+   * view(), which is not freed by the Array. */
   template <class T_>
   class Array {
     private:
@@ -78,6 +70,9 @@ namespace ops {
       T_ * data_;
       /** The number of elements in the data_ array */
       size_t size_;
+      /** Whether data_ is allocated and freed by this Array, it is false
+       * for a view */
+      bool owned_ = true;
 
     public:
       /** A empty constructor */
@@ -112,6 +107,17 @@ namespace ops {
           data_[i++] = it;
       }
 
+      /** Build a non-owning Array viewing size elements starting from
+       * data, which needs to outlive the Array and is not freed by it.
+       * Resizing a view allocates new memory owned by the Array. */
+      static Array view(T_ * data, size_t size) {
+        Array a;
+        a.data_ = data;
+        a.size_ = size;
+        a.owned_ = false;
+        return a;
+      }
+
       /** Clean up the memory */
       ~Array() { clear(); }
 
@@ -124,12 +130,14 @@ namespace ops {
       Array(Array&& other) noexcept : size_(0), data_(NULL) {
         std::swap(data_, other.data_);
         std::swap(size_, other.size_);
+        std::swap(owned_, other.owned_);
       }
       /** move assignment */
       Array& operator=(Array&& other) noexcept
       {
         std::swap(data_, other.data_);
         std::swap(size_, other.size_);
+        std::swap(owned_, other.owned_);
         other.clear();
         return *this;
       }
@@ -139,25 +147,32 @@ namespace ops {
       // released and new memory will be allocated.
       void resize(size_t size) {
         if (size == 0) clear();
-        else if (size_ != size) {
+        else if (size_ != size || !owned_) {
           clear();
           Malloc(data_, size * sizeof(T_));
           size_ = size;
         }
       }
 
-      /** Clean up the memory */
+      /** Clean up the memory, or drop the view */
       void clear() {
         if (size_ != 0) {
-          FREE(data_);
+          if (owned_) FREE(data_);
           size_ = 0;
           data_ = NULL;
         }
+        owned_ = true;
       }
 
-      /** Assign the given value to data_ */
+      /** Return whether the Array owns its memory, rather than being a
+       * view */
+      bool owned() const { return owned_; }
+
+      /** Assign the given value to data_
+       * The static schedule matches the first touch of large blocks, see
+       * pool_set_first_touch */
       void assign(T_ v) {
-        #pragma omp parallel for
+        #pragma omp parallel for schedule(static)
         for (size_t i=0; i<size_; i++) data_[i] = v;
       }
 
@@ -165,7 +180,7 @@ namespace ops {
       template<typename T>
       void assign(T * data, size_t size) {
         resize(size);
-        #pragma omp parallel for
+        #pragma omp parallel for schedule(static)
         for (size_t i=0; i<size_; i++) data_[i] = (T_)data[i];
       }
 
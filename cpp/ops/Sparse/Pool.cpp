@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "Sparse/Pool.h"
+
+#include <algorithm> // min
+#include <atomic>
+#include <mutex>
+#include <string.h> // memset
+#include <vector>
+
+#ifdef MKL
+#include <mkl.h> // mkl_malloc, mkl_free
+#else
+#include <stdlib.h> // posix_memalign, free
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h> // madvise
+#endif
+
+#include <omp.h>
+
+namespace ops {
+  namespace {
+    /** The smallest class holds 64 bytes, the largest 256 MB */
+    const int MIN_CLASS_SHIFT = 6;
+    const int MAX_CLASS_SHIFT = 27;
+    const int NUM_CLASSES = 1 + (MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1) * 4;
+    /** The class of the blocks too large to be pooled */
+    const uint32_t LARGE = UINT32_MAX;
+
+    /** The thread caches keep at most THREAD_CACHE_BLOCKS blocks of each
+     * class, and THREAD_CACHE_BYTES in total. Larger blocks go to the
+     * central cache. */
+    const size_t THREAD_CACHE_BLOCKS = 8;
+    const size_t THREAD_CACHE_BYTES = 4 << 20;
+    const size_t THREAD_CACHE_MAX_BLOCK = 1 << 20;
+
+    const size_t DEFAULT_MAX_CACHED = 512 << 20;
+
+    /** The header at the start of each block, followed by the memory
+     * returned to the caller at POOL_ALIGNMENT */
+    struct Header {
+      uint32_t size_class;
+      /** The bytes of the block, including the header */
+      size_t size;
+    };
+    static_assert(sizeof(Header) <= POOL_ALIGNMENT,
+                  "The header should fit in the alignment padding");
+
+    std::atomic<uint64_t> allocations(0);
+    std::atomic<uint64_t> system_allocations(0);
+    std::atomic<uint64_t> bytes_in_use(0);
+    std::atomic<uint64_t> bytes_cached(0);
+    std::atomic<size_t> max_cached(DEFAULT_MAX_CACHED);
+    std::atomic<bool> huge_pages(false);
+    std::atomic<bool> first_touch(false);
+
+    /** The page size used for the first touch, the smallest on the
+     * supported platforms */
+    const size_t TOUCH_PAGE_SIZE = 4096;
+
+    void * system_aligned_alloc(size_t size, size_t alignment) {
+    #ifdef MKL
+      return mkl_malloc(size, alignment);
+    #else
+      void * block = NULL;
+      if (posix_memalign(&block, alignment, size) != 0) return NULL;
+      return block;
+    #endif
+    }
+
+    /** Write to each page of a new block from the thread that the static
+     * schedule assigns it to, so that the page is placed on that thread's
+     * node */
+    void touch_pages(void * block, size_t size) {
+      char * bytes = (char *) block;
+      long pages = (long) ((size + TOUCH_PAGE_SIZE - 1) / TOUCH_PAGE_SIZE);
+      #pragma omp parallel for schedule(static)
+      for (long i=0; i<pages; i++) bytes[i * TOUCH_PAGE_SIZE] = 0;
+    }
+
+    /** Allocate a block of at least size bytes, and return its size in
+     * size */
+    void * system_alloc(size_t & size) {
+      if (size < POOL_LARGE_BLOCK) return system_aligned_alloc(size, POOL_ALIGNMENT);
+      void * block;
+      if (huge_pages) {
+        size = (size + POOL_LARGE_BLOCK - 1) / POOL_LARGE_BLOCK * POOL_LARGE_BLOCK;
+        block = system_aligned_alloc(size, POOL_LARGE_BLOCK);
+      #ifdef __linux__
+        // Best effort, the kernel may not support transparent huge pages
+        if (block != NULL) madvise(block, size, MADV_HUGEPAGE);
+      #endif
+      } else {
+        block = system_aligned_alloc(size, POOL_ALIGNMENT);
+      }
+      if (block != NULL && first_touch) touch_pages(block, size);
+      return block;
+    }
+
+    void system_free(void * block) {
+    #ifdef MKL
+      mkl_free(block);
+    #else
+      free(block);
+    #endif
+    }
+
+    /** Return the class of the blocks of size bytes, or -1 if they are too
+     * large to be pooled.
+     * Class 0 holds 64 bytes, and the next ones split each power of two
+     * range (2^k, 2^(k+1)] in four, so that a block wastes at most a
+     * quarter of its size. */
+    int size_class(size_t size) {
+      if (size <= ((size_t)1 << MIN_CLASS_SHIFT)) return 0;
+      int k = MIN_CLASS_SHIFT;
+      while (k < MAX_CLASS_SHIFT && ((size_t)1 << (k + 1)) < size) k++;
+      if (((size_t)1 << (k + 1)) < size) return -1;
+      size_t base = (size_t)1 << k, step = base >> 2;
+      return (k - MIN_CLASS_SHIFT) * 4 + (int)((size - base + step - 1) / step);
+    }
+
+    size_t class_size(int c) {
+      if (c == 0) return (size_t)1 << MIN_CLASS_SHIFT;
+      int k = MIN_CLASS_SHIFT + (c - 1) / 4;
+      return ((size_t)1 << k) + ((c - 1) % 4 + 1) * ((size_t)1 << (k - 2));
+    }
+
+    /** The free blocks shared by all the threads */
+    class CentralCache {
+      private:
+        std::mutex mutex_;
+        std::vector<void*> free_[NUM_CLASSES];
+        size_t bytes_ = 0;
+
+        /** Release blocks until the cache holds at most max bytes, with
+         * mutex_ held */
+        void shrink(size_t max) {
+          for (int c = NUM_CLASSES - 1; c >= 0 && bytes_ > max; c--) {
+            while (!free_[c].empty() && bytes_ > max) {
+              system_free(free_[c].back());
+              free_[c].pop_back();
+              bytes_ -= class_size(c);
+              bytes_cached -= class_size(c);
+            }
+          }
+        }
+
+      public:
+        /** Return a free block of class c, or NULL */
+        void * pop(int c) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (free_[c].empty()) return NULL;
+          void * block = free_[c].back();
+          free_[c].pop_back();
+          bytes_ -= class_size(c);
+          bytes_cached -= class_size(c);
+          return block;
+        }
+
+        /** Keep a free block of class c, or release it if the cache is
+         * full */
+        void push(int c, void * block) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (bytes_ + class_size(c) > max_cached) {
+            system_free(block);
+            return;
+          }
+          free_[c].push_back(block);
+          bytes_ += class_size(c);
+          bytes_cached += class_size(c);
+        }
+
+        void trim(size_t max) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          shrink(max);
+        }
+    };
+
+    /** Never destroyed, as the thread caches of the threads exiting after
+     * the static destructors still move their blocks to it */
+    CentralCache & central() {
+      static CentralCache * cache = new CentralCache();
+      return *cache;
+    }
+
+    /** The free blocks of a thread */
+    class ThreadCache {
+      private:
+        std::vector<void*> free_[NUM_CLASSES];
+        size_t bytes_ = 0;
+
+      public:
+        ~ThreadCache() { flush(); }
+
+        void * pop(int c) {
+          if (free_[c].empty()) return NULL;
+          void * block = free_[c].back();
+          free_[c].pop_back();
+          bytes_ -= class_size(c);
+          bytes_cached -= class_size(c);
+          return block;
+        }
+
+        /** Keep a free block of class c, returning false if the cache is
+         * full */
+        bool push(int c, void * block) {
+          if (class_size(c) > THREAD_CACHE_MAX_BLOCK
+              || free_[c].size() >= THREAD_CACHE_BLOCKS
+              || bytes_ + class_size(c) > THREAD_CACHE_BYTES
+              || max_cached == 0)
+            return false;
+          free_[c].push_back(block);
+          bytes_ += class_size(c);
+          bytes_cached += class_size(c);
+          return true;
+        }
+
+        /** Move all the blocks to the central cache */
+        void flush() {
+          for (int c = 0; c < NUM_CLASSES; c++) {
+            for (void * block : free_[c]) {
+              bytes_cached -= class_size(c);
+              central().push(c, block);
+            }
+            free_[c].clear();
+          }
+          bytes_ = 0;
+        }
+    };
+
+    thread_local ThreadCache thread_cache;
+  } // namespace
+
+  void * pool_malloc(size_t size) {
+    allocations++;
+    if (size > SIZE_MAX - POOL_ALIGNMENT) return NULL;
+    size_t total = size + POOL_ALIGNMENT;
+    int c = size_class(total);
+    void * block = NULL;
+    if (c >= 0) {
+      total = class_size(c);
+      block = thread_cache.pop(c);
+      if (block == NULL) block = central().pop(c);
+    }
+    if (block == NULL) {
+      block = system_alloc(total);
+      if (block == NULL) return NULL;
+      system_allocations++;
+      Header * header = (Header *) block;
+      header->size_class = c >= 0 ? (uint32_t) c : LARGE;
+      header->size = total;
+    }
+    // Rounded up to whole huge pages if allocated with them
+    bytes_in_use += ((Header *) block)->size;
+    return (char *) block + POOL_ALIGNMENT;
+  }
+
+  void * pool_calloc(size_t n, size_t e) {
+    if (e != 0 && n > SIZE_MAX / e) return NULL;
+    size_t size = n * e;
+    void * ptr = pool_malloc(size);
+    if (ptr == NULL) return NULL;
+    // Reused blocks hold the data of their previous use
+    if (size >= POOL_LARGE_BLOCK && first_touch) {
+      // Zero each thread's chunk from the thread, like touch_pages
+      char * bytes = (char *) ptr;
+      long chunks = (long) ((size + TOUCH_PAGE_SIZE - 1) / TOUCH_PAGE_SIZE);
+      #pragma omp parallel for schedule(static)
+      for (long i=0; i<chunks; i++)
+        memset(bytes + i * TOUCH_PAGE_SIZE, 0,
+               std::min(TOUCH_PAGE_SIZE, size - i * TOUCH_PAGE_SIZE));
+    } else {
+      memset(ptr, 0, size);
+    }
+    return ptr;
+  }
+
+  void pool_free(void * ptr) {
+    if (ptr == NULL) return;
+    void * block = (char *) ptr - POOL_ALIGNMENT;
+    Header * header = (Header *) block;
+    bytes_in_use -= header->size;
+    if (header->size_class == LARGE) {
+      system_free(block);
+      return;
+    }
+    int c = (int) header->size_class;
+    if (!thread_cache.push(c, block)) central().push(c, block);
+  }
+
+  PoolStats pool_stats() {
+    return PoolStats{allocations, system_allocations, bytes_in_use,
+                     bytes_cached};
+  }
+
+  void pool_trim() {
+    thread_cache.flush();
+    central().trim(0);
+  }
+
+  void pool_set_huge_pages(bool enabled) { huge_pages = enabled; }
+
+  void pool_set_first_touch(bool enabled) { first_touch = enabled; }
+
+  void pool_set_max_cached(size_t bytes) {
+    max_cached = bytes;
+    if (bytes == 0) thread_cache.flush();
+    central().trim(bytes);
+  }
+} // namespace ops
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef OPS_POOL_H_
+#define OPS_POOL_H_
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+namespace ops {
+  /**
+   * A size-class pool allocator for the memory of the sparse computation,
+   * behind the CALLOC, MALLOC and FREE macros of MemUtils.h.
+   *
+   * Each sparse op allocates its results and several temporaries, and a
+   * training loop runs the same ops on the same shapes at each step. Freed
+   * blocks are kept in size classes, four per power of two, and reused by
+   * the next allocations of their class instead of going back to the
+   * system allocator, which saves both the calls and the page faults on
+   * fresh memory.
+   *
+   * Each thread caches a few free blocks of each class, so that the
+   * parallel regions allocating per-thread tables don't contend on a lock.
+   * The rest are kept in a central cache shared by all the threads, which
+   * also gets the blocks freed by other threads than the allocating one,
+   * e.g. results allocated in a parallel region and freed from Java.
+   *
+   * Blocks are aligned to POOL_ALIGNMENT, the MKL preferred alignment with
+   * MKL. Blocks larger than the largest class aren't pooled. */
+
+  #ifdef MKL
+  const size_t POOL_ALIGNMENT = 128;
+  #else
+  const size_t POOL_ALIGNMENT = 64;
+  #endif
+
+  /** Counters of the pool */
+  struct PoolStats {
+    /** The number of blocks allocated */
+    uint64_t allocations;
+    /** The number of them allocated by the system allocator */
+    uint64_t system_allocations;
+    /** The bytes of the blocks in use, rounded up to their size class */
+    uint64_t bytes_in_use;
+    /** The bytes of the free blocks kept by the caches */
+    uint64_t bytes_cached;
+  };
+
+  /** Allocate size bytes, or return NULL */
+  void * pool_malloc(size_t size);
+  /** Allocate n zero-initialized elements of e bytes, or return NULL */
+  void * pool_calloc(size_t n, size_t e);
+  /** Free a block allocated by pool_malloc or pool_calloc, or do nothing
+   * for NULL */
+  void pool_free(void * ptr);
+
+  PoolStats pool_stats();
+
+  /** Release the free blocks of the central cache and of the calling
+   * thread's cache to the system allocator. The caches of other threads
+   * are bounded, and are moved to the central cache when their thread
+   * exits. */
+  void pool_trim();
+
+  /** The size from which blocks are large, for the large block modes
+   * below: the size of a huge page on x86-64 */
+  const size_t POOL_LARGE_BLOCK = 2 << 20;
+
+  /** Back the new large blocks with transparent huge pages, with madvise
+   * on Linux, which saves TLB misses on the long scans of the sparse ops.
+   * Off by default, as the blocks are then rounded up to whole huge
+   * pages. */
+  void pool_set_huge_pages(bool enabled);
+
+  /** Touch the pages of the new large blocks from the OpenMP threads, with
+   * the static schedule of the parallel loops over arrays, e.g.
+   * Array::assign. With the first-touch policy of Linux, the pages of each
+   * thread's chunk then land on the NUMA node of the thread, instead of all
+   * on the node of the allocating thread, which halves the bandwidth of the
+   * parallel loops on two sockets. Large blocks are also zeroed in parallel
+   * by pool_calloc. Off by default. */
+  void pool_set_first_touch(bool enabled);
+
+  /** Set the most bytes kept by the central cache, beyond which freed
+   * blocks are released to the system allocator. 0 disables the caches,
+   * so that all the blocks are freed to the system allocator. */
+  void pool_set_max_cached(size_t bytes);
+} // namespace ops
+
+#endif // OPS_POOL_H_
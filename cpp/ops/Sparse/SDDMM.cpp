@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "Arithmetic.h"
+#include "DebugUtils.h"
+
+#include <omp.h>
+
+namespace ops {
+
+  SpMat sddmm(SpMatMap & pattern, const DataType * left, const DataType * right, DimensionType inner) {
+    Require(inner >= 0, "In sddmm operation, the inner dimension should not be negative.");
+    if (pattern.nonZeros() == 0) return SpMat(pattern.rows(), pattern.cols());
+
+    const OrdinalType * rowsStart, * rowsEnd;
+    rowPointers(pattern, rowsStart, rowsEnd);
+    const DimensionType rows = pattern.rows();
+
+    // the result keeps the structure of the pattern in the 3-array format
+    Array<OrdinalType> outer(rows + 1);
+    outer[0] = 0;
+    for (DimensionType i=0; i<rows; ++i) outer[i+1] = outer[i] + (rowsEnd[i] - rowsStart[i]);
+    Array<DimensionType> indices(outer.back());
+    Array<DataType> values(outer.back());
+
+    // a row of left is reused for all the non-zeros in the row, and each
+    // dot product runs over continuous memory on both sides
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (DimensionType i=0; i<rows; ++i) {
+      const DataType * leftRow = left + (size_t)i * inner;
+      OrdinalType k = outer[i];
+      for (OrdinalType j=rowsStart[i]; j<rowsEnd[i]; ++j, ++k) {
+        DimensionType col = pattern.innerIndexPtr()[j];
+        const DataType * rightRow = right + (size_t)col * inner;
+        DataType sum = 0;
+        #pragma omp simd reduction(+:sum)
+        for (DimensionType c=0; c<inner; ++c) sum += leftRow[c] * rightRow[c];
+        indices[k] = col;
+        values[k] = sum;
+      }
+    }
+    #ifdef EIGEN
+    return SpMat(SpMatMap(rows, pattern.cols(), values.size(), outer.data(), indices.data(), values.data()));
+    #else
+    return SpMat(rows, pattern.cols(), outer, indices, values);
+    #endif
+  }
+} // namespace ops
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "SortedIntersection.h"
+
+// the SIMD kernels are compiled with target attributes, so the library
+// doesn't need to be built with -mavx2 and still runs on older CPUs
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define OPS_INTERSECTION_X86
+#include <immintrin.h>
+#endif
+
+namespace ops {
+
+  typedef OrdinalType IntersectionKernel(const DimensionType *, OrdinalType,
+      const DimensionType *, OrdinalType, OrdinalType *, OrdinalType *);
+
+  /** Merge a[i:na] and b[j:nb], with n common indices found before */
+  static inline OrdinalType intersect_merge(const DimensionType * a, OrdinalType na,
+      const DimensionType * b, OrdinalType nb, OrdinalType * posA, OrdinalType * posB,
+      OrdinalType i, OrdinalType j, OrdinalType n) {
+    while (i < na && j < nb) {
+      if (a[i] < b[j]) {
+        ++i;
+      } else if (a[i] > b[j]) {
+        ++j;
+      } else {
+        if (posA != NULL) {
+          posA[n] = i;
+          posB[n] = j;
+        }
+        ++i, ++j, ++n;
+      }
+    }
+    return n;
+  }
+
+  static OrdinalType intersect_scalar(const DimensionType * a, OrdinalType na,
+      const DimensionType * b, OrdinalType nb, OrdinalType * posA, OrdinalType * posB) {
+    return intersect_merge(a, na, b, nb, posA, posB, 0, 0, 0);
+  }
+
+  #ifdef OPS_INTERSECTION_X86
+  /** Record the matches of a block of a starting from i and a block of b
+   * starting from j. As the indices are unique, the t-th bit set in maskA
+   * and the t-th bit set in maskB are the same index. */
+  static inline void record_matches(unsigned maskA, unsigned maskB, OrdinalType i, OrdinalType j,
+      OrdinalType * posA, OrdinalType * posB, OrdinalType & n) {
+    if (posA == NULL) {
+      n += __builtin_popcount(maskA);
+      return;
+    }
+    while (maskA != 0) {
+      posA[n] = i + __builtin_ctz(maskA);
+      posB[n] = j + __builtin_ctz(maskB);
+      maskA &= maskA - 1;
+      maskB &= maskB - 1;
+      ++n;
+    }
+  }
+
+  /**
+   * Compare blocks of W indices from both sides all-to-all, by comparing
+   * one block against the W rotations of the other. After a pair of blocks,
+   * the block with the smaller last index can't have any more matches and
+   * is skipped. The rest is merged by scalar code. */
+  __attribute__((target("avx2")))
+  static OrdinalType intersect_avx2(const DimensionType * a, OrdinalType na,
+      const DimensionType * b, OrdinalType nb, OrdinalType * posA, OrdinalType * posB) {
+    const OrdinalType W = 8;
+    const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+    OrdinalType i = 0, j = 0, n = 0;
+    while (i + W <= na && j + W <= nb) {
+      DimensionType aMax = a[i + W - 1], bMax = b[j + W - 1];
+      // skip the blocks without overlap directly
+      if (aMax < b[j]) { i += W; continue; }
+      if (bMax < a[i]) { j += W; continue; }
+      __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+      __m256i vb = _mm256_loadu_si256((const __m256i *)(b + j));
+      __m256i matchA = _mm256_cmpeq_epi32(va, vb);
+      __m256i matchB = matchA;
+      __m256i ra = va, rb = vb;
+      for (OrdinalType r = 1; r < W; ++r) {
+        ra = _mm256_permutevar8x32_epi32(ra, rotate);
+        rb = _mm256_permutevar8x32_epi32(rb, rotate);
+        matchA = _mm256_or_si256(matchA, _mm256_cmpeq_epi32(va, rb));
+        matchB = _mm256_or_si256(matchB, _mm256_cmpeq_epi32(vb, ra));
+      }
+      unsigned maskA = _mm256_movemask_ps(_mm256_castsi256_ps(matchA));
+      unsigned maskB = _mm256_movemask_ps(_mm256_castsi256_ps(matchB));
+      record_matches(maskA, maskB, i, j, posA, posB, n);
+      if (aMax <= bMax) i += W;
+      if (bMax <= aMax) j += W;
+    }
+    return intersect_merge(a, na, b, nb, posA, posB, i, j, n);
+  }
+
+  /** The same as intersect_avx2, with blocks of 16 indices */
+  __attribute__((target("avx512f")))
+  static OrdinalType intersect_avx512(const DimensionType * a, OrdinalType na,
+      const DimensionType * b, OrdinalType nb, OrdinalType * posA, OrdinalType * posB) {
+    const OrdinalType W = 16;
+    const __m512i rotate = _mm512_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0);
+    OrdinalType i = 0, j = 0, n = 0;
+    while (i + W <= na && j + W <= nb) {
+      DimensionType aMax = a[i + W - 1], bMax = b[j + W - 1];
+      if (aMax < b[j]) { i += W; continue; }
+      if (bMax < a[i]) { j += W; continue; }
+      __m512i va = _mm512_loadu_si512((const void *)(a + i));
+      __m512i vb = _mm512_loadu_si512((const void *)(b + j));
+      __mmask16 maskA = _mm512_cmpeq_epi32_mask(va, vb);
+      __mmask16 maskB = maskA;
+      __m512i ra = va, rb = vb;
+      for (OrdinalType r = 1; r < W; ++r) {
+        ra = _mm512_permutexvar_epi32(rotate, ra);
+        rb = _mm512_permutexvar_epi32(rotate, rb);
+        maskA |= _mm512_cmpeq_epi32_mask(va, rb);
+        maskB |= _mm512_cmpeq_epi32_mask(vb, ra);
+      }
+      record_matches(maskA, maskB, i, j, posA, posB, n);
+      if (aMax <= bMax) i += W;
+      if (bMax <= aMax) j += W;
+    }
+    return intersect_merge(a, na, b, nb, posA, posB, i, j, n);
+  }
+  #endif // OPS_INTERSECTION_X86
+
+  static IntersectionKernel * select_kernel() {
+    #ifdef OPS_INTERSECTION_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return intersect_avx512;
+    if (__builtin_cpu_supports("avx2")) return intersect_avx2;
+    #endif
+    return intersect_scalar;
+  }
+
+  OrdinalType sortedIntersection(const DimensionType * a, OrdinalType na,
+      const DimensionType * b, OrdinalType nb, OrdinalType * posA, OrdinalType * posB) {
+    static IntersectionKernel * const kernel = select_kernel();
+    return kernel(a, na, b, nb, posA, posB);
+  }
+} // namespace ops
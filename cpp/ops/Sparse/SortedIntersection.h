@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef OPS_SPARSESORTEDINTERSECTION_H_
+#define OPS_SPARSESORTEDINTERSECTION_H_
+
+#include "MemUtils.h"
+
+namespace ops {
+  /**
+   * Find the common indices of two strictly increasing index arrays a and b,
+   * of sizes na and nb.
+   *
+   * For the t-th common index, its position in a is written to posA[t] and
+   * its position in b to posB[t], so both need min(na, nb) elements. When
+   * posA and posB are NULL, the common indices are only counted.
+   *
+   * It returns the number of common indices.
+   *
+   * The kernel is selected once at runtime: AVX-512 or AVX2 when the CPU
+   * supports them, otherwise a scalar merge. */
+  OrdinalType sortedIntersection(const DimensionType * a, OrdinalType na,
+      const DimensionType * b, OrdinalType nb, OrdinalType * posA, OrdinalType * posB);
+} // namespace ops
+
+#endif // OPS_SPARSESORTEDINTERSECTION_H_
@@ -208,4 +208,45 @@ std::vector<MemWrapper<SpMatMap>> SparseFloatTensor::toSparse2Ds()
   return sparse2Ds;
 }
 
+SpMat SparseFloatTensor::toBlockDiagonal() const
+{
+  Require(shape_.size() == 3, "toBlockDiagonal can only support 3D tensor transforming");
+  const DimensionType batchSize = shape_[0], rows = shape_[1], cols = shape_[2];
+  const DimensionType totalRows = batchSize * rows, totalCols = batchSize * cols;
+  const OrdinalType nnz = values_.size();
+  if (nnz == 0) return SpMat(totalRows, totalCols);
+
+  const Array<DimensionType> & rowIds = dims_[0].inner();
+  const Array<OrdinalType> & rowOuter = dims_[1].outer();
+  // count the non-zeros in each row and then do prefix sum
+  Array<OrdinalType> outer(totalRows + 1);
+  std::fill(outer.data(), outer.data() + outer.size(), 0);
+  #pragma omp parallel for schedule(dynamic)
+  for (DimensionType batchId = 0; batchId < batchSize; batchId++)
+    for (OrdinalType i = dims_[0].outer()[batchId]; i < dims_[0].outer()[batchId+1]; i++)
+      outer[batchId * rows + rowIds[i] + 1] = rowOuter[i+1] - rowOuter[i];
+  for (DimensionType i = 0; i < totalRows; i++) outer[i+1] += outer[i];
+
+  // set inner and values, with the column indices shifted by the batch
+  Array<DimensionType> inner(nnz);
+  Array<DataType> values(nnz);
+  #pragma omp parallel for schedule(dynamic)
+  for (DimensionType batchId = 0; batchId < batchSize; batchId++) {
+    DimensionType colOffset = batchId * cols;
+    for (OrdinalType i = dims_[0].outer()[batchId]; i < dims_[0].outer()[batchId+1]; i++) {
+      OrdinalType pos = outer[batchId * rows + rowIds[i]];
+      for (OrdinalType j = rowOuter[i]; j < rowOuter[i+1]; j++, pos++) {
+        inner[pos] = dims_[1].inner()[j] + colOffset;
+        values[pos] = values_[j];
+      }
+    }
+  }
+
+  #ifdef EIGEN
+  return SpMat(SpMatMap(totalRows, totalCols, nnz, outer.data(), inner.data(), values.data()));
+  #else
+  return SpMat(totalRows, totalCols, outer, inner, values);
+  #endif
+}
+
 } // namespace ops
@@ -191,6 +191,11 @@ namespace ops {
       /** Construct a vector of MemWrapper on SpMatMap */
       std::vector<MemWrapper<SpMatMap>> toSparse2Ds();
 
+      /** Construct a block diagonal 2D sparse matrix from a 3D tensor, with
+       * the batches on the diagonal. That is, row r and column c of batch b
+       * are at row b * shape_[1] + r and column b * shape_[2] + c. */
+      SpMat toBlockDiagonal() const;
+
       #ifdef DEBUG
       void checkShapeAndDim() {
         // For 1D, it should be represented as 2D while have the first
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "SparseResult.h"
+
+namespace ops {
+
+SparseResult::SparseResult(std::vector<SpMat> sparse2Ds, bool squeeze_batch) :
+    mats_(std::move(sparse2Ds))
+{
+  const size_t batchSize = mats_.size();
+  Require(batchSize > 0, "A sparse result needs at least one matrix");
+  for (size_t i=0; i<batchSize; i++) {
+    Require(mats_[i].rows() == mats_[0].rows(), "The number of rows in each 2D tensor needs to be consistent to construct 3D tensor");
+    Require(mats_[i].cols() == mats_[0].cols(), "The number of cols in each 2D tensor needs to be consistent to construct 3D tensor");
+  }
+
+  if (batchSize == 1 && squeeze_batch) {
+    shape_ = {(DimensionType)mats_[0].rows(), (DimensionType)mats_[0].cols()};
+    nonZeros_ = mats_[0].nonZeros();
+    return;
+  }
+  shape_ = {(DimensionType)batchSize, (DimensionType)mats_[0].rows(), (DimensionType)mats_[0].cols()};
+  countBatches();
+}
+
+SparseResult::SparseResult(SpMat blocks, DimensionType batchSize)
+{
+  Require(batchSize > 0 && blocks.rows() % batchSize == 0 && blocks.cols() % batchSize == 0,
+      "The shape of a block diagonal matrix should be divisible by the number of blocks");
+  shape_ = {batchSize, (DimensionType)(blocks.rows() / batchSize), (DimensionType)(blocks.cols() / batchSize)};
+  mats_.emplace_back(std::move(blocks));
+  blocks_ = true;
+  countBatches();
+}
+
+void SparseResult::countBatches()
+{
+  const DimensionType batchSize = shape_[0], rows = shape_[1];
+  batchRows_.resize(batchSize + 1);
+  batchNonZeros_.resize(batchSize + 1);
+  batchRows_[0] = 0;
+  batchNonZeros_[0] = 0;
+  #pragma omp parallel for schedule(dynamic)
+  for (DimensionType b = 0; b < batchSize; b++) {
+    const OrdinalType * rowsStart, * rowsEnd;
+    rowPointers(batch(b), rowsStart, rowsEnd);
+    const DimensionType rowBegin = blocks_ ? b * rows : 0;
+    OrdinalType nonEmptyRows = 0, nnz = 0;
+    for (DimensionType r = rowBegin; r < rowBegin + rows; r++) {
+      if (rowsEnd[r] > rowsStart[r]) nonEmptyRows++;
+      nnz += rowsEnd[r] - rowsStart[r];
+    }
+    batchRows_[b+1] = nonEmptyRows;
+    batchNonZeros_[b+1] = nnz;
+  }
+  for (DimensionType b = 0; b < batchSize; b++) {
+    batchRows_[b+1] += batchRows_[b];
+    batchNonZeros_[b+1] += batchNonZeros_[b];
+  }
+  nonZeros_ = batchNonZeros_[batchSize];
+}
+
+OrdinalType SparseResult::innerSize(size_t dim) const
+{
+  Require(dim < numDims(), "The dimension is out of range");
+  if (dim + 1 == numDims()) return nonZeros_;
+  return batchRows_[shape_[0]];
+}
+
+OrdinalType SparseResult::outerSize(size_t dim) const
+{
+  Require(dim < numDims(), "The dimension is out of range");
+  if (dim == 0) return shape_[0] + 1;
+  return batchRows_[shape_[0]] + 1;
+}
+
+void SparseResult::write(DataType * values, DimensionType * const * inners, OrdinalType * const * outers) const
+{
+  if (shape_.size() == 2) {
+    const SpMat & m = mats_[0];
+    const DimensionType rows = shape_[0];
+    const OrdinalType * rowsStart, * rowsEnd;
+    rowPointers(m, rowsStart, rowsEnd);
+    if (rowsStart + 1 == rowsEnd) {
+      std::copy(rowsStart, rowsStart + rows + 1, outers[0]);
+      std::copy(m.innerIndexPtr(), m.innerIndexPtr() + nonZeros_, inners[0]);
+      std::copy(m.valuePtr(), m.valuePtr() + nonZeros_, values);
+    } else { // rowsStart and rowsEnd are independent and rows need to be packed
+      outers[0][0] = 0;
+      for (DimensionType i = 0; i < rows; i++)
+        outers[0][i+1] = outers[0][i] + (rowsEnd[i] - rowsStart[i]);
+      #pragma omp parallel for schedule(dynamic, 256)
+      for (DimensionType i = 0; i < rows; i++) {
+        OrdinalType k = outers[0][i];
+        std::copy(m.innerIndexPtr() + rowsStart[i], m.innerIndexPtr() + rowsEnd[i], inners[0] + k);
+        std::copy(m.valuePtr() + rowsStart[i], m.valuePtr() + rowsEnd[i], values + k);
+      }
+    }
+    return;
+  }
+
+  const DimensionType batchSize = shape_[0], rows = shape_[1], cols = shape_[2];
+  std::copy(batchRows_.data(), batchRows_.data() + batchSize + 1, outers[0]);
+  #pragma omp parallel for schedule(dynamic)
+  for (DimensionType b = 0; b < batchSize; b++) {
+    const SpMat & m = batch(b);
+    const OrdinalType * rowsStart, * rowsEnd;
+    rowPointers(m, rowsStart, rowsEnd);
+    const DimensionType * mInner = m.innerIndexPtr();
+    const DataType * mValues = m.valuePtr();
+    const DimensionType rowBegin = blocks_ ? b * rows : 0;
+    const DimensionType colOffset = blocks_ ? b * cols : 0;
+    OrdinalType pos = batchRows_[b], offset = batchNonZeros_[b];
+    for (DimensionType r = 0; r < rows; r++) {
+      const OrdinalType start = rowsStart[rowBegin + r], end = rowsEnd[rowBegin + r];
+      if (end == start) continue;
+      inners[0][pos] = r;
+      outers[1][pos] = offset;
+      pos++;
+      for (OrdinalType j = start; j < end; j++, offset++) {
+        inners[1][offset] = mInner[j] - colOffset;
+        values[offset] = mValues[j];
+      }
+    }
+  }
+  outers[1][batchRows_[batchSize]] = nonZeros_;
+}
+
+SparseFloatTensor SparseResult::toTensor() const
+{
+  Array<DimensionType> shape(shape_.size());
+  std::copy(shape_.data(), shape_.data() + shape_.size(), shape.data());
+  Array<DataType> values(nonZeros_);
+  std::vector<DimData> dims;
+  std::vector<DimensionType *> inners;
+  std::vector<OrdinalType *> outers;
+  for (size_t d=0; d<numDims(); d++) {
+    dims.emplace_back(Array<DimensionType>(innerSize(d)), Array<OrdinalType>(outerSize(d)));
+    inners.push_back(dims.back().inner().data());
+    outers.push_back(dims.back().outer().data());
+  }
+  write(values.data(), inners.data(), outers.data());
+  return SparseFloatTensor(shape, values, dims);
+}
+
+} // namespace ops
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef OPS_SPARSERESULT_H_
+#define OPS_SPARSERESULT_H_
+
+#include "SparseFloatTensor.h"
+
+#include <vector>
+
+namespace ops {
+
+  /**
+   * The result of a sparse operation, held as the 2D sparse matrices it is
+   * computed as, until it is written into the arrays of a sparse tensor.
+   *
+   * Building a SparseFloatTensor from the matrices copies all of them, so
+   * when the tensor is copied again into Java arrays, the result is
+   * materialized twice. Instead, the sizes of the tensor arrays are
+   * computed first, so that the caller can allocate them, and write()
+   * then fills them directly from the matrices.
+   *
+   * The tensor layout is the same as SparseFloatTensor(sparse2Ds,
+   * squeeze_batch): a 2D tensor has one dimension with a dense outer,
+   * and a 3D tensor has the non-empty rows of each batch in its first
+   * dimension, and their columns in the second one. */
+  class SparseResult {
+    public:
+      /** Empty constructor */
+      SparseResult() {}
+      /** The result of a 2D operation, or of each batch of a 3D operation */
+      SparseResult(std::vector<SpMat> sparse2Ds, bool squeeze_batch = true);
+      /** The result of a 3D operation computed on a block diagonal matrix,
+       * with batchSize blocks of the same shape on the diagonal, see
+       * SparseFloatTensor::toBlockDiagonal() */
+      SparseResult(SpMat blocks, DimensionType batchSize);
+
+      /** Copy is not supported */
+      SparseResult(const SparseResult& other) = delete;
+      /** Copy assignment is not supported */
+      SparseResult& operator=(const SparseResult& other) = delete;
+      /** Move constructor */
+      SparseResult(SparseResult&& other) noexcept = default;
+      /** Move assignment */
+      SparseResult& operator=(SparseResult&& other) noexcept = default;
+
+      /** get the shape of the result tensor */
+      const Array<DimensionType> & shape() const { return shape_; }
+      /** get the number of dimensions with sparsity structure, i.e. the
+       * size of SparseFloatTensor::dims() */
+      size_t numDims() const { return shape_.size() - 1; }
+      /** get the number of non-zeros, i.e. the size of the values */
+      OrdinalType nonZeros() const { return nonZeros_; }
+      /** get the size of the inner of dimension dim */
+      OrdinalType innerSize(size_t dim) const;
+      /** get the size of the outer of dimension dim */
+      OrdinalType outerSize(size_t dim) const;
+
+      /**
+       * Write the tensor into preallocated arrays: values with nonZeros()
+       * elements, and for each dimension d, inners[d] with innerSize(d)
+       * elements and outers[d] with outerSize(d) elements. */
+      void write(DataType * values, DimensionType * const * inners, OrdinalType * const * outers) const;
+      /** Write the tensor into newly allocated arrays */
+      SparseFloatTensor toTensor() const;
+
+    private:
+      /** count the non-empty rows and non-zeros of each batch */
+      void countBatches();
+      /** get the matrix holding batch b */
+      const SpMat & batch(DimensionType b) const { return blocks_ ? mats_[0] : mats_[b]; }
+
+      std::vector<SpMat> mats_;
+      /** whether mats_ is a single block diagonal matrix of all the batches */
+      bool blocks_ = false;
+      Array<DimensionType> shape_;
+      OrdinalType nonZeros_ = 0;
+      /** for a 3D tensor, the number of non-empty rows before each batch,
+       * and the number of non-zeros before each batch, with shape_[0] + 1
+       * elements */
+      Array<OrdinalType> batchRows_;
+      Array<OrdinalType> batchNonZeros_;
+  };
+} // namespace ops
+
+#endif // OPS_SPARSERESULT_H_
@@ -7,57 +7,68 @@
 
 #include "Utils.h"
 #include "JavaClassStr.h"
+#include "JniRegistry.h"
 
-#include <map>
 #include <algorithm>
 #include <stdint.h>
 #include <vector>
+#include <type_traits>
 
 namespace ops {
 
-static const std::string OOM_ERROR_FQ_NAME = "java/lang/OutOfMemoryError";
-
-// Throw a Java OutOfMemoryError
-void out_of_memory(JNIEnv *env) {
-  jclass oomErrorClass = env->FindClass(OOM_ERROR_FQ_NAME.c_str());
-  // We should not fail to find the OOM Error class, but if by chance we do,
-  // raise the error raised from that.
-  if (oomErrorClass == NULL)
-    return;
-  env->ThrowNew(oomErrorClass, "");
+/** The Java classes, methods and fields used by the sparse JNI library,
+ * resolved once by loadJavaClasses() */
+static struct {
+  jni::ErrorClasses errors;
+  jclass sparseFloatTensor = NULL, shape = NULL, dimData = NULL, list = NULL, arrayList = NULL;
+  jfieldID tensorShape, tensorValues, tensorDims, shapeDims, dimInner, dimOuter;
+  jmethodID tensorInit, shapeInit, dimDataInit, listSize, listGet, arrayListInit, arrayListAdd;
+} java;
+
+bool loadJavaClasses(JNIEnv * env) {
+  if (!java.errors.load(env)) return false;
+  java.sparseFloatTensor = jni::globalClass(env, J_SparseFloatTensor);
+  java.shape = jni::globalClass(env, J_Shape);
+  java.dimData = jni::globalClass(env, J_DimData);
+  java.list = jni::globalClass(env, J_List);
+  java.arrayList = jni::globalClass(env, J_ArrayList);
+  if (!java.sparseFloatTensor || !java.shape || !java.dimData || !java.list || !java.arrayList)
+    return false;
+
+  java.tensorShape = env->GetFieldID(java.sparseFloatTensor, "shape", J_SIG(J_Shape));
+  java.tensorValues = env->GetFieldID(java.sparseFloatTensor, "values", "[F");
+  java.tensorDims = env->GetFieldID(java.sparseFloatTensor, "dims", J_SIG(J_List));
+  java.shapeDims = env->GetFieldID(java.shape, "dims", "[I");
+  java.dimInner = env->GetFieldID(java.dimData, "inner", "[I");
+  java.dimOuter = env->GetFieldID(java.dimData, "outer", "[I");
+  java.tensorInit = env->GetMethodID(java.sparseFloatTensor, "<init>", "(" J_SIG(J_Shape) "[F" J_SIG(J_List) ")V");
+  java.shapeInit = env->GetMethodID(java.shape, "<init>", "([I)V");
+  java.dimDataInit = env->GetMethodID(java.dimData, "<init>", "([I[I)V");
+  java.listSize = env->GetMethodID(java.list, "size", "()I");
+  java.listGet = env->GetMethodID(java.list, "get", "(I)" J_SIG(J_Object));
+  java.arrayListInit = env->GetMethodID(java.arrayList, "<init>", "(I)V");
+  java.arrayListAdd = env->GetMethodID(java.arrayList, "add", "(" J_SIG(J_Object) ")Z");
+  return java.tensorShape && java.tensorValues && java.tensorDims && java.shapeDims &&
+    java.dimInner && java.dimOuter && java.tensorInit && java.shapeInit && java.dimDataInit &&
+    java.listSize && java.listGet && java.arrayListInit && java.arrayListAdd;
 }
 
-/** Given the short class name find the Java class */
-jclass findClass(JNIEnv * env, const std::string & classname)
-{
-  jclass c = env->FindClass(classname.c_str());
-  Require(c != JNI_FALSE, std::string("Unable to find class ") + classname);
-  return c;
+void unloadJavaClasses(JNIEnv * env) {
+  java.errors.unload(env);
+  jni::deleteGlobalClass(env, java.sparseFloatTensor);
+  jni::deleteGlobalClass(env, java.shape);
+  jni::deleteGlobalClass(env, java.dimData);
+  jni::deleteGlobalClass(env, java.list);
+  jni::deleteGlobalClass(env, java.arrayList);
 }
 
-/** Return an object field from an object
- *
- * This returns the object that is inside of another given object.  It is
- * referenced by the name, the signature, and the class name.
- */
-jobject getJObjectFromClass(JNIEnv *env, jobject obj,
-    const char * name,
-    const char * objsignature,
-    const char * classname) {
-  jclass clazz = findClass(env, classname);
-  jfieldID fieldID = (env)->GetFieldID(clazz, name, objsignature);
-  jobject jobj = (env)->GetObjectField(obj, fieldID);
-  return jobj;
+void throwJavaError(JNIEnv * env, const char * message) {
+  env->ThrowNew(java.errors.error, message);
 }
 
-/** Return an int field from an object */
-INT getIntFromClass(JNIEnv *env, jobject obj,
-    const char *name,
-    const char *classname = (char *)J_SparseEigen2D) {
-  jclass clazz = findClass(env, classname);
-  jfieldID fieldID = (env)->GetFieldID(clazz, name, "I");
-  jint i = env->GetIntField(obj, fieldID);
-  return (INT)i;
+// Throw a Java OutOfMemoryError
+void out_of_memory(JNIEnv *env) {
+  env->ThrowNew(java.errors.outOfMemoryError, "");
 }
 
 /** Return a vector from a Java array
@@ -83,61 +94,32 @@ Array<D> getPrimitiveArray(JNIEnv *env, JavaT data)
   return acdata;
 }
 
-/** Return an int vector from a Java object */
-Array<INT> getIntArrayFromClass(JNIEnv *env, jobject obj, const char *name,
-    const char *classname = (char *)J_SparseEigen2D) {
-  jobject mvdata = getJObjectFromClass(env, obj, name, "[I", classname);
-  jintArray *arr = reinterpret_cast<jintArray *>(&mvdata);
-  return getPrimitiveArray<INT, int32_t, jintArray>(env, *arr);
+Array<INT> javaToIntArray(JNIEnv *env, jintArray data) {
+  return getPrimitiveArray<INT, int32_t, jintArray>(env, data);
 }
 
-/** Return a float vector from a Java object */
-Array<FLOAT> getFloatArrayFromClass(JNIEnv *env, jobject obj, const char *name,
-    const char *classname = (char *)J_SparseEigen2D) {
-  jobject mvdata = getJObjectFromClass(env, obj, name, "[F", classname);
-  jfloatArray *arr = reinterpret_cast<jfloatArray *>(&mvdata);
-  return getPrimitiveArray<FLOAT, float, jfloatArray>(env, *arr);
+/** Return an int vector from an int array field of a Java object */
+Array<INT> getIntArrayField(JNIEnv *env, jobject obj, jfieldID field) {
+  jintArray arr = (jintArray)env->GetObjectField(obj, field);
+  return getPrimitiveArray<INT, int32_t, jintArray>(env, arr);
 }
 
-/** Return an int vector from a Java tensor shape field */
-Array<INT> javaToShape(JNIEnv * env, jobject tensor) {
-   jobject jshape = getJObjectFromClass(env, tensor, "shape",
-       J_SIG(J_Shape), J_SparseFloatTensor);
-   return getIntArrayFromClass(env, jshape, (char *)"dims", J_Shape);
+/** Return a float vector from a float array field of a Java object */
+Array<FLOAT> getFloatArrayField(JNIEnv *env, jobject obj, jfieldID field) {
+  jfloatArray arr = (jfloatArray)env->GetObjectField(obj, field);
+  return getPrimitiveArray<FLOAT, float, jfloatArray>(env, arr);
 }
 
-/** Return the method ID with the given function name, class name, and
- * signature */
-jmethodID getMethodID(JNIEnv * env, const std::string functionname,
-    const std::string signature, const std::string classname)
-{
-  jmethodID jm = env -> GetMethodID(
-      findClass(env, classname.c_str()), functionname.c_str(), signature.c_str());
-  Require(jm != JNI_FALSE, std::string("Unable to find the ") + functionname + " with " + signature + " method for " + classname);
-
-  return jm;
-}
-
-/** Return the method ID with the given function name and class name */
-jmethodID getMethod(JNIEnv * env, const std::string functionname, const std::string classname = J_List)
-{
-  std::map<std::pair<std::string, std::string>, std::string> nameSign;
-  nameSign.insert({std::make_pair(J_List, "size"), "()I"});
-  nameSign.insert({std::make_pair(J_List, "get"), "(I)" J_SIG(J_Object)});
-  nameSign.insert({std::make_pair(J_ArrayList, "add"), "(" J_SIG(J_Object) ")Z"});
-  nameSign.insert({std::make_pair(J_ArrayList, "<init>"), "(I)V"});
-  nameSign.insert({std::make_pair(J_SparseFloatTensor, "<init>"), "(" J_SIG(J_Shape) "[F" J_SIG(J_List) ")V"});
-
-  auto it = nameSign.find(std::make_pair(classname, functionname));
-  Require(it != nameSign.end(), std::string("Unknown signature for the ") + functionname + " method for " + classname);
-
-  return getMethodID(env, functionname, it->second, classname);
+/** Return an int vector from a Java tensor shape field */
+Array<INT> javaToShape(JNIEnv * env, jobject tensor) {
+   jobject jshape = env->GetObjectField(tensor, java.tensorShape);
+   return getIntArrayField(env, jshape, java.shapeDims);
 }
 
 /** Return DimData from a Java DimData object */
 DimData javaDimDataToDimData(JNIEnv * env, jobject jdim) {
-  auto inner = getIntArrayFromClass(env, jdim, (char *)"inner", J_DimData);
-  auto outer = getIntArrayFromClass(env, jdim, (char *)"outer", J_DimData);
+  auto inner = getIntArrayField(env, jdim, java.dimInner);
+  auto outer = getIntArrayField(env, jdim, java.dimOuter);
   return {std::move(inner), std::move(outer)};
 }
 
@@ -146,20 +128,17 @@ std::vector<DimData> javaToDimDataVector(JNIEnv * env, jobject tensor) {
    std::vector<DimData> dims;
 
    // find the list of DimData
-   jobject jdims = getJObjectFromClass(env, tensor, "dims", J_SIG(J_List), J_SparseFloatTensor);
-
-   // find the methods to iterate the list
-   jmethodID mSize = getMethod(env, "size");
-   jmethodID mGet = getMethod(env, "get");
+   jobject jdims = env->GetObjectField(tensor, java.tensorDims);
 
    // get the size of the list
-   jint size = env->CallIntMethod(jdims, mSize);
+   jint size = env->CallIntMethod(jdims, java.listSize);
 
    dims.reserve(size);
 
    for(jint i=0; i<size; i++) {
-     jobject jdim = env->CallObjectMethod(jdims, mGet, i);
+     jobject jdim = env->CallObjectMethod(jdims, java.listGet, i);
      dims.push_back(javaDimDataToDimData(env, jdim));
+     env->DeleteLocalRef(jdim);
    }
 
    return dims;
@@ -167,7 +146,7 @@ std::vector<DimData> javaToDimDataVector(JNIEnv * env, jobject tensor) {
 
 SparseFloatTensor javaToCPPSparseTensor(JNIEnv * env, jobject tensor) {
   Array<INT> shape = javaToShape(env, tensor);
-  Array<FLOAT> values = getFloatArrayFromClass(env, tensor, (char *)"values", J_SparseFloatTensor);
+  Array<FLOAT> values = getFloatArrayField(env, tensor, java.tensorValues);
   std::vector<DimData> dims = javaToDimDataVector(env, tensor);
   SparseFloatTensor t(shape, values, dims);
 
@@ -178,6 +157,67 @@ SparseFloatTensor javaToCPPSparseTensor(JNIEnv * env, jobject tensor) {
   return t;
 }
 
+JavaSparseTensorView::JavaSparseTensorView(JNIEnv * env, jobject tensor) : env_(env) {
+  static_assert(std::is_same<INT, jint>::value && std::is_same<FLOAT, jfloat>::value,
+      "Viewing Java arrays needs the C++ types to be the same as the Java ones");
+
+  // collect all the arrays here, as no JNI function can be called once an
+  // array is pinned
+  jobject jshape = env->GetObjectField(tensor, java.tensorShape);
+  arrays_.push_back((jarray)env->GetObjectField(jshape, java.shapeDims));
+  arrays_.push_back((jarray)env->GetObjectField(tensor, java.tensorValues));
+  jobject jdims = env->GetObjectField(tensor, java.tensorDims);
+  jint numDims = env->CallIntMethod(jdims, java.listSize);
+  for (jint i=0; i<numDims; i++) {
+    jobject jdim = env->CallObjectMethod(jdims, java.listGet, i);
+    arrays_.push_back((jarray)env->GetObjectField(jdim, java.dimInner));
+    arrays_.push_back((jarray)env->GetObjectField(jdim, java.dimOuter));
+  }
+  for (jarray a : arrays_) sizes_.push_back(env->GetArrayLength(a));
+}
+
+void JavaSparseTensorView::pin() {
+  Require(pinned_.empty(), "The Java sparse tensor is already pinned");
+  pinned_.reserve(arrays_.size());
+  for (jarray a : arrays_) {
+    void * data = env_->GetPrimitiveArrayCritical(a, 0);
+    if (data == nullptr) {
+      release();
+      Require(false, "Unable to pin the arrays of the Java sparse tensor");
+    }
+    pinned_.emplace_back(a, data);
+  }
+
+  try {
+    Array<INT> shape = Array<INT>::view((INT *)pinned_[0].second, sizes_[0]);
+    Array<FLOAT> values = Array<FLOAT>::view((FLOAT *)pinned_[1].second, sizes_[1]);
+    size_t numDims = (arrays_.size() - 2) / 2;
+    std::vector<DimData> dims;
+    dims.reserve(numDims);
+    for (size_t i=0; i<numDims; i++) {
+      size_t p = 2 + 2 * i;
+      dims.emplace_back(Array<INT>::view((INT *)pinned_[p].second, sizes_[p]),
+          Array<INT>::view((INT *)pinned_[p+1].second, sizes_[p+1]));
+    }
+    tensor_ = SparseFloatTensor(shape, values, dims);
+
+    #ifdef DEBUG
+    tensor_.checkShapeAndDim();
+    #endif // DEBUG
+  } catch (...) {
+    release();
+    throw;
+  }
+}
+
+void JavaSparseTensorView::release() {
+  // drop the views before the memory is released
+  tensor_ = SparseFloatTensor();
+  for (auto it = pinned_.rbegin(); it != pinned_.rend(); ++it)
+    env_->ReleasePrimitiveArrayCritical(it->first, it->second, JNI_ABORT);
+  pinned_.clear();
+}
+
 /** Return a Java int array from a vector of int arrays */
 jintArray copyCPPArrayToJava(JNIEnv *env, const Array<INT> & iArray)
 {
@@ -209,9 +249,7 @@ jobject copyShapeToJava(JNIEnv * env, const Array<INT> & shape)
 {
   jintArray jshapedims = copyCPPArrayToJava(env, shape);
 
-  jclass clazz = findClass(env, J_Shape);
-  jmethodID constructor = (env)->GetMethodID(clazz, "<init>", "([I)V");
-  jobject obj = (env)->NewObject(clazz, constructor, jshapedims);
+  jobject obj = (env)->NewObject(java.shape, java.shapeInit, jshapedims);
   return obj;
 }
 
@@ -221,28 +259,19 @@ jobject copyDimDataToJava(JNIEnv * env, const DimData & dim)
   jintArray jinner = copyCPPArrayToJava(env, dim.inner());
   jintArray jouter = copyCPPArrayToJava(env, dim.outer());
 
-  jclass clazz = findClass(env, J_DimData);
-  // Get the method id of an empty constructor in clazz
-  jmethodID constructor = (env)->GetMethodID(clazz, "<init>", "([I[I)V");
-  // Create an instance of clazz
-  jobject obj = (env)->NewObject(clazz, constructor, jinner, jouter);
+  jobject obj = (env)->NewObject(java.dimData, java.dimDataInit, jinner, jouter);
   return obj;
 }
 
 /** Copy a vector of C++ DimData to a Java ArrayList object */
 jobject copyDimDataVectorToJava(JNIEnv * env, const std::vector<DimData> & dims) {
 
-  jclass clazz = findClass(env, J_ArrayList);
-  jmethodID constructor = getMethod(env, "<init>", J_ArrayList);
-
-  jobject jdims = (env)->NewObject(clazz, constructor, dims.size());
-
-  jmethodID madd = getMethod(env, "add", J_ArrayList);
+  jobject jdims = (env)->NewObject(java.arrayList, java.arrayListInit, (jint)dims.size());
 
   // iterate through the dims
   for (size_t i=0; i<dims.size(); i++) {
     jobject jdim = copyDimDataToJava(env, dims[i]);
-    env->CallVoidMethod(jdims, madd, jdim);
+    env->CallBooleanMethod(jdims, java.arrayListAdd, jdim);
   }
 
   return jdims;
@@ -253,13 +282,99 @@ jobject cppToJavaSparseTensor(JNIEnv *env, const SparseFloatTensor & tensor) {
   jfloatArray jvalues = copyCPPArrayToJava(env, tensor.values());
   jobject jdims = copyDimDataVectorToJava(env, tensor.dims());
 
-  jclass clazz = findClass(env, J_SparseFloatTensor);
-  jmethodID constructor = getMethod(env, "<init>", J_SparseFloatTensor);
-  jobject obj = env -> NewObject(clazz, constructor, jshape, jvalues, jdims);
+  jobject obj = env -> NewObject(java.sparseFloatTensor, java.tensorInit, jshape, jvalues, jdims);
 
   return obj;
 }
 
+/** Write a SparseResult into Java arrays of the right sizes: values, then
+ * the inner and outer of each dimension. The arrays are pinned only while
+ * writing, and no JNI function is called in between. */
+void writeSparseResultToArrays(JNIEnv * env, const SparseResult & result,
+    const std::vector<jarray> & arrays) {
+  static_assert(std::is_same<INT, jint>::value && std::is_same<FLOAT, jfloat>::value,
+      "Writing Java arrays needs the C++ types to be the same as the Java ones");
+  const size_t numDims = result.numDims();
+  Require(arrays.size() == 1 + 2 * numDims, "The number of Java arrays does not match the sparse result");
+  Require((OrdinalType)env->GetArrayLength(arrays[0]) == result.nonZeros(),
+      "The size of the Java values does not match the sparse result");
+  for (size_t d=0; d<numDims; d++) {
+    Require((OrdinalType)env->GetArrayLength(arrays[1 + 2 * d]) == result.innerSize(d) &&
+        (OrdinalType)env->GetArrayLength(arrays[2 + 2 * d]) == result.outerSize(d),
+        "The size of a Java DimData array does not match the sparse result");
+  }
+
+  std::vector<void *> pinned;
+  pinned.reserve(arrays.size());
+  for (jarray a : arrays) {
+    void * data = env->GetPrimitiveArrayCritical(a, 0);
+    if (data == nullptr) {
+      for (size_t i=pinned.size(); i>0; i--)
+        env->ReleasePrimitiveArrayCritical(arrays[i-1], pinned[i-1], JNI_ABORT);
+      Require(false, "Unable to pin the Java arrays of the sparse result");
+    }
+    pinned.push_back(data);
+  }
+
+  std::vector<DimensionType *> inners(numDims);
+  std::vector<OrdinalType *> outers(numDims);
+  for (size_t d=0; d<numDims; d++) {
+    inners[d] = (DimensionType *)pinned[1 + 2 * d];
+    outers[d] = (OrdinalType *)pinned[2 + 2 * d];
+  }
+  // write() only throws on inconsistent sizes, which are checked above
+  result.write((DataType *)pinned[0], inners.data(), outers.data());
+
+  for (size_t i=pinned.size(); i>0; i--)
+    env->ReleasePrimitiveArrayCritical(arrays[i-1], pinned[i-1], 0);
+}
+
+jobject cppToJavaSparseTensor(JNIEnv *env, const SparseResult & result) {
+  const size_t numDims = result.numDims();
+  std::vector<jarray> arrays;
+  arrays.push_back(env->NewFloatArray(result.nonZeros()));
+  for (size_t d=0; d<numDims; d++) {
+    arrays.push_back(env->NewIntArray(result.innerSize(d)));
+    arrays.push_back(env->NewIntArray(result.outerSize(d)));
+  }
+  for (jarray a : arrays) Require(a != NULL, "Unable to allocate the Java arrays of the sparse result");
+  writeSparseResultToArrays(env, result, arrays);
+
+  jobject jshape = copyShapeToJava(env, result.shape());
+  jobject jdims = (env)->NewObject(java.arrayList, java.arrayListInit, (jint)numDims);
+  for (size_t d=0; d<numDims; d++) {
+    jobject jdim = (env)->NewObject(java.dimData, java.dimDataInit, arrays[1 + 2 * d], arrays[2 + 2 * d]);
+    env->CallBooleanMethod(jdims, java.arrayListAdd, jdim);
+  }
+
+  return env -> NewObject(java.sparseFloatTensor, java.tensorInit, jshape, arrays[0], jdims);
+}
+
+jintArray sparseResultSizesToJava(JNIEnv *env, const SparseResult & result) {
+  const size_t rank = result.shape().size();
+  Array<INT> sizes(2 * rank - 1);
+  for (size_t i=0; i<rank; i++) sizes[i] = result.shape()[i];
+  for (size_t d=0; d<result.numDims(); d++) sizes[rank + d] = result.innerSize(d);
+  return copyCPPArrayToJava(env, sizes);
+}
+
+void writeSparseResultToJava(JNIEnv *env, const SparseResult & result,
+    jfloatArray values,
+    jobjectArray inners,
+    jobjectArray outers) {
+  const size_t numDims = result.numDims();
+  Require(env->GetArrayLength(inners) == (jsize)numDims && env->GetArrayLength(outers) == (jsize)numDims,
+      "The number of Java DimData arrays does not match the sparse result");
+  std::vector<jarray> arrays;
+  arrays.push_back(values);
+  for (size_t d=0; d<numDims; d++) {
+    arrays.push_back((jarray)env->GetObjectArrayElement(inners, d));
+    arrays.push_back((jarray)env->GetObjectArrayElement(outers, d));
+  }
+  for (jarray a : arrays) Require(a != NULL, "The Java arrays of the sparse result should not be null");
+  writeSparseResultToArrays(env, result, arrays);
+}
+
 COO javaToCOO(JNIEnv *env, jintArray shape,
     jintArray rows,
     jintArray cols,
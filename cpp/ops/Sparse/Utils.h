@@ -11,19 +11,110 @@
 #include <jni.h>
 
 #include "SparseFloatTensor.h"
+#include "SparseResult.h"
 #include "COO.h"
 #include "DebugUtils.h"
 
+#include <utility>
+#include <vector>
+
 namespace ops {
 
+  /** Resolve the Java classes, methods and fields used by the sparse JNI
+   * library, once in JNI_OnLoad. It returns false, with a pending Java
+   * exception, if one of them is not found. */
+  bool loadJavaClasses(JNIEnv *);
+
+  /** Release the Java classes resolved by loadJavaClasses */
+  void unloadJavaClasses(JNIEnv *);
+
+  /** Throw a java.lang.Error with the given message */
+  void throwJavaError(JNIEnv *, const char * message);
+
   /** Converte a java SparseFloatTensor objuect to a C++ SparseFloatTensor
    * object */
   SparseFloatTensor javaToCPPSparseTensor(JNIEnv *, jobject);
 
+  /**
+   * A C++ SparseFloatTensor viewing the arrays of a java SparseFloatTensor
+   * object without copying them.
+   *
+   * A view is built in two steps: the constructor collects the Java arrays
+   * and their sizes, and pin() pins them with GetPrimitiveArrayCritical and
+   * builds the tensor. They are released when the view is destroyed. Once
+   * an array is pinned, the thread must not call any other JNI function or
+   * wait on other Java threads, so the views of all the operands of an
+   * operation are constructed before any of them is pinned. The garbage
+   * collection may be delayed while arrays are pinned, so a view is
+   * expected to live only around the computation of an operation. The
+   * tensor is read-only: the arrays are released without writing back. */
+  class JavaSparseTensorView {
+    public:
+      /** Collect the arrays of the Java tensor, without pinning them */
+      JavaSparseTensorView(JNIEnv *, jobject);
+      ~JavaSparseTensorView() { release(); }
+      /** Copy is not supported */
+      JavaSparseTensorView(const JavaSparseTensorView& other) = delete;
+      /** Copy assignment is not supported */
+      JavaSparseTensorView& operator=(const JavaSparseTensorView& other) = delete;
+
+      /** Pin the arrays and build the tensor viewing them. It calls no JNI
+       * function other than GetPrimitiveArrayCritical, so other views may
+       * already be pinned. */
+      void pin();
+
+      /** get the tensor viewing the Java arrays, once pinned */
+      SparseFloatTensor & tensor() {
+        Require(!pinned_.empty(), "The Java sparse tensor is not pinned");
+        return tensor_;
+      }
+
+    private:
+      /** release all the pinned arrays */
+      void release();
+
+      JNIEnv * env_;
+      /** the arrays in the order of: shape, values, then inner and outer of
+       * each DimData, and their sizes */
+      std::vector<jarray> arrays_;
+      std::vector<size_t> sizes_;
+      /** the pinned Java arrays and their addresses */
+      std::vector<std::pair<jarray, void *>> pinned_;
+      SparseFloatTensor tensor_;
+  };
+
   /** Converte a C++ SparseFloatTensor object to a java SparseFloatTensor
    * object */
   jobject cppToJavaSparseTensor(JNIEnv *, const SparseFloatTensor &);
 
+  /** Write a C++ SparseResult into a new java SparseFloatTensor object,
+   * without building a C++ SparseFloatTensor first */
+  jobject cppToJavaSparseTensor(JNIEnv *, const SparseResult &);
+
+  /** Return the sizes of the arrays needed to hold a SparseResult, as a
+   * Java int array: the shape, followed by the size of the inner of each
+   * dimension. The last inner size is the number of values, and the outer
+   * of a dimension has one more element than the inner of the dimension
+   * before it, or than shape[0] for the first dimension. */
+  jintArray sparseResultSizesToJava(JNIEnv *, const SparseResult &);
+
+  /** Write a C++ SparseResult into Java arrays allocated by the caller with
+   * the sizes of sparseResultSizesToJava. inners and outers are Java arrays
+   * of int arrays, with one int array for each dimension. */
+  void writeSparseResultToJava(JNIEnv *, const SparseResult &,
+                               jfloatArray values,
+                               jobjectArray inners,
+                               jobjectArray outers);
+
+  /** Copy a Java int array to a C++ Array */
+  Array<INT> javaToIntArray(JNIEnv *, jintArray);
+
+  /** Copy a C++ Array to a new Java int array */
+  jintArray copyCPPArrayToJava(JNIEnv *, const Array<INT> &);
+
+  /** Copy a C++ Array to a new Java float array */
+  jfloatArray copyCPPArrayToJava(JNIEnv *, const Array<FLOAT> &);
+
   /** Converte data in COO format from Java to a C++ COO */
   COO javaToCOO(JNIEnv *, jintArray shape,
                                  jintArray rows,
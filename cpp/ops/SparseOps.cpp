@@ -7,69 +7,422 @@
 
 #include "SparseOps.h"
 #include "Sparse/Utils.h"
+#include "JniRegistry.h"
+#include "Threading/ThreadingJni.h"
 
 #include <assert.h>
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <exception>
+#include <limits>
 
 #include "Sparse/Arithmetic.h"
+#include "Sparse/MatmulPlan.h"
+#include "Sparse/Pool.h"
 
 #include <omp.h>
 
 typedef SpMat (&binary_sparseops_function)(SpMatMap &, SpMatMap &);
 typedef SpMat (&unary_sparseops_function)(SpMatMap &);
 
-static const std::string ERROR_FQ_NAME = "java/lang/Error";
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
+  JNIEnv *env = jni::getEnv(vm);
+  if (env == NULL || !ops::loadJavaClasses(env))
+    return JNI_ERR;
+  return jni::VERSION;
+}
+
+JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *vm, void *reserved) {
+  JNIEnv *env = jni::getEnv(vm);
+  if (env != NULL)
+    ops::unloadJavaClasses(env);
+}
+
+#ifndef EIGEN
+/** Whether the batches of a 3D tensor are computed at once as a block
+ * diagonal matrix, instead of one by one. Each operation on a matrix runs
+ * its own parallel regions, so a batch of many small matrices would spend
+ * most of its time forking and joining threads. The block diagonal matrix
+ * needs its shape to fit in DimensionType. */
+static bool useBlockDiagonal(const ops::SparseFloatTensor & tensor) {
+  const auto & shape = tensor.shape();
+  return shape.size() == 3 && shape[0] > 1 &&
+    (int64_t)shape[0] * std::max(shape[1], shape[2]) <= std::numeric_limits<ops::DimensionType>::max();
+}
+#endif
+
+/** Compute a unary operation on each matrix of a 2D or 3D tensor */
+ops::SparseResult unaryCompute(ops::SparseFloatTensor & tensor,
+                   unary_sparseops_function op) {
+  #ifndef EIGEN
+  if (useBlockDiagonal(tensor)) {
+    SpMat blocks = tensor.toBlockDiagonal();
+    return ops::SparseResult(op(blocks), tensor.shape()[0]);
+  }
+  #endif
+
+  auto tensor2Ds = tensor.toSparse2Ds();
+
+  std::vector<SpMat> resSparse2Ds(tensor2Ds.size());
+  size_t exceptionCount = 0;
+  #ifdef EIGEN
+  #pragma omp parallel for schedule(dynamic) reduction(+:exceptionCount)
+  for (size_t i=0; i<tensor2Ds.size(); i++) {
+    try{
+      resSparse2Ds[i] = std::move(op(tensor2Ds[i].get()));
+    } catch (...) {
+      exceptionCount++;
+    }
+  }
+  Require(exceptionCount == 0, "error in computing unary matrix operation");
+  #else // MKL: do it sequentially as the computation will be done in parallel already.
+  for (size_t i=0; i<tensor2Ds.size(); i++)
+    resSparse2Ds[i] = std::move(op(tensor2Ds[i].get()));
+  #endif
+
+  return ops::SparseResult(std::move(resSparse2Ds), tensor.shape().size() == 2);
+}
+
+/** Compute a unary operation on a Java tensor. The operand is used in
+ * place, and released before the result is returned. */
+ops::SparseResult unaryResult(JNIEnv *env, jobject operand,
+                   unary_sparseops_function op) {
+  ops::JavaSparseTensorView tensor(env, operand);
+  tensor.pin();
+  return unaryCompute(tensor.tensor(), op);
+}
 
 jobject unaryCall(JNIEnv *env, jobject operand,
                    unary_sparseops_function op) {
 
-  jclass errorClass = env->FindClass(ERROR_FQ_NAME.c_str());
-  Require(errorClass != NULL, "Unable to retrieve Java error");
+  jobject res;
+  try{
+    res = ops::cppToJavaSparseTensor(env, unaryResult(env, operand, op));
+
+  } catch (...) {
+    ops::throwJavaError(env, "error in computing unary matrix operation");
+  }
+
+  return res;
+}
+
+/** Compute a binary operation on each pair of matrices of two 2D or 3D
+ * tensors */
+ops::SparseResult binaryCompute(ops::SparseFloatTensor & leftTensor,
+                   ops::SparseFloatTensor & rightTensor,
+                   binary_sparseops_function op) {
+  // Shape requirements
+  Require(leftTensor.shape().size() == rightTensor.shape().size(), "The number of dimensions for matrices in both side should be consistent.");
+  Require(leftTensor.shape().size() <= 3, "The number of dimensions should not exceed the maximum supported: 3");
+  if (leftTensor.shape().size() == 3)
+    Require(leftTensor.shape()[0] == rightTensor.shape()[0], "For 3D batch operation, the number of batch in both side should be consistent");
+
+  #ifndef EIGEN
+  if (useBlockDiagonal(leftTensor) && useBlockDiagonal(rightTensor)) {
+    SpMat leftBlocks = leftTensor.toBlockDiagonal();
+    SpMat rightBlocks = rightTensor.toBlockDiagonal();
+    return ops::SparseResult(op(leftBlocks, rightBlocks), leftTensor.shape()[0]);
+  }
+  #endif
+
+  auto leftSparse2Ds = leftTensor.toSparse2Ds();
+  auto rightSparse2Ds = rightTensor.toSparse2Ds();
+
+  std::vector<SpMat> resSparse2Ds(leftSparse2Ds.size());
+  size_t exceptionCount = 0;
+  #ifdef EIGEN
+  #pragma omp parallel for schedule(dynamic) reduction(+:exceptionCount)
+  for (size_t i=0; i<leftSparse2Ds.size(); i++) {
+    try{
+      resSparse2Ds[i] = std::move(op(leftSparse2Ds[i].get(), rightSparse2Ds[i].get()));
+    } catch (...) {
+      exceptionCount++;
+    }
+  }
+  Require(exceptionCount == 0, "error in computing binary matrix operation");
+  #else // MKL: do it sequentially as the computation will be done in parallel already.
+  for (size_t i=0; i<leftSparse2Ds.size(); i++)
+    resSparse2Ds[i] = std::move(op(leftSparse2Ds[i].get(), rightSparse2Ds[i].get()));
+  #endif
+
+  return ops::SparseResult(std::move(resSparse2Ds), leftTensor.shape().size() == 2);
+}
+
+/** Compute a binary operation on Java tensors. The operands are used in
+ * place, and released before the result is returned. */
+ops::SparseResult binaryResult(JNIEnv *env, jobject left, jobject right,
+                   binary_sparseops_function op) {
+  // collect the arrays of both operands before pinning any of them
+  ops::JavaSparseTensorView leftTensor(env, left);
+  ops::JavaSparseTensorView rightTensor(env, right);
+  leftTensor.pin();
+  rightTensor.pin();
+  return binaryCompute(leftTensor.tensor(), rightTensor.tensor(), op);
+}
+
+jobject binaryCall(JNIEnv *env, jobject left, jobject right,
+                   binary_sparseops_function op) {
 
   jobject res;
   try{
-    ops::SparseFloatTensor tensor = ops::javaToCPPSparseTensor(env, operand);
+    res = ops::cppToJavaSparseTensor(env, binaryResult(env, left, right, op));
+
+  } catch (...) {
+    ops::throwJavaError(env, "error in computing binary matrix operation");
+  }
+
+  return res;
+}
+
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_add(JNIEnv *env,
+                                                             jobject obj,
+                                                             jobject left,
+                                                             jobject right) {
+  ops::use_thread_config();
+  return binaryCall(env, left, right, ops::add);
+}
+
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_times(JNIEnv *env,
+                                                             jobject obj,
+                                                             jobject left,
+                                                             jobject right) {
+  ops::use_thread_config();
+  return binaryCall(env, left, right, ops::times);
+}
+
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_sub(JNIEnv *env,
+                                                             jobject obj,
+                                                             jobject left,
+                                                             jobject right) {
+  ops::use_thread_config();
+  return binaryCall(env, left, right, ops::sub);
+}
 
-    auto tensor2Ds = tensor.toSparse2Ds();
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_matmul(JNIEnv *env,
+                                                             jobject obj,
+                                                             jobject left,
+                                                             jobject right) {
+  ops::use_thread_config();
+  return binaryCall(env, left, right, ops::matmul);
+}
+
+/** Compute the matmul of Java tensors with a dense result into resData.
+ * Unless it's forced, it returns false when the result is not estimated to
+ * be dense enough, with the sparse result in sparse instead. The operands
+ * are used in place, and released before returning. */
+bool matmulToDenseResult(JNIEnv *env, jobject left, jobject right, bool force,
+                   ops::Array<ops::DataType> & resData, ops::SparseResult & sparse) {
+  ops::JavaSparseTensorView leftView(env, left);
+  ops::JavaSparseTensorView rightView(env, right);
+  leftView.pin();
+  rightView.pin();
+  ops::SparseFloatTensor & leftTensor = leftView.tensor();
+  ops::SparseFloatTensor & rightTensor = rightView.tensor();
 
-    std::vector<SpMat> resSparse2Ds(tensor2Ds.size());
-    size_t exceptionCount = 0;
-    #ifdef EIGEN
-    #pragma omp parallel for schedule(dynamic) reduction(+:exceptionCount)
-    for (size_t i=0; i<tensor2Ds.size(); i++) {
-      try{
-        resSparse2Ds[i] = std::move(op(tensor2Ds[i].get()));
-      } catch (...) {
-        exceptionCount++;
-      }
+  // Shape requirements
+  size_t rank = leftTensor.shape().size();
+  Require(rank == rightTensor.shape().size(), "The number of dimensions for matrices in both side should be consistent.");
+  Require(rank <= 3, "The number of dimensions should not exceed the maximum supported: 3");
+  if (rank == 3)
+    Require(leftTensor.shape()[0] == rightTensor.shape()[0], "For 3D batch operation, the number of batch in both side should be consistent");
+
+  auto leftSparse2Ds = leftTensor.toSparse2Ds();
+  auto rightSparse2Ds = rightTensor.toSparse2Ds();
+
+  // unless it's forced, only use the dense result when all the matrices
+  // in the batch are dense enough. The first one which isn't is multiplied
+  // by the estimate, with its analysis, and the others by matmul.
+  if (!force) {
+    std::vector<SpMat> resSparse2Ds(leftSparse2Ds.size());
+    size_t fallback = 0;
+    while (fallback < leftSparse2Ds.size() &&
+        ops::denseMatmulPreferred(leftSparse2Ds[fallback].get(), rightSparse2Ds[fallback].get(), &resSparse2Ds[fallback]))
+      fallback++;
+    if (fallback < leftSparse2Ds.size()) {
+      for (size_t i=0; i<leftSparse2Ds.size(); i++)
+        if (i != fallback)
+          resSparse2Ds[i] = ops::matmul(leftSparse2Ds[i].get(), rightSparse2Ds[i].get());
+      sparse = ops::SparseResult(std::move(resSparse2Ds), rank == 2);
+      return false;
     }
-    Require(exceptionCount == 0, "error in computing unary matrix operation");
-    #else // MKL: do it sequentially as the computation will be done in parallel already.
-    for (size_t i=0; i<tensor2Ds.size(); i++)
-      resSparse2Ds[i] = std::move(op(tensor2Ds[i].get()));
-    #endif
+  }
+
+  size_t resSize = (size_t)leftTensor.shape()[rank - 2] * rightTensor.shape()[rank - 1];
+  resData.resize(leftSparse2Ds.size() * resSize);
+  // the computation is done in parallel within each batch already.
+  for (size_t i=0; i<leftSparse2Ds.size(); i++)
+    ops::matmulToDense(leftSparse2Ds[i].get(), rightSparse2Ds[i].get(), resData.data() + i * resSize);
+  return true;
+}
+
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_matmulToDense(JNIEnv *env,
+                                                             jobject obj,
+                                                             jobject left,
+                                                             jobject right,
+                                                             jboolean force) {
+  ops::use_thread_config();
+  jobject res = NULL;
+  try{
+    ops::Array<ops::DataType> resData;
+    ops::SparseResult sparse;
+    if (matmulToDenseResult(env, left, right, force, resData, sparse))
+      res = ops::copyCPPArrayToJava(env, resData);
+    else
+      res = ops::cppToJavaSparseTensor(env, sparse);
+  } catch (...) {
+    ops::throwJavaError(env, "error in computing sparse matmul with a dense result");
+  }
+  return res;
+}
+
+/** Compute the sparse-dense matmul of Java operands into resData. The
+ * operands are used in place, and released before returning. */
+void spmmResult(JNIEnv *env, jobject left, jintArray rightShape, jfloatArray right,
+                   ops::Array<ops::DataType> & resData) {
+  // collect everything needing JNI calls before pinning
+  ops::Array<ops::INT> shape = ops::javaToIntArray(env, rightShape);
+  size_t rightLength = env->GetArrayLength(right);
+  ops::JavaSparseTensorView leftView(env, left);
+  leftView.pin();
+  ops::SparseFloatTensor & leftTensor = leftView.tensor();
 
-    res = ops::cppToJavaSparseTensor(env, ops::SparseFloatTensor(resSparse2Ds, tensor.shape().size() == 2));
+  // Shape requirements
+  size_t rank = leftTensor.shape().size();
+  Require(shape.size() == rank, "The number of dimensions for matrices in both side should be consistent.");
+  Require(rank >= 2 && rank <= 3, "The number of dimensions should be 2, or 3 for a batch");
+  if (rank == 3)
+    Require(leftTensor.shape()[0] == shape[0], "For 3D batch operation, the number of batch in both side should be consistent");
+  Require(leftTensor.shape()[rank - 1] == shape[rank - 2], "In spmm operation, the number of columns on the left\
+      should be equal to the number of rows on the right.");
 
+  auto leftSparse2Ds = leftTensor.toSparse2Ds();
+  size_t leftSize = (size_t)leftTensor.shape()[rank - 2] * shape[rank - 1];
+  size_t rightSize = (size_t)shape[rank - 2] * shape[rank - 1];
+  Require(rightLength == leftSparse2Ds.size() * rightSize, "The size of the dense matrix should match its shape");
+  resData.resize(leftSparse2Ds.size() * leftSize);
+
+  float * rightData = (float *)env->GetPrimitiveArrayCritical(right, 0);
+  Require(rightData != NULL, "Unable to access the dense matrix");
+  try{
+    // the computation is done in parallel within each batch already.
+    for (size_t i=0; i<leftSparse2Ds.size(); i++)
+      ops::spmm(leftSparse2Ds[i].get(), rightData + i * rightSize, shape[rank - 1], resData.data() + i * leftSize);
   } catch (...) {
-    env->ThrowNew(errorClass, "error in computing unary matrix operation");
+    env->ReleasePrimitiveArrayCritical(right, rightData, JNI_ABORT);
+    throw;
   }
+  // the dense input is read-only, so there is nothing to copy back
+  env->ReleasePrimitiveArrayCritical(right, rightData, JNI_ABORT);
+}
 
+JNIEXPORT jfloatArray JNICALL Java_org_diffkt_external_SparseOps_spmm(JNIEnv *env,
+                                                             jobject obj,
+                                                             jobject left,
+                                                             jintArray rightShape,
+                                                             jfloatArray right) {
+  ops::use_thread_config();
+  jfloatArray res = NULL;
+  try{
+    ops::Array<ops::DataType> resData;
+    spmmResult(env, left, rightShape, right, resData);
+    res = ops::copyCPPArrayToJava(env, resData);
+  } catch (...) {
+    ops::throwJavaError(env, "error in computing sparse-dense matrix multiplication");
+  }
   return res;
 }
 
-jobject binaryCall(JNIEnv *env, jobject left, jobject right,
-                   binary_sparseops_function op) {
+/** Compute the sddmm of Java operands into res. The operands are used in
+ * place, and released before returning. */
+void sddmmResult(JNIEnv *env, jobject pattern, jintArray leftShape, jfloatArray left,
+                   jintArray rightShape, jfloatArray right, ops::SparseResult & res) {
+  // collect everything needing JNI calls before pinning
+  ops::Array<ops::INT> lShape = ops::javaToIntArray(env, leftShape);
+  ops::Array<ops::INT> rShape = ops::javaToIntArray(env, rightShape);
+  size_t leftLength = env->GetArrayLength(left);
+  size_t rightLength = env->GetArrayLength(right);
+  // the dense shapes don't depend on the pattern, so check them first
+  Require(lShape.size() >= 2 && rShape.size() >= 2, "The dense matrices should have at least 2 dimensions");
+  Require(lShape[lShape.size() - 1] == rShape[rShape.size() - 1], "In sddmm operation, the number of columns on the left and right should be the same.");
 
-  jclass errorClass = env->FindClass(ERROR_FQ_NAME.c_str());
-  Require(errorClass != NULL, "Unable to retrieve Java error");
+  ops::JavaSparseTensorView patternView(env, pattern);
+  patternView.pin();
+  ops::SparseFloatTensor & patternTensor = patternView.tensor();
 
-  jobject res;
+  // Shape requirements: pattern is (B, M, N), left is (B, M, K) and
+  // right is (B, N, K), where the batch dimension B is optional
+  size_t rank = patternTensor.shape().size();
+  Require(lShape.size() == rank && rShape.size() == rank, "The number of dimensions for the pattern and the dense matrices should be consistent.");
+  Require(rank <= 3, "The number of dimensions should not exceed the maximum supported: 3");
+  if (rank == 3)
+    Require(patternTensor.shape()[0] == lShape[0] && patternTensor.shape()[0] == rShape[0], "For 3D batch operation, the number of batch should be consistent");
+  Require(patternTensor.shape()[rank - 2] == lShape[rank - 2], "In sddmm operation, the number of rows on the left should be equal to the number of rows of the pattern.");
+  Require(patternTensor.shape()[rank - 1] == rShape[rank - 2], "In sddmm operation, the number of rows on the right should be equal to the number of columns of the pattern.");
+
+  auto patternSparse2Ds = patternTensor.toSparse2Ds();
+  ops::INT inner = lShape[rank - 1];
+  size_t leftSize = (size_t)lShape[rank - 2] * inner;
+  size_t rightSize = (size_t)rShape[rank - 2] * inner;
+  Require(leftLength == patternSparse2Ds.size() * leftSize && rightLength == patternSparse2Ds.size() * rightSize,
+      "The sizes of the dense matrices should match their shapes");
+  std::vector<SpMat> resSparse2Ds(patternSparse2Ds.size());
+
+  float * leftData = (float *)env->GetPrimitiveArrayCritical(left, 0);
+  float * rightData = leftData == NULL ? NULL : (float *)env->GetPrimitiveArrayCritical(right, 0);
+  try{
+    Require(leftData != NULL && rightData != NULL, "Unable to access the dense matrices");
+    // the computation is done in parallel within each batch already.
+    for (size_t i=0; i<patternSparse2Ds.size(); i++)
+      resSparse2Ds[i] = ops::sddmm(patternSparse2Ds[i].get(), leftData + i * leftSize, rightData + i * rightSize, inner);
+  } catch (...) {
+    if (rightData != NULL) env->ReleasePrimitiveArrayCritical(right, rightData, JNI_ABORT);
+    if (leftData != NULL) env->ReleasePrimitiveArrayCritical(left, leftData, JNI_ABORT);
+    throw;
+  }
+  // the dense inputs are read-only, so there is nothing to copy back
+  env->ReleasePrimitiveArrayCritical(right, rightData, JNI_ABORT);
+  env->ReleasePrimitiveArrayCritical(left, leftData, JNI_ABORT);
+  res = ops::SparseResult(std::move(resSparse2Ds), rank == 2);
+}
+
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_sddmm(JNIEnv *env,
+                                                             jobject obj,
+                                                             jobject pattern,
+                                                             jintArray leftShape,
+                                                             jfloatArray left,
+                                                             jintArray rightShape,
+                                                             jfloatArray right) {
+  ops::use_thread_config();
+  jobject res = NULL;
   try{
-    ops::SparseFloatTensor leftTensor = ops::javaToCPPSparseTensor(env, left);
-    ops::SparseFloatTensor rightTensor = ops::javaToCPPSparseTensor(env, right);
+    ops::SparseResult sparse;
+    sddmmResult(env, pattern, leftShape, left, rightShape, right, sparse);
+    res = ops::cppToJavaSparseTensor(env, sparse);
+  } catch (...) {
+    ops::throwJavaError(env, "error in computing sampled dense-dense matrix multiplication");
+  }
+  return res;
+}
+
+// A matmul plan handle holds one plan for each matrix in the batch. The
+// handle must later be deleted via deleteMatmulPlan by Java.
+typedef std::vector<ops::MatmulPlan> MatmulPlans;
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_matmulPlan(JNIEnv *env,
+                                                             jobject obj,
+                                                             jobject left,
+                                                             jobject right) {
+  ops::use_thread_config();
+  MatmulPlans * plans = NULL;
+  try{
+    // collect the arrays of both operands before pinning any of them
+    ops::JavaSparseTensorView leftView(env, left);
+    ops::JavaSparseTensorView rightView(env, right);
+    leftView.pin();
+    rightView.pin();
+    ops::SparseFloatTensor & leftTensor = leftView.tensor();
+    ops::SparseFloatTensor & rightTensor = rightView.tensor();
 
     // Shape requirements
     Require(leftTensor.shape().size() == rightTensor.shape().size(), "The number of dimensions for matrices in both side should be consistent.");
@@ -80,58 +433,317 @@ jobject binaryCall(JNIEnv *env, jobject left, jobject right,
     auto leftSparse2Ds = leftTensor.toSparse2Ds();
     auto rightSparse2Ds = rightTensor.toSparse2Ds();
 
-    std::vector<SpMat> resSparse2Ds(leftSparse2Ds.size());
-    size_t exceptionCount = 0;
-    #ifdef EIGEN
-    #pragma omp parallel for schedule(dynamic) reduction(+:exceptionCount)
-    for (size_t i=0; i<leftSparse2Ds.size(); i++) {
-      try{
-        resSparse2Ds[i] = std::move(op(leftSparse2Ds[i].get(), rightSparse2Ds[i].get()));
-      } catch (...) {
-        exceptionCount++;
-      }
-    }
-    Require(exceptionCount == 0, "error in computing binary matrix operation");
-    #else // MKL: do it sequentially as the computation will be done in parallel already.
+    plans = new MatmulPlans();
+    plans->reserve(leftSparse2Ds.size());
+    // the symbolic phase is done in parallel within each batch already.
     for (size_t i=0; i<leftSparse2Ds.size(); i++)
-      resSparse2Ds[i] = std::move(op(leftSparse2Ds[i].get(), rightSparse2Ds[i].get()));
-    #endif
+      plans->emplace_back(leftSparse2Ds[i].get(), rightSparse2Ds[i].get());
+  } catch (...) {
+    delete plans;
+    plans = NULL;
+    ops::throwJavaError(env, "error in creating sparse matmul plan");
+  }
+  return (jlong)plans;
+}
 
-    res = ops::cppToJavaSparseTensor(env, ops::SparseFloatTensor(resSparse2Ds, leftTensor.shape().size() == 2));
+/** Run the numeric phase of the plans on the operands, either into values,
+ * with the non-zeros of all the batches one after the other, or into new
+ * matrices in mats */
+static void executePlans(const MatmulPlans & plans, ops::SparseFloatTensor & left,
+                         ops::SparseFloatTensor & right, ops::DataType * values,
+                         std::vector<SpMat> * mats) {
+  auto leftSparse2Ds = left.toSparse2Ds();
+  auto rightSparse2Ds = right.toSparse2Ds();
+  Require(leftSparse2Ds.size() == plans.size() && rightSparse2Ds.size() == plans.size(),
+      "The number of batch is different from the one the sparse matmul plan is created for");
 
-  } catch (...) {
-    env->ThrowNew(errorClass, "error in computing binary matrix operation");
+  // the numeric phase is done in parallel within each batch already.
+  for (size_t i=0; i<plans.size(); i++) {
+    if (values != NULL) {
+      plans[i].execute(leftSparse2Ds[i].get(), rightSparse2Ds[i].get(), values);
+      values += plans[i].nonZeros();
+    } else {
+      (*mats)[i] = plans[i].execute(leftSparse2Ds[i].get(), rightSparse2Ds[i].get());
+    }
   }
+}
+
+/** Compute a matmul with a plan on Java tensors. The operands are used in
+ * place, and released before the result is returned. */
+ops::SparseResult planResult(JNIEnv *env, const MatmulPlans & plans,
+                             jobject left, jobject right) {
+  ops::JavaSparseTensorView leftTensor(env, left);
+  ops::JavaSparseTensorView rightTensor(env, right);
+  leftTensor.pin();
+  rightTensor.pin();
+  std::vector<SpMat> resSparse2Ds(plans.size());
+  executePlans(plans, leftTensor.tensor(), rightTensor.tensor(), NULL, &resSparse2Ds);
+  return ops::SparseResult(std::move(resSparse2Ds), leftTensor.tensor().shape().size() == 2);
+}
 
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_matmulWithPlan(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong plan,
+                                                             jobject left,
+                                                             jobject right) {
+  ops::use_thread_config();
+  jobject res = NULL;
+  try{
+    const MatmulPlans * plans = (const MatmulPlans *)plan;
+    Require(plans != NULL, "The sparse matmul plan is not valid");
+    res = ops::cppToJavaSparseTensor(env, planResult(env, *plans, left, right));
+  } catch (...) {
+    ops::throwJavaError(env, "error in computing sparse matmul with a plan");
+  }
   return res;
 }
 
-JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_add(JNIEnv *env,
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_matmulWithPlanInto(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong plan,
+                                                             jobject left,
+                                                             jobject right,
+                                                             jfloatArray values) {
+  ops::use_thread_config();
+  try{
+    const MatmulPlans * plans = (const MatmulPlans *)plan;
+    Require(plans != NULL, "The sparse matmul plan is not valid");
+    ops::OrdinalType nonZeros = 0;
+    for (const auto & p : *plans) nonZeros += p.nonZeros();
+    Require((ops::OrdinalType)env->GetArrayLength(values) == nonZeros,
+        "The size of the values is different from the number of non-zeros of the sparse matmul plan");
+
+    ops::JavaSparseTensorView leftTensor(env, left);
+    ops::JavaSparseTensorView rightTensor(env, right);
+    leftTensor.pin();
+    rightTensor.pin();
+    float * valuesData = (float *)env->GetPrimitiveArrayCritical(values, 0);
+    Require(valuesData != NULL, "Unable to access the values");
+    try{
+      executePlans(*plans, leftTensor.tensor(), rightTensor.tensor(), valuesData, NULL);
+    } catch (...) {
+      env->ReleasePrimitiveArrayCritical(values, valuesData, JNI_ABORT);
+      throw;
+    }
+    env->ReleasePrimitiveArrayCritical(values, valuesData, 0);
+  } catch (...) {
+    ops::throwJavaError(env, "error in computing sparse matmul with a plan");
+  }
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_deleteMatmulPlan(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong plan) {
+  delete (MatmulPlans *)plan;
+}
+
+// A result handle holds the result of an operation natively, so that Java
+// can query its sizes and then have it written into arrays it allocates.
+// The handle must later be deleted via deleteResult by Java.
+
+jlong binaryResultCall(JNIEnv *env, jobject left, jobject right,
+                   binary_sparseops_function op) {
+  ops::SparseResult * result = NULL;
+  try{
+    result = new ops::SparseResult(binaryResult(env, left, right, op));
+  } catch (...) {
+    ops::throwJavaError(env, "error in computing binary matrix operation");
+  }
+  return (jlong)result;
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_addResult(JNIEnv *env,
                                                              jobject obj,
                                                              jobject left,
                                                              jobject right) {
-  return binaryCall(env, left, right, ops::add);
+  ops::use_thread_config();
+  return binaryResultCall(env, left, right, ops::add);
 }
 
-JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_times(JNIEnv *env,
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_timesResult(JNIEnv *env,
                                                              jobject obj,
                                                              jobject left,
                                                              jobject right) {
-  return binaryCall(env, left, right, ops::times);
+  ops::use_thread_config();
+  return binaryResultCall(env, left, right, ops::times);
 }
 
-JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_sub(JNIEnv *env,
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_subResult(JNIEnv *env,
                                                              jobject obj,
                                                              jobject left,
                                                              jobject right) {
-  return binaryCall(env, left, right, ops::sub);
+  ops::use_thread_config();
+  return binaryResultCall(env, left, right, ops::sub);
 }
 
-JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_matmul(JNIEnv *env,
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_matmulResult(JNIEnv *env,
                                                              jobject obj,
                                                              jobject left,
                                                              jobject right) {
-  return binaryCall(env, left, right, ops::matmul);
+  ops::use_thread_config();
+  return binaryResultCall(env, left, right, ops::matmul);
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_transposeResult(JNIEnv *env,
+                                                             jobject obj,
+                                                             jobject operand) {
+  ops::use_thread_config();
+  ops::SparseResult * result = NULL;
+  try{
+    result = new ops::SparseResult(unaryResult(env, operand, ops::transpose));
+  } catch (...) {
+    ops::throwJavaError(env, "error in computing unary matrix operation");
+  }
+  return (jlong)result;
+}
+
+JNIEXPORT jintArray JNICALL Java_org_diffkt_external_SparseOps_resultSizes(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong result) {
+  jintArray res = NULL;
+  try{
+    const ops::SparseResult * r = (const ops::SparseResult *)result;
+    Require(r != NULL, "The sparse result is not valid");
+    res = ops::sparseResultSizesToJava(env, *r);
+  } catch (...) {
+    ops::throwJavaError(env, "error in getting the sizes of a sparse result");
+  }
+  return res;
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_writeResult(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong result,
+                                                             jfloatArray values,
+                                                             jobjectArray inners,
+                                                             jobjectArray outers) {
+  try{
+    const ops::SparseResult * r = (const ops::SparseResult *)result;
+    Require(r != NULL, "The sparse result is not valid");
+    ops::writeSparseResultToJava(env, *r, values, inners, outers);
+  } catch (...) {
+    ops::throwJavaError(env, "error in writing a sparse result");
+  }
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_deleteResult(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong result) {
+  delete (ops::SparseResult *)result;
+}
+
+// A tensor handle holds a sparse tensor in native memory, so that the
+// result of an operation can be passed to the next one without copying it
+// to Java and back. The data is only copied to Java by getTensor. The
+// handle must later be deleted via deleteTensor by Java.
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_putTensor(JNIEnv *env,
+                                                             jobject obj,
+                                                             jobject tensor) {
+  ops::use_thread_config();
+  ops::SparseFloatTensor * t = NULL;
+  try{
+    t = new ops::SparseFloatTensor(ops::javaToCPPSparseTensor(env, tensor));
+  } catch (...) {
+    ops::throwJavaError(env, "error in copying a sparse tensor to native memory");
+  }
+  return (jlong)t;
+}
+
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_getTensor(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong handle) {
+  ops::use_thread_config();
+  jobject res = NULL;
+  try{
+    const ops::SparseFloatTensor * t = (const ops::SparseFloatTensor *)handle;
+    Require(t != NULL, "The sparse tensor handle is not valid");
+    res = ops::cppToJavaSparseTensor(env, *t);
+  } catch (...) {
+    ops::throwJavaError(env, "error in copying a sparse tensor from native memory");
+  }
+  return res;
+}
+
+JNIEXPORT jintArray JNICALL Java_org_diffkt_external_SparseOps_getTensorShape(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong handle) {
+  jintArray res = NULL;
+  try{
+    const ops::SparseFloatTensor * t = (const ops::SparseFloatTensor *)handle;
+    Require(t != NULL, "The sparse tensor handle is not valid");
+    res = ops::copyCPPArrayToJava(env, t->shape());
+  } catch (...) {
+    ops::throwJavaError(env, "error in getting the shape of a sparse tensor");
+  }
+  return res;
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_deleteTensor(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong handle) {
+  delete (ops::SparseFloatTensor *)handle;
+}
+
+jlong binaryTensorCall(JNIEnv *env, jlong left, jlong right,
+                   binary_sparseops_function op) {
+  ops::SparseFloatTensor * res = NULL;
+  try{
+    ops::SparseFloatTensor * leftTensor = (ops::SparseFloatTensor *)left;
+    ops::SparseFloatTensor * rightTensor = (ops::SparseFloatTensor *)right;
+    Require(leftTensor != NULL && rightTensor != NULL, "The sparse tensor handle is not valid");
+    res = new ops::SparseFloatTensor(binaryCompute(*leftTensor, *rightTensor, op).toTensor());
+  } catch (...) {
+    ops::throwJavaError(env, "error in computing binary matrix operation");
+  }
+  return (jlong)res;
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_addTensors(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong left,
+                                                             jlong right) {
+  ops::use_thread_config();
+  return binaryTensorCall(env, left, right, ops::add);
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_timesTensors(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong left,
+                                                             jlong right) {
+  ops::use_thread_config();
+  return binaryTensorCall(env, left, right, ops::times);
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_subTensors(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong left,
+                                                             jlong right) {
+  ops::use_thread_config();
+  return binaryTensorCall(env, left, right, ops::sub);
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_matmulTensors(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong left,
+                                                             jlong right) {
+  ops::use_thread_config();
+  return binaryTensorCall(env, left, right, ops::matmul);
+}
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_transposeTensor(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong operand) {
+  ops::use_thread_config();
+  ops::SparseFloatTensor * res = NULL;
+  try{
+    ops::SparseFloatTensor * tensor = (ops::SparseFloatTensor *)operand;
+    Require(tensor != NULL, "The sparse tensor handle is not valid");
+    res = new ops::SparseFloatTensor(unaryCompute(*tensor, ops::transpose).toTensor());
+  } catch (...) {
+    ops::throwJavaError(env, "error in computing unary matrix operation");
+  }
+  return (jlong)res;
 }
 
 #ifdef EIGEN
@@ -139,6 +751,7 @@ JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_matdiv(JNIEnv *env,
                                                              jobject obj,
                                                              jobject left,
                                                              jobject right) {
+  ops::use_thread_config();
   return binaryCall(env, left, right, ops::matdiv);
 }
 #endif
@@ -146,6 +759,7 @@ JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_matdiv(JNIEnv *env,
 JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_transpose(JNIEnv *env,
                                                              jobject obj,
                                                              jobject operand) {
+  ops::use_thread_config();
   return unaryCall(env, operand, ops::transpose);
 }
 
@@ -155,9 +769,7 @@ JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_convertToCoo(JNIEnv
                                                              jintArray rows,
                                                              jintArray cols,
                                                              jfloatArray values) {
-  jclass errorClass = env->FindClass(ERROR_FQ_NAME.c_str());
-  Require(errorClass != NULL, "Unable to retrieve Java error");
-
+  ops::use_thread_config();
   jobject res;
   try{
     auto coo = ops::javaToCOO(env, shape, rows, cols, values);
@@ -167,7 +779,60 @@ JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_convertToCoo(JNIEnv
     auto tensor = ops::SparseFloatTensor(l);
     res = ops::cppToJavaSparseTensor(env, tensor);
   } catch (...) {
-    env->ThrowNew(errorClass, "error computing coo conversion operation");
+    ops::throwJavaError(env, "error computing coo conversion operation");
   }
   return res;
 }
+
+JNIEXPORT jlongArray JNICALL Java_org_diffkt_external_SparseOps_getPoolStats(JNIEnv *env,
+                                                             jobject obj) {
+  auto stats = ops::pool_stats();
+  jlong values[] = {(jlong)stats.allocations, (jlong)stats.system_allocations,
+                    (jlong)stats.bytes_in_use, (jlong)stats.bytes_cached};
+  jlongArray res = env->NewLongArray(4);
+  if (res == NULL) return NULL;
+  env->SetLongArrayRegion(res, 0, 4, values);
+  return res;
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_trimPool(JNIEnv *env,
+                                                             jobject obj) {
+  ops::pool_trim();
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_setPoolMaxCached(JNIEnv *env,
+                                                             jobject obj,
+                                                             jlong bytes) {
+  ops::pool_set_max_cached(bytes > 0 ? (size_t)bytes : 0);
+}
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_setPoolLargeBlockModes(JNIEnv *env,
+                                                             jobject obj,
+                                                             jboolean huge_pages,
+                                                             jboolean first_touch) {
+  ops::pool_set_huge_pages(huge_pages);
+  ops::pool_set_first_touch(first_touch);
+}
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_SparseOps_setThreadConfig(JNIEnv *env, jobject obj,
+    jint num_threads, jint pinning) {
+  ops::set_thread_config(num_threads, (ops::Pinning)pinning);
+}
+
+JNIEXPORT jintArray JNICALL
+Java_org_diffkt_external_SparseOps_getThreadInfo(JNIEnv *env, jobject obj) {
+  return ops::thread_info(env);
+}
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_SparseOps_setPartitions(JNIEnv *env, jobject obj,
+    jint num_partitions) {
+  ops::set_partitions(num_partitions);
+}
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_SparseOps_setThreadPartition(JNIEnv *env, jobject obj,
+    jint partition) {
+  ops::set_thread_partition(partition);
+}
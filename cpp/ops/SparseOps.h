@@ -24,6 +24,78 @@ JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_sub(JNIEnv *, jobje
 JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_matmul(JNIEnv *, jobject,
                                                              jobject, jobject);
 
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_matmulToDense(JNIEnv *, jobject,
+                                                             jobject, jobject, jboolean);
+
+JNIEXPORT jfloatArray JNICALL Java_org_diffkt_external_SparseOps_spmm(JNIEnv *, jobject,
+                                                             jobject, jintArray, jfloatArray);
+
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_sddmm(JNIEnv *, jobject,
+                                                             jobject, jintArray, jfloatArray, jintArray, jfloatArray);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_matmulPlan(JNIEnv *, jobject,
+                                                             jobject, jobject);
+
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_matmulWithPlan(JNIEnv *, jobject,
+                                                             jlong, jobject, jobject);
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_matmulWithPlanInto(JNIEnv *, jobject,
+                                                             jlong, jobject, jobject, jfloatArray);
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_deleteMatmulPlan(JNIEnv *, jobject,
+                                                             jlong);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_addResult(JNIEnv *, jobject,
+                                                             jobject, jobject);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_timesResult(JNIEnv *, jobject,
+                                                             jobject, jobject);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_subResult(JNIEnv *, jobject,
+                                                             jobject, jobject);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_matmulResult(JNIEnv *, jobject,
+                                                             jobject, jobject);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_transposeResult(JNIEnv *, jobject,
+                                                             jobject);
+
+JNIEXPORT jintArray JNICALL Java_org_diffkt_external_SparseOps_resultSizes(JNIEnv *, jobject,
+                                                             jlong);
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_writeResult(JNIEnv *, jobject,
+                                                             jlong, jfloatArray, jobjectArray, jobjectArray);
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_deleteResult(JNIEnv *, jobject,
+                                                             jlong);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_putTensor(JNIEnv *, jobject,
+                                                             jobject);
+
+JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_getTensor(JNIEnv *, jobject,
+                                                             jlong);
+
+JNIEXPORT jintArray JNICALL Java_org_diffkt_external_SparseOps_getTensorShape(JNIEnv *, jobject,
+                                                             jlong);
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_deleteTensor(JNIEnv *, jobject,
+                                                             jlong);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_addTensors(JNIEnv *, jobject,
+                                                             jlong, jlong);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_timesTensors(JNIEnv *, jobject,
+                                                             jlong, jlong);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_subTensors(JNIEnv *, jobject,
+                                                             jlong, jlong);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_matmulTensors(JNIEnv *, jobject,
+                                                             jlong, jlong);
+
+JNIEXPORT jlong JNICALL Java_org_diffkt_external_SparseOps_transposeTensor(JNIEnv *, jobject,
+                                                             jlong);
+
 JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_matdiv(JNIEnv *, jobject,
                                                              jobject, jobject);
 
@@ -32,6 +104,45 @@ JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_transpose(JNIEnv *,
 
 JNIEXPORT jobject JNICALL Java_org_diffkt_external_SparseOps_convertToCoo(JNIEnv *, jobject, jintArray,
                                                              jintArray, jintArray, jfloatArray);
+
+// Returns the allocations, system allocations, bytes in use and bytes cached
+// of the memory pool, see Sparse/Pool.h
+JNIEXPORT jlongArray JNICALL Java_org_diffkt_external_SparseOps_getPoolStats(JNIEnv *, jobject);
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_trimPool(JNIEnv *, jobject);
+
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_setPoolMaxCached(JNIEnv *, jobject,
+                                                             jlong);
+
+// Sets whether the new large blocks of the pool are backed by huge pages and
+// first touched by the OpenMP threads
+JNIEXPORT void JNICALL Java_org_diffkt_external_SparseOps_setPoolLargeBlockModes(JNIEnv *, jobject,
+                                                             jboolean, jboolean);
+
+// Sets the number of threads, or the default when <= 0, and the pinning
+// policy of the library's ops, see Threading/Threading.h
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_SparseOps_setThreadConfig(JNIEnv *, jobject,
+    /* num_threads, pinning */
+    jint, jint);
+
+// Returns the logical CPUs, physical cores, sockets and quota CPUs, followed
+// by the number of threads, the pinning, the number of partitions and the
+// partition of the calling thread
+JNIEXPORT jintArray JNICALL
+Java_org_diffkt_external_SparseOps_getThreadInfo(JNIEnv *, jobject);
+
+// Splits the cores into partitions, see Threading/Threading.h
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_SparseOps_setPartitions(JNIEnv *, jobject,
+    /* num_partitions */
+    jint);
+
+// Routes the calling thread to a partition, or by its thread id when < 0
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_SparseOps_setThreadPartition(JNIEnv *, jobject,
+    /* partition */
+    jint);
 }
 
 #endif // SPARSEOPS_H_
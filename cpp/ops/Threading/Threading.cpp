@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "Threading.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdint.h>
+#include <thread>
+#include <utility>
+
+#include <omp.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+namespace ops {
+
+namespace {
+
+bool read_line(const std::string &path, std::string &line) {
+  std::ifstream file(path);
+  return file && std::getline(file, line);
+}
+
+bool read_long(const std::string &path, long &value) {
+  std::ifstream file(path);
+  return file && (file >> value);
+}
+
+std::vector<int> affinity_cpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &set))
+        cpus.push_back(cpu);
+  }
+#endif
+  if (cpus.empty()) {
+    int n = std::max(1u, std::thread::hardware_concurrency());
+    for (int cpu = 0; cpu < n; cpu++)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+// The cgroup path of the process for the cgroup v2 hierarchy, or for the v1
+// hierarchy of the cpu controller, from /proc/self/cgroup
+std::string cgroup_path(bool v2) {
+  std::ifstream file("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(file, line)) {
+    // hierarchy-ID:controller-list:path
+    auto first = line.find(':');
+    auto second = line.find(':', first + 1);
+    if (first == std::string::npos || second == std::string::npos)
+      continue;
+    auto controllers = line.substr(first + 1, second - first - 1);
+    auto path = line.substr(second + 1);
+    if (v2 && controllers.empty())
+      return path;
+    std::stringstream ss(controllers);
+    std::string controller;
+    while (!v2 && std::getline(ss, controller, ','))
+      if (controller == "cpu")
+        return path;
+  }
+  return "";
+}
+
+// The directory of the cgroup at path under mount, followed by its ancestors
+// up to mount. A quota set on any of them applies to the process.
+std::vector<std::string> cgroup_dirs(const std::string &mount,
+                                     std::string path) {
+  std::vector<std::string> dirs;
+  while (!path.empty() && path != "/") {
+    dirs.push_back(mount + path);
+    path = path.substr(0, path.find_last_of('/'));
+  }
+  dirs.push_back(mount);
+  return dirs;
+}
+
+int quota_cpus(const std::string &sys_root) {
+  int res = 0;
+  auto use = [&](int cpus) {
+    if (cpus > 0 && (res == 0 || cpus < res))
+      res = cpus;
+  };
+
+  // cgroup v2
+  auto v2_mount = sys_root + "/fs/cgroup";
+  for (auto &dir : cgroup_dirs(v2_mount, cgroup_path(true))) {
+    std::string cpu_max;
+    if (read_line(dir + "/cpu.max", cpu_max))
+      use(parse_cpu_max(cpu_max));
+  }
+  if (res > 0)
+    return res;
+
+  // cgroup v1, where a quota of -1 means none
+  auto v1_mount = sys_root + "/fs/cgroup/cpu";
+  for (auto &dir : cgroup_dirs(v1_mount, cgroup_path(false))) {
+    long quota, period;
+    if (read_long(dir + "/cpu.cfs_quota_us", quota) &&
+        read_long(dir + "/cpu.cfs_period_us", period) && quota > 0 &&
+        period > 0)
+      use((int)((quota + period - 1) / period));
+  }
+  return res;
+}
+
+std::atomic<int> config_num_threads(0);
+std::atomic<int> config_pinning((int)Pinning::NONE);
+std::atomic<int> config_partitions(1);
+// Incremented by each configuration change, to tell threads to apply it again
+std::atomic<uint64_t> config_generation(1);
+
+thread_local uint64_t applied_generation = 0;
+thread_local bool pinned = false;
+// The partition set by set_thread_partition, or -1
+thread_local int chosen_partition = -1;
+// The partition the thread uses, or -1 when the cores aren't partitioned
+thread_local int current_partition = -1;
+
+// Pins the threads of the calling thread's OpenMP team to cores, indices of
+// cores of the topology: thread i to cores[i] modulo their number with
+// CORES, or each to any of them with NONE.
+void pin_threads(Pinning pinning, int num_threads,
+                 const std::vector<int> &cores) {
+#ifdef __linux__
+  const auto &topology = cpu_topology();
+#pragma omp parallel num_threads(num_threads)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    int core = cores[omp_get_thread_num() % cores.size()];
+    for (size_t i = 0; i < topology.cpus.size(); i++) {
+      bool allowed =
+          pinning == Pinning::NONE
+              ? std::find(cores.begin(), cores.end(), topology.cores[i]) !=
+                    cores.end()
+              : topology.cores[i] == core;
+      if (allowed)
+        CPU_SET(topology.cpus[i], &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);
+  }
+#endif
+}
+
+// The id of the calling thread in the operating system. Unlike a counter,
+// it is the same in every library holding a copy of this one.
+uint64_t os_thread_id() {
+#if defined(__linux__)
+  return (uint64_t)syscall(SYS_gettid);
+#elif defined(__APPLE__)
+  uint64_t id = 0;
+  pthread_threadid_np(NULL, &id);
+  return id;
+#else
+  return std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+}
+
+// The cores the ops may use: all of them, unless the cgroup quota allows
+// fewer
+int usable_cores() {
+  const auto &topology = cpu_topology();
+  int n = topology.num_cores;
+  if (topology.quota_cpus > 0)
+    n = std::min(n, topology.quota_cpus);
+  return std::max(n, 1);
+}
+
+} // namespace
+
+int parse_cpu_max(const std::string &cpu_max) {
+  std::stringstream ss(cpu_max);
+  std::string quota;
+  long period = 0;
+  if (!(ss >> quota >> period) || quota == "max" || period <= 0)
+    return 0;
+  long q = std::atol(quota.c_str());
+  return q > 0 ? (int)((q + period - 1) / period) : 0;
+}
+
+CpuTopology detect_cpu_topology(const std::vector<int> &cpus,
+                                const std::string &sys_root) {
+  CpuTopology res;
+  res.cpus = cpus;
+  std::sort(res.cpus.begin(), res.cpus.end());
+
+  // Cores are identified by their package and core ids. A CPU without
+  // topology information is its own core.
+  std::map<std::pair<long, long>, int> core_index;
+  std::set<long> sockets;
+  for (int cpu : res.cpus) {
+    auto dir =
+        sys_root + "/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology";
+    long package, core;
+    if (!read_long(dir + "/physical_package_id", package) ||
+        !read_long(dir + "/core_id", core)) {
+      package = -1;
+      core = cpu;
+    }
+    sockets.insert(package);
+    auto it = core_index.emplace(std::make_pair(package, core),
+                                 (int)core_index.size());
+    res.cores.push_back(it.first->second);
+  }
+  res.num_cores = (int)core_index.size();
+  res.num_sockets = (int)sockets.size();
+  res.quota_cpus = quota_cpus(sys_root);
+  return res;
+}
+
+const CpuTopology &cpu_topology() {
+  static CpuTopology topology = detect_cpu_topology(affinity_cpus(), "/sys");
+  return topology;
+}
+
+int default_num_threads() {
+  // Setting via omp_set_num_threads overrides the environment variable, so
+  // honor it here
+  const char *env = std::getenv("OMP_NUM_THREADS");
+  if (env != NULL && std::atoi(env) > 0)
+    return std::atoi(env);
+  return usable_cores();
+}
+
+void set_thread_config(int num_threads, Pinning pinning) {
+  config_num_threads = num_threads;
+  config_pinning = (int)pinning;
+  config_generation++;
+}
+
+int num_threads() {
+  int n = config_num_threads;
+  return n > 0 ? n : default_num_threads();
+}
+
+Pinning pinning() { return (Pinning)config_pinning.load(); }
+
+std::vector<int> partition_cores(int partition, int num_partitions,
+                                 int num_cores) {
+  std::vector<int> res;
+  for (int core = partition * num_cores / num_partitions;
+       core < (partition + 1) * num_cores / num_partitions; core++)
+    res.push_back(core);
+  return res;
+}
+
+void set_partitions(int num_partitions) {
+  config_partitions = std::max(1, std::min(num_partitions, usable_cores()));
+  config_generation++;
+}
+
+int num_partitions() { return config_partitions; }
+
+void set_thread_partition(int partition) {
+  chosen_partition = partition;
+  // Apply it on the next use, even if the configuration didn't change
+  applied_generation = 0;
+}
+
+int thread_partition() { return current_partition; }
+
+void use_thread_config() {
+  uint64_t generation = config_generation;
+  if (generation == applied_generation)
+    return;
+  int partitions = config_partitions;
+  auto p = pinning();
+  if (partitions <= 1) {
+    current_partition = -1;
+    int n = num_threads();
+    omp_set_num_threads(n);
+    // Threads that were never pinned don't need to be unpinned
+    if (p != Pinning::NONE || pinned) {
+      pin_threads(p, n, partition_cores(0, 1, cpu_topology().num_cores));
+      pinned = p != Pinning::NONE;
+    }
+  } else {
+    // Threads without a partition are spread by their id, which the JNI
+    // libraries, each linking its own copy of this state, agree on
+    static thread_local uint64_t thread_id = os_thread_id();
+    current_partition = chosen_partition >= 0
+                            ? chosen_partition % partitions
+                            : (int)(thread_id % (uint64_t)partitions);
+    auto cores = partition_cores(current_partition, partitions, usable_cores());
+    // One thread per core of the partition, unless fewer threads are set
+    int n = (int)cores.size();
+    if (config_num_threads > 0)
+      n = std::min(n, (int)config_num_threads);
+    omp_set_num_threads(n);
+    // The threads of a partition always stay on its cores
+    pin_threads(p, n, cores);
+    pinned = true;
+  }
+  applied_generation = generation;
+}
+
+} // namespace ops
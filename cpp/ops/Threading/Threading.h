@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef OPS_THREADING_H_
+#define OPS_THREADING_H_
+
+#include <string>
+#include <vector>
+
+namespace ops {
+
+// The CPUs the process may run on
+struct CpuTopology {
+  // The logical CPUs of the affinity mask, in increasing order
+  std::vector<int> cpus;
+  // The physical core of each of cpus, numbered from 0 in order of first CPU
+  std::vector<int> cores;
+  int num_cores = 0;
+  int num_sockets = 0;
+  // The number of CPUs allowed by the cgroup CPU quota, rounded up, or 0
+  // when there is no quota
+  int quota_cpus = 0;
+};
+
+// The topology of the process, detected once from sched_getaffinity, sysfs
+// and the cgroup CPU controller. Falls back to one core per hardware thread
+// when these aren't available, e.g. on macOS.
+const CpuTopology &cpu_topology();
+
+// Detects the topology of cpus from the sysfs and cgroup file systems mounted
+// at sys_root, usually "/sys".
+CpuTopology detect_cpu_topology(const std::vector<int> &cpus,
+                                const std::string &sys_root);
+
+// Parses a cgroup v2 cpu.max file ("max 100000" or "<quota> <period>") into a
+// number of CPUs, rounded up, or 0 without a quota.
+int parse_cpu_max(const std::string &cpu_max);
+
+// The number of threads used when none is set: OMP_NUM_THREADS if it is set,
+// otherwise the number of physical cores, capped by the cgroup quota. Hardware
+// threads of the same core share its vector units, so the ops rarely gain
+// from running on both.
+int default_num_threads();
+
+enum class Pinning : int {
+  // Threads run on any CPU of the affinity mask
+  NONE = 0,
+  // Thread i of a parallel region runs on a CPU of core i, modulo the number
+  // of cores, which keeps each thread's caches warm across regions.
+  CORES = 1,
+};
+
+// Sets the number of OpenMP threads of the ops, and how they are pinned to
+// cores. num_threads <= 0 restores default_num_threads(). With partitions,
+// num_threads caps the threads of each partition.
+//
+// OpenMP keeps the number of threads per calling thread, so the
+// configuration is applied lazily, by use_thread_config(), to each thread
+// calling the ops.
+void set_thread_config(int num_threads, Pinning pinning);
+int num_threads();
+Pinning pinning();
+
+// Partitions, for throughput on small requests.
+//
+// A single op on a small batch doesn't keep all the cores busy, and
+// synchronizing one OpenMP team across all of them costs more than the op.
+// With partitions, the usable cores are split into groups of consecutive
+// cores, and each thread calling the ops is routed to one of them: its
+// OpenMP team gets one thread per core of the partition, pinned to these
+// cores. Threads serving independent requests then run side by side, each
+// on its own cores, with their own DNNL stream (see Dnnl/Utils.h).
+
+// Splits the usable cores into num_partitions partitions, at most one per
+// core. 1 disables partitioning.
+void set_partitions(int num_partitions);
+int num_partitions();
+
+// The cores of a partition, as indices of the cores of the topology
+std::vector<int> partition_cores(int partition, int num_partitions,
+                                 int num_cores);
+
+// Routes the calling thread to a partition, modulo their number, from its
+// next use_thread_config(). Threads without a partition (partition < 0, the
+// default) are assigned the one of their operating system thread id, modulo
+// the number of partitions. Each JNI library links its own copy of this
+// state, and the thread id keeps their choices the same, so a thread is
+// never pinned to different partitions by different libraries. Threads
+// created together, like those of a pool, get consecutive ids and so are
+// spread evenly.
+void set_thread_partition(int partition);
+// The partition of the calling thread, or -1 if the cores aren't partitioned
+int thread_partition();
+
+// Applies the thread configuration to the calling thread and its OpenMP
+// threads, if it changed since the thread last applied it. The JNI entries
+// call this before running an op; it only costs two loads otherwise.
+//
+// Pinning also pins the calling thread, as it is thread 0 of its parallel
+// regions.
+void use_thread_config();
+
+} // namespace ops
+
+#endif // OPS_THREADING_H_
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef OPS_THREADINGJNI_H_
+#define OPS_THREADINGJNI_H_
+
+#include <jni.h>
+
+#include "Threading.h"
+
+namespace ops {
+
+// Returns the logical CPUs, physical cores, sockets and quota CPUs of the
+// topology, followed by the number of threads, the pinning, the number of
+// partitions and the partition of the calling thread, or NULL with a pending
+// OutOfMemoryError
+inline jintArray thread_info(JNIEnv *env) {
+  // Route the thread to its partition
+  use_thread_config();
+  const auto &topology = cpu_topology();
+  jint info[] = {(jint)topology.cpus.size(), topology.num_cores,
+                 topology.num_sockets,       topology.quota_cpus,
+                 num_threads(),              (jint)pinning(),
+                 num_partitions(),           thread_partition()};
+  jintArray res = env->NewIntArray(8);
+  if (res == NULL)
+    return NULL;
+  env->SetIntArrayRegion(res, 0, 8, info);
+  return res;
+}
+
+} // namespace ops
+
+#endif // OPS_THREADINGJNI_H_
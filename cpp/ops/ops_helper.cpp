@@ -9,6 +9,7 @@
 
 #include "Math/math.h"
 #include "Predicate/ifThenElse.h"
+#include "Threading/ThreadingJni.h"
 #include <random>
 
 JNIEXPORT void JNICALL Java_org_diffkt_external_External_plus(
@@ -181,3 +182,26 @@ JNIEXPORT void JNICALL Java_org_diffkt_external_External_ifThenElse(
   env->ReleaseFloatArrayElements(b, b_data, 0);
   env->ReleaseFloatArrayElements(res, res_data, 0);
 }
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_External_setThreadConfig(JNIEnv *env, jobject obj,
+    jint num_threads, jint pinning) {
+  ops::set_thread_config(num_threads, (ops::Pinning)pinning);
+}
+
+JNIEXPORT jintArray JNICALL
+Java_org_diffkt_external_External_getThreadInfo(JNIEnv *env, jobject obj) {
+  return ops::thread_info(env);
+}
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_External_setPartitions(JNIEnv *env, jobject obj,
+    jint num_partitions) {
+  ops::set_partitions(num_partitions);
+}
+
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_External_setThreadPartition(JNIEnv *env, jobject obj,
+    jint partition) {
+  ops::set_thread_partition(partition);
+}
@@ -57,6 +57,32 @@ JNIEXPORT void JNICALL Java_org_diffkt_external_External_polygamma__I_3F_3FI(
 JNIEXPORT void JNICALL Java_org_diffkt_external_External_ifThenElse(
     JNIEnv *, jobject, jfloatArray, jfloatArray, jfloatArray, jfloatArray,
     jint size);
+
+// Threading
+// Sets the number of threads, or the default when <= 0, and the pinning
+// policy of the library's ops, see Threading/Threading.h
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_External_setThreadConfig(JNIEnv *, jobject,
+    /* num_threads, pinning */
+    jint, jint);
+
+// Returns the logical CPUs, physical cores, sockets and quota CPUs, followed
+// by the number of threads, the pinning, the number of partitions and the
+// partition of the calling thread
+JNIEXPORT jintArray JNICALL
+Java_org_diffkt_external_External_getThreadInfo(JNIEnv *, jobject);
+
+// Splits the cores into partitions, see Threading/Threading.h
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_External_setPartitions(JNIEnv *, jobject,
+    /* num_partitions */
+    jint);
+
+// Routes the calling thread to a partition, or by its thread id when < 0
+JNIEXPORT void JNICALL
+Java_org_diffkt_external_External_setThreadPartition(JNIEnv *, jobject,
+    /* partition */
+    jint);
 }
 
 #endif // OPS_HELP_H_
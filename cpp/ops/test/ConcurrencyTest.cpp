@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "Dnnl/ArithmeticDnnl.h"
+#include "Dnnl/Conv.h"
+#include "Dnnl/Utils.h"
+#include "TestUtils.h"
+
+using namespace ops;
+
+const int NUM_THREADS = 8;
+const int ITERATIONS = 50;
+
+// Runs op from NUM_THREADS threads at once, ITERATIONS times each, and
+// expects each call to return the result of a call from this thread. Threads
+// may use different numbers of OpenMP threads, so results are compared with a
+// tolerance.
+template <typename Op> void expect_same_from_threads(Op op) {
+  std::vector<float> expected = op();
+  // The largest difference with expected seen by each thread, as gtest
+  // assertions are not checked from other threads
+  std::vector<float> max_diffs(NUM_THREADS, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < NUM_THREADS; t++) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < ITERATIONS; i++) {
+        auto res = op();
+        if (res.size() != expected.size()) {
+          max_diffs[t] = INFINITY;
+          return;
+        }
+        for (size_t j = 0; j < res.size(); j++)
+          max_diffs[t] = std::max(max_diffs[t], std::abs(res[j] - expected[j]));
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  for (auto max_diff : max_diffs)
+    EXPECT_LT(max_diff, 1.e-4f);
+}
+
+TEST(ConcurrencyTest, DoesConvFromThreads) {
+  std::vector<int32_t> img_shape = {4, 12, 12, 8};
+  std::vector<int32_t> fil_shape = {16, 3, 3, 8};
+  std::vector<int32_t> res_shape = {4, 12, 12, 16};
+  std::vector<float> img;
+  std::vector<float> fil;
+  append_random(img, product(img_shape));
+  append_random(fil, product(fil_shape));
+
+  expect_same_from_threads([&] {
+    std::vector<float> res(product(res_shape));
+    // The inputs are only read, so the threads can share them
+    conv(res_shape, img_shape, fil_shape, res.data(),
+         const_cast<float *>(img.data()), const_cast<float *>(fil.data()), 1,
+         1, Padding{1, 1, 1, 1});
+    return res;
+  });
+}
+
+TEST(ConcurrencyTest, DoesMatmulFromThreads) {
+  std::vector<int32_t> lshape = {4, 32, 48};
+  std::vector<int32_t> lstrides = {32 * 48, 48, 1};
+  std::vector<int32_t> rshape = {4, 48, 24};
+  std::vector<int32_t> rstrides = {48 * 24, 24, 1};
+  std::vector<float> lhs;
+  std::vector<float> rhs;
+  append_random(lhs, product(lshape));
+  append_random(rhs, product(rshape));
+
+  expect_same_from_threads([&] {
+    std::vector<float> res(4 * 32 * 24);
+    mmul(lshape, lstrides, 0, rshape, rstrides, 0, res.data(),
+         const_cast<float *>(lhs.data()), const_cast<float *>(rhs.data()));
+    return res;
+  });
+}
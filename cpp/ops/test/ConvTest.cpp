@@ -7,8 +7,11 @@
 
 #include "gtest/gtest.h"
 
+#include "Dnnl/Async.h"
 #include "Dnnl/Conv.h"
+#include "Dnnl/Utils.h"
 #include "TestUtils.h"
+#include "Threading/Threading.h"
 
 using namespace ops;
 
@@ -94,3 +97,49 @@ TEST(ConvGradTest, DoesSingleImageSingleChannelGradWeights) {
 
   EXPECT_EQ(weights_grad, expected);
 }
+
+TEST(ConvTensorTest, MatchesConvOfArrays) {
+  std::vector<int32_t> img_shape = {2, 6, 6, 8};
+  std::vector<int32_t> fil_shape = {16, 3, 3, 8};
+  std::vector<int32_t> res_shape = {2, 6, 6, 16};
+
+  std::vector<float> res;
+  std::vector<float> img;
+  std::vector<float> fil;
+
+  append_zeros(res, product(res_shape));
+  append_random(img, product(img_shape));
+  append_random(fil, product(fil_shape));
+
+  conv(res_shape, img_shape, fil_shape, res.data(), img.data(), fil.data(), 1,
+       1, Padding{1, 1, 1, 1});
+
+  for (bool async : {false, true}) {
+    set_async(async);
+    auto img_tensor = DenseTensor::from_user(img_shape, img.data());
+    auto fil_tensor = DenseTensor::from_user(fil_shape, fil.data());
+    auto res_tensor = conv(img_tensor, fil_tensor, 1, 1, Padding{1, 1, 1, 1});
+    EXPECT_EQ(res_tensor.shape(), res_shape);
+
+    std::vector<float> tensor_res(product(res_shape));
+    res_tensor.read(tensor_res.data());
+    EXPECT_TRUE(res_tensor.ready());
+    vector_expect_near(tensor_res, res, 1e-4f);
+  }
+  set_async(false);
+}
+
+TEST(ConvTensorTest, RunsQueuedOpsInTheCallersPartition) {
+  set_partitions(2);
+  // The last partition, or none with a single core
+  set_thread_partition(num_partitions() - 1);
+  use_thread_config();
+  int partition = -2;
+  set_async(true);
+  wait(run_op([&] { partition = thread_partition(); }));
+  set_async(false);
+  EXPECT_EQ(partition, thread_partition());
+
+  set_thread_partition(-1);
+  set_partitions(1);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "gtest/gtest.h"
+
+#include "Math/simd.h"
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+using namespace math::simd;
+
+/** The benchmark of the kernel sets of simd.h, on one thread, over inputs
+ * in the usual range of each op. */
+
+int elements = 1 << 20;
+int runs = 20;
+
+double nsPerElement(void (*kernel)(const float *, float *, int),
+                    const std::vector<float> &inputs) {
+  std::vector<float> res(inputs.size());
+  kernel(inputs.data(), res.data(), elements);
+  auto begin = std::chrono::steady_clock::now();
+  for (int it = 0; it < runs; it++)
+    kernel(inputs.data(), res.data(), elements);
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - begin).count()
+      / runs / elements;
+}
+
+TEST(MathPerfTest, Kernels) {
+  std::vector<float> exps(elements), positives(elements);
+  for (int i = 0; i < elements; i++) {
+    exps[i] = -20.f + 40.f * i / elements;
+    positives[i] = 0.01f + 100.f * i / elements;
+  }
+  printf("PerfTest: picked %s\n", kernels().name);
+  double scalar[4];
+  for (auto k : {scalar_kernels(), avx2_kernels(), avx512_kernels()}) {
+    if (k == nullptr) continue;
+    double ns[] = {nsPerElement(k->exp, exps), nsPerElement(k->log, positives),
+                   nsPerElement(k->lgamma, positives),
+                   nsPerElement(k->digamma, positives)};
+    const char *names[] = {"exp", "log", "lgamma", "digamma"};
+    for (int f = 0; f < 4; f++) {
+      if (k == scalar_kernels()) scalar[f] = ns[f];
+      printf("PerfTest: %s %s %.3f ns/element, %.1fx\n", k->name, names[f],
+             ns[f], scalar[f] / ns[f]);
+    }
+  }
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "Math/math.h"
+#include "Math/simd.h"
+#include "Math/util.h"
+
+using namespace math::simd;
+
+typedef void (*Kernel)(const float *a, float *res, int size);
+
+// The kernel sets supported here, the scalar one included
+std::vector<const Kernels *> kernelSets() {
+  std::vector<const Kernels *> sets;
+  for (auto k : {scalar_kernels(), avx2_kernels(), avx512_kernels()})
+    if (k != nullptr) sets.push_back(k);
+  return sets;
+}
+
+// The reference digamma, like util::digamma in long double with a larger
+// shift
+long double digammaReference(long double x) {
+  long double r = 0;
+  for (; x < 30; x += 1) r -= 1 / x;
+  long double z = 1 / (x * x);
+  long double y = z * (1.0L / 12 - z * (1.0L / 120 - z * (1.0L / 252 - z * (1.0L / 240
+      - z * (1.0L / 132 - z * (691.0L / 32760 - z / 12.0L))))));
+  return r + logl(x) - 0.5L / x - y;
+}
+
+// The error of a float result in units in the last place of the exact
+// result rounded to float
+double ulps(float result, long double exact) {
+  float rounded = (float) exact;
+  if (std::isinf(rounded)) return result == rounded ? 0 : INFINITY;
+  float a = std::fabs(rounded);
+  float ulp = std::nextafter(a, INFINITY) - a;
+  return (double) (fabsl((long double) result - exact) / ulp);
+}
+
+// The largest error of a kernel over inputs
+double maxUlps(Kernel kernel, long double (*exact)(long double),
+               const std::vector<float> &inputs) {
+  std::vector<float> res(inputs.size());
+  kernel(inputs.data(), res.data(), (int) inputs.size());
+  double max = 0;
+  for (size_t i = 0; i < inputs.size(); i++)
+    max = std::max(max, ulps(res[i], exact(inputs[i])));
+  return max;
+}
+
+// Every step-th positive float below high, from the subnormals up
+std::vector<float> positiveFloats(float high, uint32_t step) {
+  std::vector<float> inputs;
+  for (uint32_t bits = 1; ; bits += step) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    if (!(f < high)) break;
+    inputs.push_back(f);
+  }
+  return inputs;
+}
+
+// n evenly spaced floats in [low, high)
+std::vector<float> range(float low, float high, int n) {
+  std::vector<float> inputs;
+  for (int i = 0; i < n; i++) inputs.push_back(low + (high - low) * i / n);
+  return inputs;
+}
+
+long double expExact(long double x) { return expl(x); }
+long double logExact(long double x) { return logl(x); }
+long double lgammaExact(long double x) { return lgammal(x); }
+
+TEST(MathTest, ExpAccuracy) {
+  // Down to the subnormal results and up to the overflow
+  auto inputs = range(-104.f, 89.f, 1 << 21);
+  for (auto k : kernelSets())
+    EXPECT_LE(maxUlps(k->exp, expExact, inputs), 2.0) << k->name;
+}
+
+TEST(MathTest, LogAccuracy) {
+  auto inputs = positiveFloats(INFINITY, 1021);
+  auto near1 = range(0.9f, 1.1f, 1 << 18);
+  inputs.insert(inputs.end(), near1.begin(), near1.end());
+  for (auto k : kernelSets())
+    EXPECT_LE(maxUlps(k->log, logExact, inputs), 2.0) << k->name;
+}
+
+TEST(MathTest, LgammaAccuracy) {
+  // Up to the overflow, and closely around the zeros at 1 and 2
+  auto inputs = positiveFloats(INFINITY, 1021);
+  auto zeros = range(0.5f, 2.5f, 1 << 20);
+  inputs.insert(inputs.end(), zeros.begin(), zeros.end());
+  for (auto k : kernelSets()) {
+    // std::lgamma is only a few ULP
+    double bound = k == scalar_kernels() ? 4.0 : 1.0;
+    EXPECT_LE(maxUlps(k->lgamma, lgammaExact, inputs), bound) << k->name;
+  }
+}
+
+TEST(MathTest, DigammaAccuracy) {
+  // Closely around the zero at 1.4616
+  auto inputs = positiveFloats(INFINITY, 1021);
+  auto zero = range(1.f, 2.f, 1 << 20);
+  inputs.insert(inputs.end(), zero.begin(), zero.end());
+  for (auto k : kernelSets())
+    EXPECT_LE(maxUlps(k->digamma, digammaReference, inputs), 1.0) << k->name;
+}
+
+// The special values give the results of the scalar code
+TEST(MathTest, SpecialValues) {
+  std::vector<float> inputs = {0.f, -0.f, INFINITY, -INFINITY, NAN, -1.f, -2.5f,
+      -3.f, 1e-45f, 1e-40f, 1.f, 2.f, 10.f, 100.f, -100.f, 88.8f, -88.f, -104.f,
+      3.4e38f, -3.4e38f};
+  int size = (int) inputs.size();
+  auto scalar = scalar_kernels();
+  std::vector<float> expected(size), res(size);
+  for (auto k : kernelSets()) {
+    for (int f = 0; f < 4; f++) {
+      Kernel kernels[] = {k->exp, k->log, k->lgamma, k->digamma};
+      Kernel scalars[] = {scalar->exp, scalar->log, scalar->lgamma, scalar->digamma};
+      scalars[f](inputs.data(), expected.data(), size);
+      kernels[f](inputs.data(), res.data(), size);
+      for (int i = 0; i < size; i++) {
+        if (std::isnan(expected[i])) {
+          EXPECT_TRUE(std::isnan(res[i])) << k->name << " " << f << " " << inputs[i];
+        } else if (std::isinf(expected[i]) || expected[i] == 0) {
+          EXPECT_EQ(res[i], expected[i]) << k->name << " " << f << " " << inputs[i];
+        } else {
+          EXPECT_LE(ulps(res[i], expected[i]), 4.0) << k->name << " " << f << " " << inputs[i];
+        }
+      }
+    }
+  }
+}
+
+// The elements past the last full vector, and the vectors mixing special
+// and regular values
+TEST(MathTest, AllSizes) {
+  for (auto k : kernelSets()) {
+    for (int size = 0; size <= 40; size++) {
+      std::vector<float> inputs(size), all(size), one(1);
+      for (int i = 0; i < size; i++) inputs[i] = i % 7 == 3 ? -0.5f * i : 0.37f * (i + 1);
+      for (Kernel kernel : {k->exp, k->log, k->lgamma, k->digamma}) {
+        kernel(inputs.data(), all.data(), size);
+        for (int i = 0; i < size; i++) {
+          kernel(&inputs[i], one.data(), 1);
+          if (std::isnan(one[0])) EXPECT_TRUE(std::isnan(all[i]));
+          else EXPECT_EQ(all[i], one[0]) << k->name << " " << size << " " << i;
+        }
+      }
+    }
+  }
+}
+
+TEST(MathTest, ArrayOps) {
+  float a[] = {0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f, 8.5f};
+  float res[9];
+  math::digamma(a, res, 9);
+  for (int i = 0; i < 9; i++)
+    EXPECT_LE(ulps(res[i], digammaReference(a[i])), 1.0);
+  math::polygamma(0, a, res, 9);
+  for (int i = 0; i < 9; i++)
+    EXPECT_FLOAT_EQ(res[i], (float) math::util::digamma(a[i]));
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "gtest/gtest.h"
+
+#include "Sparse/MemUtils.h"
+#include "Sparse/Pool.h"
+#include "Threading/Threading.h"
+#include <stdio.h>
+
+#include <omp.h>
+
+using namespace ops;
+
+/** The benchmark of the large block modes of the pool, see
+ * pool_set_huge_pages and pool_set_first_touch.
+ *
+ * Each run allocates fresh arrays, fills them with Array::assign like the
+ * sparse ops fill their results, and then times a parallel triad over
+ * them, whose bandwidth depends on where the pages landed. The first-touch
+ * mode matters on multi-socket machines, where, without it, all the pages
+ * land on the node of the allocating thread; run it there with
+ * OMP_PROC_BIND=spread or Threads.configure(pinning = CORES) so that the
+ * threads stay on their node. */
+
+size_t elements = 1 << 25;
+size_t runs = 5;
+size_t triads = 10;
+
+const char * modeName(int mode) {
+  const char * names[] = {"default", "huge pages", "first touch",
+                          "huge pages + first touch"};
+  return names[mode];
+}
+
+TEST(PoolPerfTest, LargeBlockModes) {
+  const auto & topology = cpu_topology();
+  printf("PerfTest: %d sockets, %d cores, %d threads\n", topology.num_sockets,
+      topology.num_cores, omp_get_max_threads());
+  for (int mode = 0; mode < 4; mode++) {
+    pool_set_huge_pages(mode & 1);
+    pool_set_first_touch(mode & 2);
+    for (size_t it=0; it<runs; it++) {
+      // Fresh blocks, as reused ones keep the placement of their pages
+      pool_trim();
+      double timebegin = omp_get_wtime();
+      Array<float> a(elements, 1), b(elements, 2), c(elements, 0);
+      double filled = omp_get_wtime();
+      for (size_t t=0; t<triads; t++) {
+        float * pa = a.data(), * pb = b.data(), * pc = c.data();
+        #pragma omp parallel for schedule(static)
+        for (size_t i=0; i<elements; i++) pc[i] = pa[i] + 0.5f * pb[i];
+      }
+      double timeend = omp_get_wtime();
+      double bytes = 3.0 * elements * sizeof(float) * triads;
+      printf("PerfTest: %s %ld th run: allocating and filling took %f seconds, triad %f GB/s\n",
+          modeName(mode), it, filled - timebegin, bytes / (timeend - filled) / 1e9);
+      EXPECT_EQ(c[elements - 1], 2.f);
+    }
+  }
+  pool_set_huge_pages(false);
+  pool_set_first_touch(false);
+  pool_trim();
+}
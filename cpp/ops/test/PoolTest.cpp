@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "Sparse/MemUtils.h"
+#include "Sparse/Pool.h"
+
+using namespace ops;
+
+TEST(PoolTest, ReusesFreedBlocks) {
+  pool_trim();
+  void * a = pool_malloc(1000);
+  pool_free(a);
+  auto before = pool_stats();
+  void * b = pool_malloc(990);
+  auto after = pool_stats();
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(after.allocations, before.allocations + 1);
+  EXPECT_EQ(after.system_allocations, before.system_allocations);
+  pool_free(b);
+}
+
+TEST(PoolTest, AlignsBlocks) {
+  for (size_t size : {1, 100, 5000, 1 << 29}) {
+    void * p = pool_malloc(size);
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ((uintptr_t)p % POOL_ALIGNMENT, 0u);
+    pool_free(p);
+  }
+}
+
+TEST(PoolTest, ZeroesReusedBlocks) {
+  char * a = (char *) pool_malloc(256);
+  memset(a, 1, 256);
+  pool_free(a);
+  char * b = (char *) pool_calloc(64, 4);
+  for (int i = 0; i < 256; i++) EXPECT_EQ(b[i], 0);
+  pool_free(b);
+}
+
+TEST(PoolTest, CountsBytes) {
+  pool_trim();
+  auto before = pool_stats();
+  EXPECT_EQ(before.bytes_cached, 0u);
+  void * p = pool_malloc(10000);
+  EXPECT_GE(pool_stats().bytes_in_use, before.bytes_in_use + 10000);
+  pool_free(p);
+  EXPECT_EQ(pool_stats().bytes_in_use, before.bytes_in_use);
+  EXPECT_GT(pool_stats().bytes_cached, 0u);
+  pool_trim();
+  EXPECT_EQ(pool_stats().bytes_cached, 0u);
+}
+
+TEST(PoolTest, ReusesBlocksFreedByOtherThreads) {
+  pool_trim();
+  // Larger than the blocks kept by the thread caches
+  void * p = NULL;
+  std::thread([&] { p = pool_malloc(4 << 20); }).join();
+  pool_free(p);
+  void * q = NULL;
+  std::thread([&] { q = pool_malloc(4 << 20); }).join();
+  EXPECT_EQ(p, q);
+  pool_free(q);
+}
+
+TEST(PoolTest, DisablingTheCacheReleasesBlocks) {
+  pool_set_max_cached(0);
+  void * p = pool_malloc(1000);
+  pool_free(p);
+  EXPECT_EQ(pool_stats().bytes_cached, 0u);
+  pool_set_max_cached(512 << 20);
+}
+
+TEST(PoolTest, BacksArrays) {
+  auto before = pool_stats();
+  for (int i = 0; i < 10; i++) {
+    Array<int> a(1000, i);
+    EXPECT_EQ(a[999], i);
+  }
+  // Only the first array needs a new block
+  EXPECT_LE(pool_stats().system_allocations, before.system_allocations + 1);
+}
+
+TEST(PoolTest, LargeBlockModes) {
+  for (int mode = 0; mode < 4; mode++) {
+    pool_set_huge_pages(mode & 1);
+    pool_set_first_touch(mode & 2);
+    pool_trim();
+    size_t size = 3 * POOL_LARGE_BLOCK + 100;
+    char * p = (char *) pool_malloc(size);
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ((uintptr_t)p % POOL_ALIGNMENT, 0u);
+    memset(p, 1, size);
+    pool_free(p);
+    // Reuses the block, which must be zeroed again
+    char * q = (char *) pool_calloc(size, 1);
+    EXPECT_EQ(p, q);
+    for (size_t i = 0; i < size; i += 1000) EXPECT_EQ(q[i], 0);
+    EXPECT_EQ(q[size - 1], 0);
+    pool_free(q);
+  }
+  pool_set_huge_pages(false);
+  pool_set_first_touch(false);
+  pool_trim();
+}
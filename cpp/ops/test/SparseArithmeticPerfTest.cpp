@@ -10,6 +10,7 @@
 #include "Sparse/Arithmetic.h"
 #include "Sparse/SparseFloatTensor.h"
 #include <iostream>
+#include <random>
 
 #include <omp.h>
 
@@ -79,6 +80,145 @@ COO genBandCOO(DimensionType rows, DimensionType cols, DimensionType bandwidth)
   return COO(rows, cols, row_index, col_index, values);
 }
 
+/** Generate a matrix with a power-law distribution of non-zeros among rows:
+ * row i has about nnzPerRow * rows / H / (i+1) non-zeros, where H is the
+ * harmonic number of rows, so that the first rows carry most of the work
+ * in matmul, similar to the adjacency matrices of power-law graphs. */
+MemWrapper<SpMatMap> genPowerLawCSR(DimensionType rows, DimensionType cols, DimensionType nnzPerRow)
+{
+  EXPECT_GT(rows, 0);
+  EXPECT_GT(cols, 0);
+  EXPECT_GT(nnzPerRow, 0);
+
+  double harmonic = 0;
+  for (DimensionType i=0; i<rows; ++i) harmonic += 1.0 / (i + 1);
+  std::vector<DimensionType> rowSizes(rows);
+  OrdinalType nnz = 0;
+  for (DimensionType i=0; i<rows; ++i) {
+    double size = (double)nnzPerRow * rows / harmonic / (i + 1);
+    rowSizes[i] = std::max((DimensionType)1, (DimensionType)std::min((double)cols, size));
+    nnz += rowSizes[i];
+  }
+
+  OrdinalType * outer;
+  DimensionType * inner;
+  DataType * values;
+  Malloc(outer, (rows + 1) * sizeof(OrdinalType));
+  Malloc(inner, nnz * sizeof(DimensionType));
+  Malloc(values, nnz * sizeof(DataType));
+
+  OrdinalType offset = 0;
+  for (DimensionType i=0; i<rows; ++i) {
+    outer[i] = offset;
+    // spread the non-zeros over the columns, starting from a row dependent
+    // column
+    DimensionType stride = cols / rowSizes[i];
+    DimensionType start = (DimensionType)(((int64_t)i * 7919) % cols);
+    for (DimensionType j=0; j<rowSizes[i]; ++j, ++offset) {
+      inner[offset] = (DimensionType)((start + (int64_t)j * stride) % cols);
+      values[offset] = 1;
+    }
+  }
+  EXPECT_EQ(nnz, offset);
+  outer[rows] = nnz;
+
+  return MemWrapper<SpMatMap>(SpMatMap(rows, cols, nnz, outer, inner, values), std::vector<void *>{ values, outer, inner });
+}
+
+/** The transpose placing the non-zeros with a shared atomic cursor per
+ * column, as the baseline for the counting sort in transpose */
+void transposeAtomic(SpMatMap & tensor, std::vector<OrdinalType> & outer,
+    std::vector<DimensionType> & inner, std::vector<DataType> & values)
+{
+  const OrdinalType * rowsStart, * rowsEnd;
+  rowPointers(tensor, rowsStart, rowsEnd);
+  outer.assign(tensor.cols() + 1, 0);
+  inner.resize(tensor.nonZeros());
+  values.resize(tensor.nonZeros());
+  #pragma omp parallel for
+  for (DimensionType i=0; i<tensor.rows(); ++i)
+    for (OrdinalType j=rowsStart[i]; j<rowsEnd[i]; ++j) {
+      #pragma omp atomic
+      outer[tensor.innerIndexPtr()[j] + 1]++;
+    }
+  for (DimensionType i=0; i<tensor.cols(); ++i) outer[i+1] += outer[i];
+  std::vector<OrdinalType> cursor(outer.begin(), outer.end() - 1);
+  #pragma omp parallel for
+  for (DimensionType i=0; i<tensor.rows(); ++i)
+    for (OrdinalType j=rowsStart[i]; j<rowsEnd[i]; ++j) {
+      OrdinalType pos;
+      #pragma omp atomic capture
+      pos = cursor[tensor.innerIndexPtr()[j]]++;
+      inner[pos] = i;
+      values[pos] = tensor.valuePtr()[j];
+    }
+}
+
+/** The matmul scheduling the rows in chunks of the same number of rows, as
+ * the baseline for the rows balanced by multiplications in matmul. It uses
+ * a dense table per thread as the general accumulator of matmul does. */
+void matmulRowChunks(SpMatMap & left, SpMatMap & right, std::vector<OrdinalType> & outer,
+    std::vector<DimensionType> & inner, std::vector<DataType> & values)
+{
+  const OrdinalType * leftStart, * leftEnd, * rightStart, * rightEnd;
+  rowPointers(left, leftStart, leftEnd);
+  rowPointers(right, rightStart, rightEnd);
+  const DimensionType rows = left.rows();
+  const OrdinalType chunk = std::max(rows / omp_get_max_threads() / 30, 1);
+  outer.assign(rows + 1, 0);
+  for (int symbolic=1; symbolic>=0; --symbolic) {
+    if (!symbolic) {
+      for (DimensionType i=0; i<rows; ++i) outer[i+1] += outer[i];
+      inner.resize(outer[rows]);
+      values.resize(outer[rows]);
+    }
+    #pragma omp parallel
+    {
+      std::vector<DataType> table(right.cols(), 0);
+      std::vector<bool> used(right.cols(), false);
+      std::vector<DimensionType> cols;
+      #pragma omp for schedule(dynamic, chunk)
+      for (DimensionType i=0; i<rows; ++i) {
+        cols.clear();
+        for (OrdinalType j=leftStart[i]; j<leftEnd[i]; ++j) {
+          DimensionType rowRight = left.innerIndexPtr()[j];
+          for (OrdinalType k=rightStart[rowRight]; k<rightEnd[rowRight]; ++k) {
+            DimensionType c = right.innerIndexPtr()[k];
+            if (!used[c]) {
+              used[c] = true;
+              cols.push_back(c);
+            }
+            table[c] += left.valuePtr()[j] * right.valuePtr()[k];
+          }
+        }
+        if (symbolic)
+          outer[i+1] = cols.size();
+        for (size_t k=0; k<cols.size(); ++k) {
+          if (!symbolic) {
+            inner[outer[i] + k] = cols[k];
+            values[outer[i] + k] = table[cols[k]];
+          }
+          table[cols[k]] = 0;
+          used[cols[k]] = false;
+        }
+      }
+    }
+  }
+}
+
+/** Swap the non-zeros of a COO randomly, so that the row indices are not
+ * sorted */
+void shuffleCOO(COO & coo)
+{
+  std::mt19937 gen(0);
+  for (OrdinalType i=coo.nonZeros()-1; i>0; --i) {
+    OrdinalType j = gen() % (i + 1);
+    std::swap(coo.row_index()[i], coo.row_index()[j]);
+    std::swap(coo.col_index()[i], coo.col_index()[j]);
+    std::swap(coo.values()[i], coo.values()[j]);
+  }
+}
+
 size_t widthstart = 1000;
 size_t widthend = 1024000;
 size_t bandsize = 101;
@@ -119,6 +259,48 @@ TEST(OnBandmatrices, matmul) {
   perfTestBinary(matmul, "matmul");
 }
 
+// The multiplications are skewed among rows, which needs the rows to be
+// balanced by their multiplications rather than by the number of rows as in
+// matmulRowChunks
+TEST(OnPowerLawMatrices, matmul) {
+  DimensionType nnzPerRow = 16;
+  for (size_t x=widthstart; x<=widthend/8; x*=2) {
+    auto A = genPowerLawCSR(x, x, nnzPerRow);
+    auto B = genBandCSR(x, x, nnzPerRow + 1);
+    for (size_t it=0; it<=runs; it++) {
+      double timebegin, timeend, timechunks;
+      std::vector<OrdinalType> outer;
+      std::vector<DimensionType> inner;
+      std::vector<DataType> values;
+      timebegin = omp_get_wtime();
+      matmulRowChunks(A.get(), B.get(), outer, inner, values);
+      timechunks = omp_get_wtime() - timebegin;
+      timebegin = omp_get_wtime();
+      auto C = matmul(A.get(), B.get());
+      timeend = omp_get_wtime();
+      printf("PerfTest: matmul %ld th run with power-law matrix width %ld non-zeros per row %d took %f seconds, %f seconds with row chunks\n",
+          it, x, nnzPerRow, timeend - timebegin, timechunks);
+    }
+  }
+}
+
+TEST(OnBandmatrices, spmm) {
+  size_t denseCols = 64;
+  for (size_t x=widthstart; x<=widthend; x*=2) {
+    auto A = genBandCSR(x, x, bandsize);
+    std::vector<DataType> B(x * denseCols, 1);
+    std::vector<DataType> C(x * denseCols);
+    for (size_t it=0; it<=runs; it++) {
+      double timebegin, timeend;
+      timebegin = omp_get_wtime();
+      spmm(A.get(), B.data(), denseCols, C.data());
+      timeend = omp_get_wtime();
+      printf("PerfTest: spmm %ld th run with matrix width %ld band-size %ld dense-cols %ld took %f seconds\n",
+          it, x, bandsize, denseCols, timeend - timebegin);
+    }
+  }
+}
+
 TEST(OnBandmatrices, times) {
   perfTestBinary(times, "times");
 }
@@ -135,6 +317,30 @@ TEST(OnBandmatrices, transpose) {
   perfTestUnary(transpose, "transpose");
 }
 
+
+// The non-zeros of the power-law rows land on the same columns, which
+// contends on the atomic cursors of those columns in transposeAtomic
+TEST(OnPowerLawMatrices, transpose) {
+  DimensionType nnzPerRow = 16;
+  for (size_t x=widthstart; x<=widthend; x*=2) {
+    auto A = genPowerLawCSR(x, x, nnzPerRow);
+    for (size_t it=0; it<=runs; it++) {
+      double timebegin, timeend, timeatomic;
+      std::vector<OrdinalType> outer;
+      std::vector<DimensionType> inner;
+      std::vector<DataType> values;
+      timebegin = omp_get_wtime();
+      transposeAtomic(A.get(), outer, inner, values);
+      timeatomic = omp_get_wtime() - timebegin;
+      timebegin = omp_get_wtime();
+      auto B = transpose(A.get());
+      timeend = omp_get_wtime();
+      printf("PerfTest: transpose %ld th run with power-law matrix width %ld non-zeros per row %d took %f seconds, %f seconds with atomics\n",
+          it, x, nnzPerRow, timeend - timebegin, timeatomic);
+    }
+  }
+}
+
 TEST(OnBandmatrices, cooTocsr) {
   for (size_t x=widthstart; x<=widthend; x*=2) {
     auto A = genBandCOO(x, x, bandsize);
@@ -148,3 +354,18 @@ TEST(OnBandmatrices, cooTocsr) {
     }
   }
 }
+
+TEST(OnBandmatrices, unsortedCooTocsr) {
+  for (size_t x=widthstart; x<=widthend; x*=2) {
+    auto A = genBandCOO(x, x, bandsize);
+    shuffleCOO(A);
+    for (size_t it=0; it<=runs; it++) {
+      double timebegin, timeend;
+      timebegin = omp_get_wtime();
+      auto B = cooTocsr(A);
+      timeend = omp_get_wtime();
+      printf("PerfTest: unsorted cooTocsr %ld th run with matrix width %ld band-size %ld took %f seconds\n",
+          it, x, bandsize, timeend - timebegin);
+    }
+  }
+}
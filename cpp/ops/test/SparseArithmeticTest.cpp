@@ -8,8 +8,13 @@
 #include "gtest/gtest.h"
 
 #include "Sparse/Arithmetic.h"
+#include "Sparse/MatmulPlan.h"
+#include "Sparse/SparseResult.h"
 #include "SparseTestUtils.cpp"
 #include <iostream>
+#include <map>
+
+#include <omp.h>
 
 using namespace ops;
 
@@ -155,6 +160,369 @@ TEST(MatmulTest, DoesMatmul) {
   compareCSR(t, shape[0], shape[1], outerE, innerE, valuesE);
 }
 
+TEST(MatmulTest, WideSparseResult) {
+  // the result rows span a wide column range with few entries each, which
+  // goes to the hash accumulator
+  DimensionType rows = 4, mid = 3, cols = 100000;
+  std::vector<DataType> values1 = {1, 2, -1, 3, 0.5};
+  std::vector<DimensionType> inner1 = {0, 2, 1, 0, 1};
+  std::vector<OrdinalType> outer1 = {0, 2, 3, 3, 5};
+  std::vector<DataType> values2 = {1, 2, 3, 4, 5, 6, 7};
+  std::vector<DimensionType> inner2 = {3, 99999, 50000, 16, 3, 70000, 99999};
+  std::vector<OrdinalType> outer2 = {0, 2, 4, 7};
+  SpMatMap left(rows, mid, inner1.size(), outer1.data(), inner1.data(), values1.data());
+  SpMatMap right(mid, cols, inner2.size(), outer2.data(), inner2.data(), values2.data());
+  SpMat t = matmul(left, right);
+
+  std::vector<OrdinalType> outerE = {0};
+  std::vector<DimensionType> innerE;
+  std::vector<DataType> valuesE;
+  for (DimensionType i=0; i<rows; i++) {
+    std::map<DimensionType, DataType> row;
+    for (OrdinalType j=outer1[i]; j<outer1[i+1]; j++)
+      for (OrdinalType k=outer2[inner1[j]]; k<outer2[inner1[j]+1]; k++)
+        row[inner2[k]] += values1[j] * values2[k];
+    for (auto & e : row) {
+      innerE.push_back(e.first);
+      valuesE.push_back(e.second);
+    }
+    outerE.push_back(innerE.size());
+  }
+  compareCSR(t, rows, cols, outerE, innerE, valuesE, false);
+}
+
+TEST(MatmulTest, HashesStridedColumns) {
+  // the columns of the result row are strided by the size of the hash table
+  // of the row, 1024 for its 512 insertions, and all sums of two products
+  DimensionType mid = 256, stride = 1024, cols = mid * stride;
+  std::vector<DataType> values1;
+  std::vector<DimensionType> inner1;
+  for (DimensionType j=0; j<mid; j++) {
+    inner1.push_back(j);
+    values1.push_back(j % 5 + 1);
+  }
+  std::vector<OrdinalType> outer1 = {0, mid};
+  std::vector<DataType> values2;
+  std::vector<DimensionType> inner2;
+  std::vector<OrdinalType> outer2 = {0};
+  for (DimensionType i=0; i<mid; i++) {
+    inner2.push_back(i * stride);
+    inner2.push_back((i + 1) % mid * stride);
+    values2.push_back(1);
+    values2.push_back(i % 3 - 1);
+    outer2.push_back(inner2.size());
+  }
+  SpMatMap left(1, mid, inner1.size(), outer1.data(), inner1.data(), values1.data());
+  SpMatMap right(mid, cols, inner2.size(), outer2.data(), inner2.data(), values2.data());
+  SpMat t = matmul(left, right);
+
+  std::map<DimensionType, DataType> row;
+  for (OrdinalType j=outer1[0]; j<outer1[1]; j++)
+    for (OrdinalType k=outer2[inner1[j]]; k<outer2[inner1[j]+1]; k++)
+      row[inner2[k]] += values1[j] * values2[k];
+  std::vector<OrdinalType> outerE = {0, (OrdinalType)row.size()};
+  std::vector<DimensionType> innerE;
+  std::vector<DataType> valuesE;
+  for (auto & e : row) {
+    innerE.push_back(e.first);
+    valuesE.push_back(e.second);
+  }
+  compareCSR(t, 1, cols, outerE, innerE, valuesE, false);
+}
+
+TEST(MatmulTest, SkewedRows) {
+  // the first row has most of the multiplications, so it's split across
+  // threads and the partial results are merged
+  int threads = omp_get_max_threads();
+  omp_set_num_threads(4);
+  DimensionType rows = 64, mid = 512, cols = 4096, rightRowSize = 256;
+  std::vector<OrdinalType> outer1 = {0};
+  std::vector<DimensionType> inner1;
+  std::vector<DataType> values1;
+  for (DimensionType i=0; i<rows; i++) {
+    if (i == 0) {
+      for (DimensionType j=0; j<mid; j++) inner1.push_back(j);
+    } else {
+      inner1.push_back((i * 7) % mid);
+      inner1.push_back((i * 13 + 1) % mid);
+    }
+    while (values1.size() < inner1.size()) values1.push_back(values1.size() % 3 + 1);
+    outer1.push_back(inner1.size());
+  }
+  std::vector<OrdinalType> outer2 = {0};
+  std::vector<DimensionType> inner2;
+  std::vector<DataType> values2;
+  for (DimensionType r=0; r<mid; r++) {
+    for (DimensionType c=0; c<rightRowSize; c++) {
+      inner2.push_back((r * 17 + 16 * c) % cols);
+      values2.push_back((r + c) % 4 + 1);
+    }
+    outer2.push_back(inner2.size());
+  }
+  SpMatMap left(rows, mid, inner1.size(), outer1.data(), inner1.data(), values1.data());
+  SpMatMap right(mid, cols, inner2.size(), outer2.data(), inner2.data(), values2.data());
+  SpMat t = matmul(left, right);
+  omp_set_num_threads(threads);
+
+  std::vector<OrdinalType> outerE = {0};
+  std::vector<DimensionType> innerE;
+  std::vector<DataType> valuesE;
+  for (DimensionType i=0; i<rows; i++) {
+    std::map<DimensionType, DataType> row;
+    for (OrdinalType j=outer1[i]; j<outer1[i+1]; j++)
+      for (OrdinalType k=outer2[inner1[j]]; k<outer2[inner1[j]+1]; k++)
+        row[inner2[k]] += values1[j] * values2[k];
+    for (auto & e : row) {
+      innerE.push_back(e.first);
+      valuesE.push_back(e.second);
+    }
+    outerE.push_back(innerE.size());
+  }
+  compareCSR(t, rows, cols, outerE, innerE, valuesE, false);
+}
+
+TEST(MatmulTest, WideDenseResult) {
+  // each result row has many insertions over a column range wider than the
+  // cache, which is accumulated panel by panel, and the even columns of the
+  // second row cancel out. The rows on the right are grouped by panels
+  // first when they aren't sorted.
+  for (bool sortedRight : {false, true}) {
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(1);
+    DimensionType rows = 2, mid = 9, cols = 600000, rightRowSize = 300000;
+    std::vector<DataType> values1 = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, -1, 3, -2, 1, 0.5, -4, 1.5};
+    std::vector<DimensionType> inner1;
+    for (DimensionType i=0; i<rows; i++)
+      for (DimensionType j=0; j<mid; j++) inner1.push_back(j);
+    std::vector<OrdinalType> outer1 = {0, mid, 2 * mid};
+    std::vector<OrdinalType> outer2 = {0};
+    std::vector<DimensionType> inner2;
+    std::vector<DataType> values2;
+    for (DimensionType r=0; r<mid; r++) {
+      for (DimensionType c=0; c<rightRowSize; c++)
+        inner2.push_back((r * 3 + 2 * c) % cols);
+      if (sortedRight)
+        std::sort(inner2.begin() + outer2.back(), inner2.end());
+      outer2.push_back(inner2.size());
+    }
+    for (DimensionType c : inner2) values2.push_back(c % 5 + 1);
+    SpMatMap left(rows, mid, inner1.size(), outer1.data(), inner1.data(), values1.data());
+    SpMatMap right(mid, cols, inner2.size(), outer2.data(), inner2.data(), values2.data());
+    SpMat t = matmul(left, right);
+    omp_set_num_threads(threads);
+
+    std::vector<DataType> resE(rows * cols, 0);
+    for (DimensionType i=0; i<rows; i++)
+      for (OrdinalType j=outer1[i]; j<outer1[i+1]; j++)
+        for (OrdinalType k=outer2[inner1[j]]; k<outer2[inner1[j]+1]; k++)
+          resE[i * cols + inner2[k]] += values1[j] * values2[k];
+    std::vector<DataType> res(rows * cols, 0);
+    const OrdinalType * rowsStart, * rowsEnd;
+    rowPointers(t, rowsStart, rowsEnd);
+    for (DimensionType i=0; i<rows; i++)
+      for (OrdinalType j=rowsStart[i]; j<rowsEnd[i]; j++)
+        res[i * cols + t.innerIndexPtr()[j]] += t.valuePtr()[j];
+    EXPECT_EQ(t.rows(), rows);
+    EXPECT_EQ(t.cols(), cols);
+    EXPECT_FLOATS_NEARLY_EQ(resE, res, 1e-6);
+  }
+}
+
+TEST(MatmulTest, DenseResult) {
+  DimensionType rows = 6, mid = 5, cols = 7;
+  std::vector<DataType> values1 = {1, 2, -1, 3, 0.5, 2, 1, -2};
+  std::vector<DimensionType> inner1 = {0, 4, 1, 2, 3, 0, 1, 4};
+  std::vector<OrdinalType> outer1 = {0, 2, 3, 5, 5, 6, 8};
+  std::vector<DataType> values2 = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+  std::vector<DimensionType> inner2 = {0, 6, 1, 5, 3, 2, 4, 0, 6};
+  std::vector<OrdinalType> outer2 = {0, 2, 4, 5, 7, 9};
+  SpMatMap left(rows, mid, inner1.size(), outer1.data(), inner1.data(), values1.data());
+  SpMatMap right(mid, cols, inner2.size(), outer2.data(), inner2.data(), values2.data());
+
+  std::vector<DataType> resE(rows * cols, 0);
+  for (DimensionType i=0; i<rows; i++)
+    for (OrdinalType j=outer1[i]; j<outer1[i+1]; j++)
+      for (OrdinalType k=outer2[inner1[j]]; k<outer2[inner1[j]+1]; k++)
+        resE[i * cols + inner2[k]] += values1[j] * values2[k];
+
+  std::vector<DataType> res(rows * cols, -1);
+  matmulToDense(left, right, res.data());
+  EXPECT_FLOATS_NEARLY_EQ(resE, res, 1e-6);
+
+  // the result has 13 non-zeros out of 42, less than a half, then the
+  // fallback is the product of matmul
+  SpMat fallback;
+  EXPECT_FALSE(denseMatmulPreferred(left, right, &fallback));
+  EXPECT_FLOATS_NEARLY_EQ(resE, toDenseData(fallback), 1e-6);
+  std::vector<DataType> values3(mid * cols, 1);
+  std::vector<DimensionType> inner3;
+  std::vector<OrdinalType> outer3 = {0};
+  for (DimensionType r=0; r<mid; r++) {
+    for (DimensionType c=0; c<cols; c++) inner3.push_back(c);
+    outer3.push_back(inner3.size());
+  }
+  SpMatMap full(mid, cols, inner3.size(), outer3.data(), inner3.data(), values3.data());
+  EXPECT_TRUE(denseMatmulPreferred(left, full, &fallback));
+}
+
+TEST(MatmulPlanTest, ReusesStructure) {
+  std::vector<DimensionType> shape = {3, 3};
+  std::vector<DataType> values1 = {1, 2, 3, -1};
+  std::vector<DimensionType> inner1 = {2, 0, 1, 0};
+  std::vector<OrdinalType> outer1 = {0, 2, 2, 4};
+  std::vector<DataType> values2 = {1, 2, 3, 4};
+  std::vector<DimensionType> inner2 = {2, 0, 2, 1};
+  std::vector<OrdinalType> outer2 = {0, 1, 3, 4};
+  SpMatMap left(shape[0], shape[1], inner1.size(), outer1.data(), inner1.data(), values1.data());
+  SpMatMap right(shape[0], shape[1], inner2.size(), outer2.data(), inner2.data(), values2.data());
+  MatmulPlan plan(left, right);
+
+  std::vector<DimensionType> innerE = {1, 2, 0, 2};
+  std::vector<OrdinalType> outerE = {0, 2, 2, 4};
+  std::vector<DataType> valuesE = {4, 2, 6, 8};
+  SpMat t = plan.execute(left, right);
+  compareCSR(t, shape[0], shape[1], outerE, innerE, valuesE);
+
+  // only the values change, and the product cancelling out is kept as
+  // an explicit zero
+  values1 = {2, 1, 3, -9};
+  valuesE = {8, 1, 6, 0};
+  std::vector<DataType> res(plan.nonZeros());
+  plan.execute(left, right, res.data());
+  EXPECT_FLOATS_NEARLY_EQ(valuesE, res, 1e-6);
+
+  std::vector<DataType> values3 = {1, 2, 3};
+  std::vector<DimensionType> inner3 = {2, 0, 2};
+  std::vector<OrdinalType> outer3 = {0, 1, 3, 3};
+  SpMatMap other(shape[0], shape[1], inner3.size(), outer3.data(), inner3.data(), values3.data());
+  EXPECT_THROW(plan.execute(left, other), std::runtime_error);
+
+  // the same numbers of non-zeros in another structure, whose rows have
+  // more products than the plan holds positions for
+  std::vector<DimensionType> inner4 = {2, 1, 1, 0};
+  SpMatMap moved(shape[0], shape[1], inner4.size(), outer1.data(), inner4.data(), values1.data());
+  EXPECT_THROW(plan.execute(moved, right, res.data()), std::runtime_error);
+  std::vector<OrdinalType> outer5 = {0, 2, 3, 4};
+  SpMatMap shifted(shape[0], shape[1], inner2.size(), outer5.data(), inner2.data(), values2.data());
+  EXPECT_THROW(plan.execute(left, shifted, res.data()), std::runtime_error);
+}
+
+TEST(MatmulPlanTest, MatchesMatmulAfterPruning) {
+  // values of +-1 make products cancel out, which the plan keeps as
+  // explicit zeros. The shapes cover the general, the dense insertion and
+  // the hash accumulators.
+  struct Case { DimensionType rows, mid, cols; int perRow; };
+  for (Case c : {Case{40, 30, 50, 6}, Case{64, 16, 16, 12}, Case{8, 6, 100000, 3}}) {
+    uint32_t seed = 7;
+    auto next = [&](uint32_t n) { seed = seed * 1103515245u + 12345u; return (seed >> 8) % n; };
+    auto gen = [&](DimensionType rows, DimensionType cols, std::vector<OrdinalType> & outer,
+        std::vector<DimensionType> & inner, std::vector<DataType> & values) {
+      outer = {0};
+      for (DimensionType i=0; i<rows; i++) {
+        std::vector<DimensionType> row;
+        for (int k=0; k<c.perRow; k++) row.push_back(next(cols));
+        std::sort(row.begin(), row.end());
+        row.erase(std::unique(row.begin(), row.end()), row.end());
+        for (DimensionType j : row) {
+          inner.push_back(j);
+          values.push_back(next(2) ? 1 : -1);
+        }
+        outer.push_back(inner.size());
+      }
+    };
+    std::vector<OrdinalType> outer1, outer2;
+    std::vector<DimensionType> inner1, inner2;
+    std::vector<DataType> values1, values2;
+    gen(c.rows, c.mid, outer1, inner1, values1);
+    gen(c.mid, c.cols, outer2, inner2, values2);
+    SpMatMap left(c.rows, c.mid, inner1.size(), outer1.data(), inner1.data(), values1.data());
+    SpMatMap right(c.mid, c.cols, inner2.size(), outer2.data(), inner2.data(), values2.data());
+
+    MatmulPlan plan(left, right);
+    SpMat planned = plan.execute(left, right);
+    SpMat expected = matmul(left, right);
+    EXPECT_GE(plan.nonZeros(), (OrdinalType)expected.nonZeros());
+    std::vector<DataType> plannedDense = toDenseData(planned);
+    std::vector<DataType> expectedDense = toDenseData(expected);
+    EXPECT_FLOATS_NEARLY_EQ(expectedDense, plannedDense, 1e-6);
+  }
+}
+
+TEST(SpmmTest, DoesSpmm) {
+  std::vector<DimensionType> shape = {3, 4};
+  std::vector<DataType> values = {1, 2, 3, 4};
+  std::vector<DimensionType> inner = {0, 3, 1, 3};
+  std::vector<OrdinalType> outer = {0, 2, 2, 4};
+  SpMatMap left(shape[0], shape[1], inner.size(), outer.data(), inner.data(),
+      values.data());
+  // a 4x2 dense matrix in row-major order
+  std::vector<DataType> right = {1, 2, 3, 4, 5, 6, 7, 8};
+  std::vector<DataType> res(shape[0] * 2, -1);
+  spmm(left, right.data(), 2, res.data());
+
+  std::vector<DataType> resE = {15, 18, 0, 0, 37, 44};
+  EXPECT_FLOATS_NEARLY_EQ(resE, res, 1e-6);
+}
+
+TEST(SpmmTest, WideDense) {
+  // wider than a column panel, so the result rows are computed in pieces
+  DimensionType rows = 5, cols = 7, rightCols = 1100;
+  std::vector<DataType> values = {0.5, -1, 2, 3, 0.25, -2};
+  std::vector<DimensionType> inner = {6, 0, 2, 5, 1, 3};
+  std::vector<OrdinalType> outer = {0, 1, 1, 4, 4, 6};
+  SpMatMap left(rows, cols, inner.size(), outer.data(), inner.data(), values.data());
+  std::vector<DataType> right(cols * rightCols);
+  for (size_t i=0; i<right.size(); i++) right[i] = (DataType)(i % 13) - 6;
+
+  std::vector<DataType> resE(rows * rightCols, 0);
+  for (DimensionType i=0; i<rows; i++)
+    for (OrdinalType j=outer[i]; j<outer[i+1]; j++)
+      for (DimensionType c=0; c<rightCols; c++)
+        resE[i * rightCols + c] += values[j] * right[inner[j] * rightCols + c];
+
+  std::vector<DataType> res(rows * rightCols, -1);
+  spmm(left, right.data(), rightCols, res.data());
+  EXPECT_FLOATS_NEARLY_EQ(resE, res, 1e-5);
+}
+
+TEST(SddmmTest, DoesSddmm) {
+  std::vector<DimensionType> shape = {3, 4};
+  std::vector<DataType> values = {7, 7, 7, 7};
+  std::vector<DimensionType> inner = {0, 3, 1, 2};
+  std::vector<OrdinalType> outer = {0, 2, 2, 4};
+  SpMatMap pattern(shape[0], shape[1], inner.size(), outer.data(), inner.data(),
+      values.data());
+  // a 3x2 and a 4x2 dense matrix in row-major order
+  std::vector<DataType> left = {1, 2, 3, 4, 5, 6};
+  std::vector<DataType> right = {1, 0, 0, 1, 1, 1, 2, -1};
+  SpMat t = sddmm(pattern, left.data(), right.data(), 2);
+
+  std::vector<DataType> valuesE = {1, 0, 6, 11};
+  compareCSR(t, shape[0], shape[1], outer, inner, valuesE);
+}
+
+TEST(SddmmTest, LongInner) {
+  DimensionType rows = 4, cols = 5, k = 67;
+  std::vector<DataType> values = {1, 1, 1, 1, 1};
+  std::vector<DimensionType> inner = {4, 0, 2, 1, 4};
+  std::vector<OrdinalType> outer = {0, 1, 3, 3, 5};
+  SpMatMap pattern(rows, cols, inner.size(), outer.data(), inner.data(), values.data());
+  std::vector<DataType> left(rows * k), right(cols * k);
+  for (size_t i=0; i<left.size(); i++) left[i] = (DataType)(i % 7) - 3;
+  for (size_t i=0; i<right.size(); i++) right[i] = (DataType)(i % 5) - 2;
+
+  std::vector<DataType> valuesE;
+  for (DimensionType i=0; i<rows; i++) {
+    for (OrdinalType j=outer[i]; j<outer[i+1]; j++) {
+      DataType sum = 0;
+      for (DimensionType c=0; c<k; c++) sum += left[i * k + c] * right[inner[j] * k + c];
+      valuesE.push_back(sum);
+    }
+  }
+  SpMat t = sddmm(pattern, left.data(), right.data(), k);
+  compareCSR(t, rows, cols, outer, inner, valuesE);
+}
+
 TEST(TestAll, SameIndices) {
   std::vector<DimensionType> shape = {5, 5};
   std::vector<DataType> values = {1, 2, 3, 4, 5, 6, 7, 8};
@@ -212,6 +580,54 @@ TEST(TestAll, DifferentIndices) {
   compareCSR(t, shape[0], shape[1], outerAdd, innerAdd, valuesSub);
 }
 
+TEST(TestAll, LongRows) {
+  // long sorted rows go through the vectorized intersection, including a
+  // row where the non-zeros of both sides don't overlap
+  DimensionType rows = 4, cols = 400;
+  std::vector<OrdinalType> outer1 = {0}, outer2 = {0};
+  std::vector<DimensionType> inner1, inner2;
+  std::vector<DataType> values1, values2;
+  for (DimensionType i=0; i<rows; i++) {
+    for (DimensionType c=0; c<cols; c++) {
+      bool inLeft = (i == 3) ? c < 100 : (c + i) % 2 == 0;
+      bool inRight = (i == 3) ? c >= 200 : (c + i) % 3 == 0;
+      if (inLeft) { inner1.push_back(c); values1.push_back(c + 1); }
+      if (inRight) { inner2.push_back(c); values2.push_back(2 * (c + 1)); }
+    }
+    outer1.push_back(inner1.size());
+    outer2.push_back(inner2.size());
+  }
+  SpMatMap left(rows, cols, inner1.size(), outer1.data(), inner1.data(), values1.data());
+  SpMatMap right(rows, cols, inner2.size(), outer2.data(), inner2.data(), values2.data());
+
+  std::vector<OrdinalType> outerTimes = {0}, outerUnion = {0};
+  std::vector<DimensionType> innerTimes, innerUnion;
+  std::vector<DataType> valuesTimes, valuesAdd, valuesSub;
+  for (DimensionType i=0; i<rows; i++) {
+    std::map<DimensionType, std::pair<DataType, DataType>> row;
+    for (OrdinalType j=outer1[i]; j<outer1[i+1]; j++) row[inner1[j]].first = values1[j];
+    for (OrdinalType j=outer2[i]; j<outer2[i+1]; j++) row[inner2[j]].second = values2[j];
+    for (auto & e : row) {
+      if (e.second.first != 0 && e.second.second != 0) {
+        innerTimes.push_back(e.first);
+        valuesTimes.push_back(e.second.first * e.second.second);
+      }
+      innerUnion.push_back(e.first);
+      valuesAdd.push_back(e.second.first + e.second.second);
+      valuesSub.push_back(e.second.first - e.second.second);
+    }
+    outerTimes.push_back(innerTimes.size());
+    outerUnion.push_back(innerUnion.size());
+  }
+
+  SpMat t = times(left, right);
+  compareCSR(t, rows, cols, outerTimes, innerTimes, valuesTimes, false);
+  t = std::move(add(left, right));
+  compareCSR(t, rows, cols, outerUnion, innerUnion, valuesAdd, false);
+  t = std::move(sub(left, right));
+  compareCSR(t, rows, cols, outerUnion, innerUnion, valuesSub, false);
+}
+
 #ifdef EIGEN
 /**
 *  Test cases generation for matrix division:
@@ -1268,6 +1684,27 @@ TEST(ArrayTest, ListConstructor) {
   EXPECT_EQ(a[2], 2);
 }
 
+/** Test Array Class: non-owning view */
+TEST(ArrayTest, View) {
+  // the memory is owned by the vector, which frees it
+  std::vector<int32_t> data {0, 1, 2};
+  Array<int32_t> a = Array<int32_t>::view(data.data(), data.size());
+  EXPECT_FALSE(a.owned());
+  EXPECT_EQ(a.size(), 3);
+  EXPECT_EQ(a.data(), data.data());
+
+  // moving keeps the view
+  Array<int32_t> b { std::move(a) };
+  EXPECT_FALSE(b.owned());
+  EXPECT_EQ(b.data(), data.data());
+  EXPECT_TRUE(a.owned());
+
+  // resizing a view allocates new memory, even with the same size
+  b.resize(3);
+  EXPECT_TRUE(b.owned());
+  EXPECT_NE(b.data(), data.data());
+}
+
 /** Test DimData Class : move constructor */
 TEST(ArrayTest, MoveConstructor) {
   Array<int32_t> a {0, 1, 2};
@@ -1486,6 +1923,91 @@ TEST(ConvToSparse2D, emptyMatrices) {
   }
 }
 
+/** Test toBlockDiagonal function which converts SparseFloatTensor to a
+ * block diagonal sparse matrix, see SparseResultTest.BlockDiagonal for the
+ * way back
+ *
+ * With unordered row ids */
+TEST(BlockDiagonal, unorderedRowIds) {
+  SparseFloatTensor t1;
+  t1.shape() = {4,3,5};
+  t1.values() = {1, 2, 3, 5, 4};
+  t1.dims().push_back({{0, 1, 1, 0}, {0, 1, 2, 4, 4}});
+  t1.dims().push_back({{0, 1, 2, 4, 2}, {0, 1, 3, 4, 5}});
+
+  SpMat blocks = t1.toBlockDiagonal();
+
+  std::vector<OrdinalType> outer = {0, 1, 1, 1, 1, 3, 3, 4, 5, 5, 5, 5, 5};
+  std::vector<DimensionType> inner = {0, 6, 7, 12, 14};
+  std::vector<DataType> values = {1, 2, 3, 4, 5};
+  compareCSR(blocks, 12, 20, outer, inner, values);
+}
+
+/** Test writing the result of the batches of a 3D operation, which should
+ * give the same tensor as constructing it from the matrices */
+TEST(SparseResultTest, Batches) {
+  std::vector<std::vector<OrdinalType>> outers = {{0, 1, 1, 1}, {0, 0, 2, 2}, {0, 1, 2, 2}, {0, 0, 0, 0}};
+  std::vector<std::vector<DimensionType>> inners = {{0}, {1, 2}, {2, 4}, {}};
+  std::vector<std::vector<DataType>> values = {{1}, {2, 3}, {4, 5}, {}};
+  std::vector<DimensionType> shape = {3, 5};
+
+  std::vector<SpMat> sparse2Ds, sparse2DsCopy;
+  for (size_t i=0; i<outers.size(); i++) {
+    sparse2Ds.emplace_back(genSpMat(shape, outers[i], inners[i], values[i]));
+    sparse2DsCopy.emplace_back(genSpMat(shape, outers[i], inners[i], values[i]));
+  }
+  SparseFloatTensor tExp(sparse2DsCopy);
+
+  SparseResult result(std::move(sparse2Ds));
+  ASSERT_EQ(result.numDims(), 2);
+  EXPECT_EQ(result.nonZeros(), 5);
+  EXPECT_EQ(result.innerSize(0), 4);
+  EXPECT_EQ(result.outerSize(0), 5);
+  EXPECT_EQ(result.outerSize(1), 5);
+  SparseFloatTensor t2 = result.toTensor();
+  compareSparseFloatTensor(tExp, t2);
+}
+
+/** Test writing the result of a 3D operation on a block diagonal matrix */
+TEST(SparseResultTest, BlockDiagonal) {
+  SparseFloatTensor t;
+  t.shape() = {4,3,5};
+  t.values() = {1, 2, 3, 5, 4};
+  t.dims().push_back({{0, 1, 1, 0}, {0, 1, 2, 4, 4}});
+  t.dims().push_back({{0, 1, 2, 4, 2}, {0, 1, 3, 4, 5}});
+
+  SparseFloatTensor tExp;
+  tExp.shape() = {4,3,5};
+  tExp.values() = {1, 2, 3, 4, 5};
+  tExp.dims().push_back({{0, 1, 0, 1}, {0, 1, 2, 4, 4}});
+  tExp.dims().push_back({{0, 1, 2, 2, 4}, {0, 1, 3, 4, 5}});
+
+  SparseResult result(t.toBlockDiagonal(), 4);
+  SparseFloatTensor t2 = result.toTensor();
+  compareSparseFloatTensor(tExp, t2);
+}
+
+/** Test writing the result of a 2D operation, with empty rows kept in the
+ * outer */
+TEST(SparseResultTest, Squeezed) {
+  std::vector<DimensionType> shape = {4, 5};
+  std::vector<OrdinalType> outer = {0, 2, 2, 3, 3};
+  std::vector<DimensionType> inner = {1, 4, 0};
+  std::vector<DataType> values = {1, 2, 3};
+
+  std::vector<SpMat> sparse2Ds, sparse2DsCopy;
+  sparse2Ds.emplace_back(genSpMat(shape, outer, inner, values));
+  sparse2DsCopy.emplace_back(genSpMat(shape, outer, inner, values));
+  SparseFloatTensor tExp(sparse2DsCopy);
+
+  SparseResult result(std::move(sparse2Ds));
+  ASSERT_EQ(result.numDims(), 1);
+  EXPECT_EQ(result.innerSize(0), 3);
+  EXPECT_EQ(result.outerSize(0), 5);
+  SparseFloatTensor t2 = result.toTensor();
+  compareSparseFloatTensor(tExp, t2);
+}
+
 /** Test constructing SparseFloatTensor from a list of sparse
  * matrices */
 TEST(GenFromSparse2D, basic) {
@@ -1730,6 +2252,26 @@ TEST(CooToCSR, random10by5with01Permuted) {
   compareCSR(t, rowsE, colsE, outerE, innerE, valuesE, false);
 }
 
+#ifndef MKL // MKL converts with its own routine
+/** Unordered COO with duplicated entries, which are summed up, and the
+ * column indices are sorted in each row */
+TEST(CooToCSR, duplicates) {
+  //COO Input:
+  Array<DimensionType> rowsIndex {2, 0, 2, 3, 0, 2, 0};
+  Array<DimensionType> colsIndex {1, 4, 1, 0, 4, 3, 1};
+  Array<DataType> values {1, 2, 3, 4, 5, 6, 7};
+  //CSR Expected:
+  DimensionType rowsE = 4, colsE = 5;
+  std::vector<DataType> valuesE = {7, 7, 4, 6, 4};
+  std::vector<DimensionType> innerE = {1, 4, 1, 3, 0};
+  std::vector<OrdinalType> outerE = {0, 2, 2, 4, 5};
+
+  COO coo(rowsE, colsE, rowsIndex, colsIndex, values);
+  SpMat t = cooTocsr(coo);
+  compareCSR(t, rowsE, colsE, outerE, innerE, valuesE);
+}
+#endif
+
 TEST(TestSpMat, createEmpty) {
   SpMat t(5, 4);
 
@@ -1778,6 +2320,45 @@ TEST(TransposeTest, Symetric) {
   compareCSR(t, shape[1], shape[0], outer, inner, values, false);
 }
 
+TEST(TransposeTest, SortedAcrossThreads) {
+  // the rows are placed by several threads, and the column indices in the
+  // result still come out sorted
+  int threads = omp_get_max_threads();
+  omp_set_num_threads(4);
+  DimensionType rows = 64, cols = 8;
+  std::vector<OrdinalType> outer = {0};
+  std::vector<DimensionType> inner;
+  std::vector<DataType> values;
+  for (DimensionType i=0; i<rows; i++) {
+    for (DimensionType c=0; c<cols; c++) {
+      if ((i + c) % 3 == 0 || i < 4) {
+        inner.push_back(c);
+        values.push_back(i * cols + c);
+      }
+    }
+    outer.push_back(inner.size());
+  }
+  SpMatMap tensor(rows, cols, inner.size(), outer.data(), inner.data(), values.data());
+  SpMat t = transpose(tensor);
+  omp_set_num_threads(threads);
+
+  std::vector<OrdinalType> outerE = {0};
+  std::vector<DimensionType> innerE;
+  std::vector<DataType> valuesE;
+  for (DimensionType c=0; c<cols; c++) {
+    for (DimensionType i=0; i<rows; i++) {
+      for (OrdinalType j=outer[i]; j<outer[i+1]; j++) {
+        if (inner[j] == c) {
+          innerE.push_back(i);
+          valuesE.push_back(values[j]);
+        }
+      }
+    }
+    outerE.push_back(innerE.size());
+  }
+  compareCSR(t, cols, rows, outerE, innerE, valuesE);
+}
+
 /** Test generated with python/utilities/testCasesGen/transpose.py directly */
 TEST(TransposeTest, random3by3) {
   //CSR Input:
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <omp.h>
+
+#include "gtest/gtest.h"
+
+#include "Threading/Threading.h"
+
+using namespace ops;
+
+// A fake sysfs root in a temporary directory
+class FakeSysfs {
+public:
+  FakeSysfs() {
+    char dir[] = "/tmp/ThreadingTestXXXXXX";
+    root_ = mkdtemp(dir);
+  }
+
+  ~FakeSysfs() { std::system(("rm -rf " + root_).c_str()); }
+
+  const std::string &root() const { return root_; }
+
+  void write(const std::string &path, const std::string &content) {
+    auto full = root_ + "/" + path;
+    std::system(("mkdir -p " + full.substr(0, full.rfind('/'))).c_str());
+    std::ofstream(full) << content << "\n";
+  }
+
+  void add_cpu(int cpu, int package, int core) {
+    auto dir = "devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+    write(dir + "physical_package_id", std::to_string(package));
+    write(dir + "core_id", std::to_string(core));
+  }
+
+private:
+  std::string root_;
+};
+
+TEST(ThreadingTest, ParsesCpuMax) {
+  EXPECT_EQ(parse_cpu_max("max 100000"), 0);
+  EXPECT_EQ(parse_cpu_max("200000 100000"), 2);
+  EXPECT_EQ(parse_cpu_max("150000 100000"), 2);
+  EXPECT_EQ(parse_cpu_max("50000 100000"), 1);
+  EXPECT_EQ(parse_cpu_max(""), 0);
+}
+
+TEST(ThreadingTest, CountsPhysicalCores) {
+  // Two sockets of two cores with two hardware threads each, numbered like
+  // Linux does: the second threads of all the cores come last.
+  FakeSysfs sys;
+  for (int cpu = 0; cpu < 8; cpu++)
+    sys.add_cpu(cpu, (cpu / 2) % 2, cpu % 2);
+
+  auto topology = detect_cpu_topology({0, 1, 2, 3, 4, 5, 6, 7}, sys.root());
+  EXPECT_EQ(topology.num_cores, 4);
+  EXPECT_EQ(topology.num_sockets, 2);
+  EXPECT_EQ(topology.cores, std::vector<int>({0, 1, 2, 3, 0, 1, 2, 3}));
+
+  // Only the CPUs of the affinity mask count
+  topology = detect_cpu_topology({0, 4, 1}, sys.root());
+  EXPECT_EQ(topology.cpus, std::vector<int>({0, 1, 4}));
+  EXPECT_EQ(topology.num_cores, 2);
+  EXPECT_EQ(topology.num_sockets, 1);
+}
+
+TEST(ThreadingTest, CpusWithoutTopologyAreCores) {
+  FakeSysfs sys;
+  auto topology = detect_cpu_topology({0, 1, 2}, sys.root());
+  EXPECT_EQ(topology.num_cores, 3);
+  EXPECT_EQ(topology.quota_cpus, 0);
+}
+
+TEST(ThreadingTest, ReadsCgroupV2Quota) {
+  FakeSysfs sys;
+  sys.write("fs/cgroup/cpu.max", "300000 100000");
+  EXPECT_EQ(detect_cpu_topology({0}, sys.root()).quota_cpus, 3);
+}
+
+TEST(ThreadingTest, ReadsCgroupV1Quota) {
+  FakeSysfs sys;
+  sys.write("fs/cgroup/cpu/cpu.cfs_quota_us", "250000");
+  sys.write("fs/cgroup/cpu/cpu.cfs_period_us", "100000");
+  EXPECT_EQ(detect_cpu_topology({0}, sys.root()).quota_cpus, 3);
+
+  sys.write("fs/cgroup/cpu/cpu.cfs_quota_us", "-1");
+  EXPECT_EQ(detect_cpu_topology({0}, sys.root()).quota_cpus, 0);
+}
+
+TEST(ThreadingTest, AppliesConfigToCallingThread) {
+  set_thread_config(3, Pinning::NONE);
+  use_thread_config();
+  EXPECT_EQ(omp_get_max_threads(), 3);
+
+  set_thread_config(2, Pinning::CORES);
+  use_thread_config();
+  EXPECT_EQ(omp_get_max_threads(), 2);
+  EXPECT_EQ(pinning(), Pinning::CORES);
+
+  set_thread_config(0, Pinning::NONE);
+  use_thread_config();
+  EXPECT_EQ(omp_get_max_threads(), default_num_threads());
+}
+
+TEST(ThreadingTest, SplitsCoresIntoPartitions) {
+  EXPECT_EQ(partition_cores(0, 2, 8), std::vector<int>({0, 1, 2, 3}));
+  EXPECT_EQ(partition_cores(1, 2, 8), std::vector<int>({4, 5, 6, 7}));
+  // Partitions differ by at most one core
+  EXPECT_EQ(partition_cores(0, 3, 8), std::vector<int>({0, 1}));
+  EXPECT_EQ(partition_cores(1, 3, 8), std::vector<int>({2, 3, 4}));
+  EXPECT_EQ(partition_cores(2, 3, 8), std::vector<int>({5, 6, 7}));
+}
+
+TEST(ThreadingTest, RoutesThreadsToPartitions) {
+  const auto &topology = cpu_topology();
+  int cores = topology.num_cores;
+  if (topology.quota_cpus > 0)
+    cores = std::min(cores, topology.quota_cpus);
+  // At most one partition per core
+  set_partitions(cores + 1);
+  EXPECT_EQ(num_partitions(), cores);
+
+  set_partitions(2);
+  if (cores >= 2) {
+    set_thread_partition(1);
+    use_thread_config();
+    EXPECT_EQ(thread_partition(), 1);
+    EXPECT_EQ(omp_get_max_threads(), (int)partition_cores(1, 2, cores).size());
+    set_thread_partition(-1);
+
+    // Threads without a partition get the one of their id, which doesn't
+    // depend on the configurations applied before, so every library holding
+    // this state picks the same
+    int partitions[2];
+    std::thread([&] {
+      use_thread_config();
+      partitions[0] = thread_partition();
+      set_partitions(3);
+      use_thread_config();
+      set_partitions(2);
+      use_thread_config();
+      partitions[1] = thread_partition();
+    }).join();
+    EXPECT_GE(partitions[0], 0);
+    EXPECT_LT(partitions[0], 2);
+    EXPECT_EQ(partitions[0], partitions[1]);
+  }
+
+  set_partitions(1);
+  use_thread_config();
+  EXPECT_EQ(thread_partition(), -1);
+  EXPECT_EQ(omp_get_max_threads(), num_threads());
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package org.diffkt
+
+import org.diffkt.external.Dnnl
+
+/**
+ * A dense tensor held in native memory by the DNNL library.
+ *
+ * The data may be held in a blocked layout picked by the DNNL op that computed it, so a chain of ops such as
+ * conv, batch norm, relu and pool passes its intermediate results from one op to the next without copying them
+ * to Java arrays or reordering them. The data is only reordered and copied back by [toFloatTensor], which waits
+ * for the tensor to be computed when the ops run asynchronously, see [Dnnl.setAsync].
+ */
+class NativeFloatTensor internal constructor(internal val handle: Long) {
+    constructor(tensor: FloatTensor) : this(tensor.normalize().let { Dnnl.putTensor(it.shape.dims, it.data) })
+
+    val shape: Shape by lazy { Shape(Dnnl.getTensorShape(handle)) }
+
+    /** Whether the op computing this tensor has completed, which is only false in async mode, see [Dnnl.setAsync] */
+    val isReady: Boolean get() = Dnnl.isTensorReady(handle)
+
+    /** Convolves the images of this NHWC tensor with the given OHWI filters */
+    fun conv2d(
+        filters: NativeFloatTensor,
+        hStride: Int,
+        vStride: Int,
+        padding: Convolve.Padding2D = Convolve.Padding2D(0)
+    ): NativeFloatTensor {
+        require(shape.rank == 4 && filters.shape.rank == 4) { "conv2d requires rank 4 images and filters" }
+        require(shape[3] == filters.shape[3]) {
+            "the size of the filter's inChannel (${filters.shape[3]}) must match the input depth (${shape[3]})"
+        }
+        return NativeFloatTensor(Dnnl.conv2dTensor(handle, filters.handle, vStride, hStride,
+            padding.left, padding.right, padding.top, padding.bottom))
+    }
+
+    /**
+     * The gradient of [conv2d] with respect to its images, with this tensor as the seed.
+     *
+     * The filters keep the layout they were reordered to by the forward convolution, as long as they aren't
+     * [update]d.
+     */
+    fun conv2dGradImage(
+        filters: NativeFloatTensor,
+        imagesShape: Shape,
+        hStride: Int,
+        vStride: Int,
+        padding: Convolve.Padding2D = Convolve.Padding2D(0)
+    ): NativeFloatTensor {
+        require(shape.rank == 4 && filters.shape.rank == 4 && imagesShape.rank == 4) {
+            "conv2dGradImage requires rank 4 seed, filters and images"
+        }
+        return NativeFloatTensor(Dnnl.conv2dGradImageTensor(handle, filters.handle, imagesShape.dims,
+            vStride, hStride, padding.left, padding.right, padding.top, padding.bottom))
+    }
+
+    /**
+     * Normalizes the batch of this NHWC tensor.
+     *
+     * @return the normalized tensor, and the mean and variance of each channel
+     */
+    fun batchNorm(scaleShift: FloatTensor): Triple<NativeFloatTensor, FloatTensor, FloatTensor> {
+        require(shape.rank == 4) { "batchNorm requires a rank 4 input" }
+        val C = shape[3]
+        require(scaleShift.shape == Shape(2, C)) { "scaleShift must have shape ${Shape(2, C)}" }
+        val mean = StridedFloatTensor.contigZeros(Shape(C))
+        val variance = StridedFloatTensor.contigZeros(Shape(C))
+        val result = Dnnl.batchNormTensor(handle, mean.data, variance.data, scaleShift.normalize().data)
+        return Triple(NativeFloatTensor(result), mean, variance)
+    }
+
+    fun relu() = NativeFloatTensor(Dnnl.reluTensor(handle))
+
+    fun avgPool(poolHeight: Int, poolWidth: Int): NativeFloatTensor {
+        require(shape.rank == 4) { "avgPool requires a rank 4 input" }
+        return NativeFloatTensor(Dnnl.avgPoolTensor(handle, poolHeight, poolWidth))
+    }
+
+    /** Max pooling for inference: it keeps no indices, so it can't be differentiated */
+    fun maxPool(poolHeight: Int, poolWidth: Int): NativeFloatTensor {
+        require(shape.rank == 4) { "maxPool requires a rank 4 input" }
+        return NativeFloatTensor(Dnnl.maxPoolTensor(handle, poolHeight, poolWidth))
+    }
+
+    /**
+     * Overwrites this tensor with [values], such as weights updated by a training step, so that the weights
+     * reordered for convolutions are only recomputed once for each update.
+     */
+    fun update(values: FloatTensor) {
+        require(values.shape == shape) { "update requires values of shape $shape, was ${values.shape}" }
+        Dnnl.updateTensor(handle, values.normalize().data)
+    }
+
+    fun toFloatTensor(): FloatTensor {
+        return StridedFloatTensor.contiguous(shape) { Dnnl.getTensor(handle, it) }
+    }
+
+    // --- Memory management ---
+
+    protected fun finalize() {
+        Dnnl.deleteTensor(handle)
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package org.diffkt
+
+import org.diffkt.external.SparseOps
+
+/**
+ * A sparse tensor held in native memory by the sparse library.
+ *
+ * Operations on native tensors take and return native tensors, so a chain of sparse operations keeps its
+ * intermediate results in native memory instead of copying each of them to a [SparseFloatTensor] and back.
+ * The data is only copied back by [toSparseFloatTensor].
+ */
+class NativeSparseFloatTensor internal constructor(internal val handle: Long) {
+    constructor(tensor: SparseFloatTensor) : this(SparseOps.putTensor(tensor))
+
+    val shape: Shape by lazy { Shape(SparseOps.getTensorShape(handle)) }
+
+    operator fun plus(other: NativeSparseFloatTensor) =
+        NativeSparseFloatTensor(SparseOps.addTensors(handle, other.handle))
+
+    operator fun minus(other: NativeSparseFloatTensor) =
+        NativeSparseFloatTensor(SparseOps.subTensors(handle, other.handle))
+
+    /** Element-wise multiplication */
+    operator fun times(other: NativeSparseFloatTensor) =
+        NativeSparseFloatTensor(SparseOps.timesTensors(handle, other.handle))
+
+    fun matmul(other: NativeSparseFloatTensor) =
+        NativeSparseFloatTensor(SparseOps.matmulTensors(handle, other.handle))
+
+    /** Transposes the last two axes */
+    fun transpose() = NativeSparseFloatTensor(SparseOps.transposeTensor(handle))
+
+    fun toSparseFloatTensor(): SparseFloatTensor = SparseOps.getTensor(handle)
+
+    // --- Memory management ---
+
+    protected fun finalize() {
+        SparseOps.deleteTensor(handle)
+    }
+}
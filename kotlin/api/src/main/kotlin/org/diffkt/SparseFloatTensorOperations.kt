@@ -20,21 +20,21 @@ internal object SparseFloatTensorOperations: FloatTensorOperations() {
         require(derivativeId == NoDerivativeID)
         val l = wrap(left)
         val r = wrap(right)
-        return SparseOps.add(l, r)
+        return SparseOps.takeResult(SparseOps.addResult(l, r))
     }
 
     override fun minus(left: DTensor, right: DTensor, derivativeId: DerivativeID): DTensor {
         require(derivativeId == NoDerivativeID)
         val l = wrap(left)
         val r = wrap(right)
-        return SparseOps.sub(l, r)
+        return SparseOps.takeResult(SparseOps.subResult(l, r))
     }
 
     override fun times(left: DTensor, right: DTensor, derivativeId: DerivativeID): DTensor {
         require(derivativeId == NoDerivativeID)
         if (left is SparseFloatTensor) {
             if (right is SparseFloatTensor) {
-                return SparseOps.times(left, right)
+                return SparseOps.takeResult(SparseOps.timesResult(left, right))
             } else {
                 require(right is FloatTensor)
                 return left.zip(right) { l, r -> l * r }
@@ -56,6 +56,6 @@ internal object SparseFloatTensorOperations: FloatTensorOperations() {
         newAxis[s - 1] = s - 2
         newAxis[s - 2] = s - 1
         require(axes.contentEquals(newAxis)) { "Sparse Transpose only supported on the last two axes." }
-        return SparseOps.transpose(x)
+        return SparseOps.takeResult(SparseOps.transposeResult(x))
     }
 }
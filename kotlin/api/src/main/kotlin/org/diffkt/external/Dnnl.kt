@@ -82,6 +82,16 @@ object Dnnl: ExternalLib {
         return Pair(inputGrad, scaleShiftGrad)
     }
 
+    /** Counters of the cache of DNNL primitives, which are built once for each op and shape */
+    data class PrimitiveCacheStats(val hits: Long, val misses: Long, val size: Long, val capacity: Long)
+
+    val primitiveCacheStats: PrimitiveCacheStats get() = cacheStats(getPrimitiveCacheStats())
+
+    /** Counters of the cache of native conv filters reordered to the layouts picked by DNNL */
+    val weightsCacheStats: PrimitiveCacheStats get() = cacheStats(getWeightsCacheStats())
+
+    private fun cacheStats(stats: LongArray) = PrimitiveCacheStats(stats[0], stats[1], stats[2], stats[3])
+
     // --- External functions ---
     private external fun add(
             shape: IntArray,
@@ -272,4 +282,84 @@ object Dnnl: ExternalLib {
             lhs: FloatArray,
             rhs: FloatArray,
     )
+
+    // --- Native tensors, see NativeFloatTensor ---
+
+    external fun putTensor(shape: IntArray, data: FloatArray): Long
+
+    external fun getTensor(handle: Long, result: FloatArray)
+
+    external fun getTensorShape(handle: Long): IntArray
+
+    external fun deleteTensor(handle: Long)
+
+    external fun updateTensor(handle: Long, data: FloatArray)
+
+    external fun isTensorReady(handle: Long): Boolean
+
+    /**
+     * Enables or disables async mode, in which ops on [org.diffkt.NativeFloatTensor]s are queued on a native
+     * op thread and return before their result is computed. Disabling it waits for the queued ops.
+     */
+    external fun setAsync(async: Boolean)
+
+    /** Waits for all the queued ops on native tensors, throwing an Error if one of them failed */
+    external fun sync()
+
+    external fun conv2dTensor(
+            images: Long,
+            filters: Long,
+            hstride: Int,
+            vstride: Int,
+            paddingLeft: Int,
+            paddingRight: Int,
+            paddingTop: Int,
+            paddingBottom: Int
+    ): Long
+
+    external fun conv2dGradImageTensor(
+            seed: Long,
+            filters: Long,
+            imagesShape: IntArray,
+            hstride: Int,
+            vstride: Int,
+            paddingLeft: Int,
+            paddingRight: Int,
+            paddingTop: Int,
+            paddingBottom: Int
+    ): Long
+
+    external fun batchNormTensor(
+            input: Long,
+            mean: FloatArray,
+            variance: FloatArray,
+            scaleShift: FloatArray
+    ): Long
+
+    external fun reluTensor(input: Long): Long
+
+    external fun avgPoolTensor(images: Long, poolHeight: Int, poolWidth: Int): Long
+
+    external fun maxPoolTensor(images: Long, poolHeight: Int, poolWidth: Int): Long
+
+    // --- Primitive cache ---
+
+    /** Sets the number of primitives kept by the cache, 0 disables it */
+    external fun setPrimitiveCacheCapacity(capacity: Int)
+
+    private external fun getPrimitiveCacheStats(): LongArray
+
+    external fun clearPrimitiveCache()
+
+    private external fun getWeightsCacheStats(): LongArray
+
+    // --- Threading, see Threads ---
+
+    external fun setThreadConfig(numThreads: Int, pinning: Int)
+
+    external fun getThreadInfo(): IntArray
+
+    external fun setPartitions(numPartitions: Int)
+
+    external fun setThreadPartition(partition: Int)
 }
@@ -7,6 +7,7 @@
 
 package org.diffkt.external
 
+import org.diffkt.DimData
 import org.diffkt.Shape
 import org.diffkt.SparseFloatTensor
 
@@ -32,6 +33,28 @@ object SparseOps : ExternalLib {
         )
     }
 
+    /** Allocates the arrays of a native result created by one of the *Result functions, writes the result into
+     * them, and deletes it. */
+    fun takeResult(result: Long): SparseFloatTensor {
+        try {
+            val sizes = resultSizes(result)
+            val rank = (sizes.size + 1) / 2
+            val shape = sizes.copyOfRange(0, rank)
+            val inners = Array(rank - 1) { IntArray(sizes[rank + it]) }
+            val outers = Array(rank - 1) { IntArray((if (it == 0) shape[0] else inners[it - 1].size) + 1) }
+            val values = FloatArray(inners[rank - 2].size)
+            writeResult(result, values, inners, outers)
+            return SparseFloatTensor(Shape(shape), values, List(rank - 1) { DimData(inners[it], outers[it]) })
+        } finally {
+            deleteResult(result)
+        }
+    }
+
+    /** Counters of the native memory pool of the sparse ops. [bytesInUse] is rounded up to the pool size classes. */
+    data class PoolStats(val allocations: Long, val systemAllocations: Long, val bytesInUse: Long, val bytesCached: Long)
+
+    val poolStats: PoolStats get() = getPoolStats().let { PoolStats(it[0], it[1], it[2], it[3]) }
+
     // --- External functions ---
 
     external fun add(left: SparseFloatTensor, right: SparseFloatTensor): SparseFloatTensor
@@ -39,6 +62,86 @@ object SparseOps : ExternalLib {
     external fun sub(left: SparseFloatTensor, right: SparseFloatTensor): SparseFloatTensor
     external fun matdiv(left: SparseFloatTensor, right: SparseFloatTensor): SparseFloatTensor
     external fun matmul(left: SparseFloatTensor, right: SparseFloatTensor): SparseFloatTensor
+    /** Sparse matmul with a dense result, returning its row-major data as a FloatArray. Unless [force] is true, the
+     * result of [matmul] is returned instead when it is not estimated to be dense enough, computed with the analysis
+     * done for the estimate. */
+    external fun matmulToDense(left: SparseFloatTensor, right: SparseFloatTensor, force: Boolean): Any
+    /** Sparse times dense matmul. [right] holds the row-major data of a dense tensor of shape [rightShape],
+     * the row-major data of the dense result is returned. */
+    external fun spmm(left: SparseFloatTensor, rightShape: IntArray, right: FloatArray): FloatArray
+    /** Sampled dense-dense matmul: computes [left] times the transpose of [right] only at the non-zeros of
+     * [pattern], and returns it with the same sparsity structure as [pattern]. [left] and [right] hold the
+     * row-major data of dense tensors of shapes [leftShape] and [rightShape]. */
+    external fun sddmm(
+        pattern: SparseFloatTensor,
+        leftShape: IntArray,
+        left: FloatArray,
+        rightShape: IntArray,
+        right: FloatArray
+    ): SparseFloatTensor
+    /** Creates a native plan for matmul that caches the sparsity structure of the result. The plan can be used
+     * with [matmulWithPlan] for inputs with the same sparsity structures, and must be freed with [deleteMatmulPlan]. */
+    external fun matmulPlan(left: SparseFloatTensor, right: SparseFloatTensor): Long
+    /** Computes left * right with a plan. Unlike [matmul], products cancelling each other out are kept as explicit
+     * zeros, so that the structure of the result doesn't depend on the values; it equals the result of [matmul]
+     * once the zeros are pruned out. */
+    external fun matmulWithPlan(plan: Long, left: SparseFloatTensor, right: SparseFloatTensor): SparseFloatTensor
+    /** Runs only the numeric phase of a plan, writing the values of the result into [values]. The structure of the
+     * result is the same for every call with the plan, so the caller reuses the dims of a result of [matmulWithPlan],
+     * and [values] has the size of its values. */
+    external fun matmulWithPlanInto(plan: Long, left: SparseFloatTensor, right: SparseFloatTensor, values: FloatArray)
+    external fun deleteMatmulPlan(plan: Long)
+    /** These compute an operation like the functions of the same names without the Result suffix, but keep the result
+     * natively and return a handle to it. The sizes of the arrays holding the result are returned by [resultSizes],
+     * and the result is written into arrays allocated by the caller with [writeResult], so that it is copied only
+     * once. The handle must be freed with [deleteResult], see [takeResult]. */
+    external fun addResult(left: SparseFloatTensor, right: SparseFloatTensor): Long
+    external fun timesResult(left: SparseFloatTensor, right: SparseFloatTensor): Long
+    external fun subResult(left: SparseFloatTensor, right: SparseFloatTensor): Long
+    external fun matmulResult(left: SparseFloatTensor, right: SparseFloatTensor): Long
+    external fun transposeResult(tensor: SparseFloatTensor): Long
+    /** Returns the shape of a native result, followed by the size of the inner of each of its dimensions. The last
+     * inner size is the number of values, and the outer of a dimension has one more element than the inner of the
+     * dimension before it, or than the first dimension of the shape for the first one. */
+    external fun resultSizes(result: Long): IntArray
+    /** Writes a native result into [values] and the inner and outer arrays of each dimension, with the sizes given
+     * by [resultSizes]. */
+    external fun writeResult(result: Long, values: FloatArray, inners: Array<IntArray>, outers: Array<IntArray>)
+    external fun deleteResult(result: Long)
+    /** These hold a sparse tensor in native memory behind a handle, see [org.diffkt.NativeSparseFloatTensor]. The
+     * operations on handles return new handles, and the data is only copied back by [getTensor]. Every handle must be
+     * freed with [deleteTensor]. */
+    external fun putTensor(tensor: SparseFloatTensor): Long
+    external fun getTensor(tensor: Long): SparseFloatTensor
+    external fun getTensorShape(tensor: Long): IntArray
+    external fun deleteTensor(tensor: Long)
+    external fun addTensors(left: Long, right: Long): Long
+    external fun timesTensors(left: Long, right: Long): Long
+    external fun subTensors(left: Long, right: Long): Long
+    external fun matmulTensors(left: Long, right: Long): Long
+    external fun transposeTensor(tensor: Long): Long
     external fun transpose(tensor: SparseFloatTensor): SparseFloatTensor
     external fun convertToCoo(shape: IntArray, rows: IntArray, cols: IntArray, values: FloatArray): SparseFloatTensor
+
+    // --- Memory pool ---
+
+    private external fun getPoolStats(): LongArray
+    /** Releases the free blocks cached by the pool, except those of the caches of other threads */
+    external fun trimPool()
+    /** Sets the most bytes of free blocks the pool keeps for reuse, 0 disables the pool */
+    external fun setPoolMaxCached(bytes: Long)
+    /** Sets whether the new blocks of 2 MB or more are backed by transparent huge pages, and whether their pages are
+     * first touched by the threads of the parallel ops, which spreads them over the NUMA nodes of multi-socket
+     * machines. Both are off by default. */
+    external fun setPoolLargeBlockModes(hugePages: Boolean, firstTouch: Boolean)
+
+    // --- Threading, see Threads ---
+
+    external fun setThreadConfig(numThreads: Int, pinning: Int)
+
+    external fun getThreadInfo(): IntArray
+
+    external fun setPartitions(numPartitions: Int)
+
+    external fun setThreadPartition(partition: Int)
 }
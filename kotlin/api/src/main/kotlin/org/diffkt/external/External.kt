@@ -98,4 +98,14 @@ internal object External: ExternalLib {
         res: FloatArray,
         size: Int
     )
+
+    // --- Threading, see Threads ---
+
+    external fun setThreadConfig(numThreads: Int, pinning: Int)
+
+    external fun getThreadInfo(): IntArray
+
+    external fun setPartitions(numPartitions: Int)
+
+    external fun setThreadPartition(partition: Int)
 }
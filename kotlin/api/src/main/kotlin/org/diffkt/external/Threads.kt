@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package org.diffkt.external
+
+/**
+ * The threads of the native ops of the Dnnl, sparse and math libraries.
+ *
+ * By default, the ops use one thread per physical core the process may run on, capped by its cgroup CPU quota,
+ * unless OMP_NUM_THREADS is set. Each library holds its own configuration, so [configure] sets it in all the loaded
+ * ones.
+ */
+object Threads {
+    enum class Pinning {
+        /** Threads run on any CPU the process may run on */
+        NONE,
+        /** Thread i of each parallel op runs on physical core i, which keeps its caches warm across ops */
+        CORES,
+    }
+
+    /**
+     * @param cpus the logical CPUs the process may run on
+     * @param cores the physical cores of [cpus]
+     * @param quotaCpus the CPUs allowed by the cgroup CPU quota, rounded up, or 0 without a quota
+     * @param threadPartition the partition of the calling thread, or -1 if the cores aren't partitioned
+     */
+    data class Info(
+        val cpus: Int,
+        val cores: Int,
+        val sockets: Int,
+        val quotaCpus: Int,
+        val numThreads: Int,
+        val pinning: Pinning,
+        val partitions: Int,
+        val threadPartition: Int
+    )
+
+    /** Sets the number of threads of the ops, or the default when [numThreads] <= 0, and how they are pinned */
+    fun configure(numThreads: Int = 0, pinning: Pinning = Pinning.NONE) {
+        if (Dnnl.isLoaded) Dnnl.setThreadConfig(numThreads, pinning.ordinal)
+        if (SparseOps.isLoaded) SparseOps.setThreadConfig(numThreads, pinning.ordinal)
+        if (External.isLoaded) External.setThreadConfig(numThreads, pinning.ordinal)
+    }
+
+    /** The topology and configuration seen by the native libraries, or null if none is loaded */
+    val info: Info? get() {
+        val info = when {
+            Dnnl.isLoaded -> Dnnl.getThreadInfo()
+            SparseOps.isLoaded -> SparseOps.getThreadInfo()
+            External.isLoaded -> External.getThreadInfo()
+            else -> return null
+        }
+        return Info(info[0], info[1], info[2], info[3], info[4], Pinning.values()[info[5]], info[6], info[7])
+    }
+
+    /**
+     * Splits the cores into [numPartitions] groups, at most one per core, for throughput on small requests.
+     *
+     * Each thread calling the ops is routed to a partition, by its OS thread id unless set by [setThreadPartition], so
+     * that all the libraries agree, and its ops run on one thread per core of the partition, pinned to these cores.
+     * Threads serving independent requests then run side by side instead of each spreading its ops over all the
+     * cores. 1 disables partitioning.
+     */
+    fun partition(numPartitions: Int) {
+        if (Dnnl.isLoaded) Dnnl.setPartitions(numPartitions)
+        if (SparseOps.isLoaded) SparseOps.setPartitions(numPartitions)
+        if (External.isLoaded) External.setPartitions(numPartitions)
+    }
+
+    /** Routes the calling thread to [partition], modulo the number of partitions, or by its thread id when < 0 */
+    fun setThreadPartition(partition: Int) {
+        if (Dnnl.isLoaded) Dnnl.setThreadPartition(partition)
+        if (SparseOps.isLoaded) SparseOps.setThreadPartition(partition)
+        if (External.isLoaded) External.setThreadPartition(partition)
+    }
+}
@@ -14,6 +14,7 @@ import io.kotest.matchers.shouldBe
 import testutils.shouldBeExactly
 import testutils.shouldBeNear
 import testutils.compareSparseWithDense
+import org.diffkt.external.SparseOps
 
 class SparseOpsTest: AnnotationSpec() {
     @Test
@@ -685,4 +686,94 @@ class SparseOpsTest: AnnotationSpec() {
         res shouldBeExactly tensorOf(-2f, 4f, 0f, 0f).reshape(2, 2)
         res2 shouldBeExactly tensorOf(-2f, 4f, 0f, 0f).reshape(2, 2)
     }
+
+    @Test
+    fun `test chained ops on native tensors`() {
+        val t1 = SparseFloatTensor(Shape(2, 3), listOf(Pair(intArrayOf(0, 0), 1f), Pair(intArrayOf(1, 2), 2f)))
+        val t2 = SparseFloatTensor(Shape(2, 3), listOf(Pair(intArrayOf(0, 1), 3f), Pair(intArrayOf(1, 2), 4f)))
+        val n1 = NativeSparseFloatTensor(t1)
+        val n2 = NativeSparseFloatTensor(t2)
+        val res = ((n1 + n2) - n1 * n2).matmul(n2.transpose())
+        res.shape shouldBe Shape(2, 2)
+        val expected = ((t1 + t2) - t1 * t2).matmul(t2.transpose())
+        res.toSparseFloatTensor() shouldBeExactly expected
+    }
+
+    @Test
+    fun `test repeated ops reuse pooled memory`() {
+        val t1 = SparseFloatTensor(Shape(2, 3), listOf(Pair(intArrayOf(0, 0), 1f), Pair(intArrayOf(1, 2), 2f)))
+        val t2 = SparseFloatTensor(Shape(3, 2), listOf(Pair(intArrayOf(0, 1), 3f), Pair(intArrayOf(2, 0), 4f)))
+        t1.matmul(t2)
+        val before = SparseOps.poolStats
+        t1.matmul(t2)
+        val after = SparseOps.poolStats
+        (after.allocations > before.allocations) shouldBe true
+        after.systemAllocations shouldBe before.systemAllocations
+        SparseOps.trimPool()
+    }
+
+    @Test
+    fun `test matmul with a plan into preallocated values`() {
+        val t1 = SparseFloatTensor(Shape(2, 3), listOf(Pair(intArrayOf(0, 0), 1f), Pair(intArrayOf(1, 2), 2f)))
+        val t2 = SparseFloatTensor(Shape(3, 2), listOf(Pair(intArrayOf(0, 1), 3f), Pair(intArrayOf(2, 0), 4f)))
+        val plan = SparseOps.matmulPlan(t1, t2)
+        try {
+            val res = SparseOps.matmulWithPlan(plan, t1, t2)
+            res shouldBeExactly t1.matmul(t2)
+            // same structure, other values
+            val t3 = t1.map { it * 2f } as SparseFloatTensor
+            val values = FloatArray(res.values.size)
+            SparseOps.matmulWithPlanInto(plan, t3, t2, values)
+            SparseFloatTensor(res.shape, values, res.dims) shouldBeExactly t3.matmul(t2)
+            shouldThrow<Error> { SparseOps.matmulWithPlanInto(plan, t3, t2, FloatArray(values.size + 1)) }
+        } finally {
+            SparseOps.deleteMatmulPlan(plan)
+        }
+    }
+
+    @Test
+    fun `test matmul with a plan keeps cancelling products as explicit zeros`() {
+        val t1 = SparseFloatTensor(Shape(1, 2), listOf(Pair(intArrayOf(0, 0), 1f), Pair(intArrayOf(0, 1), 1f)))
+        val t2 = SparseFloatTensor(Shape(2, 1), listOf(Pair(intArrayOf(0, 0), 1f), Pair(intArrayOf(1, 0), -1f)))
+        val plan = SparseOps.matmulPlan(t1, t2)
+        try {
+            val res = SparseOps.matmulWithPlan(plan, t1, t2)
+            res.values.toList() shouldBe listOf(0f)
+            // the same as matmul once the zeros are pruned out
+            t1.matmul(t2).values.filter { it != 0f } shouldBe emptyList()
+        } finally {
+            SparseOps.deleteMatmulPlan(plan)
+        }
+    }
+
+    @Test
+    fun `test matmul to dense falls back to the sparse result`() {
+        val t1 = SparseFloatTensor(Shape(2, 3), listOf(Pair(intArrayOf(0, 0), 1f), Pair(intArrayOf(1, 2), 2f)))
+        val t2 = SparseFloatTensor(Shape(3, 4), listOf(Pair(intArrayOf(0, 1), 3f), Pair(intArrayOf(2, 0), 4f)))
+        // 2 non-zeros out of 8
+        val sparse = SparseOps.matmulToDense(t1, t2, false)
+        assert(sparse is SparseFloatTensor)
+        (sparse as SparseFloatTensor) shouldBeExactly t1.matmul(t2)
+        val dense = SparseOps.matmulToDense(t1, t2, true)
+        (dense as FloatArray).toList() shouldBe listOf(0f, 3f, 0f, 0f, 8f, 0f, 0f, 0f)
+    }
+
+    @Test
+    fun `test spmm checks the shape of the dense matrix`() {
+        val t1 = SparseFloatTensor(Shape(2, 3), listOf(Pair(intArrayOf(0, 0), 1f), Pair(intArrayOf(1, 2), 2f)))
+        val right = FloatArray(6) { it.toFloat() }
+        SparseOps.spmm(t1, intArrayOf(3, 2), right).toList() shouldBe listOf(0f, 1f, 8f, 10f)
+        shouldThrow<Error> { SparseOps.spmm(t1, intArrayOf(6), right) }
+        shouldThrow<Error> { SparseOps.spmm(t1, intArrayOf(2, 3), right) }
+    }
+
+    @Test
+    fun `test sddmm checks the shapes of the dense matrices`() {
+        val pattern = SparseFloatTensor(Shape(2, 3), listOf(Pair(intArrayOf(0, 0), 1f), Pair(intArrayOf(1, 2), 1f)))
+        val left = FloatArray(4) { 1f }
+        val right = FloatArray(6) { it.toFloat() }
+        SparseOps.sddmm(pattern, intArrayOf(2, 2), left, intArrayOf(3, 2), right).values.toList() shouldBe listOf(1f, 9f)
+        shouldThrow<Error> { SparseOps.sddmm(pattern, intArrayOf(4), left, intArrayOf(3, 2), right) }
+        shouldThrow<Error> { SparseOps.sddmm(pattern, intArrayOf(2, 2), left, intArrayOf(2, 3), right) }
+    }
 }
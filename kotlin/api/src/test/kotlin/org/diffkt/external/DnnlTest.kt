@@ -8,8 +8,13 @@
 package org.diffkt.external
 
 import io.kotest.core.spec.style.AnnotationSpec
+import io.kotest.matchers.shouldBe
 import org.diffkt.*
+import org.diffkt.model.batchNorm
+import org.diffkt.model.maxPool
 import testutils.floats
+import testutils.shouldBe
+import testutils.shouldBeNear
 import testutils.shouldBeExactly
 
 
@@ -45,4 +50,83 @@ class DnnlTest : AnnotationSpec() {
         Dnnl.mulScalar(t, s) shouldBeExactly (t.normalize() * s)
         t * s shouldBeExactly (t.normalize() * s)
     }
-}
\ No newline at end of file
+
+    @Test
+    fun `check that native tensors chain conv, batch norm, relu and pool`() {
+        val images = FloatTensor(Shape(2, 8, 8, 3), floats(2 * 8 * 8 * 3).map { (it % 7f) - 3f }.toFloatArray())
+        val filters = FloatTensor(Shape(4, 3, 3, 3), floats(4 * 3 * 3 * 3).map { (it % 5f) - 2f }.toFloatArray())
+        val scaleShift = FloatTensor(Shape(2, 4), floatArrayOf(1f, 2f, 0.5f, 1f, 0f, 1f, -1f, 0.5f))
+        val padding = Convolve.Padding2D(1)
+
+        val expected = maxPool(relu(batchNorm(conv2d(images, filters, 1, 1, padding), scaleShift).result), 2, 2)
+        val native = NativeFloatTensor(images)
+            .conv2d(NativeFloatTensor(filters), 1, 1, padding)
+            .batchNorm(scaleShift).first
+            .relu()
+            .maxPool(2, 2)
+        native.shape shouldBe expected.shape
+        native.toFloatTensor().shouldBeNear(expected, 1e-4f)
+    }
+
+    @Test
+    fun `check that repeated ops reuse cached primitives`() {
+        val t1 = FloatTensor(Shape(3, 7), floats(21))
+        val t2 = FloatTensor(Shape(7, 5), floats(35))
+        val expected = Dnnl.matmul(t1.normalize(), t2.normalize(), Shape(), Shape(3), Shape(5))
+        val before = Dnnl.primitiveCacheStats
+        Dnnl.matmul(t1.normalize(), t2.normalize(), Shape(), Shape(3), Shape(5)) shouldBeExactly expected
+        val after = Dnnl.primitiveCacheStats
+        after.hits shouldBe before.hits + 1
+        after.misses shouldBe before.misses
+    }
+
+    @Test
+    fun `check that native filters are reordered once per update`() {
+        val images = NativeFloatTensor(FloatTensor(Shape(1, 6, 6, 8), floats(6 * 6 * 8)))
+        val filterValues = FloatTensor(Shape(16, 3, 3, 8), floats(16 * 3 * 3 * 8).map { it / 100f }.toFloatArray())
+        val filters = NativeFloatTensor(filterValues)
+        val expected = images.conv2d(filters, 1, 1).toFloatTensor()
+
+        val before = Dnnl.weightsCacheStats
+        images.conv2d(filters, 1, 1).toFloatTensor() shouldBeExactly expected
+        Dnnl.weightsCacheStats.misses shouldBe before.misses
+
+        val updated = filterValues * 2f
+        filters.update(updated)
+        images.conv2d(filters, 1, 1).toFloatTensor()
+            .shouldBeNear(conv2d(images.toFloatTensor(), updated, 1, 1, Convolve.Padding2D(0)), 1e-3f)
+    }
+
+    @Test
+    fun `check that async native ops match sync ones`() {
+        val images = NativeFloatTensor(FloatTensor(Shape(2, 8, 8, 3), floats(2 * 8 * 8 * 3).map { it / 100f }.toFloatArray()))
+        val filters = NativeFloatTensor(FloatTensor(Shape(4, 3, 3, 3), floats(4 * 3 * 3 * 3).map { it / 10f }.toFloatArray()))
+        val expected = images.conv2d(filters, 1, 1).relu().avgPool(2, 2).toFloatTensor()
+        try {
+            Dnnl.setAsync(true)
+            val result = images.conv2d(filters, 1, 1).relu().avgPool(2, 2)
+            Dnnl.sync()
+            result.isReady shouldBe true
+            result.toFloatTensor() shouldBeExactly expected
+        } finally {
+            Dnnl.setAsync(false)
+        }
+    }
+
+    @Test
+    fun `check that batch norm after an async conv matches the sync one`() {
+        val images = NativeFloatTensor(FloatTensor(Shape(2, 8, 8, 3), floats(2 * 8 * 8 * 3).map { it / 100f }.toFloatArray()))
+        val filters = NativeFloatTensor(FloatTensor(Shape(4, 3, 3, 3), floats(4 * 3 * 3 * 3).map { it / 10f }.toFloatArray()))
+        val scaleShift = FloatTensor(Shape(2, 4), floatArrayOf(1f, 2f, 0.5f, 1f, 0f, 1f, -1f, 0.5f))
+        val (expected, expectedMean, expectedVariance) = images.conv2d(filters, 1, 1).batchNorm(scaleShift)
+        try {
+            Dnnl.setAsync(true)
+            val (result, mean, variance) = images.conv2d(filters, 1, 1).batchNorm(scaleShift)
+            mean shouldBeExactly expectedMean
+            variance shouldBeExactly expectedVariance
+            result.toFloatTensor() shouldBeExactly expected.toFloatTensor()
+        } finally {
+            Dnnl.setAsync(false)
+        }
+    }
+}
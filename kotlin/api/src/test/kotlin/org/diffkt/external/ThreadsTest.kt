@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package org.diffkt.external
+
+import io.kotest.core.spec.style.AnnotationSpec
+import io.kotest.matchers.shouldBe
+import org.diffkt.*
+import testutils.floats
+import testutils.shouldBeNear
+
+class ThreadsTest : AnnotationSpec() {
+    @AfterEach
+    fun restoreDefault() {
+        Threads.configure()
+        Threads.partition(1)
+        Threads.setThreadPartition(-1)
+    }
+
+    @Test
+    fun `check that the default uses at most one thread per core`() {
+        val info = Threads.info!!
+        (info.cores in 1..info.cpus) shouldBe true
+        (info.numThreads <= info.cores || System.getenv("OMP_NUM_THREADS") != null) shouldBe true
+        info.pinning shouldBe Threads.Pinning.NONE
+    }
+
+    @Test
+    fun `check that the configuration applies to all the libraries`() {
+        Threads.configure(2, Threads.Pinning.CORES)
+        for (info in listOf(Dnnl.getThreadInfo(), SparseOps.getThreadInfo(), External.getThreadInfo())) {
+            info[4] shouldBe 2
+            info[5] shouldBe Threads.Pinning.CORES.ordinal
+        }
+    }
+
+    @Test
+    fun `check that ops give the same results with pinned threads`() {
+        val t1 = FloatTensor(Shape(30, 7), floats(30 * 7).map { it / 100f }.toFloatArray())
+        val t2 = FloatTensor(Shape(7, 50), floats(7 * 50).map { it / 100f }.toFloatArray())
+        val expected = Dnnl.matmul(t1.normalize(), t2.normalize(), Shape(), Shape(30), Shape(50))
+        Threads.configure(2, Threads.Pinning.CORES)
+        Dnnl.matmul(t1.normalize(), t2.normalize(), Shape(), Shape(30), Shape(50)).shouldBeNear(expected, 1e-3f)
+    }
+
+    @Test
+    fun `check that threads are routed to partitions`() {
+        val cores = Threads.info!!.cores
+        Threads.partition(2)
+        val info = Threads.info!!
+        info.partitions shouldBe minOf(2, cores)
+        if (info.partitions == 2) {
+            Threads.setThreadPartition(1)
+            Threads.info!!.threadPartition shouldBe 1
+        }
+        Threads.partition(1)
+        Threads.info!!.threadPartition shouldBe -1
+    }
+}